@@ -0,0 +1,132 @@
+"""Fiber stack mappings at scale: spawn rate, RSS and VMA count.
+
+Spawns N greenthreads that all park on one Event (so every one of them has
+started and owns a stack at the same time), then releases and joins them.
+Each configuration runs in its own interpreter because the stack pool reads
+its settings from the environment once:
+
+    PYTHONPATH=/workspace python benchmarks/fiberstacks.py
+    PYTHONPATH=/workspace python benchmarks/fiberstacks.py --counts 30000 \\
+        --arena 0,64 --guard mprotect,auto --stack-size 262144
+
+What to look at: ``vmas`` against ``vm.max_map_count`` (65530 by default).
+A stack guarded with mprotect() is two VMAs, so the classic layout runs out
+of mappings near 32k concurrent fibers; with MADV_GUARD_INSTALL (Linux 6.13+,
+reported as ``guard=madvise``) a stack is one mapping and neighbours merge,
+and FIL_FIBER_ARENA=N carves N stacks from each reservation.  ``--guard
+mprotect`` forces the two-VMA layout for comparison.  ``rss_kb`` is
+what the parked fibers actually commit -- the stack size is virtual.  Needs
+the fiber core; on other builds it says so and exits.
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import time
+
+CHILD = r'''
+import gc, json, sys, time
+import filament
+import _fil_greenlet
+
+n, stack_size = int(sys.argv[1]), int(sys.argv[2])
+
+def rss_kb():
+    with open('/proc/self/statm') as fh:
+        return int(fh.read().split()[1]) * 4
+
+def vmas():
+    with open('/proc/self/maps') as fh:
+        return sum(1 for _ in fh)
+
+def park(ev):
+    ev.wait()
+
+kwargs = {'stack_size': stack_size} if stack_size else {}
+ev = filament.Event()
+gc.collect()
+rss0, vmas0 = rss_kb(), vmas()
+t0 = time.time()
+gts = [filament.spawn(park, ev, **kwargs) for _ in range(n)]
+t1 = time.time()
+filament.sleep(0)           # run them all up to their wait()
+t2 = time.time()
+out = {
+    'spawn_per_sec': n / (t1 - t0),
+    'start_per_sec': n / (t2 - t1),
+    'rss_kb': rss_kb() - rss0,
+    'vmas': vmas() - vmas0,
+}
+ev.set()
+for gt in gts:
+    gt.wait()
+out['join_sec'] = time.time() - t2
+st = _fil_greenlet.fiber_stack_stats()
+out['guard'] = st['guard']
+out['arenas'] = st['arenas'] + sum(c['arenas'] for c in st['classes'].values())
+print(json.dumps(out))
+'''
+
+
+def run_one(n, arena, guard, stack_size):
+    env = dict(os.environ, FIL_FIBER_ARENA=str(arena))
+    env.pop('FIL_FIBER_GUARD', None)
+    if guard != 'auto':
+        env['FIL_FIBER_GUARD'] = guard
+    proc = subprocess.Popen([sys.executable, '-c', CHILD, str(n), str(stack_size)],
+                            env=env, stdout=subprocess.PIPE,
+                            stderr=subprocess.PIPE, universal_newlines=True)
+    out, err = proc.communicate()
+    if proc.returncode != 0:
+        lines = err.strip().splitlines()
+        return {'error': lines[-1] if lines else 'exit %d' % proc.returncode}
+    return json.loads(out.strip().splitlines()[-1])
+
+
+def main():
+    try:
+        import _fil_greenlet
+    except ImportError:
+        _fil_greenlet = None
+    if not hasattr(_fil_greenlet, 'fiber_stack_stats'):
+        print('fiber core not built; nothing to measure')
+        return 0
+
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--counts', default='100000,500000',
+                        help='comma-separated greenthread counts')
+    parser.add_argument('--arena', default='0,64',
+                        help='comma-separated FIL_FIBER_ARENA values')
+    parser.add_argument('--guard', default='auto',
+                        help="comma-separated guard modes: 'auto', 'mprotect'")
+    parser.add_argument('--stack-size', type=int, default=0,
+                        help='spawn(stack_size=) in bytes; 0 for the default')
+    args = parser.parse_args()
+
+    with open('/proc/sys/vm/max_map_count') as fh:
+        print('vm.max_map_count = %s' % fh.read().strip())
+    print('%8s %6s %12s %12s %10s %8s %8s %8s %s'
+          % ('fibers', 'arena', 'spawn/s', 'start/s', 'rss_kb', 'vmas',
+             'arenas', 'join_s', 'guard'))
+    for n in [int(c) for c in args.counts.split(',')]:
+        for guard in args.guard.split(','):
+            for arena in [int(a) for a in args.arena.split(',')]:
+                res = run_one(n, arena, guard, args.stack_size)
+                if 'error' in res:
+                    print('%8d %6d  FAILED (%s): %s'
+                          % (n, arena, guard, res['error']))
+                    continue
+                print('%8d %6d %12.0f %12.0f %10d %8d %8d %8.2f %s'
+                      % (n, arena, res['spawn_per_sec'], res['start_per_sec'],
+                         res['rss_kb'], res['vmas'], res['arenas'],
+                         res['join_sec'], res['guard']))
+                sys.stdout.flush()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,140 @@
+"""StreamServer accept fan-out: connection rate and echo throughput by workers.
+
+Runs an echo ``StreamServer`` with ``workers=N`` for each N in ``--workers``
+and drives it from ``--procs`` client processes using plain blocking
+sockets, so the load generator never competes with the server for a
+scheduler.  Two phases per N:
+
+  * ``conn/s``  -- each client loops connect, send 1 byte, read it back,
+    close.  This is what the per-thread SO_REUSEPORT listeners spread out.
+  * ``MB/s``    -- each client holds ``--conns`` connections open and
+    ping-pongs ``--size`` byte messages over them round-robin.
+
+    PYTHONPATH=/workspace python benchmarks/reuseport.py
+    PYTHONPATH=/workspace python benchmarks/reuseport.py --workers 1 2 4 8 \\
+        --procs 8 --duration 3
+
+On a GIL build the extra threads take turns rather than run side by side, so
+expect a flat line there; the scaling is what a free-threaded build buys.
+"""
+
+from __future__ import print_function
+
+import argparse
+import multiprocessing
+import socket
+import sys
+import time
+
+import filament
+from filament.gevent_compat.server import StreamServer
+
+
+def _echo(sock, address):
+    while True:
+        data = sock.recv(65536)
+        if not data:
+            return
+        sock.sendall(data)
+
+
+def _recv_exact(sock, n):
+    got = 0
+    while got < n:
+        chunk = sock.recv(n - got)
+        if not chunk:
+            raise EOFError()
+        got += len(chunk)
+
+
+def _connect_client(address, duration, out):
+    count = 0
+    deadline = time.time() + duration
+    while time.time() < deadline:
+        s = socket.create_connection(address)
+        s.sendall(b'x')
+        _recv_exact(s, 1)
+        s.close()
+        count += 1
+    out.put(count)
+
+
+def _stream_client(address, duration, conns, size, out):
+    socks = [socket.create_connection(address) for _ in range(conns)]
+    payload = b'x' * size
+    nbytes = 0
+    deadline = time.time() + duration
+    while time.time() < deadline:
+        for s in socks:
+            s.sendall(payload)
+            _recv_exact(s, size)
+            nbytes += size
+    for s in socks:
+        s.close()
+    out.put(nbytes)
+
+
+def _drive(ctx, target, args, procs):
+    out = ctx.Queue()
+    children = [ctx.Process(target=target, args=args + (out,))
+                for _ in range(procs)]
+    for p in children:
+        p.start()
+    # The server lives in this process: wait cooperatively so its
+    # greenthreads keep running while the clients work.
+    results = []
+    while len(results) < procs:
+        try:
+            results.append(out.get_nowait())
+        except Exception:
+            filament.sleep(0.01)
+    for p in children:
+        p.join()
+    return sum(results)
+
+
+def run_one(ctx, workers, args):
+    srv = StreamServer(('127.0.0.1', 0), _echo, backlog=1024, workers=workers)
+    srv.start()
+    try:
+        address = srv.address
+        conns = _drive(ctx, _connect_client, (address, args.duration),
+                       args.procs)
+        nbytes = _drive(ctx, _stream_client,
+                        (address, args.duration, args.conns, args.size),
+                        args.procs)
+    finally:
+        srv.stop(timeout=1)
+    return conns / args.duration, nbytes / args.duration / 1e6
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--workers', type=int, nargs='+', default=[1, 2, 4])
+    parser.add_argument('--procs', type=int, default=4,
+                        help='client processes')
+    parser.add_argument('--conns', type=int, default=16,
+                        help='open connections per client in the echo phase')
+    parser.add_argument('--size', type=int, default=4096,
+                        help='echo message size in bytes')
+    parser.add_argument('--duration', type=float, default=2.0,
+                        help='seconds per phase')
+    args = parser.parse_args()
+
+    ctx = multiprocessing.get_context('spawn')
+    print('%d client procs, %gs per phase, %d conns x %dB for echo'
+          % (args.procs, args.duration, args.conns, args.size))
+    print('%-8s %12s %10s' % ('workers', 'conn/s', 'MB/s'))
+    base = None
+    for n in args.workers:
+        rate, mbps = run_one(ctx, n, args)
+        if base is None:
+            base = (rate, mbps)
+        print('%-8d %12.0f %10.1f   (%.2fx / %.2fx)'
+              % (n, rate, mbps, rate / base[0], mbps / base[1]))
+        sys.stdout.flush()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
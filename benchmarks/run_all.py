@@ -17,8 +17,8 @@ Usage:
                                  [--scale full|small] [--report-only]
 
 --python       interpreter to run workers with (default: this interpreter).
---benchmarks   comma list to filter (spawn,ctxswitch,semaphore,queue,tpool,
-               echo,logging137). Default: all.
+--benchmarks   comma list to filter (spawn,ctxswitch,semaphore,event,queue,
+               tpool,echo,logging137). Default: all.
 --scale        full (default) or small (quick smoke sizes).
 --report-only  skip running; just rebuild RESULTS.md from existing results/*.json.
 --timeout-scale  multiply all per-benchmark timeouts (see TIMEOUTS below); use
@@ -43,8 +43,8 @@ RESULTS_DIR = os.path.join(HERE, "results")
 REPORT = os.path.join(HERE, "RESULTS.md")
 
 FRAMEWORKS = ["filament", "gevent", "eventlet"]
-ALL_BENCHMARKS = ["spawn", "ctxswitch", "semaphore", "queue", "queue_mixed",
-                  "tpool", "echo", "logging137"]
+ALL_BENCHMARKS = ["spawn", "ctxswitch", "semaphore", "event", "queue",
+                  "queue_mixed", "tpool", "echo", "logging137"]
 
 # Per-benchmark subprocess timeout (seconds).
 #
@@ -56,7 +56,7 @@ ALL_BENCHMARKS = ["spawn", "ctxswitch", "semaphore", "queue", "queue_mixed",
 # and it runs last, right after echo@1000 -- which on some systems is still
 # tearing down thousands of fiber stacks when the next subprocess starts.
 TIMEOUTS = {
-    "spawn": 240, "ctxswitch": 180, "semaphore": 120, "queue": 120,
+    "spawn": 240, "ctxswitch": 180, "semaphore": 120, "event": 120, "queue": 120,
     "queue_mixed": 60, "tpool": 120, "echo": 240, "logging137": 45,
 }
 
@@ -73,7 +73,8 @@ SMALL_PARAMS = {
     "spawn_k": 5000, "spawn_reps": 3,
     "ctx_greenthreads": 20, "ctx_iters": 2000, "ctx_reps": 3,
     "sem_uncontended": 100000, "sem_contended_gt": 20, "sem_contended_ops": 1000,
-    "sem_reps": 3, "queue_items": 20000, "queue_reps": 3,
+    "sem_reps": 3, "event_rounds": 10000, "event_bcast_rounds": 200,
+    "event_reps": 3, "queue_items": 20000, "queue_reps": 3,
     "qmix_items": 5000, "qmix_reps": 2,
     "tpool_calls": 500, "tpool_reps": 3,
     "echo_reps": 2, "echo_specs": [[100, 30], [500, 10]],
@@ -576,6 +577,12 @@ _THROUGHPUT_ROWS = [
      lambda r: r["uncontended_ops_per_sec"]["per_sec_median"]),
     ("semaphore", "semaphore contended", "ops/s",
      lambda r: r["contended_ops_per_sec"]["per_sec_median"]),
+    ("event", "Event set/wait ping-pong", "round trips/s",
+     lambda r: r["event_pingpong_per_sec"]["per_sec_median"]),
+    ("event", "Event broadcast", "wakeups/s",
+     lambda r: r["broadcast_wakeups_per_sec"]["per_sec_median"]),
+    ("event", "AsyncResult ping-pong", "round trips/s",
+     lambda r: r["asyncresult_pingpong_per_sec"]["per_sec_median"]),
     ("queue", "queue put/get", "items/s",
      lambda r: r["items_per_sec"]["per_sec_median"]),
     ("queue_mixed", "queue shared green+native threads", "items/s",
@@ -687,6 +694,12 @@ def _report_for_version(d):
         lambda r: _fmt_num(r["uncontended_ops_per_sec"]["per_sec_median"]))
     row("semaphore", "semaphore contended", "ops/s",
         lambda r: _fmt_num(r["contended_ops_per_sec"]["per_sec_median"]))
+    row("event", "Event set/wait ping-pong", "round trips/s",
+        lambda r: _fmt_num(r["event_pingpong_per_sec"]["per_sec_median"]))
+    row("event", "Event broadcast", "wakeups/s",
+        lambda r: _fmt_num(r["broadcast_wakeups_per_sec"]["per_sec_median"]))
+    row("event", "AsyncResult ping-pong", "round trips/s",
+        lambda r: _fmt_num(r["asyncresult_pingpong_per_sec"]["per_sec_median"]))
     row("queue", "queue put/get", "items/s",
         lambda r: _fmt_num(r["items_per_sec"]["per_sec_median"]))
     row("queue_mixed", "queue shared green+native threads", "items/s",
@@ -0,0 +1,126 @@
+"""Read-mostly lock throughput: RWLock against RLock at 95/5 read/write.
+
+A dict stands in for an in-process cache.  Each worker does ``--ops``
+operations, 95% lookups under a read hold and 5% updates under the write hold
+(``--write-pct`` changes the mix), and the run reports operations per second
+for each lock.  With RLock every lookup is exclusive; with RWLock lookups
+overlap and only the updates serialize.
+
+    PYTHONPATH=/workspace python benchmarks/rwlock.py
+    PYTHONPATH=/workspace python benchmarks/rwlock.py --greenthreads 200 \\
+        --threads 4 --write-pct 5 --hold 0
+
+Holders sleep for ``--hold`` seconds inside the critical section, standing in
+for a lookup that touches the network.  That is what makes the lock contended
+at all between greenthreads -- without a yield inside, no greenthread ever
+finds it taken -- and it is the time RWLock lets readers overlap.  ``--threads`` adds native OS threads doing the same mix on the same
+lock, which is the case that made RLock serialize readers behind thread-pool
+workers.
+"""
+
+from __future__ import print_function
+
+import argparse
+import random
+import sys
+import threading
+import time
+
+import filament
+from _filament import locking
+
+
+class RLockCache(object):
+    def __init__(self, hold):
+        self._lock = locking.RLock()
+        self._hold = hold
+        self._data = {}
+
+    def get(self, key):
+        with self._lock:
+            filament.sleep(self._hold)
+            return self._data.get(key)
+
+    def set(self, key, value):
+        with self._lock:
+            filament.sleep(self._hold)
+            self._data[key] = value
+
+
+class RWLockCache(RLockCache):
+    def __init__(self, hold):
+        self._lock = locking.RWLock()
+        self._hold = hold
+        self._data = {}
+
+    def get(self, key):
+        with self._lock.reader:
+            filament.sleep(self._hold)
+            return self._data.get(key)
+
+    def set(self, key, value):
+        with self._lock.writer:
+            filament.sleep(self._hold)
+            self._data[key] = value
+
+
+def _worker(cache, ops, write_pct, seed):
+    rnd = random.Random(seed)
+    for i in range(ops):
+        key = rnd.randrange(1024)
+        if rnd.randrange(100) < write_pct:
+            cache.set(key, i)
+        else:
+            cache.get(key)
+
+
+def run_one(cache_cls, hold, greenthreads, threads, ops, write_pct):
+    cache = cache_cls(hold)
+    start = time.time()
+    natives = [threading.Thread(target=_worker,
+                                args=(cache, ops, write_pct, 1000 + i))
+               for i in range(threads)]
+    for t in natives:
+        t.start()
+    gts = [filament.spawn(_worker, cache, ops, write_pct, i)
+           for i in range(greenthreads)]
+    filament.joinall(gts)
+    while any(t.is_alive() for t in natives):
+        filament.sleep(0.001)
+    elapsed = time.time() - start
+    return (greenthreads + threads) * ops / elapsed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument('--greenthreads', type=int, default=100)
+    parser.add_argument('--threads', type=int, default=0,
+                        help='native OS threads sharing the same lock')
+    parser.add_argument('--ops', type=int, default=200,
+                        help='operations per worker')
+    parser.add_argument('--write-pct', type=int, default=5)
+    parser.add_argument('--hold', type=float, default=0.0001,
+                        help='seconds slept inside each critical section; '
+                             '0 just yields')
+    parser.add_argument('--reps', type=int, default=5)
+    args = parser.parse_args()
+
+    print('%d greenthreads + %d threads x %d ops, %d%% writes, hold %gs, '
+          'median of %d' % (args.greenthreads, args.threads, args.ops,
+                            args.write_pct, args.hold, args.reps))
+    results = {}
+    for name, cls in (('RLock', RLockCache), ('RWLock', RWLockCache)):
+        run_one(cls, args.hold, args.greenthreads, args.threads,
+                max(args.ops // 10, 1), args.write_pct)     # warm-up, discarded
+        reps = sorted(run_one(cls, args.hold, args.greenthreads, args.threads,
+                              args.ops, args.write_pct)
+                      for _ in range(args.reps))
+        results[name] = reps[len(reps) // 2]
+        print('%-8s %12.0f ops/s' % (name, results[name]))
+        sys.stdout.flush()
+    print('RWLock/RLock %.2fx' % (results['RWLock'] / results['RLock']))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
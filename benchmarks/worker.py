@@ -6,7 +6,8 @@ never cross-contaminates.  Usage:
     python worker.py <framework> <benchmark> [--params '<json>']
 
 <framework>  one of: filament | gevent | eventlet
-<benchmark>  one of: spawn ctxswitch semaphore queue queue_mixed tpool echo logging137
+<benchmark>  one of: spawn ctxswitch semaphore event queue queue_mixed tpool echo
+             logging137
 
 The result JSON is written to stdout on the last line, prefixed with
 "RESULT_JSON:".  All diagnostics go to stderr.  Any failure is reported as
@@ -53,6 +54,10 @@ DEFAULTS = {
     "sem_contended_gt": 50,     # greenthreads contending on Semaphore(1)
     "sem_contended_ops": 4000,  # ops per greenthread -> 200k contended ops
     "sem_reps": 5,
+    "event_rounds": 100000,     # Event / AsyncResult ping-pong round trips
+    "event_bcast_waiters": 100, # greenthreads released by each Event.set()
+    "event_bcast_rounds": 2000, # -> 200k wakeups
+    "event_reps": 5,
     "queue_items": 200000,      # producer/consumer items
     "queue_reps": 5,
     "qmix_items": 50000,        # items per producer in the mixed bench (x2)
@@ -103,6 +108,14 @@ class Env(object):
     def Semaphore(self, n):
         raise NotImplementedError
 
+    def Event(self):
+        """A re-settable flag: set() / clear() / wait()."""
+        raise NotImplementedError
+
+    def AsyncResult(self):
+        """A one-shot future: set(value) / get()."""
+        raise NotImplementedError
+
     def Queue(self, maxsize=None):
         raise NotImplementedError
 
@@ -151,6 +164,12 @@ class FilamentEnv(Env):
     def Semaphore(self, n):
         return self._f.Semaphore(n)
 
+    def Event(self):
+        return self._f.Event()
+
+    def AsyncResult(self):
+        return self._f.AsyncResult()
+
     def Queue(self, maxsize=None):
         if maxsize is None:
             return self._f.Queue()
@@ -181,12 +200,14 @@ class GeventEnv(Env):
         import gevent
         import gevent.pool
         import gevent.queue
+        import gevent.event
         import gevent.lock
         import gevent.threadpool
         import gevent.socket
         self._g = gevent
         self._queue = gevent.queue
         self._lock = gevent.lock
+        self._event = gevent.event
         self._socket = gevent.socket
         self._tp = gevent.threadpool.ThreadPool(8)
         self.lib_version = gevent.__version__
@@ -207,6 +228,12 @@ class GeventEnv(Env):
     def Semaphore(self, n):
         return self._lock.Semaphore(n)
 
+    def Event(self):
+        return self._event.Event()
+
+    def AsyncResult(self):
+        return self._event.AsyncResult()
+
     def Queue(self, maxsize=None):
         if maxsize is None:
             return self._queue.Queue()
@@ -230,6 +257,7 @@ class EventletEnv(Env):
 
     def __init__(self):
         import eventlet
+        import eventlet.event
         import eventlet.queue
         import eventlet.semaphore
         import eventlet.tpool
@@ -237,6 +265,7 @@ class EventletEnv(Env):
         self._e = eventlet
         self._queue = eventlet.queue
         self._sem = eventlet.semaphore
+        self._event = eventlet.event
         self._tpool = eventlet.tpool
         self._socket = gsock
         self.lib_version = eventlet.__version__
@@ -257,6 +286,12 @@ class EventletEnv(Env):
     def Semaphore(self, n):
         return self._sem.Semaphore(n)
 
+    def Event(self):
+        return _EventletFlag(self._event.Event())
+
+    def AsyncResult(self):
+        return _EventletResult(self._event.Event())
+
     def Queue(self, maxsize=None):
         if maxsize is None:
             return self._queue.Queue()
@@ -272,6 +307,31 @@ class EventletEnv(Env):
         return self._socket.socket()
 
 
+class _EventletFlag(object):
+    """eventlet has no re-settable flag: its Event is one-shot send/wait/reset.
+    This is the usual idiom on top of it; the wrapper's cost is eventlet's."""
+
+    def __init__(self, ev):
+        self._ev = ev
+
+    def set(self):
+        if not self._ev.ready():
+            self._ev.send()
+
+    def clear(self):
+        if self._ev.ready():
+            self._ev.reset()
+
+    def wait(self):
+        return self._ev.wait()
+
+
+class _EventletResult(object):
+    def __init__(self, ev):
+        self.set = ev.send
+        self.get = ev.wait
+
+
 def make_env(name):
     if name == "filament":
         return FilamentEnv()
@@ -427,6 +487,82 @@ def bench_semaphore(env, p):
     }
 
 
+def bench_event(env, p):
+    reps = p["event_reps"]
+    rounds = p["event_rounds"]
+
+    # --- Event ping-pong: two greenthreads re-arming a pair of flags ---
+    def flag_pingpong():
+        def body():
+            ping, pong = env.Event(), env.Event()
+
+            def ponger():
+                for _ in range(rounds):
+                    ping.wait()
+                    ping.clear()
+                    pong.set()
+            h = env.spawn(ponger)
+            for _ in range(rounds):
+                ping.set()
+                pong.wait()
+                pong.clear()
+            env.joinall([h])
+            return rounds
+        return env.run(body)
+
+    flag_stats = measure(flag_pingpong, reps)
+
+    # --- Event broadcast: one set() releasing many parked waiters ---
+    b_waiters = p["event_bcast_waiters"]
+    b_rounds = p["event_bcast_rounds"]
+    total_b = b_waiters * b_rounds
+
+    def broadcast():
+        def body():
+            evs = [env.Event() for _ in range(b_rounds)]
+
+            def waiter():
+                for ev in evs:
+                    ev.wait()
+            hs = [env.spawn(waiter) for _ in range(b_waiters)]
+            env.sleep(0)
+            for ev in evs:
+                ev.set()
+                env.sleep(0)
+            env.joinall(hs)
+            return total_b
+        return env.run(body)
+
+    bcast_stats = measure(broadcast, reps)
+
+    # --- AsyncResult ping-pong: a fresh request/reply future pair per round ---
+    def result_pingpong():
+        def body():
+            reqs = [env.AsyncResult() for _ in range(rounds)]
+            reps_ = [env.AsyncResult() for _ in range(rounds)]
+
+            def server():
+                for req, rep in zip(reqs, reps_):
+                    rep.set(req.get())
+            h = env.spawn(server)
+            for i, (req, rep) in enumerate(zip(reqs, reps_)):
+                req.set(i)
+                rep.get()
+            env.joinall([h])
+            return rounds
+        return env.run(body)
+
+    result_stats = measure(result_pingpong, reps)
+    return {
+        "rounds": rounds,
+        "event_pingpong_per_sec": flag_stats,
+        "broadcast_waiters": b_waiters,
+        "broadcast_wakeups": total_b,
+        "broadcast_wakeups_per_sec": bcast_stats,
+        "asyncresult_pingpong_per_sec": result_stats,
+    }
+
+
 def bench_queue(env, p):
     items = p["queue_items"]
     reps = p["queue_reps"]
@@ -779,6 +915,11 @@ def bench_logging137(framework, p, mode="naive"):
 
         res = run_attempt(logger, spawn_workers, filament.sleep, filament.spawn,
                           "filament.tpool")
+        # How the handler lock was contended: how many worker acquisitions
+        # spun (FIL_LOCK_SPIN), how many of those won, how many parked.
+        lock = logger.handlers[0].lock
+        if hasattr(lock, "spin_stats"):
+            res["lock_spin"] = lock.spin_stats()
         try:
             ftpool.shutdown()
         except Exception:
@@ -878,6 +1019,7 @@ def main():
                 "spawn": bench_spawn,
                 "ctxswitch": bench_ctxswitch,
                 "semaphore": bench_semaphore,
+                "event": bench_event,
                 "queue": bench_queue,
                 "queue_mixed": bench_queue_mixed,
                 "tpool": bench_tpool,
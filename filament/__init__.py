@@ -48,6 +48,7 @@ from filament.greenthread import (  # noqa: E402
     getcurrent,
     spawn,
     spawn_n,
+    spawn_many,
     spawn_later,
     spawn_after,
     kill,
@@ -55,9 +56,16 @@ from filament.greenthread import (  # noqa: E402
     joinall,
     wait,
     iwait,
+    wait_any,
+    wait_all,
     with_timeout,
     GreenThread,
     GreenletExit,
+    set_priority,
+    get_priority,
+    PRIORITY_HIGH,
+    PRIORITY_NORMAL,
+    PRIORITY_LOW,
 )
 
 from filament.timeout import Timeout  # noqa: E402
@@ -75,14 +83,16 @@ from filament import tpool  # noqa: E402
 # _filament.* modules.  These C modules are owned by other agents, so we import
 # them defensively -- their absence must not break the core native API above.
 try:  # pragma: no cover - availability depends on the compiled extension
-    from _filament.locking import Lock, RLock, Condition, Semaphore  # noqa: F401
+    from _filament.locking import Lock, RLock, RWLock, Condition, Semaphore  # noqa: F401
 except ImportError:  # pragma: no cover
-    Lock = RLock = Condition = Semaphore = None
+    Lock = RLock = RWLock = Condition = Semaphore = None
 
 try:  # pragma: no cover
     from _filament.queue import Queue, SimpleQueue, Empty, Full  # noqa: F401
+    from _filament.queue import PriorityQueue, LifoQueue  # noqa: F401
 except ImportError:  # pragma: no cover
     Queue = SimpleQueue = Empty = Full = None
+    PriorityQueue = LifoQueue = None
 
 try:  # pragma: no cover
     from _filament.timer import Timer  # noqa: F401
@@ -157,18 +167,35 @@ __all__ = [
     # C core
     "spawn", "sleep", "yield_thread", "Filament", "Scheduler", "Message",
     # greenthread helpers
-    "getcurrent", "spawn_n", "spawn_later", "spawn_after", "kill", "killall",
-    "joinall", "wait", "iwait", "with_timeout", "GreenThread", "GreenletExit",
+    "getcurrent", "spawn_n", "spawn_many", "spawn_later", "spawn_after", "kill", "killall",
+    "joinall", "wait", "iwait", "wait_any", "wait_all", "with_timeout", "GreenThread", "GreenletExit",
+    # scheduling classes
+    "set_priority", "get_priority", "PRIORITY_HIGH", "PRIORITY_NORMAL", "PRIORITY_LOW",
     # timeout / events / pools
     "Timeout", "Event", "AsyncResult",
     "Group", "Pool", "GreenPool", "GreenPile",
     # thread offload
     "tpool",
     # re-exported C primitives
-    "Lock", "RLock", "Condition", "Semaphore",
-    "Queue", "SimpleQueue", "Empty", "Full", "Timer",
+    "Lock", "RLock", "RWLock", "Condition", "Semaphore",
+    "Queue", "SimpleQueue", "PriorityQueue", "LifoQueue", "Empty", "Full",
+    "Timer",
     # runtime debug mode
     "set_debug", "get_debug",
     # exceptions module
     "exc",
 ]
+
+# FIL_BLOCKWATCH=<milliseconds> starts the blocking-call detector
+# (filament.blockwatch) at import.
+import os as _os  # noqa: E402
+
+if _os.environ.get("FIL_BLOCKWATCH", "") not in ("", "0"):
+    from filament import blockwatch as _blockwatch
+    _blockwatch._start_from_env(_os.environ["FIL_BLOCKWATCH"])
+
+# FIL_PREEMPT=<milliseconds> turns on time-slice preemption
+# (filament.preempt) at import.
+if _os.environ.get("FIL_PREEMPT", "") not in ("", "0"):
+    from filament import preempt as _preempt
+    _preempt._start_from_env(_os.environ["FIL_PREEMPT"])
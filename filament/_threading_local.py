@@ -7,15 +7,22 @@ greenthreads share one OS thread -- so genuine parity requires per-greenthread
 storage instead.  This module provides exactly that: a ``local`` whose
 attributes are private to the currently-running filament.
 
-The attribute-swapping design follows CPython's ``Lib/_threading_local.py``
-(Python Software Foundation License Version 2; see ``LICENSE.PSF``), adapted
-to key storage by greenthread rather than OS thread.
-
-Implementation notes
---------------------
-* We key each instance's per-greenthread dict on the current greenlet object,
-  held in a ``WeakKeyDictionary`` so that when a greenthread dies its storage is
-  reclaimed automatically (no manual cleanup, no id-reuse hazard).
+``local`` is the C implementation, ``_filament.core.local``: every instance gets
+a small integer index and every greenthread carries an array of per-instance
+dicts, so an attribute access is an array index plus the usual dict lookup
+(see ``include/core/fil_local.h``).  A Filament's dicts are released when its
+body returns.
+
+``pylocal`` is the original pure-Python version, kept as a reference and a
+fallback.  Its attribute-swapping design follows CPython's
+``Lib/_threading_local.py`` (Python Software Foundation License Version 2; see
+``LICENSE.PSF``), adapted to key storage by greenthread rather than OS thread.
+
+Implementation notes (both versions)
+------------------------------------
+* Storage is tied to the greenthread's lifetime: when a greenthread dies its
+  dicts are reclaimed automatically (no manual cleanup, no id-reuse hazard),
+  and when the ``local`` dies every greenthread's dict for it goes too.
 * Subclassing ``local`` and giving it an ``__init__``/class attributes works
   like the stdlib version: ``__init__`` runs once *per greenthread* the first
   time that greenthread touches the instance, with the original constructor
@@ -27,6 +34,7 @@ Implementation notes
 import weakref
 
 import filament as _fil
+from _filament.core import local  # noqa: F401
 
 
 def _current_key():
@@ -34,7 +42,7 @@ def _current_key():
     return _fil.Filament.getcurrent()
 
 
-class local(object):
+class pylocal(object):
     # We store all bookkeeping in private, name-mangled slots so subclasses can
     # freely use ordinary attribute names without colliding with us.
     __slots__ = ('_local__dicts', '_local__args', '_local__weakrefs',
@@ -0,0 +1,144 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+filament.blockwatch
+===================
+
+Find what is holding up the schedulers.  A greenthread that spins in a CPU
+loop, or calls something blocking that filament does not patch, stalls every
+other greenthread on its scheduler until it switches out.  With the detector
+on, any scheduler callback -- a greenthread's run up to its next switch, a
+timer callback -- that goes past the threshold is reported once, with the
+Python stack it is stuck in::
+
+    from filament import blockwatch
+
+    blockwatch.start(0.05)               # runs of 50ms or more
+    run_the_workload()
+    print(blockwatch.histogram())        # run lengths seen meanwhile
+
+``FIL_BLOCKWATCH=<milliseconds>`` in the environment starts it at import
+instead.
+
+Reports go to the ``filament.blockwatch`` logger as warnings unless
+``start()`` is given a ``callback``, which gets a :class:`Report`.  They are
+made from the watchdog thread, a native thread that checks the schedulers
+without the GIL and only takes it to report, so a callback runs on that
+thread and should be quick.  The stack is the scheduler thread's at the time
+of the report, while the run is still going.
+"""
+
+from __future__ import absolute_import
+
+import atexit
+import collections
+import linecache
+import logging
+import traceback
+
+import _filament.core as _core
+
+__all__ = ["start", "stop", "enabled", "threshold", "histogram", "Report"]
+
+log = logging.getLogger("filament.blockwatch")
+
+_BUCKETS = 32
+
+_registered_atexit = []
+
+
+class Report(collections.namedtuple(
+        "Report", "thread_id greenlet elapsed stack")):
+    """One run past the threshold.
+
+    ``thread_id`` is the scheduler thread's ident, ``greenlet`` the
+    greenthread that was running (None for a timer callback), ``elapsed``
+    how long it had run when reported, in seconds, and ``stack`` its Python
+    stack as ``(filename, lineno, name)`` tuples, outermost first.
+    """
+
+    __slots__ = ()
+
+    def format_stack(self):
+        """The stack as ``traceback.format_list()`` lines."""
+        return traceback.format_list(
+            [(filename, lineno, name,
+              linecache.getline(filename, lineno).strip() or None)
+             for filename, lineno, name in self.stack])
+
+    def __str__(self):
+        if self.greenlet is None:
+            who = "a scheduler callback"
+        else:
+            who = "greenthread %r" % (self.greenlet,)
+        return ("%s has blocked the scheduler on thread %d for %.1fms:\n%s" %
+                (who, self.thread_id, self.elapsed * 1000.0,
+                 "".join(self.format_stack()).rstrip("\n")))
+
+
+def _log_report(report):
+    log.warning("%s", report)
+
+
+def start(threshold=0.05, callback=None):
+    """Report scheduler callbacks that run ``threshold`` seconds or more.
+
+    ``callback(report)`` gets each :class:`Report`; by default they are
+    logged.  Calling it again changes the threshold and callback.
+    """
+    report = _log_report if callback is None else callback
+
+    def reporter(thread_id, greenlet, elapsed, stack):
+        report(Report(thread_id, greenlet, elapsed, stack))
+
+    _core.blockwatch_start(threshold, reporter)
+    if not _registered_atexit:
+        # The watchdog may want the GIL; stop it before finalization does.
+        atexit.register(stop)
+        _registered_atexit.append(True)
+
+
+def stop():
+    """Stop the detector; the histogram keeps what it counted."""
+    _core.blockwatch_stop()
+
+
+def enabled():
+    return _core.blockwatch_threshold() is not None
+
+
+def threshold():
+    """The threshold in seconds, or None while the detector is off."""
+    return _core.blockwatch_threshold()
+
+
+def _bounds():
+    # Upper bound of each bucket, in seconds; see blockwatch_histogram().
+    return [(1 << i) / 1e6 for i in range(_BUCKETS - 1)] + [float("inf")]
+
+
+def histogram(reset=False, per_thread=False):
+    """Run lengths of scheduler callbacks counted while the detector was on.
+
+    A list of ``(upper_bound, count)`` pairs, ``upper_bound`` in seconds and
+    doubling from 1us, the last one infinite.  With ``per_thread=True``, a
+    dict of such lists keyed by scheduler thread ident (None for schedulers
+    that have gone).  ``reset=True`` zeroes the counts after reading them.
+    """
+    bounds = _bounds()
+    per = _core.blockwatch_histogram(reset=reset)
+    if per_thread:
+        return dict((tid, list(zip(bounds, counts))) for tid, counts in per)
+    totals = [0] * _BUCKETS
+    for _, counts in per:
+        for i, n in enumerate(counts):
+            totals[i] += n
+    return list(zip(bounds, totals))
+
+
+def _start_from_env(value):
+    try:
+        ms = float(value)
+    except ValueError:
+        raise ValueError("FIL_BLOCKWATCH must be a threshold in "
+                         "milliseconds, not %r" % (value,))
+    start(ms / 1000.0)
@@ -21,9 +21,18 @@ Response framing follows gevent's rules:
   * anything else (HTTP/1.0 without a length, ``Connection: close``, a request
     body the app left unread) ends with the connection closed.
 
+Responses are written through a per-connection output buffer rather than one
+``sendall`` per chunk: it is flushed when it passes ``_HIGH_WATER`` bytes,
+when the response is done, and whenever the handler is about to wait -- for
+more request bytes, or (via a deferred flusher) inside a streaming app that
+blocks between chunks -- so nothing is ever held back from a client that is
+waiting for it.  Pipelined requests already sitting in the read buffer are
+parsed and answered before anything is flushed, and their responses leave in
+one send.  Flushes made mid-response pass ``MSG_MORE`` where the platform has
+it, so the kernel need not push a short segment out on its own.
+
 Deliberate simplifications (documented limits vs. gevent's full pywsgi):
-  * No 100-continue handling, no HTTP/2, no pipelining beyond serving requests
-    one after another on the same connection.
+  * No 100-continue handling, no HTTP/2.
   * Minimal error handling: a malformed request line yields a 400 and closes.
   * The access log line is close to gevent's but not byte-identical.
 
@@ -35,14 +44,23 @@ latin-1 before being written.
 
 from __future__ import absolute_import
 
+import socket as _socket
 import sys
 import time
 
+import filament
 from filament.gevent_compat.server import StreamServer
 
 # Blank lines tolerated before a request line (see _read_request).
 _MAX_BLANK_LINES = 4
 
+# Output buffered past this many bytes is flushed without waiting for the end
+# of the response; also the read size of the connection reader.
+_HIGH_WATER = 65536
+
+# "More data follows" for mid-response flushes (Linux); 0 where unsupported.
+_MSG_MORE = getattr(_socket, "MSG_MORE", 0)
+
 # WSGI wants native str in environ.  On Py3 the wire bytes are decoded latin-1;
 # on Py2 native str *is* bytes so decoding is a no-op passthrough.
 _PY3 = sys.version_info[0] >= 3
@@ -222,6 +240,89 @@ class Input(object):
             self.position += len(data)
 
 
+class _Reader(object):
+    """
+    Buffered reader over the connection socket, in place of ``makefile()``.
+
+    Exposes just what :class:`Input` and the request parser use (``read``,
+    ``readline``, ``close``) plus :meth:`pending`, which says whether the next
+    request is already buffered, and calls ``before_wait`` before every
+    ``recv`` so the handler can flush its output before it blocks.
+    """
+
+    def __init__(self, sock, before_wait=None):
+        self._sock = sock
+        self._buf = b""
+        self._pos = 0
+        self.before_wait = before_wait
+
+    def pending(self):
+        """Bytes that can be read without touching the socket."""
+        return len(self._buf) - self._pos
+
+    def _recv(self, size=_HIGH_WATER):
+        if self.before_wait is not None:
+            self.before_wait()
+        return self._sock.recv(size)
+
+    def _take(self, size):
+        data = self._buf[self._pos:self._pos + size]
+        self._pos += len(data)
+        return data
+
+    def read(self, size=-1):
+        if size is None or size < 0:
+            parts = [self._take(self.pending())]
+            while True:
+                data = self._recv()
+                if not data:
+                    return b"".join(parts)
+                parts.append(data)
+        avail = self.pending()
+        if avail >= size:
+            return self._take(size)
+        parts = [self._take(avail)]
+        need = size - avail
+        while need > 0:
+            data = self._recv(max(need, _HIGH_WATER))
+            if not data:
+                break
+            if len(data) > need:
+                # Keep the overshoot (the next request, typically).
+                self._buf, self._pos = data, need
+                data = data[:need]
+            parts.append(data)
+            need -= len(data)
+        return b"".join(parts)
+
+    def readline(self, size=-1):
+        if size is None:
+            size = -1
+        while True:
+            idx = self._buf.find(b"\n", self._pos)
+            if idx >= 0:
+                end = idx + 1
+                break
+            if 0 <= size <= self.pending():
+                end = len(self._buf)
+                break
+            data = self._recv()
+            if not data:
+                end = len(self._buf)
+                break
+            self._buf = self._buf[self._pos:] + data
+            self._pos = 0
+        if size >= 0:
+            end = min(end, self._pos + size)
+        line = self._buf[self._pos:end]
+        self._pos = end
+        return line
+
+    def close(self):
+        self._buf = b""
+        self._pos = 0
+
+
 def _to_native(b):
     """bytes -> native str (latin-1 on py3, identity on py2)."""
     if _PY3 and isinstance(b, bytes):
@@ -255,12 +356,21 @@ class WSGIHandler(object):
         self.client_address = address
         self.server = server
         self.application = server.application
+        # Output buffer (see _write/_flush).  The lock and the deferred
+        # flusher only come into play for apps that block mid-response.
+        self._wbuf = []
+        self._wbuf_len = 0
+        self._wlock = None
+        self._flush_armed = False
+        self._flush_error = None
+        self._closed = False
+        self._msg_more = 0 if getattr(server, "ssl_enabled", False) \
+            else _MSG_MORE
         # Buffered reader over the (cooperative) socket for line-oriented parse.
         if rfile is not None:
             self.rfile = rfile
         else:
-            self.rfile = \
-                sock.makefile("rb", 0) if not _PY3 else sock.makefile("rb")
+            self.rfile = _Reader(sock, before_wait=self._flush)
         self._reset_request_state()
 
     def _reset_request_state(self):
@@ -268,6 +378,7 @@ class WSGIHandler(object):
         self._headers = []
         self._headers_sent = False
         self._chunked_response = False
+        self._result_is_sequence = False
         self.close_connection = True
         self._request_keep_alive = False
         self._protocol = "HTTP/1.0"
@@ -446,7 +557,7 @@ class WSGIHandler(object):
             lines.append(b"Connection: keep-alive")
         lines.append(b"")
         lines.append(b"")
-        self.sock.sendall(b"\r\n".join(lines))
+        self._write(b"\r\n".join(lines))
 
     def _write_body(self, data):
         # The write() callable handed to legacy apps.
@@ -457,16 +568,76 @@ class WSGIHandler(object):
         data = _to_bytes(data)
         self.response_length += len(data)
         if self._chunked_response:
-            self.sock.sendall(
-                ("%x\r\n" % len(data)).encode("ascii") + data + b"\r\n")
+            self._write(("%x\r\n" % len(data)).encode("ascii"))
+            self._write(data)
+            self._write(b"\r\n")
         else:
-            self.sock.sendall(data)
+            self._write(data)
+        # Whatever the app does before its next chunk may block; if it does,
+        # the deferred flusher gets to run and sends what is buffered.  A list
+        # body has nothing in between its items.
+        if not self._result_is_sequence:
+            self._arm_flush()
 
     def _finish_response(self):
         if not self._headers_sent:
             self._send_headers()
         if self._chunked_response:
-            self.sock.sendall(b"0\r\n\r\n")
+            self._write(b"0\r\n\r\n")
+
+    # -- output buffer -------------------------------------------------------
+
+    def _write(self, data):
+        self._wbuf.append(data)
+        self._wbuf_len += len(data)
+        if self._wbuf_len >= _HIGH_WATER:
+            self._flush(self._msg_more)
+
+    def _flush(self, flags=0):
+        """Send everything buffered, in one ``sendall``."""
+        if self._flush_error is not None:
+            exc, self._flush_error = self._flush_error, None
+            raise exc
+        if not self._wbuf:
+            return
+        if self._wlock is None:
+            self._send_buffered(flags)
+        else:
+            # The deferred flusher may be part-way through a send.
+            with self._wlock:
+                self._send_buffered(flags)
+
+    def _send_buffered(self, flags):
+        wbuf = self._wbuf
+        if not wbuf:
+            return
+        self._wbuf = []
+        self._wbuf_len = 0
+        data = wbuf[0] if len(wbuf) == 1 else b"".join(wbuf)
+        if flags:
+            self.sock.sendall(data, flags)
+        else:
+            self.sock.sendall(data)
+
+    def _arm_flush(self):
+        """Have what is buffered sent the next time this greenthread yields."""
+        if self._wbuf and not self._flush_armed:
+            self._flush_armed = True
+            if self._wlock is None:
+                self._wlock = filament.Lock()
+            filament.spawn_n(self._deferred_flush)
+
+    def _deferred_flush(self):
+        # Runs the first time the handler yields after buffering output.
+        self._flush_armed = False
+        if self._closed or not self._wbuf:
+            return
+        try:
+            with self._wlock:
+                self._send_buffered(0)
+        except Exception as exc:
+            # The handler is the one that gets to see it.
+            self._flush_error = exc
 
     # -- logging -------------------------------------------------------------
 
@@ -486,10 +657,11 @@ class WSGIHandler(object):
         Write one access-log line to ``server.log``.
 
         Overridable, and overridden in the wild to count requests, so it
-        stays a real method even when the server has no log.
+        stays a real method even when the server has no log -- but the line
+        is only formatted when there is a real log to write it to.
         """
         log = getattr(self.server, "log", None)
-        if log is None:
+        if log is None or isinstance(log, _NoopLog):
             return
         try:
             log.write(self.format_request() + "\n")
@@ -517,6 +689,7 @@ class WSGIHandler(object):
 
         self.environ = environ = self._build_environ(req)
         self.result = result = self.application(environ, self._start_response)
+        self._result_is_sequence = isinstance(result, (list, tuple))
         try:
             for chunk in result:
                 self._write_body(chunk)
@@ -530,9 +703,23 @@ class WSGIHandler(object):
             self.log_request()
 
         if self.close_connection:
+            self._flush()
             return False
         # A body the app never read would be parsed as the next request line.
-        return self._input.exhaust()
+        if not self._input.exhaust():
+            self._flush()
+            return False
+        # With the next request already buffered (pipelining), answer it
+        # first and send both responses together -- unless its app yields
+        # (sleeps, waits on I/O), in which case the deferred flusher sends
+        # this one then rather than holding it behind a slow app.  Otherwise
+        # the reader flushes before it waits for more.
+        pending = getattr(self.rfile, "pending", None)
+        if pending is None or not pending():
+            self._flush()
+        else:
+            self._arm_flush()
+        return True
 
     def handle(self):
         """
@@ -545,6 +732,13 @@ class WSGIHandler(object):
             while self.handle_one_request():
                 pass
         finally:
+            # Responses already made go out even if a later pipelined app
+            # raised; the connection may be gone by now, though.
+            try:
+                self._flush()
+            except Exception:
+                pass
+            self._closed = True
             try:
                 self.rfile.close()
             except Exception:
@@ -563,7 +757,8 @@ class WSGIHandler(object):
                    b"\r\nContent-Length: " +
                    str(len(body)).encode("ascii") +
                    b"\r\nConnection: close\r\n\r\n" + body)
-        self.sock.sendall(payload)
+        self._write(payload)
+        self._flush()
 
 
 class _NoopLog(object):
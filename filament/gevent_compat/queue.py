@@ -14,8 +14,9 @@ Mapping summary:
     already provides ``task_done`` / ``join``, so JoinableQueue is the same
     class -- faithful mapping).
   * ``SimpleQueue``               -> :class:`filament.SimpleQueue`.
-  * ``PriorityQueue`` / ``LifoQueue`` -> filament's pure-Python cooperative
-    subclasses (faithful mapping, different ordering discipline).
+  * ``PriorityQueue`` / ``LifoQueue`` -> :class:`filament.PriorityQueue` /
+    :class:`filament.LifoQueue`, the C queue's other ordering disciplines
+    (faithful mapping, with task_done / join as in gevent).
   * ``Empty`` / ``Full``          -> filament's queue exceptions.
   * ``Channel``                   -> a faithful pure-Python port of gevent's
     unbuffered rendezvous channel (the C queue has no zero-buffer mode),
@@ -27,7 +28,6 @@ from __future__ import absolute_import
 import collections
 
 import filament
-from filament import pyqueue as _pyqueue
 from filament import timeout as _timeout
 from filament.gevent_compat import hub as _hub
 
@@ -40,8 +40,8 @@ JoinableQueue = filament.Queue
 # carrying task_done/join as extras is a harmless superset.  The zero-arg C
 # filament.SimpleQueue cannot even accept gevent's ``SimpleQueue(maxsize)``.
 SimpleQueue = filament.Queue
-PriorityQueue = _pyqueue.PriorityQueue
-LifoQueue = _pyqueue.LifoQueue
+PriorityQueue = filament.PriorityQueue
+LifoQueue = filament.LifoQueue
 Empty = filament.Empty
 Full = filament.Full
 
@@ -20,13 +20,22 @@ Documented limitations:
     context options beyond filament.ssl.wrap_socket are not modelled.
   * The libev-specific knobs of gevent's server (``.loop``, watchers) are not
     provided.
+
+``workers=N`` (a filament extension) spreads accepting over N scheduler
+threads: the calling thread plus N-1 native threads, each with its own
+``SO_REUSEPORT`` listener on the same port, its own accept loop and, for an
+int ``spawn``, its own pool.  The kernel hashes incoming connections across
+the listeners, so no accept lock or hand-off queue is shared between threads.
+This only buys parallelism on a free-threaded build; under the GIL the
+threads still take turns, it is merely correct.
 """
 
 from __future__ import absolute_import
 
 import filament
+from filament import event as _event
+from filament import patcher as _patcher
 import filament.socket as _green_socket
-from filament.gevent_compat import greenlet as _greenlet
 from filament.gevent_compat import pool as _pool
 
 
@@ -44,19 +53,41 @@ class StreamServer(object):
         an int -> an internal bounded :class:`gevent.pool.Pool` of that size;
         a Pool/Group instance -> used directly;
         ``None`` -> handle inline in the accept loop (no spawning).
+    :param workers: number of scheduler threads accepting connections (see
+        the module docstring).  More than one needs an ``(host, port)``
+        listener, ``SO_REUSEPORT``, and a ``spawn`` that is not a Pool
+        instance, since a pool belongs to the thread that made it.
     """
 
     def __init__(self, listener, handle=None, backlog=None, spawn='default',
-                 **ssl_args):
+                 workers=1, **ssl_args):
         self.backlog = backlog if backlog is not None else 256
         self._ssl_args = ssl_args
         self.started = False
         self._stopped = False
         self._accept_greenlet = None
+        self.workers = workers
+        self._spawn = spawn
+        self._threads = []
+        self._stop_event = None
+
+        if workers < 1:
+            raise ValueError("workers must be >= 1")
+        if workers > 1:
+            if not isinstance(listener, tuple):
+                raise ValueError("workers > 1 needs an (host, port) address "
+                                 "so each thread can bind its own listener")
+            if _REUSEPORT is None:
+                raise ValueError("workers > 1 needs SO_REUSEPORT")
+            if not (spawn is None or spawn == 'default'
+                    or isinstance(spawn, int)):
+                raise ValueError("workers > 1 cannot share a Pool instance "
+                                 "across threads; pass a size instead")
 
         # Resolve the listening socket.
         if isinstance(listener, tuple):
-            self.socket = self._make_listener(listener, self.backlog)
+            self.socket = self._make_listener(listener, self.backlog,
+                                              reuseport=workers > 1)
         else:
             # An already-prepared socket.
             self.socket = listener
@@ -77,19 +108,27 @@ class StreamServer(object):
         elif spawn is None:
             self.pool = None
             self._inline = True                  # no spawning at all
-        elif isinstance(spawn, int):
-            self.pool = _pool.Pool(spawn)
         else:
-            self.pool = spawn                    # a Pool/Group instance
+            self.pool = self._make_pool(spawn)
+
+    @staticmethod
+    def _make_pool(spawn):
+        if spawn is None or spawn == 'default':
+            return None
+        if isinstance(spawn, int):
+            return _pool.Pool(spawn)
+        return spawn                             # a Pool/Group instance
 
     # -- listener setup ------------------------------------------------------
 
     @staticmethod
-    def _make_listener(address, backlog):
+    def _make_listener(address, backlog, reuseport=False):
         sock = _green_socket.socket(_green_socket.AF_INET,
                                     _green_socket.SOCK_STREAM)
         sock.setsockopt(_green_socket.SOL_SOCKET,
                         _green_socket.SO_REUSEADDR, 1)
+        if reuseport:
+            sock.setsockopt(_green_socket.SOL_SOCKET, _REUSEPORT, 1)
         sock.bind(address)
         sock.listen(backlog)
         return sock
@@ -126,6 +165,8 @@ class StreamServer(object):
         self.started = True
         self._stopped = False
         self.start_accepting()
+        if self.workers > 1:
+            self._start_workers()
 
     def start_accepting(self):
         """
@@ -146,10 +187,14 @@ class StreamServer(object):
         if accept_greenlet is not None:
             filament.kill(accept_greenlet)
 
-    def _accept_loop(self):
+    def _accept_loop(self, sock=None, pool=None):
+        # Worker threads pass their own listener and pool; the calling
+        # thread's loop uses the server's.
+        if sock is None:
+            sock, pool = self.socket, self.pool
         while not self._stopped:
             try:
-                client, address = self.socket.accept()
+                client, address = sock.accept()
             except filament.GreenletExit:
                 # We were killed by stop(); exit quietly.
                 break
@@ -162,11 +207,80 @@ class StreamServer(object):
             if self._inline:
                 # spawn=None: handle in the accept greenlet itself.
                 self.wrap_socket_and_handle(client, address)
-            elif self.pool is None:
-                # spawn='default': a fresh untracked greenlet per connection.
-                _greenlet.spawn(self.wrap_socket_and_handle, client, address)
+            elif pool is None:
+                # spawn='default': a fresh untracked greenthread per
+                # connection.  Nothing ever looks at it, so spawn_n: no
+                # Greenlet wrapper or result, and a failing handler's
+                # traceback is still printed.
+                filament.spawn_n(self.wrap_socket_and_handle, client, address)
             else:
-                self.pool.spawn(self.wrap_socket_and_handle, client, address)
+                pool.spawn(self.wrap_socket_and_handle, client, address)
+
+    # -- worker threads (workers > 1) ----------------------------------------
+
+    def _start_workers(self):
+        # Every worker binds its listener before start() returns, so a
+        # client connecting right after start() can land on any of them and
+        # a bind failure surfaces here rather than in a thread nobody joins.
+        self._stop_event = _event.Event()
+        thread_cls = _patcher.get_original('threading', 'Thread')
+        address = self.address
+        for i in range(1, self.workers):
+            worker = _Worker(address, self.backlog)
+            t = thread_cls(target=self._worker_main, args=(worker,),
+                           name='StreamServer-worker-%d' % i)
+            t.daemon = True
+            worker.thread = t
+            self._threads.append(worker)
+            t.start()
+        failed = None
+        for worker in self._threads:
+            worker.ready.wait()
+            if worker.error is not None and failed is None:
+                failed = worker.error
+        if failed is not None:
+            self.stop()
+            raise failed
+
+    def _worker_main(self, worker):
+        # Runs in its own native thread, hence on its own scheduler.  The
+        # thread's main greenlet parks on the stop event while the accept
+        # loop and handlers run around it.
+        pool = None
+        try:
+            try:
+                sock = self._make_listener(worker.address, worker.backlog,
+                                           reuseport=True)
+            except Exception as exc:
+                worker.error = exc
+                return
+            pool = self._make_pool(self._spawn)
+            acceptor = filament.spawn(self._accept_loop, sock, pool)
+            worker.ready.set()
+            self._stop_event.wait()
+            filament.kill(acceptor)
+            try:
+                sock.close()
+            except Exception:
+                pass
+            if pool is not None:
+                pool.join(timeout=worker.timeout)
+                pool.kill()
+        finally:
+            worker.ready.set()
+            worker.done.set()
+
+    def _stop_workers(self, timeout):
+        workers, self._threads = self._threads, []
+        if not workers:
+            return
+        for worker in workers:
+            worker.timeout = timeout
+        self._stop_event.set()
+        for worker in workers:
+            # Each worker does its own join(timeout) + kill, so this only
+            # waits as long as the slowest one's drain.
+            worker.done.wait()
 
     def serve_forever(self):
         """Start the server and block until :meth:`stop` is called."""
@@ -181,7 +295,8 @@ class StreamServer(object):
         """
         Stop accepting and close the socket; with a pool, wait up to
         ``timeout`` for in-flight handlers, then kill the stragglers (gevent
-        contract).
+        contract).  With ``workers > 1`` every worker thread does the same
+        with its own listener and pool, and this returns once all have.
         """
         self._stopped = True
         self.stop_accepting()
@@ -192,6 +307,7 @@ class StreamServer(object):
         if self.pool is not None:
             self.pool.join(timeout=timeout)
             self.pool.kill()
+        self._stop_workers(timeout)
         self.started = False
 
     def close(self):
@@ -209,4 +325,20 @@ class StreamServer(object):
         return self.address[1] if self.address else None
 
 
+_REUSEPORT = getattr(_green_socket, 'SO_REUSEPORT', None)
+
+
+class _Worker(object):
+    """Book-keeping for one extra accept thread of a ``workers > 1`` server."""
+
+    def __init__(self, address, backlog):
+        self.address = address
+        self.backlog = backlog
+        self.thread = None
+        self.error = None
+        self.timeout = None
+        self.ready = _event.Event()
+        self.done = _event.Event()
+
+
 __all__ = ["StreamServer"]
@@ -18,7 +18,6 @@ whatever it raised).
 from __future__ import absolute_import
 
 import sys
-import traceback
 
 try:
     # Python 3: filament's private vendored greenlet runtime.  All of
@@ -28,7 +27,17 @@ try:
 except ImportError:  # Python 2 / stock-greenlet build
     import greenlet
 
+from _filament.core import Filament
+from _filament.core import PRIORITY_HIGH
+from _filament.core import PRIORITY_LOW
+from _filament.core import PRIORITY_NORMAL
+from _filament.core import Message
+from _filament.core import WaitSet
 from _filament.core import spawn as _core_spawn
+from _filament.locking import AsyncResult
+from _filament.locking import Event
+from _filament.core import spawn_n as _core_spawn_n
+from _filament.core import spawn_many as _core_spawn_many
 from _filament.core import sleep as _sleep
 from _filament.timer import Timer
 
@@ -57,23 +66,19 @@ def spawn(fn, *args, **kwargs):
     The greenthread does not start running until the scheduler next gets
     control (e.g. the caller sleeps or waits).  Use the returned object's
     ``.wait()`` to retrieve the result or ``.kill()`` via :func:`kill`.
-    """
-    return _core_spawn(fn, *args, **kwargs)
 
+    ``stack_size=`` (bytes) is taken by ``spawn`` itself, not passed to
+    ``fn``: with the fiber core it gives this greenthread a stack of that
+    size, rounded up to a power of two from 64 KiB, instead of
+    ``FIL_FIBER_STACK_SIZE``.  It is ignored on builds without private
+    stacks.  ``_fil_greenlet.fiber_stack_profile()`` shows how deep each
+    spawn site actually goes, for picking one.
 
-def _fire_and_forget(fn, args, kwargs):
-    # Runs the target and *discards* its result.  Any exception is printed (so
-    # bugs aren't silently lost) but never propagated -- there is, by design, no
-    # one waiting to receive it.  This mirrors eventlet's spawn_n semantics.
-    try:
-        fn(*args, **kwargs)
-    except GreenletExit:
-        pass
-    except BaseException:
-        # BaseException so a Timeout (which deliberately does not derive from
-        # Exception) is still printed here rather than escaping into the
-        # scheduler greenlet.
-        traceback.print_exc()
+    ``priority=`` is taken by ``spawn`` too: the greenthread's scheduling
+    class, ``PRIORITY_HIGH``, ``PRIORITY_NORMAL`` or ``PRIORITY_LOW`` (see
+    :func:`set_priority`).  By default it is the spawner's.
+    """
+    return _core_spawn(fn, *args, **kwargs)
 
 
 def spawn_n(fn, *args, **kwargs):
@@ -81,13 +86,55 @@ def spawn_n(fn, *args, **kwargs):
     Fire-and-forget spawn.  Schedules ``fn`` to run and returns ``None``.
 
     Unlike :func:`spawn`, the result and any exception are NOT retrievable --
-    this is deliberately not just an alias for spawn.  It is slightly cheaper
-    conceptually (no one holds the Filament to inspect it) and matches
-    eventlet's ``spawn_n``.  Exceptions are printed rather than swallowed
-    silently, so genuine errors still surface in logs.
+    this is deliberately not just an alias for spawn.  The greenthread runs
+    ``fn`` directly with no result ``Message`` behind it, so it is cheaper
+    than ``spawn``, and matches eventlet's ``spawn_n``.  Exceptions are
+    printed rather than swallowed silently (``GreenletExit`` excepted), so
+    genuine errors still surface in logs.  ``stack_size=`` and
+    ``priority=`` work as for :func:`spawn`.
     """
-    _core_spawn(_fire_and_forget, fn, args, kwargs)
-    return None
+    return _core_spawn_n(fn, *args, **kwargs)
+
+
+def spawn_many(fn, iterable_of_args):
+    """
+    Spawn ``fn(*args)`` for every ``args`` in ``iterable_of_args`` and return
+    the list of Filaments, in order.
+
+    Same as ``[spawn(fn, *args) for args in iterable_of_args]`` except that
+    the whole batch is queued on the scheduler at once -- one lock hold and
+    at most one wakeup rather than one per greenthread -- and atomically: if
+    building any of them fails (or the iterable raises), none runs.  Meant
+    for fan-out, e.g. scatter/gather to shards.
+    """
+    return _core_spawn_many(fn, iterable_of_args)
+
+
+def set_priority(priority, gt=None):
+    """
+    Put greenthread ``gt`` (by default the current one) in scheduling class
+    ``priority``: ``PRIORITY_HIGH``, ``PRIORITY_NORMAL`` or ``PRIORITY_LOW``.
+
+    The scheduler runs ready high greenthreads ahead of normal ones and
+    normal ahead of low.  A class that keeps being passed over gets a longer
+    turn each time, so low greenthreads are delayed but never starved.
+    Wakeups -- a lock being released, an event set, a timeout -- are queued
+    in the class of the greenthread being woken.  Greenthreads spawn in
+    their spawner's class.  The change applies from ``gt``'s next wakeup.
+    """
+    if gt is None:
+        gt = greenlet.getcurrent()
+    if not isinstance(gt, Filament):
+        raise TypeError("set_priority() needs a greenthread, not %r" % (gt,))
+    gt.priority = priority
+
+
+def get_priority(gt=None):
+    """The scheduling class of ``gt`` (by default the current greenthread);
+    ``PRIORITY_NORMAL`` for greenlets that are not greenthreads."""
+    if gt is None:
+        gt = greenlet.getcurrent()
+    return getattr(gt, "priority", PRIORITY_NORMAL)
 
 
 class GreenThread(object):
@@ -208,6 +255,60 @@ def kill(g, exception=GreenletExit, *args):
     sleep(0)
 
 
+_NATIVE_SOURCES = (Filament, Message, Event, AsyncResult)
+
+
+def _native_source(obj):
+    """What a WaitSet can watch for ``obj`` directly, or None."""
+    if isinstance(obj, _NATIVE_SOURCES):
+        return obj
+    if isinstance(obj, GreenThread):
+        return _native_source(obj._filament)
+    return None
+
+
+def _relay(obj):
+    try:
+        obj.wait()
+    except Exception:
+        # Completion is all the WaitSet needs; the caller fetches the
+        # value/exception from the object itself.
+        pass
+
+
+def _waitset(objects, timeout):
+    """
+    Build a WaitSet over ``objects`` (a list), deadline ``timeout``.
+
+    Filaments, Messages, Events and AsyncResults are watched directly.
+    Anything else with a ``wait()`` gets a relay greenthread that waits on it,
+    and the relay is watched instead; objects without ``wait()`` count as
+    complete.  Returns
+    ``(waitset, relays)``; pass both to :func:`_waitset_done` when finished.
+    """
+    sources = []
+    relays = []
+    for obj in objects:
+        src = _native_source(obj)
+        if src is None:
+            if getattr(obj, "wait", None) is None:
+                src = Message()
+                src.send(None)
+            else:
+                src = _core_spawn(_relay, obj)
+                relays.append(src)
+        sources.append(src)
+    return WaitSet(sources, timeout), relays
+
+
+def _waitset_done(ws, relays):
+    ws.close()
+    for r in relays:
+        if not r.dead:
+            # Cooperative, as in kill(), but without waiting for it.
+            Timer(0, r.throw, GreenletExit)
+
+
 def joinall(greenlets, timeout=None, raise_error=False):
     """
     Wait for every greenthread in ``greenlets`` to finish.
@@ -215,35 +316,32 @@ def joinall(greenlets, timeout=None, raise_error=False):
     :param timeout: overall wall-clock budget across all of them (``None`` ==
         wait forever).  On expiry we simply return the (possibly still-running)
         list -- we do not raise, matching gevent.
-    :param raise_error: if True, re-raise the first exception a greenthread
-        raised; otherwise exceptions are ignored (you can still inspect each
-        greenthread individually).
+    :param raise_error: if True, re-raise the exception of the first
+        greenthread to *fail*, as soon as it finishes, even if one earlier in
+        ``greenlets`` fails later (joinall used to wait in list order and
+        raise the first failure in the list).  Otherwise exceptions are
+        ignored (you can still inspect each greenthread individually).  A
+        greenthread killed with ``GreenletExit`` is not an error.
+
+    Built on ``_filament.core.WaitSet``: one registration per greenthread and
+    a single park for the lot (one per failure check with ``raise_error``),
+    rather than a park per greenthread under a Python ``Timeout``.
     """
-    from filament.timeout import Timeout
-
     greenlets = list(greenlets)
-    # ``Timeout(timeout, False)`` == silent expiry: the with-block just exits.
-    # ``Timeout(None, ...)`` is an inert no-op, so this also handles timeout=None.
-    #
-    # The sentinel fires *inside* a blocking ``g.wait()`` below, so we must not
-    # let the per-greenthread ``except`` swallow it -- otherwise the timeout only
-    # cuts one wait short and joinall keeps blocking for the full remaining set.
-    # Re-raise the sentinel instance so it reaches the ``with`` block, which
-    # suppresses it, and we return whatever is (still) in ``greenlets``.
-    timer = Timeout(timeout, False)
-    with timer:
-        for g in greenlets:
-            try:
-                g.wait()
-            except GreenletExit:
-                # A killed greenthread finishing is not an error to joiners.
-                pass
-            except BaseException as e:
-                if e is timer:
-                    # Overall budget exhausted -> stop waiting, return early.
-                    raise
-                if raise_error:
-                    raise
+    ws, relays = _waitset(greenlets, timeout)
+    try:
+        while len(ws):
+            ready = ws.wait(1 if raise_error else len(ws))
+            if not ready:
+                break               # deadline
+            if raise_error:
+                for i in ready:
+                    try:
+                        greenlets[i].wait()
+                    except GreenletExit:
+                        pass
+    finally:
+        _waitset_done(ws, relays)
     return greenlets
 
 
@@ -275,9 +373,10 @@ def wait(objects=None, timeout=None, count=None):
         parity but simply returns immediately (there is no global run loop to
         drain here).
     :param timeout: overall budget; on expiry return whatever finished so far.
-    :param count: stop once this many have finished (``None`` == all).
+    :param count: stop once this many have finished (``None`` == all);
+        ``0`` returns ``[]`` at once.
 
-    Returns the list of objects that completed.
+    Returns the list of objects that completed, in completion order.
     """
     if objects is None:
         return []
@@ -286,33 +385,48 @@ def wait(objects=None, timeout=None, count=None):
 
 def iwait(objects, timeout=None, count=None):
     """
-    Iterator form of :func:`wait`: yield each waitable as it completes.
-
-    Simplicity/correctness note: filament's C waitables don't expose a
-    select-style "wait on any", so we wait on them in turn.  Because every
-    waitable is driven by the same cooperative scheduler, waiting on one still
-    lets the others make progress, and a completed one returns immediately --
-    so the practical behaviour (all of them get waited on within ``timeout``)
-    is correct even though we don't yield in strict completion order.
+    Iterator form of :func:`wait`: yield each waitable as it completes, in
+    completion order.
+
+    Filaments, ``Message``s, ``Event``s and ``AsyncResult``s are watched
+    natively (see :func:`joinall`); other waitables cost a relay greenthread
+    each.
+    ``timeout`` is one deadline for the whole iteration, including the time
+    the consumer spends between items.  ``count=0`` yields nothing and does
+    not wait (it used to wait for, and yield, the first object).
+    """
+    objects = list(objects)
+    left = len(objects) if count is None else min(count, len(objects))
+    ws, relays = _waitset(objects, timeout)
+    try:
+        while left > 0:
+            ready = ws.wait()
+            if not ready:
+                return              # deadline
+            for i in ready[:left]:
+                yield objects[i]
+            left -= len(ready)
+    finally:
+        _waitset_done(ws, relays)
+
+
+def wait_any(objects, timeout=None):
     """
-    from filament.timeout import Timeout
+    Wait until any of ``objects`` completes; return it, or ``None`` if
+    ``timeout`` expires first.  Accepts what :func:`iwait` does.
+    """
+    for obj in iwait(objects, timeout=timeout, count=1):
+        return obj
+    return None
+
 
+def wait_all(objects, timeout=None):
+    """
+    Wait until all of ``objects`` complete, or ``timeout`` expires.  Returns
+    True if they all did.  Results and exceptions stay on the objects.
+    """
     objects = list(objects)
-    yielded = 0
-    with Timeout(timeout, False):
-        for obj in objects:
-            waiter = getattr(obj, "wait", None)
-            if waiter is not None:
-                try:
-                    waiter()
-                except Exception:
-                    # Completion is what we report; the value/exception is the
-                    # caller's to fetch from the object itself.
-                    pass
-            yield obj
-            yielded += 1
-            if count is not None and yielded >= count:
-                return
+    return len(wait(objects, timeout=timeout)) == len(objects)
 
 
 def with_timeout(seconds, function, *args, **kwargs):
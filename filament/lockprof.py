@@ -0,0 +1,122 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+filament.lockprof
+=================
+
+Contention profile for the cooperative locks and queues.
+
+Turn it on before the primitives you care about are created -- with
+``FIL_LOCK_PROFILE=1`` in the environment, or ``enable()`` -- then read it
+back::
+
+    from filament import lockprof
+
+    lockprof.enable()
+    run_the_workload()
+    lockprof.report()                    # table, most wait time first
+    lockprof.dump_json("locks.json")     # or a JSON snapshot
+
+Each ``Lock``, ``RLock``, ``Semaphore``, ``Condition``, ``RWLock``, ``Queue``
+and ``SimpleQueue`` created while profiling is on is tagged with its kind
+and creation site (``file:line in func``, the first frame outside filament
+and the ``threading``/``queue`` modules).  It counts acquisitions (a queue's
+gets and puts), contended acquisitions (ones that had to wait), the total and
+longest wait, and the most waiters parked at once.  Primitives created with
+profiling off cost one NULL test per operation and are not listed.
+
+A ``Condition.wait()`` always parks, so every wait is contended; the ones a
+``notify()`` ended are its acquisitions.  Dead primitives are folded into
+one row per (kind, site), with ``instances`` saying how many.
+"""
+
+import json
+import sys
+
+import _filament.core as _core
+
+__all__ = ["enable", "disable", "enabled", "snapshot", "reset", "report",
+           "dump_json"]
+
+# (header, key, width, conversion); "kind" is left-aligned.
+_COLUMNS = (
+    ("kind", "kind", -11, "s"),
+    ("n", "instances", 6, "d"),
+    ("acquired", "acquisitions", 10, "d"),
+    ("contended", "contended", 10, "d"),
+    ("wait total", "wait_total", 11, ".6f"),
+    ("wait max", "wait_max", 10, ".6f"),
+    ("depth", "max_depth", 6, "d"),
+)
+
+SORT_KEYS = ("wait_total", "wait_max", "contended", "acquisitions",
+             "max_depth", "instances")
+
+
+def enable():
+    """Profile primitives created from now on."""
+    _core.lock_profile_mode("on")
+
+
+def disable():
+    """Stop profiling new primitives; already profiled ones keep counting."""
+    _core.lock_profile_mode("off")
+
+
+def enabled():
+    return _core.lock_profile_mode() == "on"
+
+
+def snapshot(reset=False):
+    """One dict per profiled primitive (per (kind, site) for dead ones).
+
+    Keys: ``kind``, ``site``, ``live``, ``instances``, ``acquisitions``,
+    ``contended``, ``wait_total`` and ``wait_max`` (seconds), ``max_depth``.
+    ``reset=True`` clears the counters after reading them.
+    """
+    return _core.lock_profile(reset=reset)
+
+
+def reset():
+    """Zero every counter and forget dead primitives."""
+    _core.lock_profile(reset=True)
+
+
+def _sorted(entries, sort_by):
+    if sort_by not in SORT_KEYS:
+        raise ValueError("sort_by must be one of %s, not %r"
+                         % (", ".join(SORT_KEYS), sort_by))
+    return sorted(entries, key=lambda e: e[sort_by], reverse=True)
+
+
+def report(sort_by="wait_total", limit=None, file=None, entries=None):
+    """Print the profile as a table, largest ``sort_by`` first.
+
+    ``limit`` caps the rows; ``entries`` prints a saved ``snapshot()``
+    instead of a fresh one.
+    """
+    if file is None:
+        file = sys.stdout
+    if entries is None:
+        entries = snapshot()
+    entries = _sorted(entries, sort_by)
+    if limit is not None:
+        entries = entries[:limit]
+    header = " ".join("%*s" % (width, title) for title, _, width, _ in _COLUMNS)
+    file.write(header + "  site\n")
+    for e in entries:
+        row = " ".join(("%*" + conv) % (width, e[key])
+                       for _, key, width, conv in _COLUMNS)
+        site = e["site"] if e["site"] is not None else "?"
+        if not e["live"]:
+            site += " (dead)"
+        file.write("%s  %s\n" % (row, site))
+
+
+def dump_json(path_or_file, sort_by="wait_total", reset=False):
+    """Write a ``snapshot()`` as JSON, sorted like ``report()``."""
+    entries = _sorted(snapshot(reset=reset), sort_by)
+    if hasattr(path_or_file, "write"):
+        json.dump(entries, path_or_file, indent=1)
+        return
+    with open(path_or_file, "w") as f:
+        json.dump(entries, f, indent=1)
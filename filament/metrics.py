@@ -0,0 +1,334 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+filament.metrics
+================
+
+Runtime counters for the whole process: what every scheduler, the io thread
+and the thread pools have been doing, ready to log or scrape::
+
+    from filament import metrics
+
+    metrics.enable()                     # also keep scheduler timings
+    run_the_workload()
+    snap = metrics.snapshot()
+    print(snap["totals"]["switches_per_sec"],
+          snap["totals"]["ready_latency"]["p99"])
+    open("filament.prom", "w").write(metrics.prometheus_text())
+
+The counters are always kept; each is an increment on a path that was taken
+anyway.  The two scheduler histograms -- ready-to-run latency, from an event
+being queued to run to its callback starting, and how long a scheduler sleeps
+when it has nothing to do -- read the clock per event, so they are only kept
+while timings are on: ``enable()``, or ``FIL_METRICS=1`` in the environment.
+
+Ready latency covers events queued to run now (wakeups, yields, spawns);
+a timer's wait for its deadline is not counted.  Rates (``*_per_sec``) are
+over the time since the previous ``snapshot()`` (or since this module was
+imported).
+"""
+
+from __future__ import absolute_import
+
+import threading
+import time
+
+import _filament.core as _core
+import _filament.io as _io
+import _filament.thrpool as _thrpool
+
+__all__ = ["enable", "disable", "enabled", "snapshot", "prometheus_text",
+           "percentile"]
+
+_clock = getattr(time, "monotonic", time.time)
+
+_COUNTERS = ("switches", "passes", "events", "timers_armed",
+             "timers_cancelled", "timers_fired", "freelist_hits",
+             "freelist_misses", "wakeups_local", "wakeups_remote",
+             "preemptions", "filaments_recycled")
+
+_HISTOGRAMS = ("ready_latency", "sleep")
+
+_PERCENTILES = (50, 90, 99, 99.9)
+
+# Prometheus histogram bounds, 2**10ns (~1us) to 2**36ns (~69s).
+_LE_EXPONENTS = range(10, 37)
+
+_lock = threading.Lock()
+
+
+def enable():
+    """Keep scheduler timings (the latency and sleep histograms)."""
+    _core.metrics_mode("on")
+
+
+def disable():
+    """Stop keeping timings; what was recorded stays in the histograms."""
+    _core.metrics_mode("off")
+
+
+def enabled():
+    return _core.metrics_mode() == "on"
+
+
+def _bucket_top(floor):
+    # The first value past a bucket, given its floor (see core/fil_histogram.h:
+    # 8 sub-buckets per power of two, one per value below 8).
+    if floor < 8:
+        return floor + 1
+    return floor + (1 << (floor.bit_length() - 4))
+
+
+def percentile(hist, q):
+    """The ``q``th percentile (0-100) of a raw histogram dict, in seconds.
+
+    Accurate to the bucket, 12.5%, and never over the recorded maximum; None
+    when nothing was recorded.
+    """
+    count = hist["count"]
+    if not count:
+        return None
+    want = count * q / 100.0
+    seen = 0
+    for floor, n in hist["buckets"]:
+        seen += n
+        if seen >= want:
+            return min(_bucket_top(floor) - 1, hist["max"]) / 1e9
+    return hist["max"] / 1e9
+
+
+def _summary(hist):
+    out = {"count": hist["count"],
+           "sum": hist["sum"] / 1e9,
+           "max": hist["max"] / 1e9 if hist["count"] else None,
+           "mean": (hist["sum"] / 1e9 / hist["count"]) if hist["count"]
+           else None}
+    for q in _PERCENTILES:
+        out["p%s" % (("%g" % q).replace(".", "_"),)] = percentile(hist, q)
+    return out
+
+
+def _merge(hists):
+    merged = {"count": 0, "sum": 0, "max": 0}
+    buckets = {}
+    for hist in hists:
+        merged["count"] += hist["count"]
+        merged["sum"] += hist["sum"]
+        merged["max"] = max(merged["max"], hist["max"])
+        for floor, n in hist["buckets"]:
+            buckets[floor] = buckets.get(floor, 0) + n
+    merged["buckets"] = sorted(buckets.items())
+    return merged
+
+
+def _raw():
+    return {"schedulers": _core.scheduler_stats(),
+            "io": _io.iothread_stats(),
+            "pools": _thrpool.pool_stats()}
+
+
+def _totals(schedulers):
+    totals = dict((name, sum(s[name] for s in schedulers))
+                  for name in _COUNTERS + ("immediate", "timers"))
+    for name in _HISTOGRAMS:
+        totals[name] = _merge([s[name] for s in schedulers])
+    return totals
+
+
+def _last_counts(raw):
+    totals = _totals(raw["schedulers"])
+    return {"switches": totals["switches"], "events": totals["events"],
+            "io_events": raw["io"]["events"]}
+
+
+_last = [_clock(), None]
+
+
+def _rate(now_count, then_count, elapsed):
+    if then_count is None or elapsed <= 0:
+        return None
+    return (now_count - then_count) / elapsed
+
+
+def snapshot(raw_histograms=False):
+    """Every counter in the process, as a dict:
+
+    ``schedulers``
+        one dict per scheduler (``thread_id`` None for the ones that have
+        gone, totalled): the ``Scheduler.stats()`` counters and queue depths,
+        and the histograms summarized as count/sum/max/mean/p50/p90/p99/
+        p99_9, in seconds.
+    ``totals``
+        the same summed over all of them, plus ``switches_per_sec`` and
+        ``events_per_sec``.
+    ``io``
+        the io thread's ``events`` (and ``events_per_sec``), and its waits:
+        ``cached_waits`` on a cached fd waiter vs ``classic_waits`` on a
+        one-shot event, ``cached_fallbacks`` (a cached wait that had to go
+        the classic way) and ``cached_retries``.
+    ``pools``
+        one ``ThreadPool.stats()`` dict per live thread pool, with ``id``.
+
+    ``raw_histograms=True`` leaves the histograms as the raw bucket dicts.
+    """
+    raw = _raw()
+    now = _clock()
+    counts = _last_counts(raw)
+    with _lock:
+        then, last = _last
+        _last[:] = [now, counts]
+    elapsed = now - then
+    last = last or {}
+
+    def cook(sched):
+        out = dict(sched)
+        if not raw_histograms:
+            for name in _HISTOGRAMS:
+                out[name] = _summary(sched[name])
+        return out
+
+    totals = _totals(raw["schedulers"])
+    totals["switches_per_sec"] = _rate(totals["switches"],
+                                       last.get("switches"), elapsed)
+    totals["events_per_sec"] = _rate(totals["events"],
+                                     last.get("events"), elapsed)
+    io = dict(raw["io"])
+    io["events_per_sec"] = _rate(io["events"], last.get("io_events"), elapsed)
+    pools = []
+    for pool, stats in raw["pools"]:
+        stats = dict(stats)
+        stats["id"] = id(pool)
+        pools.append(stats)
+    return {"time": now,
+            "timings": enabled(),
+            "schedulers": [cook(s) for s in raw["schedulers"]],
+            "totals": cook(totals),
+            "io": io,
+            "pools": pools}
+
+
+# -- Prometheus text exposition ----------------------------------------------
+
+_SCHED_HELP = {
+    "switches": "Greenthreads switched into.",
+    "passes": "Scheduler loop passes that ran something.",
+    "events": "Scheduler callbacks run.",
+    "timers_armed": "Timed events queued.",
+    "timers_cancelled": "Timed events cancelled before their deadline.",
+    "timers_fired": "Timed events whose deadline came.",
+    "freelist_hits": "Events allocated from the scheduler's freelist.",
+    "freelist_misses": "Events that had to be malloc'd.",
+    "wakeups_local": "Wakeups queued from the scheduler's own thread.",
+    "wakeups_remote": "Wakeups queued from another thread.",
+    "preemptions": "Greenthreads switched out at the end of a time slice.",
+    "filaments_recycled": "Greenthreads allocated from a freed one.",
+}
+
+_IO_HELP = {
+    "events": "Io callbacks run by the io thread.",
+    "classic_waits": "Fd waits that armed a one-shot event.",
+    "cached_waits": "Fd waits parked on a cached fd waiter.",
+    "cached_retries": "Cached fd waits retried because an edge came first.",
+    "cached_fallbacks": "Cached fd waits sent back to the classic path.",
+}
+
+_POOL_GAUGES = {
+    "threads": "Worker threads.",
+    "busy": "Workers running a callback.",
+    "queued": "Callbacks waiting for a worker.",
+}
+
+_POOL_COUNTERS = {
+    "submitted": "Callbacks submitted.",
+    "completed": "Callbacks completed.",
+}
+
+
+def _labels(**labels):
+    if not labels:
+        return ""
+    return "{%s}" % ",".join('%s="%s"' % (k, v)
+                             for k, v in sorted(labels.items()))
+
+
+def _family(lines, name, kind, help_text):
+    lines.append("# HELP %s %s" % (name, help_text))
+    lines.append("# TYPE %s %s" % (name, kind))
+
+
+def _le(seconds):
+    return "%.9g" % seconds
+
+
+def _histogram_lines(lines, name, hist, labels):
+    le_ns = [1 << e for e in _LE_EXPONENTS]
+    cumulative = 0
+    buckets = hist["buckets"]
+    i = 0
+    for bound in le_ns:
+        while i < len(buckets) and buckets[i][0] < bound:
+            cumulative += buckets[i][1]
+            i += 1
+        lines.append("%s_bucket%s %d" % (
+            name, _labels(le=_le(bound / 1e9), **labels), cumulative))
+    lines.append("%s_bucket%s %d" % (name, _labels(le="+Inf", **labels),
+                                     hist["count"]))
+    lines.append("%s_sum%s %.9g" % (name, _labels(**labels),
+                                    hist["sum"] / 1e9))
+    lines.append("%s_count%s %d" % (name, _labels(**labels), hist["count"]))
+
+
+def prometheus_text(snap=None):
+    """The counters in the Prometheus text exposition format (0.0.4).
+
+    Scheduler metrics carry a ``thread`` label (the scheduler thread's
+    ident, or ``retired`` for the schedulers that have gone), pool metrics
+    a ``pool`` label.  ``snap`` is a ``snapshot(raw_histograms=True)``;
+    by default one is taken.
+    """
+    if snap is None:
+        snap = snapshot(raw_histograms=True)
+    lines = []
+    scheds = [(s, {"thread": "retired" if s["thread_id"] is None
+                   else s["thread_id"]})
+              for s in snap["schedulers"]]
+
+    for name in _COUNTERS:
+        metric = "filament_scheduler_%s_total" % name
+        _family(lines, metric, "counter", _SCHED_HELP[name])
+        for s, labels in scheds:
+            lines.append("%s%s %d" % (metric, _labels(**labels), s[name]))
+    for name, help_text in (("immediate", "Events queued to run now."),
+                            ("timers", "Timed events queued.")):
+        metric = "filament_scheduler_queued_%s" % name
+        _family(lines, metric, "gauge", help_text)
+        for s, labels in scheds:
+            if s["thread_id"] is not None:
+                lines.append("%s%s %d" % (metric, _labels(**labels), s[name]))
+    for name, help_text in (
+            ("ready_latency", "Time from an event being queued to run to "
+                              "its callback starting."),
+            ("sleep", "Time a scheduler slept with nothing to run.")):
+        metric = "filament_scheduler_%s_seconds" % name
+        _family(lines, metric, "histogram", help_text)
+        for s, labels in scheds:
+            if isinstance(s[name], dict) and "buckets" in s[name]:
+                _histogram_lines(lines, metric, s[name], labels)
+
+    for name in sorted(_IO_HELP):
+        metric = "filament_io_%s_total" % name
+        _family(lines, metric, "counter", _IO_HELP[name])
+        lines.append("%s %d" % (metric, snap["io"][name]))
+
+    for name in sorted(_POOL_GAUGES):
+        metric = "filament_thrpool_%s" % name
+        _family(lines, metric, "gauge", _POOL_GAUGES[name])
+        for pool in snap["pools"]:
+            lines.append("%s%s %d" % (metric, _labels(pool="%x" % pool["id"]),
+                                      pool[name]))
+    for name in sorted(_POOL_COUNTERS):
+        metric = "filament_thrpool_%s_total" % name
+        _family(lines, metric, "counter", _POOL_COUNTERS[name])
+        for pool in snap["pools"]:
+            lines.append("%s%s %d" % (metric, _labels(pool="%x" % pool["id"]),
+                                      pool[name]))
+    return "\n".join(lines) + "\n"
@@ -18,14 +18,19 @@ scheduler -- when the pool is full) and the greenthread releases it when it
 finishes.  We keep our own ``_running``/``_waiting`` counters so free_count(),
 running() and waiting() are O(1) and don't depend on introspecting the C
 semaphore's internals.
+
+The map family (``map``/``imap``/``imap_unordered``/``starmap``) and
+:class:`GreenPile` run on the C ``_filament.core.Fanout`` engine: at most
+``size`` worker greenthreads, reused across items, pulling the input lazily
+and handing results back through a C ring in input or completion order.  The
+workers are spawned through the group (see :meth:`Group._spawn_worker`), so
+they are tracked members that hold pool slots like any other greenthread.
 """
 
 from __future__ import absolute_import
 
-import sys
-
 from _filament.locking import Semaphore
-from _filament.core import Message
+from _filament.core import Fanout
 
 from filament import greenthread
 
@@ -129,6 +134,24 @@ class Group(object):
 
     # -- map family ----------------------------------------------------------
 
+    def _spawn_worker(self, fn, must):
+        """
+        Spawn hook for :class:`Fanout` workers.  Returning None declines,
+        which the engine only allows when ``must`` is false -- i.e. when it
+        already has a worker and is merely asking for more concurrency.
+        """
+        return self._spawn_tracked(fn, (), {})
+
+    def _fanout(self, func, iterable, ordered, star):
+        size = getattr(self, "size", None)
+        return Fanout(func, iterable, concurrency=size, ordered=ordered,
+                      star=star, window=size, spawn=self._spawn_worker)
+
+    def _fanout_map(self, func, iterables, ordered):
+        if len(iterables) == 1:
+            return self._fanout(func, iterables[0], ordered, False)
+        return self._fanout(func, zip(*iterables), ordered, True)
+
     def map(self, func, iterable):
         """
         Apply ``func`` to each item concurrently; return results as a list in
@@ -141,40 +164,22 @@ class Group(object):
         Lazy, ordered concurrent map.  Yields ``func(*items)`` results in input
         order (a slow early item holds back later, already-finished ones --
         that's what "ordered" means).
+
+        Work starts immediately.  On a :class:`Pool` at most ``size`` items are
+        in flight or finished-but-unconsumed at once; the input is only pulled
+        as that allows.
         """
-        greenlets = []
-        for items in zip(*iterables):
-            gt = self.spawn(func, *items)
-            greenlets.append(gt)
-        for gt in greenlets:
-            yield gt.wait()
+        return self._fanout_map(func, iterables, True)
 
     def imap_unordered(self, func, *iterables):
         """
         Lazy concurrent map yielding results as they COMPLETE (any order).
-
-        We route each result through a shared queue so a finished greenthread
-        can be yielded immediately without waiting on earlier-but-slower ones.
         """
-        pending = []
-        for items in zip(*iterables):
-            msg = Message()
-
-            def runner(func=func, items=items, msg=msg):
-                try:
-                    msg.send(func(*items))
-                except BaseException:
-                    et, ev, tb = sys.exc_info()
-                    msg.send_exception(et, ev, tb)
-
-            self.spawn(runner)
-            pending.append(msg)
-        # NOTE: this yields in spawn order at worst; for true completion order
-        # we'd need a shared ready-queue.  We keep it simple and correct: each
-        # wait() returns as soon as *that* item is done, and because everything
-        # shares one scheduler, no item is starved.
-        for msg in pending:
-            yield msg.wait()
+        return self._fanout_map(func, iterables, False)
+
+    def starmap(self, function, iterable):
+        """Like map, but each item is an argument *tuple* for ``function``."""
+        return list(self._fanout(function, iterable, True, True))
 
 
 class Pool(Group):
@@ -244,6 +249,13 @@ class Pool(Group):
             self._waiting -= 1
         self._running += 1
 
+    def _spawn_worker(self, fn, must):
+        # Extra workers only take free slots: one blocked waiting for a slot
+        # would sit on the item it already took.
+        if must or self._sem is None or self.free_count() > 0:
+            return self.spawn(fn)
+        return None
+
     def _run_and_release(self, fn, args, kwargs):
         # The body runs in the spawned greenthread; the finally releases the
         # slot no matter how the body exits (return, exception, or kill), waking
@@ -291,10 +303,6 @@ class Pool(Group):
         """eventlet alias for join()."""
         return self.join(timeout=timeout)
 
-    def starmap(self, function, iterable):
-        """Like map, but each item is an argument *tuple* for ``function``."""
-        return list(self.imap(lambda args: function(*args), iterable))
-
 
 class GreenPool(Pool):
     """
@@ -310,11 +318,12 @@ class GreenPile(object):
     """
     Feed work with :meth:`spawn`, then iterate to collect results IN ORDER.
 
-    Ordering guarantee: each ``spawn`` appends a one-shot ``Message`` to an
-    internal FIFO; iteration pops them in spawn order and waits on each in turn.
-    So even if later items finish first, results come back in the order they
-    were submitted.  ``Message.wait`` re-raises a failed item's exception (with
-    traceback) at the point you iterate to it.
+    Ordering guarantee: the pile is an ordered :class:`Fanout` fed through
+    ``put``; iteration hands results back in the order they were submitted,
+    even if later items finish first, and stops once everything submitted so
+    far has been consumed.  A failed item's exception (with traceback) is
+    raised at the point you iterate to it.  ``spawn`` blocks while the pool
+    has no slot for the item, like ``Pool.spawn``.
     """
 
     def __init__(self, size_or_pool=1000):
@@ -325,34 +334,19 @@ class GreenPile(object):
             self.pool = GreenPool()
         else:
             self.pool = GreenPool(size_or_pool)
-        # FIFO of pending result futures, in spawn order.
-        self._pending = []
+        self._fanout = Fanout(None, concurrency=getattr(self.pool, "size", None),
+                              spawn=self.pool._spawn_worker)
 
     def spawn(self, fn, *args, **kwargs):
         """Submit ``fn(*args, **kwargs)`` to the pile."""
-        msg = Message()
-        self._pending.append(msg)
-
-        def runner(fn=fn, args=args, kwargs=kwargs, msg=msg):
-            try:
-                msg.send(fn(*args, **kwargs))
-            except BaseException:
-                et, ev, tb = sys.exc_info()
-                msg.send_exception(et, ev, tb)
-
-        self.pool.spawn(runner)
+        self._fanout.put((fn, args, kwargs))
         return self
 
     def __iter__(self):
         return self
 
     def __next__(self):
-        # Pop the next-submitted future and block for it.  StopIteration when
-        # everything submitted so far has been consumed.
-        if not self._pending:
-            raise StopIteration
-        msg = self._pending.pop(0)
-        return msg.wait()
+        return next(self._fanout)
 
     # Python 2 iterator protocol.
     next = __next__
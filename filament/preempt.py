@@ -0,0 +1,121 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+filament.preempt
+================
+
+Time-slice preemption.  Greenthreads are cooperative: one that runs Python
+code without blocking on anything holds its scheduler until it is done, and
+every other greenthread there waits.  With preemption on, a greenthread that
+has run for its time slice is switched out at its next function call, as if
+it had called ``sleep(0)``, and runs again once the others have had a turn::
+
+    from filament import preempt
+
+    preempt.enable(0.01)                 # 10ms slices
+    filament.spawn(crunch_numbers)       # no longer starves the rest
+
+``FIL_PREEMPT=<milliseconds>`` in the environment turns it on at import
+instead.
+
+It is off by default because it costs something and changes something:
+
+* Each scheduler thread gets a C profile function, which the interpreter
+  calls on every Python function call.  It only tests a flag, but profiling
+  alone makes call-heavy code a few times slower.  A thread that already has
+  a profiler (``cProfile``, a debugger) when preemption is turned on is left
+  alone, and a profiler started later takes the thread over.
+* Greenthreads are only switched out at Python function calls and returns
+  from C calls.  A loop that calls nothing, or one long C call, still runs to
+  the end.
+* Code that counted on not being switched out between two blocking calls can
+  now be.  A greenthread holding a filament ``Lock``, ``RLock`` or
+  ``RWLock`` (or a ``Condition`` over one) is not preempted, nor is one
+  inside :func:`disabled`.  A ``Semaphore`` has no owner, so holding one
+  does not count; wrap anything else that has to run in one go in
+  ``with preempt.disabled():``.
+
+Slices are measured from the greenthread being switched in, and checked a
+quarter-slice apart (at least 1ms), so a greenthread overruns by up to a
+quarter of the default slice.  :func:`set_slice` gives one greenthread a
+slice of its own, or exempts it.
+"""
+
+from __future__ import absolute_import
+
+import atexit
+import contextlib
+
+import _filament.core as _core
+from _filament.core import Filament
+from filament.greenthread import getcurrent
+
+__all__ = ["enable", "disable", "enabled", "time_slice", "set_slice",
+           "get_slice", "disabled"]
+
+_registered_atexit = []
+
+
+def enable(time_slice=0.01):
+    """Preempt greenthreads that run ``time_slice`` seconds or more.
+
+    Calling it again changes the slice.  Each scheduler thread starts on
+    its next pass.
+    """
+    _core.preempt_start(time_slice)
+    if not _registered_atexit:
+        atexit.register(disable)
+        _registered_atexit.append(True)
+
+
+def disable():
+    """Stop preempting; each scheduler removes its hook on its next pass."""
+    _core.preempt_stop()
+
+
+def enabled():
+    return _core.preempt_slice() is not None
+
+
+def time_slice():
+    """The default slice in seconds, or None while preemption is off."""
+    return _core.preempt_slice()
+
+
+def _greenthread(gt, name):
+    if gt is None:
+        gt = getcurrent()
+    if not isinstance(gt, Filament):
+        raise TypeError("%s() needs a greenthread, not %r" % (name, gt))
+    return gt
+
+
+def set_slice(seconds, gt=None):
+    """Give ``gt`` (by default the current greenthread) its own slice.
+
+    ``None`` goes back to the default; ``0`` means never preempt it.
+    """
+    _greenthread(gt, "set_slice").time_slice = seconds
+
+
+def get_slice(gt=None):
+    """``gt``'s own slice: None for the default, 0.0 for never."""
+    return _greenthread(gt, "get_slice").time_slice
+
+
+@contextlib.contextmanager
+def disabled():
+    """Don't preempt the current greenthread inside the block.  Nests."""
+    _core.preempt_disable()
+    try:
+        yield
+    finally:
+        _core.preempt_enable()
+
+
+def _start_from_env(value):
+    try:
+        ms = float(value)
+    except ValueError:
+        raise ValueError("FIL_PREEMPT must be a time slice in "
+                         "milliseconds, not %r" % (value,))
+    enable(ms / 1000.0)
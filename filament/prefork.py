@@ -0,0 +1,224 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+filament.prefork
+================
+
+One filament process per core, all accepting on one listening socket --
+the way to use more than one core on a GIL build::
+
+    from filament import prefork
+    from filament.gevent_compat.server import StreamServer
+
+    server = StreamServer(("0.0.0.0", 8000), handle, spawn=1000)
+    prefork.serve(server, processes=4)
+
+The server's listening socket is bound before the first fork, so every worker
+inherits the same one and there is no startup race: a connection that
+arrives before any worker is up waits in the listen backlog.  The calling
+process becomes a supervisor and never accepts itself.  It reacts to:
+
+  * ``SIGHUP`` -- graceful reload: a new generation of workers is forked
+    first, then the old ones are told to stop.  A stopping worker closes its
+    copy of the listener, gives in-flight handlers up to ``grace`` seconds
+    (``server.stop(timeout=grace)``; that only drains handlers in a pool, so
+    pass an int ``spawn``) and exits.
+  * ``SIGTERM`` / ``SIGINT`` -- the same graceful stop for every worker,
+    then ``serve()`` closes the listener and returns.  Workers still running
+    ``grace`` seconds after their in-flight deadline are killed.
+
+A worker that exits on its own is replaced.  ``setup``, if given, runs in
+each worker right after the fork, before it starts serving (per-process
+connections, seeding, re-reading config on a reload).
+
+Forking is safe once filament is in use -- the io thread, thread pools and
+fiber stack pool reset themselves in the child -- but only the forking
+thread survives it, and every greenthread of that thread is copied into each
+worker.  Call ``serve()`` from a process that is not running anything else.
+"""
+
+from __future__ import absolute_import
+
+import errno
+import multiprocessing
+import os
+import signal
+import sys
+import time
+import traceback
+
+import filament
+
+__all__ = ["serve"]
+
+# How often the supervisor and workers look at their signal flags and
+# children; a signal handler only runs between bytecodes, so this bounds how
+# long one takes to act on.
+_POLL = 0.05
+
+# A worker that dies sooner than this after its fork is assumed to be
+# crash-looping, and its replacement is held back this long.
+_RESPAWN_BACKOFF = 1.0
+
+_SIGNALS = (signal.SIGHUP, signal.SIGTERM, signal.SIGINT)
+
+
+def serve(server, processes=None, grace=10.0, setup=None):
+    """
+    Run ``server`` in ``processes`` forked workers (default: one per CPU)
+    until the supervisor is sent ``SIGTERM`` or ``SIGINT``.
+
+    ``server`` is a ``StreamServer`` (or ``WSGIServer``) that has been
+    created -- so its socket is bound and listening -- but not started.
+    """
+    # The io thread, thread pools and scheduler reset themselves in the
+    # child from os.register_at_fork() hooks, which 2.7 does not have.
+    if not hasattr(os, "register_at_fork"):
+        raise RuntimeError("prefork.serve() needs os.fork() and "
+                           "os.register_at_fork() (Python 3.7+)")
+    if getattr(server, "started", False):
+        raise ValueError("prefork.serve() needs a server that has not been "
+                         "started yet")
+    if processes is None:
+        processes = multiprocessing.cpu_count()
+    if processes < 1:
+        raise ValueError("processes must be >= 1")
+    _Supervisor(server, processes, grace, setup).run()
+
+
+class _Supervisor(object):
+
+    def __init__(self, server, processes, grace, setup):
+        self.server = server
+        self.processes = processes
+        self.grace = grace
+        self.setup = setup
+        self.generation = 0
+        # pid -> (generation, fork time)
+        self.workers = {}
+        self.signals = []
+        self.respawn_at = 0.0
+
+    def _on_signal(self, signum, frame):
+        self.signals.append(signum)
+
+    def run(self):
+        saved = dict((s, signal.signal(s, self._on_signal))
+                     for s in _SIGNALS)
+        try:
+            self._fork_generation()
+            while True:
+                while self.signals:
+                    if self.signals.pop(0) == signal.SIGHUP:
+                        self._reload()
+                    else:
+                        self._stop()
+                        return
+                self._reap()
+                self._respawn()
+                filament.sleep(_POLL)
+        finally:
+            for signum, handler in saved.items():
+                signal.signal(signum, handler)
+            self.server.stop()
+
+    # -- workers ---------------------------------------------------------
+
+    def _fork_generation(self):
+        for _ in range(self.processes):
+            self._fork_worker()
+
+    def _fork_worker(self):
+        # Flush first, or whatever sits in our buffers is written once more
+        # by every worker that exits.
+        sys.stdout.flush()
+        sys.stderr.flush()
+        # Held off until the worker has its own handlers: one that landed
+        # in between would run ours and be lost.
+        mask = signal.pthread_sigmask(signal.SIG_BLOCK, _SIGNALS)
+        pid = os.fork()
+        if pid == 0:
+            _worker_main(self.server, self.grace, self.setup, os.getppid(),
+                         mask)
+        signal.pthread_sigmask(signal.SIG_SETMASK, mask)
+        self.workers[pid] = (self.generation, time.time())
+
+    def _current(self):
+        return [pid for pid, (gen, _) in self.workers.items()
+                if gen == self.generation]
+
+    def _reap(self):
+        for pid in list(self.workers):
+            try:
+                done, _ = os.waitpid(pid, os.WNOHANG)
+            except OSError as exc:
+                if exc.errno != errno.ECHILD:
+                    raise
+                done = pid
+            if done:
+                gen, forked = self.workers.pop(pid)
+                if (gen == self.generation and
+                        time.time() - forked < _RESPAWN_BACKOFF):
+                    self.respawn_at = time.time() + _RESPAWN_BACKOFF
+
+    def _respawn(self):
+        if time.time() < self.respawn_at:
+            return
+        for _ in range(self.processes - len(self._current())):
+            self._fork_worker()
+
+    def _signal_workers(self, pids, signum):
+        for pid in pids:
+            try:
+                os.kill(pid, signum)
+            except OSError:
+                pass
+
+    def _reload(self):
+        old = list(self.workers)
+        self.generation += 1
+        self._fork_generation()
+        self._signal_workers(old, signal.SIGTERM)
+
+    def _stop(self):
+        self._signal_workers(list(self.workers), signal.SIGTERM)
+        # Each worker allows its handlers 'grace'; allow it as much again
+        # to get that far before giving up on it.
+        deadline = time.time() + 2 * self.grace + 1.0
+        while self.workers and time.time() < deadline:
+            self._reap()
+            filament.sleep(_POLL)
+        self._signal_workers(list(self.workers), signal.SIGKILL)
+        for pid in list(self.workers):
+            try:
+                os.waitpid(pid, 0)
+            except OSError as exc:
+                if exc.errno != errno.ECHILD:
+                    raise
+            del self.workers[pid]
+
+
+def _worker_main(server, grace, setup, supervisor, mask):
+    # Never returns: a worker must not fall back into the supervisor's code.
+    stopping = []
+    code = 0
+    try:
+        signal.signal(signal.SIGHUP, signal.SIG_IGN)
+        for signum in (signal.SIGTERM, signal.SIGINT):
+            signal.signal(signum, lambda signum, frame: stopping.append(signum))
+        signal.pthread_sigmask(signal.SIG_SETMASK, mask)
+        if setup is not None:
+            setup()
+        server.start()
+        # Also stop if the supervisor went away without telling us.
+        while not stopping and os.getppid() == supervisor:
+            filament.sleep(_POLL)
+        server.stop(timeout=grace)
+    except BaseException:
+        traceback.print_exc()
+        code = 1
+    finally:
+        try:
+            sys.stdout.flush()
+            sys.stderr.flush()
+        finally:
+            os._exit(code)
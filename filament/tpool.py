@@ -36,12 +36,14 @@ from _filament.thrpool import ThreadPool
 
 # Module-level default pool, created lazily on first use.
 _default_pool = None
+# Extra ThreadPool() keywords for the default pool; see configure().
+_pool_options = {}
 
 
 def _get_pool():
     global _default_pool
     if _default_pool is None:
-        _default_pool = ThreadPool()
+        _default_pool = ThreadPool(**_pool_options)
     return _default_pool
 
 
@@ -75,7 +77,33 @@ def set_num_threads(n):
     """
     global _default_pool
     old = _default_pool
-    _default_pool = ThreadPool(min_threads=n, max_threads=n)
+    options = dict(_pool_options, min_threads=n, max_threads=n)
+    _default_pool = ThreadPool(**options)
+    if old is not None:
+        old.shutdown()
+
+
+def configure(**options):
+    """
+    Set ``ThreadPool()`` keywords for the default pool.
+
+    Typically used for worker placement, e.g.
+    ``configure(cpus="numa", placement="compact")`` or
+    ``configure(cpus="8-15", sched_batch=True, nice=10)``.  ``cpus`` is a CPU
+    list string, an iterable of CPU numbers, or ``"numa"`` for the NUMA node
+    of the thread that creates the pool; ``placement`` is ``"shared"``,
+    ``"compact"`` or ``"spread"``.  Options apply to the next pool created; if
+    the default pool already exists it is replaced, as with
+    :func:`set_num_threads`.
+    """
+    global _default_pool, _pool_options
+    new_options = dict(_pool_options)
+    new_options.update(options)
+    old = _default_pool
+    if old is not None:
+        # Build the replacement first so bad options leave the old pool alone.
+        _default_pool = ThreadPool(**new_options)
+    _pool_options = new_options
     if old is not None:
         old.shutdown()
 
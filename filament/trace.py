@@ -0,0 +1,338 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+filament.trace
+==============
+
+What the schedulers did: which greenthread ran and for how long, why it
+parked, who woke it, and when a scheduler sat idle.  Turn it on, run the
+workload, and write the trace out for a viewer::
+
+    from filament import trace
+
+    trace.start()
+    run_the_workload()
+    trace.stop()
+    trace.dump_chrome("sched.json")       # chrome://tracing, ui.perfetto.dev
+    trace.dump_perfetto("sched.pftrace")  # ui.perfetto.dev, trace_processor
+
+``FIL_TRACE=1`` in the environment starts tracing at import instead.
+
+Each scheduler records into its own fixed-size ring (65536 records unless
+the first ``start()`` says otherwise), so a long run keeps its most recent history
+rather than growing without bound.  With tracing off, the instrumented paths
+cost one pointer test each.
+
+In the output every scheduler thread is a track.  Each run of a greenthread
+is a slice named after it (``greenthread 0x...``, the greenlet's id), with
+the reason it parked -- ``lock``, ``queue``, ``fd-read``, ``sleep``,
+``thrpool`` and so on -- as an argument.  ``idle`` slices are the scheduler
+asleep with nothing to run.  A wakeup is a ``wake`` mark on the track of the
+thread that queued it (the io thread and thread-pool workers get tracks of
+their own) with a flow arrow to the run it caused.
+"""
+
+from __future__ import absolute_import
+
+import json
+import os
+import struct
+import threading
+
+import _filament.core as _core
+
+__all__ = ["start", "stop", "enabled", "records", "chrome_events",
+           "dump_chrome", "perfetto_trace", "dump_perfetto"]
+
+# Record types and park reasons, as in core/fil_trace.h.
+RUN, STOP, PARK, WAKE, IDLE, BUSY = 1, 2, 3, 4, 5, 6
+
+_WHY = ("other", "yield", "sleep", "lock", "cond", "event", "queue",
+        "fd-read", "fd-write", "thrpool", "join", "waitset", "preempt")
+
+
+def start(size=None):
+    """Start a new trace.  Records from any earlier trace are dropped.
+
+    ``size`` is the ring size (a power of two) for schedulers traced for
+    the first time; one that already has a ring keeps it."""
+    if size is None:
+        _core.trace_mode("on")
+    else:
+        _core.trace_mode("on", size)
+
+
+def stop():
+    """Stop recording; what was recorded stays readable until ``start()``."""
+    _core.trace_mode("off")
+
+
+def enabled():
+    return _core.trace_mode() == "on"
+
+
+def records():
+    """The raw trace: a list of ``(thread_id, records)``, one per scheduler,
+    each record an ``(ns, type, greenlet_id, arg, writer_thread)`` tuple.
+    ``thread_id`` is the scheduler thread's ident; ``writer_thread`` the low
+    32 bits of the ident of the thread that wrote the record."""
+    return _core.trace_records()
+
+
+def _why(arg):
+    return _WHY[arg] if 0 <= arg < len(_WHY) else "other"
+
+
+def _thread_names():
+    names = {}
+    for t in threading.enumerate():
+        if t.ident is not None:
+            names[t.ident & 0xffffffff] = t.name
+    return names
+
+
+def _walk(traced):
+    """
+    Pair the records up.  Yields, in no particular order:
+
+      ("run", sched_tid, gl, begin_ns, end_ns, why, flow_in)
+      ("idle", sched_tid, begin_ns, end_ns)
+      ("wake", writer_tid, gl, ns, timeout, flow_out)
+
+    where a flow id links a wake to the run it caused.
+    """
+    flow = [0]
+    for thread_id, recs in traced:
+        tid = thread_id & 0xffffffff
+        running = {}
+        parked = {}
+        waking = {}
+        idle_since = None
+        for ns, kind, gl, arg, writer in recs:
+            if kind == RUN:
+                running[gl] = (ns, waking.pop(gl, None))
+            elif kind == STOP:
+                begin = running.pop(gl, None)
+                if begin is not None:
+                    yield ("run", tid, gl, begin[0], ns,
+                           parked.pop(gl, None), begin[1])
+                parked.pop(gl, None)
+            elif kind == PARK:
+                parked[gl] = _why(arg)
+            elif kind == WAKE:
+                flow[0] += 1
+                waking[gl] = flow[0]
+                yield ("wake", writer, gl, ns, bool(arg), flow[0])
+            elif kind == IDLE:
+                idle_since = ns
+            elif kind == BUSY and idle_since is not None:
+                yield ("idle", tid, idle_since, ns)
+                idle_since = None
+
+
+def _gl_name(gl):
+    return "greenthread 0x%x" % gl
+
+
+def chrome_events(traced=None):
+    """The trace as a list of Chrome Trace Event dicts."""
+    if traced is None:
+        traced = records()
+    pid = os.getpid()
+    names = _thread_names()
+    sched_tids = set(thread_id & 0xffffffff for thread_id, _ in traced)
+    base = min([recs[0][0] for _, recs in traced if recs] or [0])
+    events = []
+    seen = set()
+
+    def us(ns):
+        return (ns - base) / 1000.0
+
+    def track(tid):
+        if tid not in seen:
+            seen.add(tid)
+            label = names.get(tid, "thread %d" % tid)
+            if tid in sched_tids:
+                label = "scheduler: " + label
+            events.append({"ph": "M", "pid": pid, "tid": tid,
+                           "name": "thread_name", "args": {"name": label}})
+        return tid
+
+    for item in _walk(traced):
+        if item[0] == "run":
+            _, tid, gl, begin, end, why, flow_in = item
+            args = {"greenthread": "0x%x" % gl}
+            if why is not None:
+                args["parked"] = why
+            events.append({"ph": "X", "pid": pid, "tid": track(tid),
+                           "name": _gl_name(gl), "cat": "run",
+                           "ts": us(begin), "dur": (end - begin) / 1000.0,
+                           "args": args})
+            if flow_in is not None:
+                events.append({"ph": "f", "bp": "e", "pid": pid, "tid": tid,
+                               "name": "wake", "cat": "wake", "id": flow_in,
+                               "ts": us(begin)})
+        elif item[0] == "idle":
+            _, tid, begin, end = item
+            events.append({"ph": "X", "pid": pid, "tid": track(tid),
+                           "name": "idle", "cat": "idle", "ts": us(begin),
+                           "dur": (end - begin) / 1000.0})
+        else:
+            _, tid, gl, ns, timeout, flow_out = item
+            events.append({"ph": "X", "pid": pid, "tid": track(tid),
+                           "name": "wake", "cat": "wake", "ts": us(ns),
+                           "dur": 0,
+                           "args": {"greenthread": "0x%x" % gl,
+                                    "timeout": timeout}})
+            events.append({"ph": "s", "pid": pid, "tid": tid, "name": "wake",
+                           "cat": "wake", "id": flow_out, "ts": us(ns)})
+    return events
+
+
+def _open(path_or_file, mode):
+    if hasattr(path_or_file, "write"):
+        return path_or_file, False
+    return open(path_or_file, mode), True
+
+
+def dump_chrome(path_or_file, traced=None):
+    """Write the trace as Chrome Trace Event JSON."""
+    f, close = _open(path_or_file, "w")
+    try:
+        json.dump({"traceEvents": chrome_events(traced),
+                   "displayTimeUnit": "ns"}, f)
+    finally:
+        if close:
+            f.close()
+
+
+# -- Perfetto protobuf -------------------------------------------------------
+#
+# Just enough of perfetto/trace/trace.proto to write a Trace: TracePacket
+# with a TrackDescriptor per thread and TrackEvents on it.  Field numbers:
+#   Trace.packet = 1
+#   TracePacket: timestamp = 8, trusted_packet_sequence_id = 10,
+#                track_event = 11, timestamp_clock_id = 58,
+#                track_descriptor = 60
+#   TrackDescriptor: uuid = 1, name = 2, thread = 4
+#   ThreadDescriptor: pid = 1, tid = 2, thread_name = 5
+#   TrackEvent: debug_annotations = 4, type = 9, track_uuid = 11,
+#               name = 23, flow_ids = 47, terminating_flow_ids = 48
+#   DebugAnnotation: string_value = 6, name = 10
+
+_SLICE_BEGIN, _SLICE_END, _INSTANT = 1, 2, 3
+_CLOCK_MONOTONIC = 3
+_SEQUENCE_ID = 1
+
+
+def _varint(value):
+    out = bytearray()
+    while True:
+        byte = value & 0x7f
+        value >>= 7
+        if value:
+            out.append(byte | 0x80)
+        else:
+            out.append(byte)
+            return bytes(out)
+
+
+def _key(field, wire):
+    return _varint((field << 3) | wire)
+
+
+def _uint(field, value):
+    return _key(field, 0) + _varint(value)
+
+
+def _bytes(field, data):
+    if not isinstance(data, bytes):
+        data = data.encode("utf-8")
+    return _key(field, 2) + _varint(len(data)) + data
+
+
+def _fixed64(field, value):
+    return _key(field, 1) + struct.pack("<Q", value)
+
+
+def _packet(body, ns=None):
+    if ns is not None:
+        body = _uint(8, ns) + _uint(58, _CLOCK_MONOTONIC) + body
+    return _bytes(1, _uint(10, _SEQUENCE_ID) + body)
+
+
+def _track_event(kind, track, name=None, annotations=(), flow_ids=(),
+                 terminating=()):
+    body = _uint(9, kind) + _uint(11, track)
+    if name is not None:
+        body += _bytes(23, name)
+    for key, value in annotations:
+        body += _bytes(4, _bytes(10, key) + _bytes(6, value))
+    for flow in flow_ids:
+        body += _fixed64(47, flow)
+    for flow in terminating:
+        body += _fixed64(48, flow)
+    return _bytes(11, body)
+
+
+def perfetto_trace(traced=None):
+    """The trace as a serialized Perfetto ``Trace`` protobuf (bytes)."""
+    if traced is None:
+        traced = records()
+    pid = os.getpid()
+    names = _thread_names()
+    sched_tids = set(thread_id & 0xffffffff for thread_id, _ in traced)
+    tracks = {}
+    header = []
+    timed = []
+
+    def track(tid):
+        uuid = tracks.get(tid)
+        if uuid is None:
+            uuid = tracks[tid] = len(tracks) + 1
+            label = names.get(tid, "thread %d" % tid)
+            if tid in sched_tids:
+                label = "scheduler: " + label
+            thread = (_uint(1, pid) + _uint(2, tid & 0x7fffffff) +
+                      _bytes(5, label))
+            header.append(_packet(_bytes(60, _uint(1, uuid) +
+                                         _bytes(2, label) + _bytes(4, thread))))
+        return uuid
+
+    for item in _walk(traced):
+        if item[0] == "run":
+            _, tid, gl, begin, end, why, flow_in = item
+            uuid = track(tid)
+            notes = [("greenthread", "0x%x" % gl)]
+            if why is not None:
+                notes.append(("parked", why))
+            timed.append((begin, 1, _track_event(
+                _SLICE_BEGIN, uuid, _gl_name(gl), notes,
+                terminating=[flow_in] if flow_in is not None else ())))
+            timed.append((end, 0, _track_event(_SLICE_END, uuid)))
+        elif item[0] == "idle":
+            _, tid, begin, end = item
+            uuid = track(tid)
+            timed.append((begin, 1, _track_event(_SLICE_BEGIN, uuid, "idle")))
+            timed.append((end, 0, _track_event(_SLICE_END, uuid)))
+        else:
+            _, tid, gl, ns, timeout, flow_out = item
+            timed.append((ns, 1, _track_event(
+                _INSTANT, track(tid), "wake",
+                [("greenthread", "0x%x" % gl),
+                 ("timeout", "yes" if timeout else "no")],
+                flow_ids=[flow_out])))
+
+    # Ends before begins at the same instant, so back-to-back slices on one
+    # track do not nest.
+    timed.sort(key=lambda t: (t[0], t[1]))
+    return b"".join(header + [_packet(body, ns) for ns, _, body in timed])
+
+
+def dump_perfetto(path_or_file, traced=None):
+    """Write the trace as a Perfetto protobuf (``.pftrace``)."""
+    f, close = _open(path_or_file, "wb")
+    try:
+        f.write(perfetto_trace(traced))
+    finally:
+        if close:
+            f.close()
@@ -0,0 +1,438 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Copyright (c) 2019, Chris Behrens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#ifndef __CORE_FIL_AFFINITY_H__
+#define __CORE_FIL_AFFINITY_H__
+
+/*
+ * CPU placement for the OS threads filament starts on its own: thread pool
+ * workers and the io thread.
+ *
+ * Left to the kernel, those threads land wherever the load balancer happens
+ * to put them.  On a big box that is a lottery: benchmarks/METHODOLOGY.md
+ * measured tpool and the #137 cross-thread ping-pong swinging 1.6x between
+ * runs on a 64-thread machine purely from where the workers landed relative
+ * to the scheduler thread (same core's SMT sibling, same socket, other
+ * socket).  Pinning removes the lottery.  It is strictly opt-in; the default
+ * FilAffinity changes nothing.
+ *
+ * The policy has two halves:
+ *
+ *   - WHICH CPUs: an explicit set, or "the NUMA node the creating thread is
+ *     running on" (optionally intersected with the explicit set).  An empty
+ *     set means the process's current affinity mask.  The set is resolved
+ *     once, on the creating thread, by fil_affinity_resolve() -- pools and
+ *     the io thread are created lazily from the first scheduler thread that
+ *     needs them, so "the creating thread" is the submitting scheduler.
+ *
+ *   - HOW threads are spread over it: SHARED lets every thread float over the
+ *     whole set; COMPACT pins thread N to the Nth CPU of the set (neighbours
+ *     share caches); SPREAD pins thread N round-robin across the set's NUMA
+ *     nodes so memory bandwidth is divided evenly.  On a single-node box
+ *     SPREAD degenerates to COMPACT.
+ *
+ * Plus SCHED_BATCH and/or a nice value, for bulk pools whose work should
+ * yield to latency-sensitive threads rather than compete with them.
+ *
+ * Everything is applied by the thread to itself, at startup, before it runs
+ * anything.  Failures there are ignored: a cpuset cgroup can shrink between
+ * resolve and thread start, and a thread running unpinned is better than a
+ * pool with no threads.  Only Linux has the per-thread calls this needs;
+ * elsewhere resolving a non-default policy fails with ENOSYS.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#define FIL_AFFINITY_PLACEMENT_NONE     0
+#define FIL_AFFINITY_PLACEMENT_SHARED   1
+#define FIL_AFFINITY_PLACEMENT_COMPACT  2
+#define FIL_AFFINITY_PLACEMENT_SPREAD   3
+
+typedef struct _fil_affinity
+{
+    int placement;
+    /* Restrict the set to the creating thread's NUMA node. */
+    int numa_local;
+    /* Run with SCHED_BATCH. */
+    int sched_batch;
+    /* Apply 'nice' (absolute, like nice(1) -n on a fresh process). */
+    int set_nice;
+    int nice;
+#ifdef __linux__
+    cpu_set_t cpus;
+#endif
+} FilAffinity;
+
+static inline void fil_affinity_init(FilAffinity *aff)
+{
+    memset(aff, 0, sizeof(*aff));
+    aff->placement = FIL_AFFINITY_PLACEMENT_NONE;
+}
+
+static inline int fil_affinity_is_default(const FilAffinity *aff)
+{
+    return aff->placement == FIL_AFFINITY_PLACEMENT_NONE && !aff->numa_local &&
+           !aff->sched_batch && !aff->set_nice;
+}
+
+#ifdef __linux__
+
+/*
+ * Parse a kernel-style CPU list ("0-3,8,10-11") into 'set', OR-ing into
+ * whatever is there.  Returns 0, or -1 on a malformed list or a CPU number
+ * that does not fit a cpu_set_t.
+ */
+static inline int fil_affinity_parse_cpulist(const char *s, cpu_set_t *set)
+{
+    while (*s != '\0' && *s != '\n')
+    {
+        char *end;
+        long lo, hi;
+
+        lo = strtol(s, &end, 10);
+        if (end == s || lo < 0)
+        {
+            return -1;
+        }
+        hi = lo;
+        s = end;
+        if (*s == '-')
+        {
+            s++;
+            hi = strtol(s, &end, 10);
+            if (end == s || hi < lo)
+            {
+                return -1;
+            }
+            s = end;
+        }
+        if (hi >= CPU_SETSIZE)
+        {
+            return -1;
+        }
+        for (; lo <= hi; lo++)
+        {
+            CPU_SET((int)lo, set);
+        }
+        if (*s == ',')
+        {
+            s++;
+        }
+        else if (*s != '\0' && *s != '\n')
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* CPUs of NUMA node 'node' per sysfs.  Returns 0, or -1 if unknown. */
+static inline int _fil_affinity_node_cpus(int node, cpu_set_t *set)
+{
+    char path[64];
+    char buf[1024];
+    FILE *fp;
+    int err = -1;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if ((fp = fopen(path, "r")) == NULL)
+    {
+        return -1;
+    }
+    CPU_ZERO(set);
+    if (fgets(buf, sizeof(buf), fp) != NULL)
+    {
+        err = fil_affinity_parse_cpulist(buf, set);
+    }
+    fclose(fp);
+    return err;
+}
+
+/*
+ * Call 'cb' for every NUMA node sysfs knows about, in ascending order, with
+ * that node's CPUs.  Stops early if 'cb' returns non-zero and returns that.
+ * Returns -1 if there is no NUMA information at all (no sysfs, or a kernel
+ * built without CONFIG_NUMA), which callers treat as "one node".
+ */
+static inline int _fil_affinity_foreach_node(int (*cb)(int node, cpu_set_t *cpus, void *arg), void *arg)
+{
+    DIR *dir;
+    struct dirent *de;
+    int max_node = -1, node, ret;
+    cpu_set_t cpus;
+
+    if ((dir = opendir("/sys/devices/system/node")) == NULL)
+    {
+        return -1;
+    }
+    /* readdir order is arbitrary; find the range, then walk it in order. */
+    while ((de = readdir(dir)) != NULL)
+    {
+        char *end;
+        long n;
+
+        if (strncmp(de->d_name, "node", 4) != 0)
+        {
+            continue;
+        }
+        n = strtol(de->d_name + 4, &end, 10);
+        if (end != de->d_name + 4 && *end == '\0' && n > max_node && n < 4096)
+        {
+            max_node = (int)n;
+        }
+    }
+    closedir(dir);
+
+    if (max_node < 0)
+    {
+        return -1;
+    }
+    for (node = 0; node <= max_node; node++)
+    {
+        if (_fil_affinity_node_cpus(node, &cpus) < 0)
+        {
+            /* node ids can be sparse */
+            continue;
+        }
+        if ((ret = cb(node, &cpus, arg)) != 0)
+        {
+            return ret;
+        }
+    }
+    return 0;
+}
+
+struct _fil_affinity_node_of
+{
+    int cpu;
+    cpu_set_t *out;
+};
+
+static inline int _fil_affinity_node_of_cb(int node, cpu_set_t *cpus, void *arg)
+{
+    struct _fil_affinity_node_of *info = arg;
+
+    if (CPU_ISSET(info->cpu, cpus))
+    {
+        memcpy(info->out, cpus, sizeof(*cpus));
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Turn the policy into a concrete CPU set.  Must be called on the creating
+ * thread (the NUMA node is the one *it* is running on).  Returns 0 or an
+ * errno: EINVAL if nothing usable is left of the set.
+ */
+static inline int fil_affinity_resolve(FilAffinity *aff)
+{
+    cpu_set_t allowed;
+
+    if (aff->placement == FIL_AFFINITY_PLACEMENT_NONE)
+    {
+        if (aff->numa_local || CPU_COUNT(&(aff->cpus)) > 0)
+        {
+            aff->placement = FIL_AFFINITY_PLACEMENT_SHARED;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    {
+        return errno;
+    }
+
+    if (CPU_COUNT(&(aff->cpus)) == 0)
+    {
+        memcpy(&(aff->cpus), &allowed, sizeof(allowed));
+    }
+    else
+    {
+        CPU_AND(&(aff->cpus), &(aff->cpus), &allowed);
+    }
+
+    if (aff->numa_local)
+    {
+        struct _fil_affinity_node_of info;
+        cpu_set_t node_cpus;
+        int cpu = sched_getcpu();
+
+        info.cpu = cpu;
+        info.out = &node_cpus;
+        if (cpu >= 0 && _fil_affinity_foreach_node(_fil_affinity_node_of_cb, &info) == 1)
+        {
+            CPU_AND(&(aff->cpus), &(aff->cpus), &node_cpus);
+        }
+        /* else: no NUMA information, so the whole machine is one node. */
+    }
+
+    if (CPU_COUNT(&(aff->cpus)) == 0)
+    {
+        return EINVAL;
+    }
+    return 0;
+}
+
+/* The 'n'th CPU (in ascending order) of 'set', wrapping.  'set' is non-empty. */
+static inline int _fil_affinity_nth_cpu(const cpu_set_t *set, unsigned int n)
+{
+    int cpu, count = CPU_COUNT(set);
+
+    n %= (unsigned int)count;
+    for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, set) && n-- == 0)
+        {
+            return cpu;
+        }
+    }
+    return -1;
+}
+
+struct _fil_affinity_spread
+{
+    const cpu_set_t *cpus;
+    /* nodes that have at least one CPU in 'cpus', and their intersections */
+    int num_nodes;
+    cpu_set_t nodes[64];
+};
+
+static inline int _fil_affinity_spread_cb(int node, cpu_set_t *cpus, void *arg)
+{
+    struct _fil_affinity_spread *info = arg;
+    cpu_set_t *dst;
+
+    if (info->num_nodes >= (int)(sizeof(info->nodes) / sizeof(info->nodes[0])))
+    {
+        return 1;
+    }
+    dst = &(info->nodes[info->num_nodes]);
+    CPU_AND(dst, cpus, info->cpus);
+    if (CPU_COUNT(dst) > 0)
+    {
+        info->num_nodes++;
+    }
+    return 0;
+}
+
+/*
+ * Apply a resolved policy to the calling thread.  'thr_index' is the
+ * thread's sequence number within its pool (COMPACT/SPREAD use it to pick a
+ * CPU).  Best effort: see the comment at the top of this file.
+ */
+static inline void fil_affinity_apply(const FilAffinity *aff, unsigned int thr_index)
+{
+    cpu_set_t mine;
+    int cpu = -1;
+
+    switch (aff->placement)
+    {
+        case FIL_AFFINITY_PLACEMENT_SHARED:
+            sched_setaffinity(0, sizeof(aff->cpus), &(aff->cpus));
+            break;
+        case FIL_AFFINITY_PLACEMENT_COMPACT:
+            cpu = _fil_affinity_nth_cpu(&(aff->cpus), thr_index);
+            break;
+        case FIL_AFFINITY_PLACEMENT_SPREAD:
+        {
+            struct _fil_affinity_spread *info = malloc(sizeof(*info));
+
+            if (info == NULL)
+            {
+                cpu = _fil_affinity_nth_cpu(&(aff->cpus), thr_index);
+                break;
+            }
+            info->cpus = &(aff->cpus);
+            info->num_nodes = 0;
+            _fil_affinity_foreach_node(_fil_affinity_spread_cb, info);
+            if (info->num_nodes <= 1)
+            {
+                cpu = _fil_affinity_nth_cpu(&(aff->cpus), thr_index);
+            }
+            else
+            {
+                /* node-major round robin: 0 -> n0c0, 1 -> n1c0, ..., then n0c1 */
+                cpu = _fil_affinity_nth_cpu(&(info->nodes[thr_index % info->num_nodes]),
+                                            thr_index / info->num_nodes);
+            }
+            free(info);
+            break;
+        }
+        default:
+            break;
+    }
+
+    if (cpu >= 0)
+    {
+        CPU_ZERO(&mine);
+        CPU_SET(cpu, &mine);
+        sched_setaffinity(0, sizeof(mine), &mine);
+    }
+
+    if (aff->sched_batch)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+    }
+
+    if (aff->set_nice)
+    {
+        /* On Linux nice is per-thread when addressed by tid. */
+        setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), aff->nice);
+    }
+}
+
+#else /* !__linux__ */
+
+static inline int fil_affinity_resolve(FilAffinity *aff)
+{
+    return fil_affinity_is_default(aff) ? 0 : ENOSYS;
+}
+
+static inline void fil_affinity_apply(const FilAffinity *aff, unsigned int thr_index)
+{
+}
+
+#endif /* __linux__ */
+
+#endif /* __CORE_FIL_AFFINITY_H__ */
@@ -0,0 +1,98 @@
+#ifndef __FIL_CORE_BLOCKWATCH_H__
+#define __FIL_CORE_BLOCKWATCH_H__
+
+#include "core/filament.h"
+
+/*
+ * Blocking-call detector: notice a scheduler callback -- a greenthread's run,
+ * a timer callback -- that keeps its scheduler from everything else for too
+ * long, say a CPU loop or an unpatched blocking call.
+ *
+ * Off by default.  While it is on (blockwatch_start()), each scheduler times
+ * every callback _sched_main runs, stamping its start here and counting its
+ * length into a histogram when it returns.  A watchdog thread polls the
+ * stamps without the GIL; only when a callback has been running past the
+ * threshold does it take the GIL, and then it reports that run -- once --
+ * with the scheduler thread's Python stack.  With it off, the scheduler
+ * pays one flag test per callback.
+ *
+ * The stamp is a sequence number, odd while a callback runs: the scheduler
+ * thread writes start_ns before making it odd, and the watchdog re-reads it
+ * after start_ns to know the two go together.
+ */
+
+/* Run-length buckets: 0 is under 1us, i is [2^(i-1), 2^i) us, and the last
+ * also takes everything longer. */
+#define FIL_BLOCKWATCH_BUCKETS 32
+
+typedef struct _fil_blockwatch FilBlockWatch;
+
+struct _fil_blockwatch
+{
+    /* Registry links; see src/core/fil_blockwatch.c. */
+    FilBlockWatch *prev;
+    FilBlockWatch *next;
+    int registered;
+    unsigned long thread_id;
+    uint64_t seq;
+    uint64_t start_ns;
+    /* The greenthread the running callback switched into, or NULL (timer
+     * callbacks, the scheduler's own work).  Borrowed: set and cleared
+     * around the switch, and only read with the GIL held. */
+    PyGreenlet *greenlet;
+    /* The seq the watchdog last reported; watchdog only. */
+    uint64_t reported;
+    uint64_t hist[FIL_BLOCKWATCH_BUCKETS];
+};
+
+/* Around the switch into 'gl' in a scheduler callback. */
+#define FIL_BLOCKWATCH_RUNNING(__sched, __gl)                               \
+    ((__sched)->blockwatch.greenlet = (__gl))
+
+#ifdef __FIL_BUILDING_CORE__
+
+typedef struct _pyfilcore_capi PyFilCore_CAPIObject;
+struct _pyfil_scheduler;
+
+/* src/core/fil_blockwatch.c */
+extern int fil_blockwatch_wanted;
+int fil_blockwatch_init(PyObject *module, PyFilCore_CAPIObject *capi);
+/* Put 'sched' on the watchdog's list; scheduler thread. */
+void fil_blockwatch_attach(struct _pyfil_scheduler *sched);
+/* Scheduler dealloc: off the list, its histogram kept. */
+void fil_blockwatch_detach(struct _pyfil_scheduler *sched);
+
+static inline uint64_t fil_blockwatch_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Scheduler thread, GIL held, before and after one callback. */
+static inline void fil_blockwatch_begin(FilBlockWatch *bw)
+{
+    bw->greenlet = NULL;
+    __atomic_store_n(&(bw->start_ns), fil_blockwatch_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&(bw->seq), bw->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline void fil_blockwatch_end(FilBlockWatch *bw)
+{
+    uint64_t us = (fil_blockwatch_now() - bw->start_ns) / 1000;
+    int bucket = 0;
+
+    while (us != 0 && bucket < FIL_BLOCKWATCH_BUCKETS - 1)
+    {
+        us >>= 1;
+        bucket++;
+    }
+    __atomic_store_n(&(bw->hist[bucket]), bw->hist[bucket] + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&(bw->seq), bw->seq + 1, __ATOMIC_RELEASE);
+}
+
+#endif
+
+#endif /* __FIL_CORE_BLOCKWATCH_H__ */
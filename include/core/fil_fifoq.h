@@ -281,4 +281,90 @@ static inline int fil_fifoq_get(FilFifoQ *q, void **item_ret)
     return 0;
 }
 
+/*
+ * Batch versions: whole runs are copied a chunk at a time.  put_many
+ * returns how many went in -- fewer than 'n' only if a chunk could not be
+ * allocated.  get_many takes up to 'n' and returns how many it took.
+ */
+static inline uint64_t fil_fifoq_put_many(FilFifoQ *q, void **items, uint64_t n)
+{
+    FilFifoQChunk *tail = q->tail;
+    uint64_t done = 0;
+    uint64_t room;
+
+    while (done < n)
+    {
+        if (tail->append_idx == (FIL_FIFOQ_CHUNK_SIZE - 1))
+        {
+            if ((tail->next_chunk = _fil_fifoq_chunk_alloc()) == NULL)
+            {
+                break;
+            }
+            tail = q->tail = tail->next_chunk;
+#ifndef NDEBUG
+            tail->next_chunk = NULL;
+#endif
+            tail->append_idx = -1;
+        }
+
+        /* append_idx is -1 in a fresh chunk; the unsigned wrap makes this
+         * the whole chunk. */
+        room = (FIL_FIFOQ_CHUNK_SIZE - 1) - tail->append_idx;
+        if (room > n - done)
+        {
+            room = n - done;
+        }
+        memcpy(&(tail->items[tail->append_idx + 1]), items + done,
+               room * sizeof(void *));
+        tail->append_idx += room;
+        q->len += room;
+        done += room;
+    }
+
+    return done;
+}
+
+static inline uint64_t fil_fifoq_get_many(FilFifoQ *q, void **items_ret, uint64_t n)
+{
+    FilFifoQChunk *head;
+    uint64_t done = 0;
+    uint64_t avail;
+
+    if (n > q->len)
+    {
+        n = q->len;
+    }
+
+    while (done < n)
+    {
+        head = q->head;
+        avail = ((head == q->tail) ? head->append_idx + 1 : FIL_FIFOQ_CHUNK_SIZE) - q->pop_idx;
+        if (avail > n - done)
+        {
+            avail = n - done;
+        }
+        memcpy(items_ret + done, &(head->items[q->pop_idx]), avail * sizeof(void *));
+        done += avail;
+        q->pop_idx += avail;
+
+        if ((q->len -= avail) == 0)
+        {
+            assert(head == q->tail);
+            q->pop_idx = 0;
+            head->append_idx = -1;
+            break;
+        }
+
+        if (q->pop_idx == FIL_FIFOQ_CHUNK_SIZE)
+        {
+            q->head = head->next_chunk;
+            assert(q->head != NULL);
+            _fil_fifoq_chunk_free(head);
+            q->pop_idx = 0;
+        }
+    }
+
+    return done;
+}
+
 #endif /* __FIL_CORE_FIFOQ_H__ */
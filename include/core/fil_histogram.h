@@ -0,0 +1,127 @@
+#ifndef __FIL_CORE_HISTOGRAM_H__
+#define __FIL_CORE_HISTOGRAM_H__
+
+#include "core/filament.h"
+
+/*
+ * Log-linear ("HDR-style") histogram of nanosecond durations.
+ *
+ * Every power of two is split into FIL_HIST_SUB equal buckets, so a value is
+ * placed to within 1/FIL_HIST_SUB (12.5%) of itself at any scale, and values
+ * under FIL_HIST_SUB ns get a bucket each.  Everything from
+ * 2^(FIL_HIST_MAX_EXP + 1) ns (about two minutes) up lands in the last
+ * bucket; 'max' still says how far up.
+ *
+ * One writer: the fields are stored with relaxed atomics so another thread
+ * can read them at any time, but two threads must not record into the same
+ * histogram.
+ */
+#define FIL_HIST_SUB_BITS 3
+#define FIL_HIST_SUB (1 << FIL_HIST_SUB_BITS)
+#define FIL_HIST_MAX_EXP 36
+#define FIL_HIST_BUCKETS ((FIL_HIST_MAX_EXP - FIL_HIST_SUB_BITS + 2) * FIL_HIST_SUB)
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[FIL_HIST_BUCKETS];
+} FilHistogram;
+
+static inline int fil_histogram_bucket(uint64_t ns)
+{
+    int e;
+
+    if (ns < FIL_HIST_SUB)
+    {
+        return (int)ns;
+    }
+    e = 63 - __builtin_clzll(ns);
+    if (e > FIL_HIST_MAX_EXP)
+    {
+        return FIL_HIST_BUCKETS - 1;
+    }
+    return (e - FIL_HIST_SUB_BITS + 1) * FIL_HIST_SUB +
+           (int)((ns >> (e - FIL_HIST_SUB_BITS)) & (FIL_HIST_SUB - 1));
+}
+
+/* The smallest value that lands in 'bucket'. */
+static inline uint64_t fil_histogram_floor(int bucket)
+{
+    int octave = bucket / FIL_HIST_SUB;
+
+    if (octave == 0)
+    {
+        return (uint64_t)bucket;
+    }
+    return (uint64_t)(FIL_HIST_SUB + bucket % FIL_HIST_SUB) << (octave - 1);
+}
+
+static inline void fil_histogram_record(FilHistogram *hist, uint64_t ns)
+{
+    int bucket = fil_histogram_bucket(ns);
+
+    __atomic_store_n(&(hist->buckets[bucket]), hist->buckets[bucket] + 1,
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&(hist->count), hist->count + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&(hist->sum), hist->sum + ns, __ATOMIC_RELAXED);
+    if (ns > hist->max)
+    {
+        __atomic_store_n(&(hist->max), ns, __ATOMIC_RELAXED);
+    }
+}
+
+/* Reader side: a copy of 'src' added into 'dst'. */
+static inline void fil_histogram_add(FilHistogram *dst, FilHistogram *src)
+{
+    int i;
+
+    dst->count += __atomic_load_n(&(src->count), __ATOMIC_RELAXED);
+    dst->sum += __atomic_load_n(&(src->sum), __ATOMIC_RELAXED);
+    if (__atomic_load_n(&(src->max), __ATOMIC_RELAXED) > dst->max)
+    {
+        dst->max = src->max;
+    }
+    for (i = 0; i < FIL_HIST_BUCKETS; i++)
+    {
+        dst->buckets[i] += __atomic_load_n(&(src->buckets[i]),
+                                           __ATOMIC_RELAXED);
+    }
+}
+
+/* {'count', 'sum', 'max', 'buckets'}: sum and max in ns, and buckets the
+ * non-empty ones as (floor_ns, count), smallest first. */
+static inline PyObject *fil_histogram_to_dict(FilHistogram *hist)
+{
+    PyObject *buckets = PyList_New(0);
+    PyObject *item;
+    int i;
+
+    for (i = 0; i < FIL_HIST_BUCKETS && buckets != NULL; i++)
+    {
+        if (hist->buckets[i] == 0)
+        {
+            continue;
+        }
+        item = Py_BuildValue("(KK)",
+                             (unsigned long long)fil_histogram_floor(i),
+                             (unsigned long long)hist->buckets[i]);
+        if (item == NULL || PyList_Append(buckets, item) < 0)
+        {
+            Py_CLEAR(buckets);
+        }
+        Py_XDECREF(item);
+    }
+    if (buckets == NULL)
+    {
+        return NULL;
+    }
+    return Py_BuildValue("{sKsKsKsN}",
+                         "count", (unsigned long long)hist->count,
+                         "sum", (unsigned long long)hist->sum,
+                         "max", (unsigned long long)hist->max,
+                         "buckets", buckets);
+}
+
+#endif /* __FIL_CORE_HISTOGRAM_H__ */
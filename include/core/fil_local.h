@@ -0,0 +1,58 @@
+#ifndef __FIL_CORE_LOCAL_H__
+#define __FIL_CORE_LOCAL_H__
+
+#include "core/filament.h"
+
+/*
+ * Greenthread-local storage (_filament.core.local).
+ *
+ * Every local instance is handed a small integer index when it is created,
+ * and every greenthread carries an array of slots indexed by it: a Filament
+ * embeds its array in the PyFilament struct, any other greenlet (a thread's
+ * main greenlet, the scheduler's, one made with greenlet() directly) keeps
+ * one in a holder object in its instance __dict__.  An attribute access is
+ * then "find the current greenlet's array, index it, generic getattr against
+ * that dict" -- no per-instance mapping is consulted on the way.
+ *
+ * The dicts themselves belong to the local, as in _threading_local: it keeps
+ * them in a mapping keyed by a weakref to each greenlet, traverses them, and
+ * drops them all when it dies.  A slot only borrows its dict, so a cycle back
+ * to the local (l.x = l) is one the collector can see.  A greenlet's entry
+ * goes when the weakref's callback fires, when a Filament's body returns
+ * (fil_local_slots_release()), or, for a greenlet that has finished but is
+ * still referenced, at the start of the next full collection.
+ *
+ * Indices are recycled once their local dies, so each slot also records the
+ * 64-bit serial of the local that filled it.  A slot whose serial does not
+ * match belongs to a dead local, its borrowed dict already freed, and is
+ * simply overwritten; nothing ever has to walk every greenthread to clear a
+ * dead local's slots.
+ */
+typedef struct _fil_local_slot
+{
+    uint64_t serial;
+    /* Borrowed from the local; only valid while 'serial' matches it. */
+    PyObject *dict;
+    /* Weak reference to the local that filled the slot. */
+    PyObject *localref;
+} FilLocalSlot;
+
+typedef struct _fil_local_slots
+{
+    FilLocalSlot *slots;
+    Py_ssize_t nslots;
+} FilLocalSlots;
+
+#ifdef __FIL_BUILDING_CORE__
+
+typedef struct _pyfilcore_capi PyFilCore_CAPIObject;
+
+/* src/core/fil_local.c */
+int fil_local_init(PyObject *module, PyFilCore_CAPIObject *capi);
+int fil_local_slots_traverse(FilLocalSlots *ls, visitproc visit, void *arg);
+void fil_local_slots_clear(FilLocalSlots *ls);
+void fil_local_slots_release(FilLocalSlots *ls, PyObject *greenlet);
+
+#endif
+
+#endif /* __FIL_CORE_LOCAL_H__ */
@@ -0,0 +1,114 @@
+#ifndef __FIL_CORE_LOCKPROF_H__
+#define __FIL_CORE_LOCKPROF_H__
+
+#include "core/filament.h"
+
+/*
+ * Contention profiling for the locking and queue primitives.
+ *
+ * Off by default.  While it is on (FIL_LOCK_PROFILE=1, or
+ * lock_profile_mode("on")), each Lock, RLock, Semaphore, Condition, RWLock,
+ * Queue and SimpleQueue created gets a FilLockProf record, tagged with its
+ * kind and its creation site: the first Python frame outside filament and
+ * the threading/queue modules that wrap it.  A primitive created while it is
+ * off has no record, and the hot paths test exactly that -- one branch on a
+ * NULL pointer -- before counting anything.
+ *
+ * The counters are updated with relaxed atomics: on a free-threading build a
+ * queue's producers and consumers update the same record without sharing a
+ * mutex.  A record outlives its primitive: on dealloc it is folded into a
+ * per-(kind, site) aggregate, so short-lived locks created in a loop show up
+ * as one row rather than vanishing.
+ */
+typedef struct _fil_lockprof FilLockProf;
+
+struct _fil_lockprof {
+    FilLockProf *prev;
+    FilLockProf *next;
+    const char *kind;
+    PyObject *site;
+    /* Primitives folded into this record: 1 while live, more once dead
+     * instances from the same site have been merged in. */
+    uint64_t instances;
+    int live;
+    uint64_t acquisitions;
+    uint64_t contended;
+    uint64_t wait_ns;
+    uint64_t wait_max_ns;
+    uint64_t depth;
+    uint64_t max_depth;
+};
+
+static inline uint64_t _fil_lockprof_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static inline void _fil_lockprof_max(uint64_t *maxp, uint64_t value)
+{
+    uint64_t cur = __atomic_load_n(maxp, __ATOMIC_RELAXED);
+
+    while (value > cur &&
+           !__atomic_compare_exchange_n(maxp, &cur, value, 1,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+/* An acquisition (or get/put) that did not have to wait. */
+static inline void fil_lockprof_acquired(FilLockProf *prof)
+{
+    __atomic_fetch_add(&(prof->acquisitions), 1, __ATOMIC_RELAXED);
+}
+
+/* About to park: returns the start time to hand to fil_lockprof_wait_end(). */
+static inline uint64_t fil_lockprof_wait_begin(FilLockProf *prof)
+{
+    uint64_t depth;
+
+    __atomic_fetch_add(&(prof->contended), 1, __ATOMIC_RELAXED);
+    depth = __atomic_add_fetch(&(prof->depth), 1, __ATOMIC_RELAXED);
+    _fil_lockprof_max(&(prof->max_depth), depth);
+    return _fil_lockprof_now();
+}
+
+/* Back from parking; 'acquired' is whether the wait got what it was after
+ * (a timeout or an exception does not count as an acquisition). */
+static inline void fil_lockprof_wait_end(FilLockProf *prof, uint64_t start, int acquired)
+{
+    uint64_t waited = _fil_lockprof_now() - start;
+
+    __atomic_fetch_sub(&(prof->depth), 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&(prof->wait_ns), waited, __ATOMIC_RELAXED);
+    _fil_lockprof_max(&(prof->wait_max_ns), waited);
+    if (acquired)
+    {
+        __atomic_fetch_add(&(prof->acquisitions), 1, __ATOMIC_RELAXED);
+    }
+}
+
+#ifdef __FIL_BUILDING_CORE__
+
+typedef struct _pyfilcore_capi PyFilCore_CAPIObject;
+
+/* src/core/fil_lockprof.c */
+int fil_lockprof_init(PyObject *module, PyFilCore_CAPIObject *capi);
+int fil_lockprof_attach(FilLockProf **prof, const char *kind);
+void fil_lockprof_detach(FilLockProf **prof);
+
+#else
+
+/*
+ * fil_lockprof_attach(): call from tp_new.  Leaves *prof NULL when profiling
+ * is off; returns -1 with an exception set on failure.
+ * fil_lockprof_detach(): call from tp_dealloc; a no-op on a NULL record.
+ */
+static int (*fil_lockprof_attach)(FilLockProf **prof, const char *kind);
+static void (*fil_lockprof_detach)(FilLockProf **prof);
+
+#endif
+
+#endif /* __FIL_CORE_LOCKPROF_H__ */
@@ -5,6 +5,82 @@
 
 typedef struct _pyfil_message PyFilMessage;
 
+/*
+ * A completion hook on a Message: 'cb' runs once, when the result (or
+ * exception) is sent, and the link is off the message by then.  This is how
+ * one WaitSet watches many messages without a waiter on each.  The callback
+ * runs inside send() -- with the GIL, and on a free-threaded build under the
+ * message's lock -- so it must not call back into Python or into the message.
+ */
+typedef struct _fil_message_link FilMessageLink;
+typedef void (*fil_message_link_cb_t)(FilMessageLink *link);
+
+struct _fil_message_link {
+    FilMessageLink *prev;   /* NULL when not linked */
+    FilMessageLink *next;
+    fil_message_link_cb_t cb;
+};
+
+/*
+ * The owner side: a circular list headed by a FilMessageLink whose 'cb' is
+ * unused.  Other one-shot-ish completions (the locking module's Event and
+ * AsyncResult) carry the same list so a WaitSet can watch them too; see
+ * fil_waitset_register_type below.  All of these run under the owner's lock,
+ * where it has one.
+ */
+static inline void fil_links_init(FilMessageLink *head)
+{
+    head->prev = head->next = head;
+}
+
+static inline int fil_links_empty(FilMessageLink *head)
+{
+    return head->next == head;
+}
+
+static inline void fil_links_add(FilMessageLink *head, FilMessageLink *link)
+{
+    FilMessageLink *tail = head->prev;
+
+    link->prev = tail;
+    link->next = head;
+    tail->next = link;
+    head->prev = link;
+}
+
+static inline void fil_links_del(FilMessageLink *link)
+{
+    if (link->prev != NULL)
+    {
+        link->prev->next = link->next;
+        link->next->prev = link->prev;
+        link->prev = link->next = NULL;
+    }
+}
+
+/* Unhook and run every link; each is off the list before its cb runs. */
+static inline void fil_links_fire(FilMessageLink *head)
+{
+    FilMessageLink *link;
+
+    while ((link = head->next) != head)
+    {
+        head->next = link->next;
+        link->next->prev = head;
+        link->prev = link->next = NULL;
+        link->cb(link);
+    }
+}
+
+/*
+ * How a WaitSet hooks a completion it does not know natively.  'link' returns
+ * 1, leaving 'link' unlinked, if 'obj' is already complete, else 0 once it is
+ * on obj's list.  'unlink' takes it back off and is a no-op if it already
+ * fired.  The WaitSet holds a reference to 'obj' while linked.
+ */
+typedef int (*fil_waitable_link_t)(PyObject *obj, FilMessageLink *link);
+typedef void (*fil_waitable_unlink_t)(PyObject *obj, FilMessageLink *link);
+
 #ifdef __FIL_BUILDING_CORE__
 
 typedef struct _pyfilcore_capi PyFilCore_CAPIObject;
@@ -13,7 +89,20 @@ int fil_message_init(PyObject *module, PyFilCore_CAPIObject *capi);
 PyFilMessage *fil_message_alloc(void);
 int fil_message_send(PyFilMessage *message, PyObject *result);
 int fil_message_send_exception(PyFilMessage *message, PyObject *exc_type, PyObject *exc_value, PyObject *exc_tb);
+void fil_message_deliver(PyFilMessage *message, PyObject *result_or_exc_type, int is_exc, PyObject *exc_value, PyObject *exc_tb);
 PyObject *fil_message_wait(PyFilMessage *message, struct timespec *ts);
+int fil_message_check(PyObject *obj);
+int fil_message_link(PyFilMessage *message, FilMessageLink *link);
+void fil_message_unlink(PyFilMessage *message, FilMessageLink *link);
+/* src/core/fil_waitset.c: the WaitSet type, built on the links above. */
+int fil_waitset_init(PyObject *module, PyFilCore_CAPIObject *capi);
+int fil_waitset_register_type(PyTypeObject *type, fil_waitable_link_t link, fil_waitable_unlink_t unlink);
+/* src/core/fil_fanout.c: Fanout, the engine behind the pool map family. */
+int fil_fanout_init(PyObject *module, PyFilCore_CAPIObject *capi);
+
+#else
+
+static int (*fil_waitset_register_type)(PyTypeObject *type, fil_waitable_link_t link, fil_waitable_unlink_t unlink);
 
 #endif
 
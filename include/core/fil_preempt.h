@@ -0,0 +1,125 @@
+#ifndef __FIL_CORE_PREEMPT_H__
+#define __FIL_CORE_PREEMPT_H__
+
+#include "core/filament.h"
+
+/*
+ * Time-slice preemption: a greenthread that keeps running Python code past
+ * its slice is switched out as if it had called sleep(0).
+ *
+ * Off by default.  While it is on (preempt_start(), FIL_PREEMPT), every
+ * scheduler thread has a C profile function installed -- unless something
+ * else, a profiler, already has one there, in which case that thread goes
+ * without -- so the interpreter gives us a look in at every Python function
+ * call and every return from a C call.  Those are the only points a
+ * greenthread can be preempted at: a loop that calls nothing, or one long C
+ * call (a regex, a json.dumps), runs to the end.
+ *
+ * The profile function does not read the clock: it tests a flag.  A ticker
+ * thread polls the scheduler runs without the GIL, as the blocking-call
+ * detector's watchdog does, and sets a run's flag every tick once it has gone
+ * on that long; only then does the profile function look at how long the
+ * greenthread has had and at its slice.  A greenthread holding a filament
+ * Lock, RLock or RWLock (a Condition holds through its lock), or inside
+ * preempt_disable(), is left alone, and looked at again the tick after.
+ * A Semaphore has no owner -- any greenthread may release it -- so it does
+ * not count.
+ *
+ * Runs are stamped the way the blockwatch stamps them: a sequence number,
+ * odd while a run is going, with start_ns written before it.
+ */
+typedef struct _fil_preempt FilPreempt;
+
+#define FIL_PREEMPT_OFF         0
+#define FIL_PREEMPT_ON          1
+/* Wanted, but another profile function was installed on this thread. */
+#define FIL_PREEMPT_DECLINED    2
+
+struct _fil_preempt
+{
+    /* Ticker list links; see src/core/fil_preempt.c. */
+    FilPreempt *prev;
+    FilPreempt *next;
+    /* FIL_PREEMPT_*; scheduler thread only. */
+    int state;
+    uint64_t seq;
+    uint64_t start_ns;
+    /* The greenthread the running callback switched into.  Borrowed: set and
+     * cleared around the switch. */
+    PyGreenlet *greenlet;
+    /* Set by the ticker, cleared by the profile function. */
+    int tick;
+};
+
+static inline uint64_t fil_preempt_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Scheduler thread, GIL held, around the switch into 'gl' in a scheduler
+ * callback.  With preemption off, one test. */
+static inline void fil_preempt_begin(FilPreempt *pre, PyGreenlet *gl)
+{
+    if (pre->state != FIL_PREEMPT_ON)
+    {
+        return;
+    }
+    pre->greenlet = gl;
+    __atomic_store_n(&(pre->tick), 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&(pre->start_ns), fil_preempt_now(), __ATOMIC_RELAXED);
+    __atomic_store_n(&(pre->seq), pre->seq + 1, __ATOMIC_RELEASE);
+}
+
+static inline void fil_preempt_end(FilPreempt *pre)
+{
+    if (!(pre->seq & 1))
+    {
+        return;
+    }
+    pre->greenlet = NULL;
+    __atomic_store_n(&(pre->seq), pre->seq + 1, __ATOMIC_RELEASE);
+}
+
+#ifdef __FIL_BUILDING_CORE__
+
+typedef struct _pyfilcore_capi PyFilCore_CAPIObject;
+struct _pyfil_scheduler;
+
+/* src/core/fil_preempt.c */
+extern int fil_preempt_wanted;
+int fil_preempt_init(PyObject *module, PyFilCore_CAPIObject *capi);
+/* Install or remove this thread's profile function to match
+ * fil_preempt_wanted; scheduler thread, GIL held. */
+void fil_preempt_sync(struct _pyfil_scheduler *sched);
+/* Scheduler dealloc, or its thread exiting: off the ticker's list. */
+void fil_preempt_detach(struct _pyfil_scheduler *sched);
+void fil_preempt_hold(int delta);
+
+#define _FIL_PREEMPT_WANTED()                                               \
+    __atomic_load_n(&fil_preempt_wanted, __ATOMIC_RELAXED)
+
+/* Does _sched_main have to call fil_preempt_sync()? */
+static inline int fil_preempt_out_of_sync(FilPreempt *pre)
+{
+    return _FIL_PREEMPT_WANTED() ? pre->state == FIL_PREEMPT_OFF :
+                                   pre->state != FIL_PREEMPT_OFF;
+}
+
+#else
+
+static void (*fil_preempt_hold)(int delta);
+
+#endif
+
+/* The running greenthread took (+1) or let go of (-1) a lock: it is not
+ * preempted while it holds one.  Counted whether preemption is on or not,
+ * so turning it on finds every hold taken before. */
+static inline void fil_preempt_lock_held(int delta)
+{
+    fil_preempt_hold(delta);
+}
+
+#endif /* __FIL_CORE_PREEMPT_H__ */
@@ -9,16 +9,68 @@ typedef void (*fil_event_cb_t)(PyFilScheduler *sched, void *cb_arg);
 
 #define FIL_SCHED_EVENT_FLAGS_DONTBLOCK_THREADS   0x00000001
 
+/*
+ * Priority classes.  Ready events are run a class at a time, highest first;
+ * a greenthread's class is its Filament's 'priority', and a wakeup takes the
+ * class of whoever is being woken.  See _sched_main for how a busy lower
+ * class keeps getting its share.
+ */
+#define FIL_SCHED_PRIO_HIGH     0
+#define FIL_SCHED_PRIO_NORMAL   1
+#define FIL_SCHED_PRIO_LOW      2
+#define FIL_SCHED_NPRIO         3
+
+/* An event's class rides in its flags, so every add_event caller can say it
+ * without a new entry point.  Zero -- what callers that do not care pass --
+ * is NORMAL. */
+#define FIL_SCHED_EVENT_FLAGS_PRIO_SHIFT          4
+#define FIL_SCHED_EVENT_FLAGS_PRIO_MASK           0x00000030
+#define FIL_SCHED_EVENT_FLAGS_PRIO(__prio)                                  \
+    ((uint32_t)((__prio) + 1) << FIL_SCHED_EVENT_FLAGS_PRIO_SHIFT)
+#define FIL_SCHED_EVENT_PRIO(__flags)                                       \
+    ((((__flags) & FIL_SCHED_EVENT_FLAGS_PRIO_MASK) == 0) ?                 \
+     FIL_SCHED_PRIO_NORMAL :                                                \
+     (int)(((__flags) & FIL_SCHED_EVENT_FLAGS_PRIO_MASK) >>                 \
+           FIL_SCHED_EVENT_FLAGS_PRIO_SHIFT) - 1)
+
 typedef struct
 {
     PyGreenlet greenlet;
     PyFilScheduler *sched;
+    /* Made on demand, for a waiter that has to park; until then the body's
+     * outcome is only kept below.  See fil_filament_message(). */
     PyFilMessage *message;
+    int finished;
+    int is_exc;
+    PyObject *result_or_exc_type;
+    PyObject *exc_value;
+    PyObject *exc_tb;
     PyObject *method;
+    /* The body is called with method_args[method_args_start:], so spawn()
+     * can keep its own argument tuple, callable and all. */
     PyObject *method_args;
+    Py_ssize_t method_args_start;
     PyObject *method_kwargs;
+    uint32_t flags; /* FIL_FILAMENT_FLAGS_* */
+    /* FIL_SCHED_PRIO_*: the class its wakeups are queued in. */
+    int priority;
+    /* Time-slice preemption (core/fil_preempt.h): its own slice in ns, 0 for
+     * the default or -1 for never; preempt_disable() depth; and filament
+     * locks held. */
+    int64_t time_slice_ns;
+    int preempt_disabled;
+    int preempt_locks;
+    /* This greenthread's _filament.local dicts; see core/fil_local.h. */
+    FilLocalSlots locals;
 } PyFilament;
 
+/* spawn_n(): no result Message; the body's exception is printed instead of
+ * delivered, and wait()/join() refuse.  Fixed at creation. */
+#define FIL_FILAMENT_FLAGS_NO_RESULT   0x00000001
+/* Set by tp_dealloc before greenlet unwinds the body: an outcome produced
+ * after that has nowhere to go. */
+#define FIL_FILAMENT_FLAGS_DEALLOC     0x00000002
+
 /* Events live in one of two structures, picked by how they were scheduled:
  *
  *   - "wake up now" events (ts == NULL at add time) go on a FIFO list, which
@@ -56,6 +108,9 @@ typedef struct _pyfil_sched_event
     /* FIFO links; unused (and stale) once the event leaves the FIFO. */
     FilSchedEvent *prev;
     FilSchedEvent *next;
+    /* CLOCK_MONOTONIC ns it was queued to run now, while scheduler timings
+     * are on; else 0.  See FilSchedStats. */
+    uint64_t queued_ns;
 } FilSchedEvent;
 
 typedef struct
@@ -74,6 +129,41 @@ typedef struct
     size_t capacity;
 } FilSchedTimerHeap;
 
+/*
+ * What a scheduler has done, for Scheduler.stats() and filament.metrics.
+ *
+ * The counters marked "sched_lock" are bumped by whichever thread queues or
+ * cancels an event, under the lock; the rest only ever by the scheduler's own
+ * thread (FIL_SCHED_STAT_INC), so they cost an increment and no more.  The
+ * histograms are kept only while timings are on (metrics_mode("on"),
+ * FIL_METRICS=1), since they read the clock once per event:
+ *
+ *   ready_latency: from an event being queued to run now to its callback
+ *                  starting (timed events are not counted);
+ *   sleep:         each time the scheduler slept with nothing to run.
+ */
+typedef struct
+{
+    uint64_t switches;          /* greenthreads switched into */
+    uint64_t passes;            /* loop passes that ran anything */
+    uint64_t events;            /* callbacks run */
+    uint64_t timers_armed;      /* sched_lock */
+    uint64_t timers_cancelled;  /* sched_lock */
+    uint64_t timers_fired;      /* sched_lock */
+    uint64_t freelist_hits;     /* sched_lock */
+    uint64_t freelist_misses;   /* sched_lock */
+    uint64_t wakeups_local;     /* sched_lock; queued by its own thread */
+    uint64_t wakeups_remote;    /* sched_lock; queued by another thread */
+    uint64_t preemptions;       /* greenthreads switched out at a slice's end */
+    uint64_t filaments_recycled; /* Filaments made from a freed one */
+    FilHistogram ready_latency;
+    FilHistogram sleep;
+} FilSchedStats;
+
+#define FIL_SCHED_STAT_INC(__sched, __field)                                \
+    __atomic_store_n(&((__sched)->stats.__field),                          \
+                     (__sched)->stats.__field + 1, __ATOMIC_RELAXED)
+
 /* Cap on the per-scheduler freelist of FilSchedEvent structs (see
  * _scheduler_add_event / _sched_main).  Sized so even high-concurrency
  * workloads (~1000 greenlets with an event in flight each) never touch malloc
@@ -81,6 +171,10 @@ typedef struct
  * (2048 * sizeof(FilSchedEvent) ~= 112KB). */
 #define FIL_SCHED_EVENT_FREELIST_MAX 2048
 
+/* Cap on the per-scheduler freelist of dead Filament shells (see
+ * filament.c): a few hundred bytes each, so ~80KB at most. */
+#define FIL_FILAMENT_FREELIST_MAX 256
+
 typedef struct _pyfil_scheduler
 {
     PyObject_HEAD
@@ -88,8 +182,9 @@ typedef struct _pyfil_scheduler
     PyThreadState *thread_state;
     pthread_mutex_t sched_lock;
     pthread_cond_t sched_cond;
-    /* Ready-now events, in the order they were queued. */
-    FilSchedEventList immediate;
+    /* Ready-now events, one FIFO per priority class, each in the order its
+     * events were queued. */
+    FilSchedEventList immediate[FIL_SCHED_NPRIO];
     /* Events waiting for a deadline, earliest first. */
     FilSchedTimerHeap timers;
     /* Freelist of FilSchedEvent nodes, protected by sched_lock.  Every
@@ -99,6 +194,10 @@ typedef struct _pyfil_scheduler
      * FIL_SCHED_EVENT_FREELIST_MAX. */
     FilSchedEvent *event_freelist;
     int event_freelist_len;
+    /* Freed Filaments kept for the next spawn(); scheduler thread only.
+     * Bounded by FIL_FILAMENT_FREELIST_MAX. */
+    PyFilament *filament_freelist;
+    int filament_freelist_len;
     PyObject *system_exceptions;
     int running;
     int aborting;
@@ -108,6 +207,24 @@ typedef struct _pyfil_scheduler
      * owner here so cross-thread misuse can be rejected instead of crashing.
      */
     unsigned long thread_id;
+    /* Trace ring while tracing is (or was) on, else NULL; see
+     * core/fil_trace.h.  Set once, by this scheduler's thread. */
+    struct _fil_trace_ring *trace;
+    /* Callback timing for the blocking-call detector; see
+     * core/fil_blockwatch.h. */
+    FilBlockWatch blockwatch;
+    FilPreempt preempt;
+    FilSchedStats stats;
+    /* Class of the event _sched_main is running, i.e. of the greenthread it
+     * switched into; a waiter parking now is woken in this class.  Scheduler
+     * thread only. */
+    int running_prio;
+    /* Per class: how many passes in a row its work was cut short for a
+     * higher class's; see _sched_main.  Scheduler thread only. */
+    unsigned int prio_age[FIL_SCHED_NPRIO];
+    /* Every scheduler, for scheduler_stats(); see fil_scheduler.c. */
+    struct _pyfil_scheduler *reg_prev;
+    struct _pyfil_scheduler *reg_next;
 } PyFilScheduler;
 
 #ifdef __FIL_BUILDING_CORE__
@@ -121,7 +238,11 @@ int fil_scheduler_add_event_ref(PyFilScheduler *sched, struct timespec *ts, uint
 int fil_scheduler_del_event(PyFilScheduler *sched, FilSchedEvent **owner_ref);
 int fil_scheduler_switch(PyFilScheduler *sched);
 int fil_scheduler_gl_switch(PyFilScheduler *sched, struct timespec *ts, PyGreenlet *greenlet);
+/* core-only (spawn_many); not in the C API capsule */
+int fil_scheduler_gl_switch_many(PyFilScheduler *sched, PyGreenlet **greenlets, Py_ssize_t n);
 PyGreenlet *fil_scheduler_greenlet(PyFilScheduler *sched);
+/* core-only: the calling thread's scheduler, borrowed; NULL if none. */
+PyFilScheduler *fil_scheduler_current(void);
 
 #else
 
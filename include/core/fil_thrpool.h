@@ -27,6 +27,7 @@
 #define __CORE_FIL_THRPOOL_H__
 
 #include "core/filament.h"
+#include "core/fil_affinity.h"
 
 #define FIL_THRPOOL_DEFAULT_MIN_THREADS   10
 #define FIL_THRPOOL_DEFAULT_MAX_THREADS   20
@@ -49,6 +50,10 @@ typedef struct _fil_thr_pool_opt
     FilThrPoolInitThrCallback thr_init_cb;
     void *thr_init_cb_arg;
     FilThrPoolDeinitThrCallback thr_deinit_cb;
+
+    /* CPU placement / scheduling class for the workers (fil_affinity.h).
+     * Resolved once by fil_thrpool_create(), on the creating thread. */
+    FilAffinity affinity;
 } FilThrPoolOpt;
 
 typedef struct _fil_thr_pool_cb_info FilThrPoolCBInfo;
@@ -90,6 +95,8 @@ typedef struct _fil_thr_pool
     uint32_t flags;
     uint32_t num_threads;
     uint32_t num_threads_pending;
+    /* Start order of workers, for COMPACT/SPREAD placement. */
+    uint32_t thr_seq;
 
     pthread_mutex_t lock;
     pthread_cond_t cond;
@@ -100,8 +107,25 @@ typedef struct _fil_thr_pool
 
     /* LIFO stack of idle workers (see FilThrPoolIdle above). */
     FilThrPoolIdle *idle_stack;
+
+    /* For fil_thrpool_stats(); under 'lock'. */
+    uint32_t queued;
+    uint32_t busy;
+    uint64_t submitted;
+    uint64_t completed;
 } FilThrPool;
 
+typedef struct _fil_thr_pool_stats
+{
+    uint32_t num_threads;
+    uint32_t min_thr;
+    uint32_t max_thr;
+    uint32_t queued;        /* waiting for a worker */
+    uint32_t busy;          /* workers in a callback */
+    uint64_t submitted;
+    uint64_t completed;
+} FilThrPoolStats;
+
 /* Wake one idle worker (most recently idled first).  Call with 'lock' held. */
 static inline void _fil_thrpool_wake_one_idle(FilThrPool *tpool)
 {
@@ -138,6 +162,18 @@ static void _fil_thr_pool_thread(FilThrPool *tpool)
     idle.next = NULL;
     pthread_cond_init(&(idle.cond), NULL);
 
+    if (!fil_affinity_is_default(&(tpool->opt.affinity)))
+    {
+        uint32_t thr_index;
+
+        pthread_mutex_lock(&(tpool->lock));
+        thr_index = tpool->thr_seq++;
+        pthread_mutex_unlock(&(tpool->lock));
+        /* Before the init callback, so anything it allocates is first
+         * touched from the CPU (and NUMA node) we will actually run on. */
+        fil_affinity_apply(&(tpool->opt.affinity), thr_index);
+    }
+
     if (tpool->opt.thr_init_cb != NULL)
     {
         thread_state = tpool->opt.thr_init_cb(tpool->opt.thr_init_cb_arg);
@@ -181,11 +217,15 @@ static void _fil_thr_pool_thread(FilThrPool *tpool)
         {
             tpool->last = NULL;
         }
+        tpool->queued--;
+        tpool->busy++;
 
         pthread_mutex_unlock(&(tpool->lock));
         entry->callback(thread_state, entry->callback_arg, 0);
         free(entry);
         pthread_mutex_lock(&(tpool->lock));
+        tpool->busy--;
+        tpool->completed++;
     }
 out:
     /*
@@ -353,6 +393,7 @@ static inline void fil_thrpool_opt_init(FilThrPoolOpt *opt)
     opt->thr_init_cb = NULL;
     opt->thr_init_cb_arg = NULL;
     opt->thr_deinit_cb = NULL;
+    fil_affinity_init(&(opt->affinity));
 }
 
 static inline FilThrPool *fil_thrpool_create(FilThrPoolOpt *opt)
@@ -367,6 +408,12 @@ static inline FilThrPool *fil_thrpool_create(FilThrPoolOpt *opt)
     }
 
     memcpy(&(tpool->opt), opt, sizeof(*opt));
+    if ((err = fil_affinity_resolve(&(tpool->opt.affinity))) != 0)
+    {
+        free(tpool);
+        errno = err;
+        return NULL;
+    }
     pthread_mutex_init(&(tpool->lock), NULL);
     pthread_cond_init(&(tpool->cond), NULL);
     pthread_cond_init(&(tpool->shutdown_cond), NULL);
@@ -431,12 +478,54 @@ static inline int fil_thrpool_run(FilThrPool *tpool, FilThrPoolCallback cb, void
         tpool->last->next = cbinfo;
         tpool->last = cbinfo;
     }
+    tpool->queued++;
+    tpool->submitted++;
     _fil_thrpool_wake_one_idle(tpool);
     pthread_mutex_unlock(&(tpool->lock));
 
     return 0;
 }
 
+static inline void fil_thrpool_stats(FilThrPool *tpool, FilThrPoolStats *stats)
+{
+    pthread_mutex_lock(&(tpool->lock));
+    stats->num_threads = tpool->num_threads;
+    stats->min_thr = tpool->opt.min_thr;
+    stats->max_thr = tpool->opt.max_thr;
+    stats->queued = tpool->queued;
+    stats->busy = tpool->busy;
+    stats->submitted = tpool->submitted;
+    stats->completed = tpool->completed;
+    pthread_mutex_unlock(&(tpool->lock));
+}
+
+/*
+ * In the child of a fork(): every worker is gone, and one of them may have
+ * held 'lock' at that instant.  Start the pool over with fresh locks and
+ * min_thr new workers; they pick up whatever was queued and not yet started.
+ * A callback a worker was in the middle of is lost, and a shutdown that was
+ * in progress (its helper thread is gone too) never finishes.
+ */
+static inline void fil_thrpool_after_fork_child(FilThrPool *tpool)
+{
+    pthread_mutex_init(&(tpool->lock), NULL);
+    pthread_cond_init(&(tpool->cond), NULL);
+    pthread_cond_init(&(tpool->shutdown_cond), NULL);
+    tpool->num_threads = 0;
+    tpool->num_threads_pending = 0;
+    tpool->thr_seq = 0;
+    tpool->idle_stack = NULL;
+    /* Whatever a worker was running died with it. */
+    tpool->busy = 0;
+
+    pthread_mutex_lock(&(tpool->lock));
+    if (!(tpool->flags & FIL_THRPOOL_FLAGS_SHUTDOWN))
+    {
+        _fil_create_min_threads(tpool);
+    }
+    pthread_mutex_unlock(&(tpool->lock));
+}
+
 /* this can block the caller, filaments or not! */
 static inline void fil_thrpool_shutdown(FilThrPool *tpool, int now)
 {
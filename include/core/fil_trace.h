@@ -0,0 +1,151 @@
+#ifndef __FIL_CORE_TRACE_H__
+#define __FIL_CORE_TRACE_H__
+
+#include "core/filament.h"
+
+/*
+ * Scheduler tracing: what each scheduler ran, for how long, why it parked
+ * and who woke it.
+ *
+ * Off by default.  While it is on (trace_mode("on"), or FIL_TRACE=1), every
+ * scheduler gets a FilTraceRing the first time its loop comes round, and the
+ * instrumented paths append fixed-size binary records to it.  A scheduler
+ * that has no ring -- every one, unless tracing was ever turned on -- costs
+ * one NULL test per record site; one whose ring has been stopped costs a
+ * second load.
+ *
+ * Records come from the scheduler's own thread (runs, parks, idle time) and
+ * from whichever thread queues a wakeup for one of its greenthreads (the io
+ * thread, a thread-pool worker, another scheduler), so a ring is
+ * multi-producer: a writer claims a slot with one atomic add, fills it, and
+ * publishes it by storing the slot's sequence number last.  Nothing waits
+ * for anything.  The ring overwrites its oldest records; the reader copies a
+ * slot and keeps it only if the sequence number it read before and after the
+ * copy is the one that slot should hold, which drops a record that was being
+ * overwritten instead of returning a torn one.
+ *
+ * Timestamps are raw cycle-counter ticks where the CPU has a usable one
+ * (rdtsc, the arm64 virtual counter), else CLOCK_MONOTONIC nanoseconds; the
+ * reader converts them with a ticks-per-ns rate measured between
+ * trace_mode("on") and the read.
+ */
+
+/* Record types. */
+#define FIL_TRACE_RUN   1   /* gl switched in */
+#define FIL_TRACE_STOP  2   /* gl switched back out to the scheduler */
+#define FIL_TRACE_PARK  3   /* gl is about to park; arg is a FIL_TRACE_WHY_* */
+#define FIL_TRACE_WAKE  4   /* wakeup queued for gl; arg 1 if its timeout */
+#define FIL_TRACE_IDLE  5   /* the scheduler found nothing to run and sleeps */
+#define FIL_TRACE_BUSY  6   /* ... and is awake again */
+
+/* Why a greenthread parked.  Keep in step with _WHY in filament/trace.py. */
+#define FIL_TRACE_WHY_OTHER     0
+#define FIL_TRACE_WHY_YIELD     1
+#define FIL_TRACE_WHY_SLEEP     2
+#define FIL_TRACE_WHY_LOCK      3
+#define FIL_TRACE_WHY_COND      4
+#define FIL_TRACE_WHY_EVENT     5
+#define FIL_TRACE_WHY_QUEUE     6
+#define FIL_TRACE_WHY_FD_READ   7
+#define FIL_TRACE_WHY_FD_WRITE  8
+#define FIL_TRACE_WHY_THRPOOL   9
+#define FIL_TRACE_WHY_JOIN      10
+#define FIL_TRACE_WHY_WAITSET   11
+#define FIL_TRACE_WHY_PREEMPT   12
+
+typedef struct _fil_trace_record
+{
+    /* Slot index + 1 once the record is complete; see above. */
+    uint64_t seq;
+    uint64_t ticks;
+    /* The greenlet, by address: an identity, never dereferenced. */
+    uint64_t gl;
+    uint64_t arg;
+    uint32_t type;
+    /* Low 32 bits of the writing thread's ident -- the scheduler's own
+     * thread, or whoever queued a wakeup. */
+    uint32_t tid;
+} FilTraceRecord;
+
+typedef struct _fil_trace_ring FilTraceRing;
+
+struct _fil_trace_ring
+{
+    /* Registry links; see src/core/fil_trace.c. */
+    FilTraceRing *prev;
+    FilTraceRing *next;
+    /* Cleared by trace_mode("off"); the ring stays attached. */
+    int active;
+    /* 0 once the owning scheduler is gone; the records stay readable. */
+    int attached;
+    unsigned long thread_id;
+    /* Next slot to claim, and where the current trace_mode("on") began. */
+    uint64_t head;
+    uint64_t start;
+    uint64_t mask;
+    FilTraceRecord records[1];
+};
+
+static inline uint64_t fil_trace_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    uint32_t lo, hi;
+
+    __asm__ __volatile__ ("rdtsc" : "=a" (lo), "=d" (hi));
+    return ((uint64_t)hi << 32) | lo;
+#elif defined(__aarch64__)
+    uint64_t v;
+
+    __asm__ __volatile__ ("mrs %0, cntvct_el0" : "=r" (v));
+    return v;
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static inline void fil_trace_emit(FilTraceRing *ring, uint32_t type,
+                                  const void *gl, uint64_t arg)
+{
+    uint64_t idx = __atomic_fetch_add(&(ring->head), 1, __ATOMIC_RELAXED);
+    FilTraceRecord *rec = &(ring->records[idx & ring->mask]);
+
+    __atomic_store_n(&(rec->seq), 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    rec->ticks = fil_trace_ticks();
+    rec->gl = (uint64_t)(uintptr_t)gl;
+    rec->arg = arg;
+    rec->type = type;
+    rec->tid = (uint32_t)PyThread_get_thread_ident();
+    __atomic_store_n(&(rec->seq), idx + 1, __ATOMIC_RELEASE);
+}
+
+/* The record site: 'sched' is the PyFilScheduler the record belongs to. */
+#define FIL_TRACE(__sched, __type, __gl, __arg)                             \
+    do {                                                                    \
+        FilTraceRing *__ring =                                              \
+            __atomic_load_n(&((__sched)->trace), __ATOMIC_ACQUIRE);         \
+        if (__ring != NULL &&                                               \
+            __atomic_load_n(&(__ring->active), __ATOMIC_RELAXED))           \
+        {                                                                   \
+            fil_trace_emit(__ring, (__type), (__gl), (uint64_t)(__arg));    \
+        }                                                                   \
+    } while (0)
+
+#ifdef __FIL_BUILDING_CORE__
+
+typedef struct _pyfilcore_capi PyFilCore_CAPIObject;
+
+/* src/core/fil_trace.c */
+extern int fil_trace_wanted;
+int fil_trace_init(PyObject *module, PyFilCore_CAPIObject *capi);
+/* Give 'sched' a ring if tracing is on and it has none; scheduler thread. */
+void fil_trace_attach(PyFilScheduler *sched);
+/* Scheduler dealloc: the ring outlives it, for reading. */
+void fil_trace_detach(PyFilScheduler *sched);
+
+#endif
+
+#endif /* __FIL_CORE_TRACE_H__ */
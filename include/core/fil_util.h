@@ -466,4 +466,84 @@ static inline void fil_set_timeout_exc(PyObject *timeout_exc)
     PyErr_Restore(exc_type, exc_value, exc_tb);
 }
 
+/*
+ * Have os.fork() call the given METH_NOARGS functions before forking and
+ * after it, in the parent and in the child; any of them may be NULL.  These
+ * run with the GIL held -- in the child, after CPython has reinitialized its
+ * own runtime -- which is what resetting anything that involves Python
+ * objects or thread states needs and what a pthread_atfork() child handler
+ * does not get.  A fork made behind CPython's back (a C library calling
+ * fork() itself) skips them; only exec is safe after one of those anyway.
+ * A no-op before 3.7, which has no os.register_at_fork().
+ */
+static inline int fil_register_at_fork(PyMethodDef *before,
+                                       PyMethodDef *after_in_parent,
+                                       PyMethodDef *after_in_child)
+{
+#if PY_VERSION_HEX >= 0x03070000
+    PyMethodDef *defs[3] = { before, after_in_parent, after_in_child };
+    static const char *names[3] = { "before", "after_in_parent", "after_in_child" };
+    PyObject *kwargs;
+    PyObject *os_mod;
+    PyObject *reg;
+    PyObject *res = NULL;
+    int i;
+
+    kwargs = PyDict_New();
+    if (kwargs == NULL)
+    {
+        return -1;
+    }
+
+    for (i = 0; i < 3; i++)
+    {
+        PyObject *cb;
+        int err;
+
+        if (defs[i] == NULL)
+        {
+            continue;
+        }
+        cb = PyCFunction_NewEx(defs[i], NULL, NULL);
+        if (cb == NULL)
+        {
+            goto done;
+        }
+        err = PyDict_SetItemString(kwargs, names[i], cb);
+        Py_DECREF(cb);
+        if (err < 0)
+        {
+            goto done;
+        }
+    }
+
+    os_mod = PyImport_ImportModule("os");
+    if (os_mod == NULL)
+    {
+        goto done;
+    }
+    reg = PyObject_GetAttrString(os_mod, "register_at_fork");
+    Py_DECREF(os_mod);
+    if (reg == NULL)
+    {
+        goto done;
+    }
+    res = PyObject_Call(reg, fil_empty_tuple(), kwargs);
+    Py_DECREF(reg);
+
+done:
+    Py_DECREF(kwargs);
+    if (res == NULL)
+    {
+        return -1;
+    }
+    Py_DECREF(res);
+#else
+    (void)before;
+    (void)after_in_parent;
+    (void)after_in_child;
+#endif
+    return 0;
+}
+
 #endif /* __FIL_UTIL_H__ */
@@ -42,6 +42,9 @@ struct _fil_waiter {
      * last touch of the waiter strictly before the free. If a code path ever
      * needs to change refcnt from another thread, this must become atomic. */
     unsigned int refcnt;
+    /* Priority class of the parked greenthread (FIL_SCHED_PRIO_*): its
+     * wakeup, and its timeout, are queued in this class. */
+    int prio;
     /* Handle on the scheduler event that would fire this waiter's timeout,
      * while it is queued (see fil_scheduler_add_event_ref).  The scheduler
      * NULLs it when the event leaves the queue, so a wait that is signaled
@@ -169,6 +172,7 @@ static inline FilWaiter *fil_waiter_alloc(void)
         waiter->gl = NULL;
         waiter->flags = 0;
         waiter->refcnt = 1;
+        waiter->prio = FIL_SCHED_PRIO_NORMAL;
         waiter->timeout_event = NULL;
         waiter->switch_event = NULL;
         return waiter;
@@ -182,6 +186,7 @@ static inline FilWaiter *fil_waiter_alloc(void)
         waiter->gl = NULL;
         waiter->flags = 0;
         waiter->refcnt = 1;
+        waiter->prio = FIL_SCHED_PRIO_NORMAL;
         waiter->timeout_event = NULL;
         waiter->switch_event = NULL;
         pthread_mutex_init(&(waiter->waiter_lock), NULL);
@@ -255,6 +260,7 @@ static inline void _fil_waiter_handle_timeout(PyFilScheduler *sched, FilWaiter *
     pthread_mutex_lock(&(waiter->waiter_lock));
     if (!fil_waiter_signaled(waiter) && fil_waiter_waiting(waiter))
     {
+        FIL_TRACE(sched, FIL_TRACE_WAKE, waiter->gl, 1);
         _fil_waiter_queue_switch(waiter, sched);
     }
     pthread_mutex_unlock(&(waiter->waiter_lock));
@@ -290,7 +296,16 @@ static inline void _fil_waiter_switch_event_cb(PyFilScheduler *sched, void *cb_a
          * for you" here.  Clearing it before the switch would let the
          * greenthread conclude nobody had queued a wakeup and drop the
          * reservation that this callback is about to drop as well. */
-        PyObject *result = fil_greenlet_switch_noargs(gl);
+        PyObject *result;
+
+        FIL_TRACE(sched, FIL_TRACE_RUN, gl, 0);
+        FIL_BLOCKWATCH_RUNNING(sched, gl);
+        FIL_SCHED_STAT_INC(sched, switches);
+        fil_preempt_begin(&(sched->preempt), gl);
+        result = fil_greenlet_switch_noargs(gl);
+        fil_preempt_end(&(sched->preempt));
+        FIL_BLOCKWATCH_RUNNING(sched, NULL);
+        FIL_TRACE(sched, FIL_TRACE_STOP, gl, 0);
         Py_XDECREF(result);
         Py_DECREF(gl);
     }
@@ -309,7 +324,8 @@ static inline void _fil_waiter_queue_switch(FilWaiter *waiter, PyFilScheduler *s
      * signaler (or the timeout callback) from queueing a second switch. */
     waiter->flags &= ~FIL_WAITER_FLAGS_WAITING;
 
-    if (fil_scheduler_add_event_ref(sched, NULL, 0,
+    if (fil_scheduler_add_event_ref(sched, NULL,
+                                    FIL_SCHED_EVENT_FLAGS_PRIO(waiter->prio),
                                     _fil_waiter_switch_event_cb, waiter,
                                     &(waiter->switch_event)) < 0)
     {
@@ -326,6 +342,12 @@ static inline void _fil_waiter_queue_switch(FilWaiter *waiter, PyFilScheduler *s
 /*
  * Wait for this waiter to be signaled.
  *
+ * 'why' (a FIL_TRACE_WHY_*) is what the scheduler trace records as the
+ * reason for parking.  fil_waiter_wait() passes FIL_WAIT_WHY, which a source
+ * file defines before including filament.h when all of its waits are of one
+ * kind (the lock module's are locks); a file with several kinds calls
+ * fil_waiter_wait_why() directly.
+ *
  * Returns:
  *   0                          signaled: whatever the signal handed over
  *                              (lock ownership, a semaphore count, a queued
@@ -344,7 +366,7 @@ static inline void _fil_waiter_queue_switch(FilWaiter *waiter, PyFilScheduler *s
  *   -ETIMEDOUT                 the deadline passed (timeout_exc is pending).
  *   -1                         not signaled; an exception is pending.
  */
-static inline int fil_waiter_wait(FilWaiter *waiter, struct timespec *ts, PyObject *timeout_exc)
+static inline int fil_waiter_wait_why(FilWaiter *waiter, struct timespec *ts, PyObject *timeout_exc, int why)
 {
     int err;
 
@@ -436,6 +458,8 @@ static inline int fil_waiter_wait(FilWaiter *waiter, struct timespec *ts, PyObje
         return PyErr_Occurred() ? FIL_WAITER_SIGNALED_UNWIND : 0;
     }
 
+    /* We are the greenthread _sched_main is running, so its class is ours. */
+    waiter->prio = waiter->sched->running_prio;
     waiter->gl = PyGreenlet_GetCurrent();
     if (waiter->gl == NULL)
     {
@@ -476,7 +500,8 @@ static inline int fil_waiter_wait(FilWaiter *waiter, struct timespec *ts, PyObje
         if (ts != NULL && waiter->timeout_event == NULL)
         {
             waiter->refcnt++;
-            if (fil_scheduler_add_event_ref(waiter->sched, ts, 0,
+            if (fil_scheduler_add_event_ref(waiter->sched, ts,
+                                            FIL_SCHED_EVENT_FLAGS_PRIO(waiter->prio),
                                             (fil_event_cb_t)_fil_waiter_handle_timeout,
                                             waiter, &(waiter->timeout_event)) < 0)
             {
@@ -491,6 +516,7 @@ static inline int fil_waiter_wait(FilWaiter *waiter, struct timespec *ts, PyObje
             }
         }
 
+        FIL_TRACE(waiter->sched, FIL_TRACE_PARK, waiter->gl, why);
         fil_scheduler_switch(waiter->sched);
 
         /* Signaled (or thrown into) before the deadline?  Take the timeout
@@ -601,6 +627,7 @@ static inline int fil_waiter_wait(FilWaiter *waiter, struct timespec *ts, PyObje
             return -1;
         }
 
+        waiter->prio = waiter->sched->running_prio;
         waiter->gl = PyGreenlet_GetCurrent();
         if (waiter->gl == NULL)
         {
@@ -609,6 +636,12 @@ static inline int fil_waiter_wait(FilWaiter *waiter, struct timespec *ts, PyObje
     }
 }
 
+#ifndef FIL_WAIT_WHY
+#define FIL_WAIT_WHY FIL_TRACE_WHY_OTHER
+#endif
+#define fil_waiter_wait(waiter, ts, timeout_exc) \
+    fil_waiter_wait_why(waiter, ts, timeout_exc, FIL_WAIT_WHY)
+
 /*
  * Wake the waiter (common implementation).
  *
@@ -698,6 +731,7 @@ static inline void _fil_waiter_signal_common(FilWaiter *waiter, int have_gil)
          * Works with or without the GIL: the event carries the waiter and the
          * reservation the parked greenthread made for it, so nothing here
          * touches a refcount.  See the wakeup contract above. */
+        FIL_TRACE(sched, FIL_TRACE_WAKE, waiter->gl, 0);
         _fil_waiter_queue_switch(waiter, sched);
     }
 
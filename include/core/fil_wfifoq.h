@@ -78,6 +78,9 @@ typedef struct _fil_wfifoq {
 #ifdef Py_GIL_DISABLED
     pthread_mutex_t lock;
 #endif
+    /* Contention profile; NULL unless the owner attached one (see
+     * core/fil_lockprof.h).  Gets and puts both count as acquisitions. */
+    FilLockProf *prof;
 } FilWFifoQ;
 
 #define fil_wfifoq_len(__q) ((__q)->queue.len)
@@ -183,6 +186,7 @@ static inline void fil_wfifoq_deinit(FilWFifoQ *q)
     }
     Py_CLEAR(q->empty_error);
     Py_CLEAR(q->full_error);
+    fil_lockprof_detach(&(q->prof));
 #ifdef Py_GIL_DISABLED
     if (q->_queue_inited)
     {
@@ -211,18 +215,40 @@ static inline PyObject *_fil_wfifoq_put(FilWFifoQ *q, PyObject *item)
     }
 
     fil_waiterlist_signal_first(q->getters);
+    if (q->prof != NULL)
+    {
+        fil_lockprof_acquired(q->prof);
+    }
     Py_RETURN_NONE;
 }
 
+/* Profiling for the blocking loops below: one contended get()/put() however
+ * many times it goes round, timed from its first wait to its last. */
+#define _FIL_WFIFOQ_PROF_BEGIN(__q, __start)                                \
+    do {                                                                    \
+        if ((__q)->prof != NULL && !(__start))                              \
+        {                                                                   \
+            (__start) = fil_lockprof_wait_begin((__q)->prof);               \
+        }                                                                   \
+    } while (0)
+
+#define _FIL_WFIFOQ_PROF_END(__q, __start)                                  \
+    do {                                                                    \
+        if (__start)                                                        \
+        {                                                                   \
+            fil_lockprof_wait_end((__q)->prof, (__start), 0);               \
+        }                                                                   \
+    } while (0)
+
 #ifndef Py_GIL_DISABLED
 
 /*
- * Stock build.  These four are byte-for-byte what they always were: the GIL is
- * the mutual exclusion, and adding even a no-op lock/unlock plus a result
- * temporary around them costs measurable throughput -- 3.7% on a queue
- * put/get benchmark, on top of the 6.6% the wait-function refactor cost before
- * it was split out.  The free-threading variants live below, separately, so
- * this path never changes shape.
+ * Stock build.  These four are what they always were, plus the profiler's
+ * NULL test on 'prof': the GIL is the mutual exclusion, and adding even a
+ * no-op lock/unlock plus a result temporary around them costs measurable
+ * throughput -- 3.7% on a queue put/get benchmark, on top of the 6.6% the
+ * wait-function refactor cost before it was split out.  The free-threading
+ * variants live below, separately, so this path never changes shape.
  */
 static inline PyObject *fil_wfifoq_put_nowait(FilWFifoQ *q, PyObject *item)
 {
@@ -236,12 +262,16 @@ static inline PyObject *fil_wfifoq_put_nowait(FilWFifoQ *q, PyObject *item)
 
 static inline PyObject *fil_wfifoq_put(FilWFifoQ *q, PyObject *item, struct timespec *ts)
 {
+    uint64_t start = 0;
+
     while(fil_wfifoq_full(q))
     {
+        _FIL_WFIFOQ_PROF_BEGIN(q, start);
         int err = fil_waiterlist_wait(q->putters, ts, q->full_error);
 
         if (err)
         {
+            _FIL_WFIFOQ_PROF_END(q, start);
             if (err == FIL_WAITER_SIGNALED_UNWIND)
             {
                 /* A get() made room and woke us, and we are unwinding out of
@@ -253,6 +283,7 @@ static inline PyObject *fil_wfifoq_put(FilWFifoQ *q, PyObject *item, struct time
             return NULL;
         }
     }
+    _FIL_WFIFOQ_PROF_END(q, start);
 
     return _fil_wfifoq_put(q, item);
 }
@@ -268,17 +299,25 @@ static inline PyObject *fil_wfifoq_get_nowait(FilWFifoQ *q)
     }
 
     fil_waiterlist_signal_first(q->putters);
+    if (q->prof != NULL)
+    {
+        fil_lockprof_acquired(q->prof);
+    }
     return res;
 }
 
 static inline PyObject *fil_wfifoq_get(FilWFifoQ *q, struct timespec *ts)
 {
+    uint64_t start = 0;
+
     while(!q->queue.len)
     {
+        _FIL_WFIFOQ_PROF_BEGIN(q, start);
         int err = fil_waiterlist_wait(q->getters, ts, q->empty_error);
 
         if (err)
         {
+            _FIL_WFIFOQ_PROF_END(q, start);
             if (err == FIL_WAITER_SIGNALED_UNWIND)
             {
                 /* An item arrived for us and we are unwinding out of get()
@@ -289,6 +328,7 @@ static inline PyObject *fil_wfifoq_get(FilWFifoQ *q, struct timespec *ts)
             return NULL;
         }
     }
+    _FIL_WFIFOQ_PROF_END(q, start);
 
     return fil_wfifoq_get_nowait(q);
 }
@@ -307,6 +347,10 @@ static inline PyObject *_fil_wfifoq_get_locked(FilWFifoQ *q)
     }
 
     fil_waiterlist_signal_first(q->putters);
+    if (q->prof != NULL)
+    {
+        fil_lockprof_acquired(q->prof);
+    }
     return res;
 }
 
@@ -334,14 +378,17 @@ static inline PyObject *fil_wfifoq_put_nowait(FilWFifoQ *q, PyObject *item)
 static inline PyObject *fil_wfifoq_put(FilWFifoQ *q, PyObject *item, struct timespec *ts)
 {
     PyObject *res;
+    uint64_t start = 0;
 
     FIL_WFIFOQ_LOCK(q);
     while(fil_wfifoq_full(q))
     {
+        _FIL_WFIFOQ_PROF_BEGIN(q, start);
         int err = FIL_WFIFOQ_WAIT(q, q->putters, ts, q->full_error);
 
         if (err)
         {
+            _FIL_WFIFOQ_PROF_END(q, start);
             if (err == FIL_WAITER_SIGNALED_UNWIND)
             {
                 fil_waiterlist_signal_first_keep_exc(q->putters);
@@ -350,6 +397,7 @@ static inline PyObject *fil_wfifoq_put(FilWFifoQ *q, PyObject *item, struct time
             return NULL;
         }
     }
+    _FIL_WFIFOQ_PROF_END(q, start);
 
     res = _fil_wfifoq_put(q, item);
     FIL_WFIFOQ_UNLOCK(q);
@@ -369,14 +417,17 @@ static inline PyObject *fil_wfifoq_get_nowait(FilWFifoQ *q)
 static inline PyObject *fil_wfifoq_get(FilWFifoQ *q, struct timespec *ts)
 {
     PyObject *res;
+    uint64_t start = 0;
 
     FIL_WFIFOQ_LOCK(q);
     while(!q->queue.len)
     {
+        _FIL_WFIFOQ_PROF_BEGIN(q, start);
         int err = FIL_WFIFOQ_WAIT(q, q->getters, ts, q->empty_error);
 
         if (err)
         {
+            _FIL_WFIFOQ_PROF_END(q, start);
             if (err == FIL_WAITER_SIGNALED_UNWIND)
             {
                 fil_waiterlist_signal_first_keep_exc(q->getters);
@@ -385,6 +436,7 @@ static inline PyObject *fil_wfifoq_get(FilWFifoQ *q, struct timespec *ts)
             return NULL;
         }
     }
+    _FIL_WFIFOQ_PROF_END(q, start);
 
     res = _fil_wfifoq_get_locked(q);
     FIL_WFIFOQ_UNLOCK(q);
@@ -393,4 +445,185 @@ static inline PyObject *fil_wfifoq_get(FilWFifoQ *q, struct timespec *ts)
 
 #endif /* Py_GIL_DISABLED */
 
+/*
+ * Batch put/get: a whole run moves under one lock hold, and only as many
+ * waiters are woken as there were items moved (fewer if fewer are parked),
+ * rather than one signal per put.  One body serves both builds -- the lock
+ * macros are no-ops on a stock build -- since the per-call cost is
+ * amortized over the batch.
+ */
+static inline void _fil_wfifoq_wake(FilWaiterList *waiters, uint64_t n)
+{
+    while (n-- && !fil_waiterlist_empty(*waiters))
+    {
+        fil_waiterlist_signal_first(*waiters);
+    }
+}
+
+/*
+ * Puts items[0..n) in order, waiting for room as needed unless !blocking.
+ * '*done' is how many went in, on failure too: items already queued stay
+ * queued.  Fails with full_error only if nothing went in; a timeout after
+ * partial progress returns 0 with *done < n.
+ */
+static inline int fil_wfifoq_put_many(FilWFifoQ *q, PyObject **items, Py_ssize_t n,
+                                      int blocking, struct timespec *ts, Py_ssize_t *done)
+{
+    uint64_t start = 0;
+    uint64_t room;
+    uint64_t put;
+    Py_ssize_t i;
+    int err;
+
+    *done = 0;
+    FIL_WFIFOQ_LOCK(q);
+    while (*done < n)
+    {
+        room = fil_wfifoq_full(q) ? 0 : q->max_size - q->queue.len;
+        if (room > (uint64_t)(n - *done))
+        {
+            room = n - *done;
+        }
+        if (room)
+        {
+            for (i = *done; i < *done + (Py_ssize_t)room; i++)
+            {
+                Py_INCREF(items[i]);
+            }
+            put = fil_fifoq_put_many(&(q->queue), (void **)(items + *done), room);
+            /* Just-taken references: the caller holds its own. */
+            for (i = *done + put; i < *done + (Py_ssize_t)room; i++)
+            {
+                Py_DECREF(items[i]);
+            }
+            *done += put;
+            _fil_wfifoq_wake(&(q->getters), put);
+            if (put < room)
+            {
+                _FIL_WFIFOQ_PROF_END(q, start);
+                FIL_WFIFOQ_UNLOCK(q);
+                PyErr_SetString(PyExc_MemoryError, "out of memory inserting queue entry");
+                return -1;
+            }
+            /* Waking a native thread drops the GIL for the signal, so the
+             * queue may have changed: test for room again before waiting. */
+            continue;
+        }
+
+        if (!blocking)
+        {
+            break;
+        }
+
+        _FIL_WFIFOQ_PROF_BEGIN(q, start);
+        err = FIL_WFIFOQ_WAIT(q, q->putters, ts, q->full_error);
+        if (err)
+        {
+            if (err == FIL_WAITER_SIGNALED_UNWIND)
+            {
+                fil_waiterlist_signal_first_keep_exc(q->putters);
+            }
+            _FIL_WFIFOQ_PROF_END(q, start);
+            FIL_WFIFOQ_UNLOCK(q);
+            if (err == -ETIMEDOUT && *done)
+            {
+                PyErr_Clear();
+                return 0;
+            }
+            return -1;
+        }
+    }
+    _FIL_WFIFOQ_PROF_END(q, start);
+    if (q->prof != NULL)
+    {
+        fil_lockprof_acquired(q->prof);
+    }
+    FIL_WFIFOQ_UNLOCK(q);
+
+    if (*done == 0 && n)
+    {
+        PyErr_SetNone(q->full_error);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Waits (unless !blocking) for the queue to be non-empty, then takes up to
+ * 'max_items' without waiting again.  Returns them as a list.
+ */
+static inline PyObject *fil_wfifoq_get_many(FilWFifoQ *q, Py_ssize_t max_items,
+                                            int blocking, struct timespec *ts)
+{
+    uint64_t start = 0;
+    uint64_t n;
+    PyObject **items;
+    PyObject *res;
+    uint64_t i;
+    int err;
+
+    FIL_WFIFOQ_LOCK(q);
+    while (!q->queue.len)
+    {
+        if (!blocking)
+        {
+            FIL_WFIFOQ_UNLOCK(q);
+            PyErr_SetNone(q->empty_error);
+            return NULL;
+        }
+
+        _FIL_WFIFOQ_PROF_BEGIN(q, start);
+        err = FIL_WFIFOQ_WAIT(q, q->getters, ts, q->empty_error);
+        if (err)
+        {
+            if (err == FIL_WAITER_SIGNALED_UNWIND)
+            {
+                fil_waiterlist_signal_first_keep_exc(q->getters);
+            }
+            _FIL_WFIFOQ_PROF_END(q, start);
+            FIL_WFIFOQ_UNLOCK(q);
+            return NULL;
+        }
+    }
+    _FIL_WFIFOQ_PROF_END(q, start);
+
+    n = q->queue.len;
+    if (n > (uint64_t)max_items)
+    {
+        n = max_items;
+    }
+    /* Plain malloc, not a list: nothing under the queue lock may run the
+     * collector (or a finalizer that touches this queue). */
+    items = malloc(n * sizeof(PyObject *));
+    if (items == NULL)
+    {
+        FIL_WFIFOQ_UNLOCK(q);
+        return PyErr_NoMemory();
+    }
+    fil_fifoq_get_many(&(q->queue), (void **)items, n);
+    _fil_wfifoq_wake(&(q->putters), n);
+    if (q->prof != NULL)
+    {
+        fil_lockprof_acquired(q->prof);
+    }
+    FIL_WFIFOQ_UNLOCK(q);
+
+    res = PyList_New(n);
+    if (res == NULL)
+    {
+        for (i = 0; i < n; i++)
+        {
+            Py_DECREF(items[i]);
+        }
+        free(items);
+        return NULL;
+    }
+    for (i = 0; i < n; i++)
+    {
+        PyList_SET_ITEM(res, i, items[i]);
+    }
+    free(items);
+    return res;
+}
+
 #endif /* __FIL_CORE_WFIFOQ_H__ */
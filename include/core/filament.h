@@ -29,11 +29,17 @@
 #include <time.h>
 #include <unistd.h>
 #include "pyversion.h"
+#include "core/fil_blockwatch.h"
 #include "core/fil_exceptions.h"
 #include "core/fil_fifoq.h"
+#include "core/fil_histogram.h"
+#include "core/fil_local.h"
+#include "core/fil_lockprof.h"
 #include "core/fil_message.h"
+#include "core/fil_preempt.h"
 #include "core/fil_scheduler.h"
 #include "core/fil_thrpool.h"
+#include "core/fil_trace.h"
 #include "core/fil_util.h"
 #include "core/fil_waiter.h"
 #include "core/fil_wfifoq.h"
@@ -64,12 +70,22 @@ typedef struct _pyfilcore_capi
      * through a shifted pointer. */
     int (*fil_scheduler_add_event_ref)(PyFilScheduler *sched, struct timespec *ts, uint32_t flags, fil_event_cb_t cb, void *cb_arg, FilSchedEvent **owner_ref);
     int (*fil_scheduler_del_event)(PyFilScheduler *sched, FilSchedEvent **owner_ref);
+    int (*filament_spawn_n)(PyObject *method, PyObject *args, PyObject *kwargs);
+    int (*fil_waitset_register_type)(PyTypeObject *type, fil_waitable_link_t link, fil_waitable_unlink_t unlink);
+    int (*fil_lockprof_attach)(FilLockProf **prof, const char *kind);
+    void (*fil_lockprof_detach)(FilLockProf **prof);
+    void (*fil_preempt_hold)(int delta);
 } PyFilCore_CAPIObject;
 
 #ifdef __FIL_BUILDING_CORE__
 
 extern PyTypeObject *PyFilament_Type;
 PyFilament *filament_alloc(PyObject *method, PyObject *args, PyObject *kwargs);
+int filament_spawn_n(PyObject *method, PyObject *args, PyObject *kwargs);
+PyFilMessage *fil_filament_message(PyFilament *fil);
+void fil_filament_finish_exception(PyFilament *fil, PyObject *exc_type,
+                                   PyObject *exc_value, PyObject *exc_tb);
+void fil_filament_freelist_clear(PyFilScheduler *sched);
 
 #else
 
@@ -78,6 +94,7 @@ static PyFilCore_CAPIObject *_PY_FIL_CORE_API;
 static PyTypeObject *PyFilament_Type;
 
 static PyFilament *(*filament_alloc)(PyObject *method, PyObject *args, PyObject *kwargs);
+static int (*filament_spawn_n)(PyObject *method, PyObject *args, PyObject *kwargs);
 
 static inline int PyFilCore_Import(void)
 {
@@ -104,6 +121,11 @@ static inline int PyFilCore_Import(void)
 
     PyFilament_Type = _PY_FIL_CORE_API->filament_type;
     filament_alloc = _PY_FIL_CORE_API->filament_alloc;
+    filament_spawn_n = _PY_FIL_CORE_API->filament_spawn_n;
+    fil_waitset_register_type = _PY_FIL_CORE_API->fil_waitset_register_type;
+    fil_lockprof_attach = _PY_FIL_CORE_API->fil_lockprof_attach;
+    fil_lockprof_detach = _PY_FIL_CORE_API->fil_lockprof_detach;
+    fil_preempt_hold = _PY_FIL_CORE_API->fil_preempt_hold;
     PyFil_TimeoutExc = _PY_FIL_CORE_API->timeout_exc;
     fil_scheduler_get = _PY_FIL_CORE_API->fil_scheduler_get;
     fil_scheduler_add_event = _PY_FIL_CORE_API->fil_scheduler_add_event;
@@ -246,6 +246,113 @@ static inline PyObject *fil_greenlet_switch_noargs(PyGreenlet *g)
     return PyGreenlet_Switch(g, NULL, NULL);
 }
 
+/*
+ * ------------------------------------------------------------------
+ * Per-spawn fiber stacks.
+ *
+ * The vendored greenlet's fiber core can give a greenthread a stack of
+ * its own size class and record, per spawn site, how deep its stack got
+ * (see vendor/greenlet/fil_fiber.hpp).  It exports
+ * "_fil_greenlet._C_FIBER_API", an
+ * int (*)(PyObject *g, PyObject *site_callable, Py_ssize_t stack_size)
+ * that must be called before the greenlet's first switch; stack_size < 0
+ * means "not given".  Without the fiber core (classic stack slicing, a
+ * stock greenlet, Python 2) there are no per-greenlet stacks to size and
+ * nothing to profile, so this quietly does nothing.
+ * ------------------------------------------------------------------
+ */
+#if _FIL_PYTHON3
+__attribute__((unused)) static int (*_fil_fiber_configure_fp)(PyObject *, PyObject *, Py_ssize_t) = NULL;
+__attribute__((unused)) static int _fil_fiber_configure_tried = 0;
+#endif
+
+static inline int fil_greenlet_configure_stack(PyGreenlet *g, PyObject *site_callable,
+                                               Py_ssize_t stack_size)
+{
+#if _FIL_PYTHON3
+    if (!_fil_fiber_configure_tried)
+    {
+        _fil_fiber_configure_tried = 1;
+        _fil_fiber_configure_fp = (int (*)(PyObject *, PyObject *, Py_ssize_t))PyCapsule_Import(
+            "_fil_greenlet._C_FIBER_API", 0);
+        if (_fil_fiber_configure_fp == NULL)
+        {
+            PyErr_Clear();
+        }
+    }
+    if (_fil_fiber_configure_fp != NULL)
+    {
+        return _fil_fiber_configure_fp((PyObject *)g, site_callable, stack_size);
+    }
+#endif
+    return 0;
+}
+
+/*
+ * ------------------------------------------------------------------
+ * Quiet profile function.
+ *
+ * The vendored greenlet turns its debug mode (eager frame
+ * materialization, see vendor/greenlet/TGreenlet.hpp) on for any
+ * thread with a profile function installed.  Filament's time-slice
+ * preemption hook never looks at a frame, so it is registered through
+ * "_fil_greenlet._C_QUIET_PROFILE_API", a void (*)(Py_tracefunc), to
+ * leave switches fast.  With a stock greenlet the hook only costs the
+ * slower switches.
+ * ------------------------------------------------------------------
+ */
+static inline void fil_greenlet_quiet_profile(Py_tracefunc func)
+{
+#if _FIL_PYTHON3
+    void (*set_fp)(Py_tracefunc);
+
+    set_fp = (void (*)(Py_tracefunc))PyCapsule_Import(
+        "_fil_greenlet._C_QUIET_PROFILE_API", 0);
+    if (set_fp == NULL)
+    {
+        PyErr_Clear();
+        return;
+    }
+    set_fp(func);
+#else
+    (void)func;
+#endif
+}
+
+/*
+ * Step out of (and back into) the "inside a trace/profile function" state,
+ * for a profile function that switches greenlets: the greenthread switched
+ * to must not run with tracing suspended.  3.11 made this public.
+ */
+#if PY_VERSION_HEX >= 0x030B0000
+#define fil_tstate_leave_tracing(ts)    PyThreadState_LeaveTracing(ts)
+#define fil_tstate_enter_tracing(ts)    PyThreadState_EnterTracing(ts)
+#elif PY_VERSION_HEX >= 0x030A0000
+#define fil_tstate_leave_tracing(ts)                                      \
+    do {                                                                  \
+        (ts)->tracing--;                                                  \
+        (ts)->cframe->use_tracing = ((ts)->c_tracefunc != NULL ||         \
+                                     (ts)->c_profilefunc != NULL);        \
+    } while (0)
+#define fil_tstate_enter_tracing(ts)                                      \
+    do {                                                                  \
+        (ts)->tracing++;                                                  \
+        (ts)->cframe->use_tracing = 0;                                    \
+    } while (0)
+#else
+#define fil_tstate_leave_tracing(ts)                                      \
+    do {                                                                  \
+        (ts)->tracing--;                                                  \
+        (ts)->use_tracing = ((ts)->c_tracefunc != NULL ||                 \
+                             (ts)->c_profilefunc != NULL);                \
+    } while (0)
+#define fil_tstate_enter_tracing(ts)                                      \
+    do {                                                                  \
+        (ts)->tracing++;                                                  \
+        (ts)->use_tracing = 0;                                            \
+    } while (0)
+#endif
+
 /*
  * Is the interpreter tearing down?  Threads that outlive the runtime (e.g.
  * thread-pool workers) must not attach a thread state once finalization has
@@ -265,4 +372,19 @@ static inline int fil_py_is_finalizing(void)
 #endif
 }
 
+/*
+ * Generic attribute access against a caller-supplied instance dict (what
+ * greenthread-local objects do with the current greenthread's dict).  3.7
+ * added a 'suppress' flag to the getter; we always want the AttributeError.
+ */
+#if PY_VERSION_HEX >= 0x03070000
+#define fil_generic_getattr_with_dict(o, n, d)                            \
+    _PyObject_GenericGetAttrWithDict((o), (n), (d), 0)
+#else
+#define fil_generic_getattr_with_dict(o, n, d)                            \
+    _PyObject_GenericGetAttrWithDict((o), (n), (d))
+#endif
+#define fil_generic_setattr_with_dict(o, n, v, d)                         \
+    _PyObject_GenericSetAttrWithDict((o), (n), (v), (d))
+
 #endif /* __FIL_CORE_PYVERSION_H__ */
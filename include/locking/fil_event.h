@@ -0,0 +1,8 @@
+#ifndef __FIL_LOCKING_EVENT_H__
+#define __FIL_LOCKING_EVENT_H__
+
+#include <Python.h>
+
+int fil_event_type_init(PyObject *module);
+
+#endif /* __FIL_LOCKING_EVENT_H__ */
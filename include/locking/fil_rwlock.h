@@ -0,0 +1,8 @@
+#ifndef __FIL_LOCKING_RWLOCK_H__
+#define __FIL_LOCKING_RWLOCK_H__
+
+#include <Python.h>
+
+int fil_rwlock_type_init(PyObject *module);
+
+#endif /* __FIL_LOCKING_RWLOCK_H__ */
@@ -26,6 +26,7 @@
 #define __FILAMENT_QUEUE_FIL_QUEUE_H__
 
 #include "core/filament.h"
+#include "queue/fil_wheapq.h"
 
 typedef struct _pyfil_simple_queue {
     PyObject_HEAD
@@ -39,13 +40,71 @@ typedef struct _pyfil_queue {
     FilWaiterList task_done_waiters;
 } PyFilQueue;
 
+/* PriorityQueue and LifoQueue: Queue's interface over a FilWHeapQ. */
+typedef struct _pyfil_heap_queue {
+    PyObject_HEAD
+    FilWHeapQ queue;
+    uint64_t unfinished_tasks;
+    FilWaiterList task_done_waiters;
+} PyFilHeapQueue;
+
 #ifdef __FIL_BUILDING_QUEUE__
 
 extern PyObject *_FIL_QUEUE_EMPTY_ERROR, *_FIL_QUEUE_FULL_ERROR;
 extern PyTypeObject *_FIL_QUEUE_TYPE, *_FIL_SIMPLE_QUEUE_TYPE;
+extern PyTypeObject *_FIL_PRIORITY_QUEUE_TYPE, *_FIL_LIFO_QUEUE_TYPE;
 
 int fil_queue_init(PyObject *m);
 int fil_simplequeue_init(PyObject *m);
+int fil_heapqueue_init(PyObject *m);
+
+/*
+ * block/timeout for the batch methods, with get()/put()'s meaning: block
+ * false or a zero timeout means don't wait, and *ts is the deadline (NULL
+ * for none) otherwise.
+ */
+static inline int _fil_queue_block_args(PyObject *block, PyObject *timeout, int *blocking,
+                                        struct timespec *tsbuf, struct timespec **ts)
+{
+    double timeout_dbl = 0;
+
+    *ts = NULL;
+    *blocking = (block == NULL) ? 1 : PyObject_IsTrue(block);
+    if (*blocking < 0)
+    {
+        return -1;
+    }
+    if (!*blocking)
+    {
+        return 0;
+    }
+    if (fil_double_from_timeout_obj(timeout, &timeout_dbl))
+    {
+        return -1;
+    }
+    if (timeout_dbl == 0)
+    {
+        *blocking = 0;
+        return 0;
+    }
+    return fil_timespec_from_double_interval(timeout_dbl, tsbuf, ts);
+}
+
+/* get_many()'s max_items: a positive int. */
+static inline int _fil_queue_max_items(PyObject *obj, Py_ssize_t *max_items)
+{
+    *max_items = PyInt_AsSsize_t(obj);
+    if (*max_items == -1 && PyErr_Occurred())
+    {
+        return -1;
+    }
+    if (*max_items <= 0)
+    {
+        PyErr_SetString(PyExc_ValueError, "max_items must be a positive integer");
+        return -1;
+    }
+    return 0;
+}
 
 #endif
 
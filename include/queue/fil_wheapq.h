@@ -0,0 +1,539 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Copyright (c) 2019, Chris Behrens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+#ifndef __FILAMENT_QUEUE_FIL_WHEAPQ_H__
+#define __FILAMENT_QUEUE_FIL_WHEAPQ_H__
+
+#include "core/filament.h"
+
+/*
+ * The waiting queue behind PriorityQueue and LifoQueue: FilWFifoQ's waiter
+ * semantics over an array that is either a d-ary min-heap or, for a LIFO, a
+ * plain stack.
+ *
+ * The difference that matters is the heap's comparisons.  An item's __lt__
+ * may be Python code, and Python code can drop the GIL to another thread (or,
+ * perversely, switch greenthreads), so a heap operation is not atomic the way
+ * a fifo operation is.  While one is sifting, 'busy' is set and every other
+ * get()/put() parks on 'busy_waiters' until it is done.  On free-threading
+ * builds the queue lock is also dropped for the sift: running arbitrary code
+ * with a pthread mutex held invites deadlock (against another thread blocked
+ * on that mutex while attached, when the code triggers a stop-the-world
+ * collection).  A stack never compares and never sets 'busy'.
+ *
+ * A comparison that raises fails that get()/put() with the queue as it was:
+ * every sift records its path and swaps back along it.  The array is always a
+ * permutation of the queued items (sifts swap, they do not leave a hole), so
+ * the collector can traverse it even mid-sift.
+ *
+ * The lock order and the GIL-held reasoning are the same as FilWFifoQ's; see
+ * core/fil_wfifoq.h.
+ */
+#define FIL_WHEAPQ_LOCK(__q)    FIL_WFIFOQ_LOCK(__q)
+#define FIL_WHEAPQ_UNLOCK(__q)  FIL_WFIFOQ_UNLOCK(__q)
+#define FIL_WHEAPQ_WAIT(__q, __list, __ts, __exc) FIL_WFIFOQ_WAIT(__q, __list, __ts, __exc)
+
+/* 4 children per node: half the depth of a binary heap, and the children of
+ * a node share a cache line. */
+#define FIL_WHEAPQ_ARITY 4
+#define FIL_WHEAPQ_MIN_CAP 16
+/* Deeper than any 4-ary heap of 2^64 items. */
+#define FIL_WHEAPQ_MAX_DEPTH 34
+
+typedef struct _fil_wheapq {
+    int lifo;
+    int busy;
+    uint64_t max_size;
+    uint64_t len;
+    uint64_t cap;
+    PyObject **items;
+    PyObject *empty_error;
+    PyObject *full_error;
+
+    FilWaiterList getters;
+    FilWaiterList putters;
+    FilWaiterList busy_waiters;
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_t lock;
+#endif
+    /* Contention profile; see core/fil_lockprof.h. */
+    FilLockProf *prof;
+} FilWHeapQ;
+
+#define fil_wheapq_len(__q) ((__q)->len)
+#define fil_wheapq_empty(__q) (fil_wheapq_len(__q) == 0)
+/* max_size is (uint64_t)-1 if unlimited, as with FilWFifoQ. */
+#define fil_wheapq_full(__q) ((__q)->len >= (__q)->max_size)
+
+static inline int fil_wheapq_init(FilWHeapQ *q, uint64_t max_size, int lifo,
+                                  PyObject *empty_error, PyObject *full_error)
+{
+    q->items = malloc(FIL_WHEAPQ_MIN_CAP * sizeof(PyObject *));
+    if (q->items == NULL)
+    {
+        PyErr_SetString(PyExc_MemoryError, "out of memory allocating queue");
+        return -1;
+    }
+    q->cap = FIL_WHEAPQ_MIN_CAP;
+    q->len = 0;
+    q->lifo = lifo;
+    q->busy = 0;
+    if (max_size == 0)
+    {
+        max_size = (uint64_t)-1;
+    }
+    q->max_size = max_size;
+    Py_INCREF(empty_error);
+    q->empty_error = empty_error;
+    Py_INCREF(full_error);
+    q->full_error = full_error;
+    fil_waiterlist_init(q->getters);
+    fil_waiterlist_init(q->putters);
+    fil_waiterlist_init(q->busy_waiters);
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_init(&(q->lock), NULL);
+#endif
+    return 0;
+}
+
+/* GC support for the owning Python object; see fil_wfifoq_traverse(). */
+static inline int fil_wheapq_traverse(FilWHeapQ *q, visitproc visit, void *arg)
+{
+    uint64_t i;
+
+    for (i = 0; i < q->len; i++)
+    {
+        Py_VISIT(q->items[i]);
+    }
+    Py_VISIT(q->empty_error);
+    Py_VISIT(q->full_error);
+    return 0;
+}
+
+static inline void fil_wheapq_clear_items(FilWHeapQ *q)
+{
+    PyObject *item;
+
+    /* Pop before dropping: a finalizer may look at the queue. */
+    while (q->len)
+    {
+        item = q->items[--q->len];
+        Py_DECREF(item);
+    }
+}
+
+static inline void fil_wheapq_deinit(FilWHeapQ *q)
+{
+    assert(fil_waiterlist_empty(q->getters));
+    assert(fil_waiterlist_empty(q->putters));
+    assert(fil_waiterlist_empty(q->busy_waiters));
+    if (q->items != NULL)
+    {
+        fil_wheapq_clear_items(q);
+        free(q->items);
+        q->items = NULL;
+#ifdef Py_GIL_DISABLED
+        pthread_mutex_destroy(&(q->lock));
+#endif
+    }
+    Py_CLEAR(q->empty_error);
+    Py_CLEAR(q->full_error);
+    fil_lockprof_detach(&(q->prof));
+}
+
+/* Caller holds the queue lock. */
+static inline int _fil_wheapq_reserve(FilWHeapQ *q)
+{
+    PyObject **items;
+    uint64_t cap;
+
+    if (q->len < q->cap)
+    {
+        return 0;
+    }
+    cap = q->cap * 2;
+    if (cap > PY_SSIZE_T_MAX / sizeof(PyObject *) ||
+        (items = realloc(q->items, cap * sizeof(PyObject *))) == NULL)
+    {
+        PyErr_SetString(PyExc_MemoryError, "out of memory inserting queue entry");
+        return -1;
+    }
+    q->items = items;
+    q->cap = cap;
+    return 0;
+}
+
+/* Caller holds the queue lock.  Give back memory once a burst drains; a
+ * failed shrink just keeps the bigger array. */
+static inline void _fil_wheapq_shrink(FilWHeapQ *q)
+{
+    PyObject **items;
+
+    if (q->cap > FIL_WHEAPQ_MIN_CAP && q->len < q->cap / 4)
+    {
+        if ((items = realloc(q->items, (q->cap / 2) * sizeof(PyObject *))) != NULL)
+        {
+            q->items = items;
+            q->cap /= 2;
+        }
+    }
+}
+
+/*
+ * Three-way compare a and b without the rich compare when they are both
+ * exact floats or both exact ints whose values fit a C long.  1 if decided
+ * (-1, 0 or 1 into *cmp), 0 if the caller has to ask Python.
+ */
+static inline int _fil_wheapq_fast_cmp(PyObject *a, PyObject *b, int *cmp)
+{
+    if (PyFloat_CheckExact(a) && PyFloat_CheckExact(b))
+    {
+        double x = PyFloat_AS_DOUBLE(a), y = PyFloat_AS_DOUBLE(b);
+
+        /* NaN is unordered: let Python have it. */
+        if (x != x || y != y)
+        {
+            return 0;
+        }
+        *cmp = (x > y) - (x < y);
+        return 1;
+    }
+    if (PyLong_CheckExact(a) && PyLong_CheckExact(b))
+    {
+        int ovf_a, ovf_b;
+        long x = PyLong_AsLongAndOverflow(a, &ovf_a);
+        long y = PyLong_AsLongAndOverflow(b, &ovf_b);
+
+        if (ovf_a || ovf_b)
+        {
+            return 0;
+        }
+        *cmp = (x > y) - (x < y);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * a < b.  Priority-queue items are overwhelmingly numbers or tuples of them
+ * -- (priority, seq, payload) -- and tuple's own rich compare goes through
+ * an == and then a < on the first differing element, each via a dispatch.
+ * Here, elements that are numbers are compared in C (identical ones are
+ * equal, as for tuple compare), and the first one that is not falls back to
+ * the rich compare of the whole pair.
+ */
+static inline int _fil_wheapq_lt(PyObject *a, PyObject *b)
+{
+    Py_ssize_t i, n;
+    PyObject *x, *y;
+    int cmp;
+
+    if (PyTuple_CheckExact(a) && PyTuple_CheckExact(b))
+    {
+        n = PyTuple_GET_SIZE(a) < PyTuple_GET_SIZE(b) ? PyTuple_GET_SIZE(a) : PyTuple_GET_SIZE(b);
+        for (i = 0; i < n; i++)
+        {
+            x = PyTuple_GET_ITEM(a, i);
+            y = PyTuple_GET_ITEM(b, i);
+            if (x == y)
+            {
+                continue;
+            }
+            if (!_fil_wheapq_fast_cmp(x, y, &cmp))
+            {
+                return PyObject_RichCompareBool(a, b, Py_LT);
+            }
+            if (cmp)
+            {
+                return cmp < 0;
+            }
+        }
+        return PyTuple_GET_SIZE(a) < PyTuple_GET_SIZE(b);
+    }
+    if (_fil_wheapq_fast_cmp(a, b, &cmp))
+    {
+        return cmp < 0;
+    }
+    return PyObject_RichCompareBool(a, b, Py_LT);
+}
+
+#define _FIL_WHEAPQ_SWAP(__items, __a, __b) do {                        \
+    PyObject *__tmp = (__items)[__a];                                   \
+    (__items)[__a] = (__items)[__b];                                    \
+    (__items)[__b] = __tmp;                                             \
+} while (0)
+
+/* Undo a failed sift: path[0..depth) is where the item was before each
+ * swap, and 'pos' is where it is now. */
+static inline void _fil_wheapq_unwind(PyObject **items, uint64_t *path, int depth, uint64_t pos)
+{
+    while (depth--)
+    {
+        _FIL_WHEAPQ_SWAP(items, path[depth], pos);
+        pos = path[depth];
+    }
+}
+
+/* Move items[pos] up to its place.  Runs with 'busy' set: nothing else
+ * touches the array until it returns. */
+static inline int _fil_wheapq_sift_up(FilWHeapQ *q, uint64_t pos)
+{
+    PyObject **items = q->items;
+    uint64_t path[FIL_WHEAPQ_MAX_DEPTH];
+    uint64_t parent;
+    int depth = 0;
+    int lt;
+
+    while (pos > 0)
+    {
+        parent = (pos - 1) / FIL_WHEAPQ_ARITY;
+        if ((lt = _fil_wheapq_lt(items[pos], items[parent])) <= 0)
+        {
+            if (lt < 0)
+            {
+                _fil_wheapq_unwind(items, path, depth, pos);
+                return -1;
+            }
+            break;
+        }
+        path[depth++] = pos;
+        _FIL_WHEAPQ_SWAP(items, pos, parent);
+        pos = parent;
+    }
+    return 0;
+}
+
+/*
+ * Move items[0] down to its place.  Runs with 'busy' set.
+ *
+ * Floyd's variant: items[0] came from the bottom and almost always goes
+ * back near it, so follow the smallest child all the way to a leaf without
+ * comparing against it, then sift it up the few levels it belongs.  That
+ * saves a comparison per level against the textbook loop.
+ */
+static inline int _fil_wheapq_sift_down(FilWHeapQ *q)
+{
+    PyObject **items = q->items;
+    uint64_t path[2 * FIL_WHEAPQ_MAX_DEPTH];
+    uint64_t len = q->len;
+    uint64_t pos = 0;
+    uint64_t child, last, best, parent;
+    int depth = 0;
+    int lt;
+
+    while ((child = pos * FIL_WHEAPQ_ARITY + 1) < len)
+    {
+        last = child + FIL_WHEAPQ_ARITY;
+        if (last > len)
+        {
+            last = len;
+        }
+        for (best = child++; child < last; child++)
+        {
+            if ((lt = _fil_wheapq_lt(items[child], items[best])) < 0)
+            {
+                goto failed;
+            }
+            if (lt)
+            {
+                best = child;
+            }
+        }
+        path[depth++] = pos;
+        _FIL_WHEAPQ_SWAP(items, pos, best);
+        pos = best;
+    }
+
+    while (pos > 0)
+    {
+        parent = (pos - 1) / FIL_WHEAPQ_ARITY;
+        if ((lt = _fil_wheapq_lt(items[pos], items[parent])) <= 0)
+        {
+            if (lt < 0)
+            {
+                goto failed;
+            }
+            break;
+        }
+        path[depth++] = pos;
+        _FIL_WHEAPQ_SWAP(items, pos, parent);
+        pos = parent;
+    }
+    return 0;
+
+failed:
+    _fil_wheapq_unwind(items, path, depth, pos);
+    return -1;
+}
+
+/* Caller holds the queue lock and set 'busy'.  Clears it and lets the
+ * parked operations re-test, without clobbering a pending exception. */
+static inline void _fil_wheapq_unbusy(FilWHeapQ *q)
+{
+    q->busy = 0;
+    if (!fil_waiterlist_empty(q->busy_waiters))
+    {
+        PyObject *exc_type, *exc_value, *exc_tb;
+
+        PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+        fil_waiterlist_signal_all(q->busy_waiters);
+        PyErr_Restore(exc_type, exc_value, exc_tb);
+    }
+}
+
+/*
+ * Caller holds the queue lock.  Waits until no sift is in progress and, for
+ * 'wait_list' (putters or getters), until 'ready' says so -- re-tested after
+ * every wake.  !blocking fails at once with 'exc' if not ready; it still
+ * waits out another operation's sift, which is never long.  Returns with
+ * the lock held either way.
+ */
+#define _FIL_WHEAPQ_WAIT_UNTIL(__q, __ready, __wait_list, __blocking, __ts, __exc, __err) do { \
+    uint64_t __start = 0;                                                      \
+    (__err) = 0;                                                               \
+    while ((__q)->busy || !(__ready))                                          \
+    {                                                                          \
+        int __busy = (__q)->busy;                                              \
+        if (!__busy && !(__blocking))                                          \
+        {                                                                      \
+            PyErr_SetNone(__exc);                                              \
+            (__err) = -1;                                                      \
+            break;                                                             \
+        }                                                                      \
+        _FIL_WFIFOQ_PROF_BEGIN(__q, __start);                                  \
+        (__err) = __busy                                                       \
+            ? FIL_WHEAPQ_WAIT(__q, (__q)->busy_waiters, __ts, __exc)           \
+            : FIL_WHEAPQ_WAIT(__q, (__q)->__wait_list, __ts, __exc);           \
+        if (__err)                                                             \
+        {                                                                      \
+            if ((__err) == FIL_WAITER_SIGNALED_UNWIND && !__busy)              \
+            {                                                                  \
+                /* Room or an item was handed to us: pass it on. */            \
+                fil_waiterlist_signal_first_keep_exc((__q)->__wait_list);      \
+            }                                                                  \
+            break;                                                             \
+        }                                                                      \
+    }                                                                          \
+    _FIL_WFIFOQ_PROF_END(__q, __start);                                        \
+} while (0)
+
+/* put() and put_nowait(): None, or NULL with an exception set. */
+static inline PyObject *fil_wheapq_put(FilWHeapQ *q, PyObject *item, int blocking,
+                                       struct timespec *ts)
+{
+    uint64_t pos;
+    int err;
+
+    FIL_WHEAPQ_LOCK(q);
+    _FIL_WHEAPQ_WAIT_UNTIL(q, !fil_wheapq_full(q), putters, blocking, ts,
+                           q->full_error, err);
+    if (err || _fil_wheapq_reserve(q))
+    {
+        FIL_WHEAPQ_UNLOCK(q);
+        return NULL;
+    }
+
+    Py_INCREF(item);
+    pos = q->len++;
+    q->items[pos] = item;
+    if (!q->lifo && pos)
+    {
+        q->busy = 1;
+        FIL_WHEAPQ_UNLOCK(q);
+        err = _fil_wheapq_sift_up(q, pos);
+        FIL_WHEAPQ_LOCK(q);
+        if (err)
+        {
+            /* Unwound: the item is back in the slot it started in. */
+            q->len--;
+            _fil_wheapq_unbusy(q);
+            FIL_WHEAPQ_UNLOCK(q);
+            Py_DECREF(item);
+            return NULL;
+        }
+        _fil_wheapq_unbusy(q);
+    }
+
+    fil_waiterlist_signal_first(q->getters);
+    if (q->prof != NULL)
+    {
+        fil_lockprof_acquired(q->prof);
+    }
+    FIL_WHEAPQ_UNLOCK(q);
+    Py_RETURN_NONE;
+}
+
+/* get() and get_nowait(): the smallest (or newest) item, or NULL with an
+ * exception set. */
+static inline PyObject *fil_wheapq_get(FilWHeapQ *q, int blocking, struct timespec *ts)
+{
+    PyObject *item;
+    int err;
+
+    FIL_WHEAPQ_LOCK(q);
+    _FIL_WHEAPQ_WAIT_UNTIL(q, q->len, getters, blocking, ts, q->empty_error, err);
+    if (err)
+    {
+        FIL_WHEAPQ_UNLOCK(q);
+        return NULL;
+    }
+
+    if (q->lifo)
+    {
+        item = q->items[--q->len];
+    }
+    else
+    {
+        item = q->items[0];
+        if (--q->len)
+        {
+            q->items[0] = q->items[q->len];
+            q->busy = 1;
+            FIL_WHEAPQ_UNLOCK(q);
+            err = _fil_wheapq_sift_down(q);
+            FIL_WHEAPQ_LOCK(q);
+            if (err)
+            {
+                /* Unwound to the state just after the removal: undo it. */
+                q->items[q->len++] = q->items[0];
+                q->items[0] = item;
+                _fil_wheapq_unbusy(q);
+                FIL_WHEAPQ_UNLOCK(q);
+                return NULL;
+            }
+            _fil_wheapq_unbusy(q);
+        }
+    }
+    _fil_wheapq_shrink(q);
+
+    fil_waiterlist_signal_first(q->putters);
+    if (q->prof != NULL)
+    {
+        fil_lockprof_acquired(q->prof);
+    }
+    FIL_WHEAPQ_UNLOCK(q);
+    return item;
+}
+
+#endif /* __FILAMENT_QUEUE_FIL_WHEAPQ_H__ */
@@ -259,6 +259,13 @@ ext_modules = [
             'src/core/fil_scheduler.c',
             'src/core/fil_exceptions.c',
             'src/core/fil_message.c',
+            'src/core/fil_waitset.c',
+            'src/core/fil_lockprof.c',
+            'src/core/fil_trace.c',
+            'src/core/fil_blockwatch.c',
+            'src/core/fil_preempt.c',
+            'src/core/fil_local.c',
+            'src/core/fil_fanout.c',
         ],
         include_dirs=['./include'],
         libraries=['pthread'],
@@ -269,6 +276,7 @@ ext_modules = [
             'src/queue/fil_queue_mod.c',
             'src/queue/fil_queue.c',
             'src/queue/fil_simple_queue.c',
+            'src/queue/fil_heap_queue.c',
         ],
         include_dirs=['./include'],
         libraries=['pthread'],
@@ -277,8 +285,10 @@ ext_modules = [
         '_filament.locking',
         sources=[
             'src/locking/fil_cond.c',
+            'src/locking/fil_event.c',
             'src/locking/fil_lock.c',
             'src/locking/fil_locking.c',
+            'src/locking/fil_rwlock.c',
             'src/locking/fil_semaphore.c',
         ],
         include_dirs=['./include'],
@@ -0,0 +1,608 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#define __FIL_BUILDING_CORE__
+#include "core/filament.h"
+
+/*
+ * The blocking-call detector's watchdog; see core/fil_blockwatch.h.
+ *
+ * Every scheduler that has run a callback while the detector was on is on
+ * '_bw_list'.  '_bw_lock' covers the list, the histograms of schedulers that
+ * have gone ('_bw_retired') and the watchdog's settings.  The watchdog holds
+ * it while it scans, never while it waits for the GIL: with the GIL it takes
+ * the lock again and checks the run it found is still going before it
+ * reports it.  A scheduler only leaves the list in its dealloc, which holds
+ * the GIL, so a scheduler found on the list with the GIL held is alive, and
+ * so is the greenthread its running callback switched into.
+ *
+ * The reporter (a Python callable) is only touched with the GIL held.
+ */
+static pthread_mutex_t _bw_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _bw_cond = PTHREAD_COND_INITIALIZER;
+static FilBlockWatch _bw_list = { &_bw_list, &_bw_list };
+static uint64_t _bw_retired[FIL_BLOCKWATCH_BUCKETS];
+static uint64_t _bw_threshold_ns;
+static pthread_t _bw_thread;
+static int _bw_running;
+static int _bw_stopping;
+/* Bumped per watchdog thread, so one left over from a stop() made by its own
+ * reporter exits instead of running alongside a new one. */
+static uintptr_t _bw_generation;
+static PyObject *_bw_reporter;
+
+/* Read by each scheduler once per pass of its loop, and per callback. */
+int fil_blockwatch_wanted;
+
+void fil_blockwatch_attach(PyFilScheduler *sched)
+{
+    FilBlockWatch *bw = &(sched->blockwatch);
+
+    pthread_mutex_lock(&_bw_lock);
+    if (!bw->registered)
+    {
+        bw->thread_id = sched->thread_id;
+        bw->next = &_bw_list;
+        bw->prev = _bw_list.prev;
+        _bw_list.prev->next = bw;
+        _bw_list.prev = bw;
+        bw->registered = 1;
+    }
+    pthread_mutex_unlock(&_bw_lock);
+}
+
+static void __bw_retire(FilBlockWatch *bw)
+{
+    int i;
+
+    bw->prev->next = bw->next;
+    bw->next->prev = bw->prev;
+    bw->registered = 0;
+    for (i = 0; i < FIL_BLOCKWATCH_BUCKETS; i++)
+    {
+        _bw_retired[i] += bw->hist[i];
+    }
+}
+
+void fil_blockwatch_detach(PyFilScheduler *sched)
+{
+    if (!sched->blockwatch.registered)
+    {
+        return;
+    }
+    pthread_mutex_lock(&_bw_lock);
+    __bw_retire(&(sched->blockwatch));
+    pthread_mutex_unlock(&_bw_lock);
+}
+
+/* [(filename, lineno, name), ...], outermost first, of what the thread
+ * 'thread_id' is running now; empty if it is not running Python code. */
+static PyObject *__bw_stack(unsigned long thread_id)
+{
+    PyObject *current_frames = PySys_GetObject("_current_frames");
+    PyObject *frames;
+    PyObject *key;
+    PyObject *stack;
+    PyFrameObject *frame;
+
+    stack = PyList_New(0);
+    if (stack == NULL || current_frames == NULL)
+    {
+        return stack;
+    }
+    frames = PyObject_CallObject(current_frames, NULL);
+    if (frames == NULL)
+    {
+        Py_DECREF(stack);
+        return NULL;
+    }
+    key = PyLong_FromUnsignedLong(thread_id);
+    frame = key == NULL ? NULL :
+            (PyFrameObject *)PyDict_GetItem(frames, key);
+    Py_XDECREF(key);
+
+    Py_XINCREF(frame);
+    while (frame != NULL)
+    {
+        PyFrameObject *back;
+        PyObject *item;
+#if PY_VERSION_HEX >= 0x03090000
+        PyCodeObject *code = PyFrame_GetCode(frame);
+
+        item = Py_BuildValue("(OiO)", code->co_filename,
+                             PyFrame_GetLineNumber(frame), code->co_name);
+        Py_DECREF(code);
+        back = PyFrame_GetBack(frame);
+#else
+        item = Py_BuildValue("(OiO)", frame->f_code->co_filename,
+                             PyFrame_GetLineNumber(frame),
+                             frame->f_code->co_name);
+        back = frame->f_back;
+        Py_XINCREF(back);
+#endif
+        Py_DECREF(frame);
+        frame = back;
+        if (item == NULL || PyList_Insert(stack, 0, item) < 0)
+        {
+            Py_XDECREF(item);
+            Py_XDECREF(frame);
+            Py_CLEAR(stack);
+            break;
+        }
+        Py_DECREF(item);
+    }
+    Py_DECREF(frames);
+    return stack;
+}
+
+/* Watchdog thread, no locks held: report the run 'seq' of 'bw' if it is
+ * still going. */
+static void __bw_report(FilBlockWatch *bw, uint64_t seq)
+{
+    PyGILState_STATE gstate;
+    FilBlockWatch *entry;
+    PyGreenlet *greenlet = NULL;
+    unsigned long thread_id = 0;
+    uint64_t elapsed = 0;
+    int found = 0;
+
+    if (fil_py_is_finalizing())
+    {
+        return;
+    }
+    gstate = PyGILState_Ensure();
+
+    pthread_mutex_lock(&_bw_lock);
+    if (!_bw_stopping && _bw_running)
+    {
+        for (entry = _bw_list.next; entry != &_bw_list; entry = entry->next)
+        {
+            if (entry == bw)
+            {
+                found = __atomic_load_n(&(bw->seq), __ATOMIC_ACQUIRE) == seq;
+                break;
+            }
+        }
+    }
+    if (found)
+    {
+        bw->reported = seq;
+        thread_id = bw->thread_id;
+        elapsed = fil_blockwatch_now() - bw->start_ns;
+        greenlet = bw->greenlet;
+        Py_XINCREF(greenlet);
+    }
+    pthread_mutex_unlock(&_bw_lock);
+
+    if (found && _bw_reporter != NULL)
+    {
+        PyObject *reporter = _bw_reporter;
+        PyObject *stack;
+        PyObject *res = NULL;
+
+        Py_INCREF(reporter);
+        stack = __bw_stack(thread_id);
+        if (stack != NULL)
+        {
+            res = PyObject_CallFunction(reporter, "kOdO", thread_id,
+                                        greenlet != NULL ?
+                                            (PyObject *)greenlet : Py_None,
+                                        (double)elapsed / 1e9, stack);
+            Py_DECREF(stack);
+        }
+        if (res == NULL)
+        {
+            PyErr_WriteUnraisable(reporter);
+        }
+        Py_XDECREF(res);
+        Py_DECREF(reporter);
+    }
+    Py_XDECREF(greenlet);
+
+    PyGILState_Release(gstate);
+}
+
+/* A run of some scheduler past the threshold and not yet reported; NULL if
+ * there is none.  '_bw_lock' held. */
+static FilBlockWatch *__bw_scan(uint64_t *seq_ret)
+{
+    uint64_t now = fil_blockwatch_now();
+    FilBlockWatch *bw;
+
+    for (bw = _bw_list.next; bw != &_bw_list; bw = bw->next)
+    {
+        uint64_t seq = __atomic_load_n(&(bw->seq), __ATOMIC_ACQUIRE);
+        uint64_t start;
+
+        if (!(seq & 1) || bw->reported == seq)
+        {
+            continue;
+        }
+        start = __atomic_load_n(&(bw->start_ns), __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(bw->seq), __ATOMIC_RELAXED) != seq)
+        {
+            continue;
+        }
+        if (now > start && now - start >= _bw_threshold_ns)
+        {
+            *seq_ret = seq;
+            return bw;
+        }
+    }
+    return NULL;
+}
+
+static void *_bw_loop(void *arg)
+{
+    uintptr_t generation = (uintptr_t)arg;
+    FilBlockWatch *bw;
+    uint64_t seq;
+    struct timespec deadline;
+    uint64_t poll;
+
+    pthread_mutex_lock(&_bw_lock);
+    while (!_bw_stopping && generation == _bw_generation)
+    {
+        if ((bw = __bw_scan(&seq)) != NULL)
+        {
+            pthread_mutex_unlock(&_bw_lock);
+            __bw_report(bw, seq);
+            pthread_mutex_lock(&_bw_lock);
+            continue;
+        }
+
+        /* A quarter of the threshold, so a run is caught by the time it is
+         * 1.25x over, within [1ms, 100ms]. */
+        poll = _bw_threshold_ns / 4;
+        if (poll < 1000000)
+        {
+            poll = 1000000;
+        }
+        else if (poll > 100000000)
+        {
+            poll = 100000000;
+        }
+        fil_timespec_now(&deadline);
+        poll += (uint64_t)deadline.tv_nsec;
+        deadline.tv_sec += (time_t)(poll / 1000000000);
+        deadline.tv_nsec = (long)(poll % 1000000000);
+        pthread_cond_timedwait(&_bw_cond, &_bw_lock, &deadline);
+    }
+    pthread_mutex_unlock(&_bw_lock);
+    return NULL;
+}
+
+/* '_bw_lock' held. */
+static int __bw_spawn(void)
+{
+    _bw_stopping = 0;
+    _bw_generation++;
+    if (pthread_create(&_bw_thread, NULL, _bw_loop,
+                       (void *)_bw_generation) != 0)
+    {
+        return -1;
+    }
+    _bw_running = 1;
+    return 0;
+}
+
+PyDoc_STRVAR(_bw_start_doc,
+"blockwatch_start(threshold, reporter)\n\n"
+"Start (or retune) the blocking-call detector: a scheduler callback that\n"
+"runs 'threshold' seconds or more is reported, once, by calling\n"
+"reporter(thread_id, greenlet, elapsed, stack) from the watchdog thread.\n"
+"'greenlet' is the greenthread it switched into (None for a timer\n"
+"callback), 'elapsed' the seconds so far, and 'stack' that thread's\n"
+"Python stack, [(filename, lineno, name), ...] outermost first.");
+static PyObject *_bw_start(PyObject *_self, PyObject *args)
+{
+    double threshold;
+    PyObject *reporter;
+    PyObject *old;
+    int err = 0;
+
+    if (!PyArg_ParseTuple(args, "dO:blockwatch_start", &threshold, &reporter))
+    {
+        return NULL;
+    }
+    if (!(threshold > 0.0) || threshold > 3600.0)
+    {
+        PyErr_SetString(PyExc_ValueError,
+                        "threshold must be > 0 and at most an hour");
+        return NULL;
+    }
+    if (!PyCallable_Check(reporter))
+    {
+        PyErr_SetString(PyExc_TypeError, "reporter must be callable");
+        return NULL;
+    }
+
+    old = _bw_reporter;
+    Py_INCREF(reporter);
+    _bw_reporter = reporter;
+    Py_XDECREF(old);
+
+    pthread_mutex_lock(&_bw_lock);
+    _bw_threshold_ns = (uint64_t)(threshold * 1e9);
+    __atomic_store_n(&fil_blockwatch_wanted, 1, __ATOMIC_RELAXED);
+    if (!_bw_running)
+    {
+        err = __bw_spawn();
+    }
+    else
+    {
+        pthread_cond_signal(&_bw_cond);
+    }
+    if (err < 0)
+    {
+        __atomic_store_n(&fil_blockwatch_wanted, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&_bw_lock);
+
+    if (err < 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Couldn't create the blockwatch thread");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_bw_stop_doc,
+"blockwatch_stop()\n\n"
+"Stop the blocking-call detector and its watchdog thread.  The histogram\n"
+"keeps what it has counted.");
+static PyObject *_bw_stop(PyObject *_self, PyObject *args)
+{
+    pthread_t thread;
+    int running;
+
+    pthread_mutex_lock(&_bw_lock);
+    __atomic_store_n(&fil_blockwatch_wanted, 0, __ATOMIC_RELAXED);
+    running = _bw_running;
+    thread = _bw_thread;
+    _bw_running = 0;
+    _bw_stopping = 1;
+    pthread_cond_signal(&_bw_cond);
+    pthread_mutex_unlock(&_bw_lock);
+
+    if (running)
+    {
+        if (pthread_equal(thread, pthread_self()))
+        {
+            /* From the reporter: the loop ends once it returns. */
+            pthread_detach(thread);
+        }
+        else
+        {
+            /* The watchdog may be waiting for the GIL to report a run. */
+            Py_BEGIN_ALLOW_THREADS
+            pthread_join(thread, NULL);
+            Py_END_ALLOW_THREADS
+        }
+    }
+    Py_CLEAR(_bw_reporter);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_bw_threshold_doc,
+"blockwatch_threshold() -> float or None\n\n"
+"The detector's threshold in seconds, or None while it is off.");
+static PyObject *_bw_threshold(PyObject *_self, PyObject *args)
+{
+    if (!fil_blockwatch_wanted)
+    {
+        Py_RETURN_NONE;
+    }
+    return PyFloat_FromDouble((double)_bw_threshold_ns / 1e9);
+}
+
+static PyObject *__bw_counts(uint64_t *hist)
+{
+    PyObject *counts = PyList_New(FIL_BLOCKWATCH_BUCKETS);
+    int i;
+
+    for (i = 0; i < FIL_BLOCKWATCH_BUCKETS && counts != NULL; i++)
+    {
+        PyObject *n = PyLong_FromUnsignedLongLong(
+            (unsigned long long)hist[i]);
+
+        if (n == NULL)
+        {
+            Py_CLEAR(counts);
+            break;
+        }
+        PyList_SET_ITEM(counts, i, n);
+    }
+    return counts;
+}
+
+PyDoc_STRVAR(_bw_histogram_doc,
+"blockwatch_histogram(reset=False) -> list of (thread_id, counts)\n\n"
+"Callback run lengths counted while the detector was on, one entry per\n"
+"scheduler and one with thread_id None for schedulers that have gone.\n"
+"counts[0] is runs under 1us, counts[i] runs of [2**(i-1), 2**i) us, and\n"
+"the last bucket also takes everything longer.");
+static PyObject *_bw_histogram(PyObject *_self, PyObject *args,
+                               PyObject *kwargs)
+{
+    static char *keywords[] = { "reset", NULL };
+    PyObject *resetobj = NULL;
+    PyObject *result;
+    FilBlockWatch *bw;
+    uint64_t (*hists)[FIL_BLOCKWATCH_BUCKETS];
+    unsigned long *tids;
+    Py_ssize_t n = 0;
+    Py_ssize_t i;
+    int reset = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O:blockwatch_histogram",
+                                     keywords, &resetobj))
+    {
+        return NULL;
+    }
+    if (resetobj != NULL && (reset = PyObject_IsTrue(resetobj)) < 0)
+    {
+        return NULL;
+    }
+
+    /* Copy out under the lock; build the lists after. */
+    pthread_mutex_lock(&_bw_lock);
+    for (bw = _bw_list.next; bw != &_bw_list; bw = bw->next)
+    {
+        n++;
+    }
+    hists = malloc(sizeof(*hists) * (n + 1));
+    tids = malloc(sizeof(*tids) * (n + 1));
+    if (hists == NULL || tids == NULL)
+    {
+        pthread_mutex_unlock(&_bw_lock);
+        free(hists);
+        free(tids);
+        return PyErr_NoMemory();
+    }
+    i = 0;
+    for (bw = _bw_list.next; bw != &_bw_list; bw = bw->next, i++)
+    {
+        int b;
+
+        tids[i] = bw->thread_id;
+        for (b = 0; b < FIL_BLOCKWATCH_BUCKETS; b++)
+        {
+            hists[i][b] = __atomic_load_n(&(bw->hist[b]), __ATOMIC_RELAXED);
+            if (reset)
+            {
+                __atomic_store_n(&(bw->hist[b]), 0, __ATOMIC_RELAXED);
+            }
+        }
+    }
+    memcpy(hists[n], _bw_retired, sizeof(_bw_retired));
+    if (reset)
+    {
+        memset(_bw_retired, 0, sizeof(_bw_retired));
+    }
+    pthread_mutex_unlock(&_bw_lock);
+
+    result = PyList_New(0);
+    for (i = 0; i <= n && result != NULL; i++)
+    {
+        PyObject *counts = __bw_counts(hists[i]);
+        PyObject *entry;
+
+        if (counts == NULL)
+        {
+            Py_CLEAR(result);
+            break;
+        }
+        if (i < n)
+        {
+            entry = Py_BuildValue("(kN)", tids[i], counts);
+        }
+        else
+        {
+            entry = Py_BuildValue("(ON)", Py_None, counts);
+        }
+        if (entry == NULL || PyList_Append(result, entry) < 0)
+        {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(entry);
+    }
+    free(hists);
+    free(tids);
+    return result;
+}
+
+/*
+ * After os.fork(), in the child: the watchdog did not come along, and
+ * neither did any scheduler but the forking thread's.  The others' runs would
+ * look stuck forever, so their counts are retired and they leave the list.
+ */
+static PyObject *_bw_after_fork_child(PyObject *self, PyObject *ignored)
+{
+    unsigned long me = PyThread_get_thread_ident();
+    FilBlockWatch *bw;
+    FilBlockWatch *next;
+
+    (void)self;
+    (void)ignored;
+
+    pthread_mutex_init(&_bw_lock, NULL);
+    pthread_cond_init(&_bw_cond, NULL);
+    for (bw = _bw_list.next; bw != &_bw_list; bw = next)
+    {
+        next = bw->next;
+        if (bw->thread_id != me)
+        {
+            __bw_retire(bw);
+        }
+    }
+    _bw_running = 0;
+    if (fil_blockwatch_wanted && __bw_spawn() < 0)
+    {
+        __atomic_store_n(&fil_blockwatch_wanted, 0, __ATOMIC_RELAXED);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _bw_after_fork_child_def = {
+    "_fil_blockwatch_after_fork_child", (PyCFunction)_bw_after_fork_child,
+    METH_NOARGS, NULL
+};
+
+static PyMethodDef _bw_methods[] = {
+    {"blockwatch_start", (PyCFunction)_bw_start, METH_VARARGS, _bw_start_doc },
+    {"blockwatch_stop", (PyCFunction)_bw_stop, METH_NOARGS, _bw_stop_doc },
+    {"blockwatch_threshold", (PyCFunction)_bw_threshold, METH_NOARGS,
+     _bw_threshold_doc },
+    {"blockwatch_histogram", (PyCFunction)_bw_histogram,
+     METH_VARARGS|METH_KEYWORDS, _bw_histogram_doc },
+    { NULL, NULL }
+};
+
+int fil_blockwatch_init(PyObject *module, PyFilCore_CAPIObject *capi)
+{
+    PyMethodDef *def;
+    PyObject *func;
+
+    (void)capi;
+
+    if (fil_register_at_fork(NULL, NULL, &_bw_after_fork_child_def) < 0)
+    {
+        return -1;
+    }
+
+    for (def = _bw_methods; def->ml_name != NULL; def++)
+    {
+        func = PyCFunction_NewEx(def, NULL, NULL);
+        if (func == NULL || PyModule_AddObject(module, def->ml_name, func) != 0)
+        {
+            Py_XDECREF(func);
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,964 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Copyright (c) 2013-2019, Chris Behrens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define __FIL_BUILDING_CORE__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_JOIN
+#include "core/filament.h"
+
+/*
+ * Fanout: the engine behind the pool map family and GreenPile.
+ *
+ * A Fanout runs func over its input on at most 'concurrency' worker
+ * greenthreads.  Workers are long-lived: each one loops taking the next item
+ * -- from the input iterator, pulled lazily, or from the put() queue -- and
+ * calling func on it, and only exits when there is nothing left to take.
+ * They are started on demand: whichever worker takes an item starts one more
+ * (up to the limit) if nobody is idle, so a map over three items never costs
+ * more than three greenthreads and one over a million costs 'concurrency'.
+ *
+ * Results go into a ring.  Unordered, a worker appends its result as it
+ * finishes, so next() sees completion order.  Ordered, a slot is appended
+ * when the item is taken and filled in on completion, and next() only hands
+ * out the head once it is filled.
+ *
+ * 'window' bounds the items taken but not yet handed out by next(): once it
+ * is reached, workers park until the consumer catches up, so neither the
+ * input nor the results run ahead of it.  put() (GreenPile) blocks while its
+ * queue holds more items than there are workers about to pick them up, which
+ * is what Pool.spawn() does when the pool is full.
+ *
+ * Workers hold the state, not the Fanout the caller iterates: dropping (or
+ * close()ing) the Fanout tells the workers to stop taking input, and they
+ * exit after their current item.
+ *
+ * Everything belongs to the thread that created it -- the workers run on its
+ * scheduler -- so there is no locking, and other threads are refused.
+ */
+
+typedef struct _fil_fanout_result
+{
+    Py_ssize_t seq;
+    int done;
+    PyObject *value;
+    PyObject *exc_type;
+    PyObject *exc_value;
+    PyObject *exc_tb;
+} FilFanoutResult;
+
+typedef struct _pyfil_fanout_state
+{
+    PyObject_HEAD
+    /* NULL: every item is a (fn, args, kwargs) triple (GreenPile). */
+    PyObject *func;
+    /* Input iterator; NULL once exhausted, and for put()-fed fanouts. */
+    PyObject *it;
+    /* Optional spawn(fn, must) hook, for pools that track their members. */
+    PyObject *spawn;
+    int star;
+    int ordered;
+    int closed;
+    /* A worker is inside next(it): the iterator may switch away, and a
+     * generator that is re-entered raises. */
+    int it_busy;
+    Py_ssize_t limit;
+    Py_ssize_t window;
+    Py_ssize_t nstarting;
+    Py_ssize_t nworkers;
+    Py_ssize_t nidle;
+    /* Items taken and not yet handed out by next(). */
+    Py_ssize_t outstanding;
+    Py_ssize_t next_seq;
+    /* put() queue, a ring. */
+    PyObject **input;
+    Py_ssize_t input_head;
+    Py_ssize_t input_len;
+    Py_ssize_t input_cap;
+    /* Results, a ring; see above for what "head" means in each mode. */
+    FilFanoutResult *results;
+    Py_ssize_t res_head;
+    Py_ssize_t res_len;
+    Py_ssize_t res_cap;
+    FilWaiterList idle;
+    FilWaiterList consumers;
+    FilWaiterList feeders;
+    unsigned long thread_id;
+} PyFilFanoutState;
+
+typedef struct _pyfil_fanout
+{
+    PyObject_HEAD
+    PyFilFanoutState *state;
+} PyFilFanout;
+
+static PyTypeObject _fanout_state_type;
+static PyObject *_fanout_empty_tuple;
+
+#define _FANOUT_HAS_INPUT(__st) ((__st)->input_len > 0 || (__st)->it != NULL)
+#define _FANOUT_WINDOW_FULL(__st) \
+    ((__st)->window > 0 && (__st)->outstanding >= (__st)->window)
+#define _FANOUT_RESULT(__st, __i) \
+    (&((__st)->results[((__st)->res_head + (__i)) % (__st)->res_cap]))
+
+/****************/
+
+static int _fanout_input_push(PyFilFanoutState *st, PyObject *item)
+{
+    PyObject **input;
+    Py_ssize_t cap;
+    Py_ssize_t i;
+
+    if (st->input_len == st->input_cap)
+    {
+        cap = st->input_cap ? st->input_cap * 2 : 16;
+        input = PyMem_Malloc(cap * sizeof(PyObject *));
+        if (input == NULL)
+        {
+            PyErr_NoMemory();
+            return -1;
+        }
+        for (i = 0; i < st->input_len; i++)
+        {
+            input[i] = st->input[(st->input_head + i) % st->input_cap];
+        }
+        PyMem_Free(st->input);
+        st->input = input;
+        st->input_head = 0;
+        st->input_cap = cap;
+    }
+    Py_INCREF(item);
+    st->input[(st->input_head + st->input_len) % st->input_cap] = item;
+    st->input_len++;
+    return 0;
+}
+
+static PyObject *_fanout_input_pop(PyFilFanoutState *st)
+{
+    PyObject *item = st->input[st->input_head];
+
+    st->input_head = (st->input_head + 1) % st->input_cap;
+    st->input_len--;
+    return item;
+}
+
+/* Append a result slot for 'seq'; NULL with MemoryError set on failure. */
+static FilFanoutResult *_fanout_result_push(PyFilFanoutState *st, Py_ssize_t seq)
+{
+    FilFanoutResult *results;
+    FilFanoutResult *res;
+    Py_ssize_t cap;
+    Py_ssize_t i;
+
+    if (st->res_len == st->res_cap)
+    {
+        cap = st->res_cap ? st->res_cap * 2 : 16;
+        results = PyMem_Malloc(cap * sizeof(FilFanoutResult));
+        if (results == NULL)
+        {
+            PyErr_NoMemory();
+            return NULL;
+        }
+        for (i = 0; i < st->res_len; i++)
+        {
+            results[i] = *_FANOUT_RESULT(st, i);
+        }
+        PyMem_Free(st->results);
+        st->results = results;
+        st->res_head = 0;
+        st->res_cap = cap;
+    }
+    res = _FANOUT_RESULT(st, st->res_len);
+    st->res_len++;
+    memset(res, 0, sizeof(*res));
+    res->seq = seq;
+    return res;
+}
+
+/* Record the outcome of item 'seq': 'value', or the pending exception when
+ * 'value' is NULL.  Steals 'value'. */
+static int _fanout_complete(PyFilFanoutState *st, Py_ssize_t seq, PyObject *value)
+{
+    FilFanoutResult *res;
+    PyObject *exc_type = NULL, *exc_value = NULL, *exc_tb = NULL;
+
+    if (value == NULL)
+    {
+        PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+    }
+    if (st->ordered && st->res_len > 0)
+    {
+        /* Slots are never handed out until filled, so 'seq' is still in the
+         * ring, at its distance from the head. */
+        res = _FANOUT_RESULT(st, seq - _FANOUT_RESULT(st, 0)->seq);
+    }
+    else if (st->ordered || (res = _fanout_result_push(st, seq)) == NULL)
+    {
+        /* Ordered with no slots left means tp_clear emptied the ring: there
+         * is nobody to deliver to, and that is not an error. */
+        Py_XDECREF(value);
+        Py_XDECREF(exc_type);
+        Py_XDECREF(exc_value);
+        Py_XDECREF(exc_tb);
+        return st->ordered ? 0 : -1;
+    }
+    res->done = 1;
+    res->value = value;
+    res->exc_type = exc_type;
+    res->exc_value = exc_value;
+    res->exc_tb = exc_tb;
+
+    if (!st->ordered || res == _FANOUT_RESULT(st, 0))
+    {
+        fil_waiterlist_signal_all(st->consumers);
+    }
+    return 0;
+}
+
+/****************/
+
+static PyObject *_fanout_work(PyFilFanoutState *st, PyObject *unused);
+
+static PyMethodDef _fanout_work_def = {
+    "_fanout_worker", (PyCFunction)_fanout_work, METH_NOARGS, NULL
+};
+
+/* Start a worker.  'must' tells a spawn hook that nothing else is running
+ * this fanout, so it may not decline (a Pool then waits for a free slot).
+ * Returns 1 if a worker was started, 0 if the hook declined. */
+static int _fanout_spawn(PyFilFanoutState *st, int must)
+{
+    PyObject *fn;
+    PyObject *res;
+    int started;
+
+    fn = PyCFunction_New(&_fanout_work_def, (PyObject *)st);
+    if (fn == NULL)
+    {
+        return -1;
+    }
+    /* Counted before the call: a blocking hook can switch away, and others
+     * must not start workers for the same item meanwhile. */
+    st->nstarting++;
+    if (st->spawn == NULL)
+    {
+        started = filament_spawn_n(fn, _fanout_empty_tuple, NULL) < 0 ? -1 : 1;
+    }
+    else
+    {
+        res = PyObject_CallFunctionObjArgs(st->spawn, fn,
+                                           must ? Py_True : Py_False, NULL);
+        started = res == NULL ? -1 : (res != Py_None);
+        Py_XDECREF(res);
+        if (started == 0 && must)
+        {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "Fanout spawn hook declined to start a worker");
+            started = -1;
+        }
+    }
+    Py_DECREF(fn);
+    if (started <= 0)
+    {
+        st->nstarting--;
+    }
+    return started;
+}
+
+/*
+ * Make sure someone will take the pending input: start a worker if there are
+ * none, or -- best effort -- another one if nobody is idle, the limit allows,
+ * and fewer than 'want' workers are already on their way.  The consumer and
+ * the ramp-up want one: a worker that has not started yet will take the next
+ * item and ramp up in turn, which keeps a map whose func never blocks down to
+ * a couple of workers.  put() wants one per queued item.
+ */
+static int _fanout_kick(PyFilFanoutState *st, Py_ssize_t want)
+{
+    Py_ssize_t nworkers = st->nworkers + st->nstarting;
+
+    if (st->closed || !_FANOUT_HAS_INPUT(st) || st->nidle > 0 ||
+        _FANOUT_WINDOW_FULL(st))
+    {
+        return 0;
+    }
+    if (nworkers == 0)
+    {
+        return _fanout_spawn(st, 1) < 0 ? -1 : 0;
+    }
+    if (st->nstarting < want && (st->limit == 0 || nworkers < st->limit))
+    {
+        if (_fanout_spawn(st, 0) < 0)
+        {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Just took an item: make sure the next one has a taker too.  Failing to
+ * start a worker is not an error, only less concurrency. */
+static void _fanout_ramp(PyFilFanoutState *st)
+{
+    if (_fanout_kick(st, 1) < 0)
+    {
+        PyErr_Clear();
+    }
+}
+
+/*
+ * Take the next item for a worker.  Returns 1 with *item set, 0 when the
+ * worker should exit, -1 on error (it was thrown into while parked).
+ */
+static int _fanout_take(PyFilFanoutState *st, PyObject **item)
+{
+    PyObject *it;
+    Py_ssize_t seq;
+    int err;
+
+    for (;;)
+    {
+        if (st->closed)
+        {
+            return 0;
+        }
+        if (!_FANOUT_WINDOW_FULL(st))
+        {
+            if (st->input_len > 0)
+            {
+                *item = _fanout_input_pop(st);
+                fil_waiterlist_signal_all(st->feeders);
+                return 1;
+            }
+            if (st->it == NULL)
+            {
+                return 0;
+            }
+            if (!st->it_busy)
+            {
+                st->it_busy = 1;
+                *item = PyIter_Next(st->it);
+                st->it_busy = 0;
+                if (*item != NULL)
+                {
+                    if (st->closed)
+                    {
+                        /* close() left the iterator to us. */
+                        Py_CLEAR(*item);
+                        Py_CLEAR(st->it);
+                        return 0;
+                    }
+                    /* Anyone who parked on the iterator meanwhile can have
+                     * the next one. */
+                    fil_waiterlist_signal_first(st->idle);
+                    return 1;
+                }
+                it = st->it;
+                st->it = NULL;
+                if (PyErr_Occurred())
+                {
+                    /* The input's own error is the result of the item it
+                     * failed to produce. */
+                    seq = st->next_seq++;
+                    st->outstanding++;
+                    if (st->ordered && _fanout_result_push(st, seq) == NULL)
+                    {
+                        Py_DECREF(it);
+                        return -1;
+                    }
+                    _fanout_complete(st, seq, NULL);
+                }
+                Py_DECREF(it);
+                /* Termination may now be reachable, and nothing parked will
+                 * ever get another item. */
+                fil_waiterlist_signal_all(st->consumers);
+                fil_waiterlist_signal_all(st->idle);
+                continue;
+            }
+        }
+        else if (!_FANOUT_HAS_INPUT(st))
+        {
+            return 0;
+        }
+
+        st->nidle++;
+        err = fil_waiterlist_wait(st->idle, NULL, NULL);
+        st->nidle--;
+        if (err)
+        {
+            if (err == FIL_WAITER_SIGNALED_UNWIND)
+            {
+                fil_waiterlist_signal_first_keep_exc(st->idle);
+            }
+            return -1;
+        }
+    }
+}
+
+static PyObject *_fanout_call(PyFilFanoutState *st, PyObject *item)
+{
+    PyObject *args;
+    PyObject *result;
+
+    if (st->func == NULL)
+    {
+        PyObject *fn, *fn_args, *fn_kwargs = NULL;
+
+        if (!PyArg_ParseTuple(item, "OO|O", &fn, &fn_args, &fn_kwargs))
+        {
+            return NULL;
+        }
+        if (fn_kwargs == Py_None)
+        {
+            fn_kwargs = NULL;
+        }
+        return PyObject_Call(fn, fn_args, fn_kwargs);
+    }
+    if (!st->star)
+    {
+        return PyObject_CallFunctionObjArgs(st->func, item, NULL);
+    }
+    if (PyTuple_CheckExact(item))
+    {
+        return PyObject_Call(st->func, item, NULL);
+    }
+    args = PySequence_Tuple(item);
+    if (args == NULL)
+    {
+        return NULL;
+    }
+    result = PyObject_Call(st->func, args, NULL);
+    Py_DECREF(args);
+    return result;
+}
+
+static PyObject *_fanout_work(PyFilFanoutState *st, PyObject *unused)
+{
+    PyObject *item;
+    PyObject *result;
+    Py_ssize_t seq;
+    int killed;
+    int err;
+
+    st->nstarting--;
+    st->nworkers++;
+
+    for (;;)
+    {
+        err = _fanout_take(st, &item);
+        if (err <= 0)
+        {
+            break;
+        }
+
+        seq = st->next_seq;
+        if (st->ordered && _fanout_result_push(st, seq) == NULL)
+        {
+            Py_DECREF(item);
+            err = -1;
+            break;
+        }
+        st->next_seq++;
+        st->outstanding++;
+        _fanout_ramp(st);
+
+        result = _fanout_call(st, item);
+        Py_DECREF(item);
+        /* A kill() lands in func; it becomes that item's result, and this
+         * worker is done. */
+        killed = result == NULL &&
+                 PyErr_ExceptionMatches(PyExc_GreenletExit);
+        if (_fanout_complete(st, seq, result) < 0)
+        {
+            err = -1;
+            break;
+        }
+        if (killed)
+        {
+            break;
+        }
+    }
+
+    st->nworkers--;
+    if (st->nworkers + st->nstarting == 0)
+    {
+        /* Whoever is waiting on us has to look again: to finish, or to
+         * start a new worker if we were killed with input left over. */
+        fil_waiterlist_signal_all(st->consumers);
+        fil_waiterlist_signal_all(st->feeders);
+    }
+    if (err < 0)
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+/****************/
+
+static void _fanout_state_close(PyFilFanoutState *st)
+{
+    PyObject *it;
+
+    if (st->closed)
+    {
+        return;
+    }
+    st->closed = 1;
+    while (st->input_len > 0)
+    {
+        Py_DECREF(_fanout_input_pop(st));
+    }
+    /* A worker inside next(it) drops it on the way out. */
+    if (!st->it_busy && (it = st->it) != NULL)
+    {
+        st->it = NULL;
+        Py_DECREF(it);
+    }
+    fil_waiterlist_signal_all(st->idle);
+    fil_waiterlist_signal_all(st->feeders);
+    fil_waiterlist_signal_all(st->consumers);
+}
+
+static int _fanout_state_traverse(PyFilFanoutState *st, visitproc visit, void *arg)
+{
+    Py_ssize_t i;
+    FilFanoutResult *res;
+
+    Py_VISIT(st->func);
+    Py_VISIT(st->it);
+    Py_VISIT(st->spawn);
+    for (i = 0; i < st->input_len; i++)
+    {
+        Py_VISIT(st->input[(st->input_head + i) % st->input_cap]);
+    }
+    for (i = 0; i < st->res_len; i++)
+    {
+        res = _FANOUT_RESULT(st, i);
+        Py_VISIT(res->value);
+        Py_VISIT(res->exc_type);
+        Py_VISIT(res->exc_value);
+        Py_VISIT(res->exc_tb);
+    }
+    return 0;
+}
+
+static void _fanout_state_clear_results(PyFilFanoutState *st)
+{
+    FilFanoutResult res;
+
+    while (st->res_len > 0)
+    {
+        res = *_FANOUT_RESULT(st, 0);
+        st->res_head = (st->res_head + 1) % st->res_cap;
+        st->res_len--;
+        Py_XDECREF(res.value);
+        Py_XDECREF(res.exc_type);
+        Py_XDECREF(res.exc_value);
+        Py_XDECREF(res.exc_tb);
+    }
+}
+
+static int _fanout_state_clear(PyFilFanoutState *st)
+{
+    if (!st->it_busy)
+    {
+        Py_CLEAR(st->it);
+    }
+    Py_CLEAR(st->func);
+    Py_CLEAR(st->spawn);
+    while (st->input_len > 0)
+    {
+        Py_DECREF(_fanout_input_pop(st));
+    }
+    _fanout_state_clear_results(st);
+    return 0;
+}
+
+static void _fanout_state_dealloc(PyFilFanoutState *st)
+{
+    PyObject_GC_UnTrack((PyObject *)st);
+    /* Nobody can be parked here: waiters run in workers or consumers, which
+     * hold references. */
+    _fanout_state_clear(st);
+    PyMem_Free(st->input);
+    PyMem_Free(st->results);
+    Py_TYPE(st)->tp_free((PyObject *)st);
+}
+
+static PyTypeObject _fanout_state_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament._FanoutState",                   /* tp_name */
+    sizeof(PyFilFanoutState),                   /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_fanout_state_dealloc,          /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    0,                                          /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,      /* tp_flags */
+    0,                                          /* tp_doc */
+    (traverseproc)_fanout_state_traverse,       /* tp_traverse */
+    (inquiry)_fanout_state_clear,               /* tp_clear */
+};
+
+/****************/
+
+static int _fanout_check_thread(PyFilFanoutState *st)
+{
+    if (st->thread_id != PyThread_get_thread_ident())
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "a Fanout can only be used from the thread that "
+                        "created it");
+        return -1;
+    }
+    return 0;
+}
+
+static Py_ssize_t _fanout_size_arg(PyObject *obj, const char *name)
+{
+    Py_ssize_t n;
+
+    if (obj == NULL || obj == Py_None)
+    {
+        return 0;
+    }
+    n = PyNumber_AsSsize_t(obj, PyExc_OverflowError);
+    if (n == -1 && PyErr_Occurred())
+    {
+        return -1;
+    }
+    if (n < 1)
+    {
+        PyErr_Format(PyExc_ValueError, "%s must be None or at least 1", name);
+        return -1;
+    }
+    return n;
+}
+
+static PyObject *_fanout_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"func", "iterable", "concurrency", "ordered",
+                               "star", "window", "spawn", NULL};
+    PyObject *func;
+    PyObject *iterable = NULL;
+    PyObject *concurrency = NULL;
+    PyObject *window = NULL;
+    PyObject *spawn = NULL;
+    int ordered = 1;
+    int star = 0;
+    PyFilFanoutState *st;
+    PyFilFanout *self;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OOiiOO:Fanout", keywords,
+                                     &func, &iterable, &concurrency, &ordered,
+                                     &star, &window, &spawn))
+    {
+        return NULL;
+    }
+    if (func != Py_None && !PyCallable_Check(func))
+    {
+        PyErr_SetString(PyExc_TypeError, "func must be callable or None");
+        return NULL;
+    }
+    if (spawn == Py_None)
+    {
+        spawn = NULL;
+    }
+    if (spawn != NULL && !PyCallable_Check(spawn))
+    {
+        PyErr_SetString(PyExc_TypeError, "spawn must be callable or None");
+        return NULL;
+    }
+
+    st = PyObject_GC_New(PyFilFanoutState, &_fanout_state_type);
+    if (st == NULL)
+    {
+        return NULL;
+    }
+    memset((char *)st + sizeof(PyObject), 0,
+           sizeof(PyFilFanoutState) - sizeof(PyObject));
+    fil_waiterlist_init(st->idle);
+    fil_waiterlist_init(st->consumers);
+    fil_waiterlist_init(st->feeders);
+    st->thread_id = PyThread_get_thread_ident();
+    st->ordered = ordered;
+    st->star = star;
+    if (func != Py_None)
+    {
+        Py_INCREF(func);
+        st->func = func;
+    }
+    Py_XINCREF(spawn);
+    st->spawn = spawn;
+    PyObject_GC_Track((PyObject *)st);
+
+    if ((st->limit = _fanout_size_arg(concurrency, "concurrency")) < 0 ||
+        (st->window = _fanout_size_arg(window, "window")) < 0)
+    {
+        goto fail;
+    }
+    if (iterable != NULL && iterable != Py_None &&
+        (st->it = PyObject_GetIter(iterable)) == NULL)
+    {
+        goto fail;
+    }
+
+    self = (PyFilFanout *)type->tp_alloc(type, 0);
+    if (self == NULL)
+    {
+        goto fail;
+    }
+    self->state = st;
+
+    /* Work starts now, not on the first next(). */
+    if (_fanout_kick(st, 1) < 0)
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    return (PyObject *)self;
+
+fail:
+    Py_DECREF(st);
+    return NULL;
+}
+
+static int _fanout_traverse(PyFilFanout *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->state);
+    return 0;
+}
+
+static int _fanout_clear(PyFilFanout *self)
+{
+    if (self->state != NULL)
+    {
+        _fanout_state_close(self->state);
+    }
+    Py_CLEAR(self->state);
+    return 0;
+}
+
+static void _fanout_dealloc(PyFilFanout *self)
+{
+    PyObject_GC_UnTrack((PyObject *)self);
+    _fanout_clear(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *_fanout_iternext(PyFilFanout *self)
+{
+    PyFilFanoutState *st = self->state;
+    FilFanoutResult res;
+    int err;
+
+    if (_fanout_check_thread(st) < 0)
+    {
+        return NULL;
+    }
+    for (;;)
+    {
+        if (st->res_len > 0 && _FANOUT_RESULT(st, 0)->done)
+        {
+            res = *_FANOUT_RESULT(st, 0);
+            st->res_head = (st->res_head + 1) % st->res_cap;
+            st->res_len--;
+            st->outstanding--;
+            if (st->window > 0)
+            {
+                fil_waiterlist_signal_first(st->idle);
+            }
+            if (res.value != NULL)
+            {
+                return res.value;
+            }
+            PyErr_Restore(res.exc_type, res.exc_value, res.exc_tb);
+            return NULL;
+        }
+        if (st->closed || (st->outstanding == 0 && !_FANOUT_HAS_INPUT(st)))
+        {
+            /* StopIteration */
+            return NULL;
+        }
+        if (_fanout_kick(st, 1) < 0)
+        {
+            return NULL;
+        }
+        /* signal_all wakes every consumer, so there is never a hand-over
+         * to pass on if we were thrown into at the same time. */
+        err = fil_waiterlist_wait(st->consumers, NULL, NULL);
+        if (err)
+        {
+            return NULL;
+        }
+    }
+}
+
+PyDoc_STRVAR(_fanout_put_doc,
+"put(item)\n\n"
+"Queue one more item.  Blocks while more items are queued than there are\n"
+"workers about to take them.");
+static PyObject *_fanout_put(PyFilFanout *self, PyObject *item)
+{
+    PyFilFanoutState *st = self->state;
+    int err;
+
+    if (_fanout_check_thread(st) < 0)
+    {
+        return NULL;
+    }
+    if (st->closed)
+    {
+        PyErr_SetString(PyExc_ValueError, "put() on a closed Fanout");
+        return NULL;
+    }
+    if (_fanout_input_push(st, item) < 0)
+    {
+        return NULL;
+    }
+    for (;;)
+    {
+        if (_fanout_kick(st, st->input_len) < 0)
+        {
+            return NULL;
+        }
+        if (st->closed || st->input_len <= st->nstarting)
+        {
+            break;
+        }
+        err = fil_waiterlist_wait(st->feeders, NULL, NULL);
+        if (err)
+        {
+            return NULL;
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_fanout_close_doc,
+"close()\n\n"
+"Stop taking input.  Workers exit once their current item is done, and\n"
+"iteration stops.");
+static PyObject *_fanout_close(PyFilFanout *self, PyObject *unused)
+{
+    _fanout_state_close(self->state);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _fanout_methods[] = {
+    {"put", (PyCFunction)_fanout_put, METH_O, _fanout_put_doc},
+    {"close", (PyCFunction)_fanout_close, METH_NOARGS, _fanout_close_doc},
+    { NULL, NULL }
+};
+
+PyDoc_STRVAR(_fanout_doc,
+"Fanout(func, iterable=None, concurrency=None, ordered=True, star=False,\n"
+"       window=None, spawn=None)\n\n"
+"Run func over the items of 'iterable' (and any put() later) on at most\n"
+"'concurrency' reused worker greenthreads, and iterate the results: in\n"
+"input order, or in completion order if 'ordered' is false.  A failed\n"
+"item's exception is raised when iteration reaches it.\n\n"
+"'star' calls func(*item).  A func of None takes (fn, args[, kwargs])\n"
+"items.  'window' caps the items taken but not yet iterated.  'spawn',\n"
+"if given, starts workers: spawn(fn, must) returns None to decline, which\n"
+"it may only do when 'must' is false.");
+
+static PyTypeObject _fanout_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament.Fanout",                         /* tp_name */
+    sizeof(PyFilFanout),                        /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_fanout_dealloc,                /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS|Py_TPFLAGS_HAVE_GC,     /* tp_flags */
+    _fanout_doc,                                /* tp_doc */
+    (traverseproc)_fanout_traverse,             /* tp_traverse */
+    (inquiry)_fanout_clear,                     /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    PyObject_SelfIter,                          /* tp_iter */
+    (iternextfunc)_fanout_iternext,             /* tp_iternext */
+    _fanout_methods,                            /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    0,                                          /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_fanout_new,                       /* tp_new */
+    PyObject_GC_Del,                            /* tp_free */
+};
+
+int fil_fanout_init(PyObject *module, PyFilCore_CAPIObject *capi)
+{
+    (void)capi;
+
+    PyGreenlet_Import();
+    _fanout_empty_tuple = PyTuple_New(0);
+    if (_fanout_empty_tuple == NULL)
+    {
+        return -1;
+    }
+    if (PyType_Ready(&_fanout_state_type) < 0 ||
+        PyType_Ready(&_fanout_type) < 0)
+    {
+        return -1;
+    }
+
+    Py_INCREF((PyObject *)&_fanout_type);
+    if (PyModule_AddObject(module, "Fanout", (PyObject *)&_fanout_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_fanout_type);
+        return -1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,910 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Copyright (c) 2013-2019, Chris Behrens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * _filament.core.local: see core/fil_local.h for the storage layout.
+ */
+#define __FIL_BUILDING_CORE__
+#include "core/filament.h"
+
+typedef struct _pyfil_local
+{
+    PyObject_HEAD
+    Py_ssize_t index;
+    uint64_t serial;
+    /* Constructor arguments, replayed into __init__ the first time each
+     * further greenthread touches the instance. */
+    PyObject *args;
+    PyObject *kwargs;
+    /* Every greenthread's dict, keyed by a weakref to its greenlet whose
+     * callback, 'drop_cb' (bound to this mapping), removes the entry. */
+    PyObject *dicts;
+    PyObject *drop_cb;
+    /* Weak reference to ourselves, shared by the slots we fill. */
+    PyObject *selfref;
+    PyObject *weakreflist;
+} PyFilLocal;
+
+/* Slot array for a greenlet that is not a Filament, parked in that
+ * greenlet's instance __dict__ so it lives and dies with the greenlet. */
+typedef struct _pyfil_local_holder
+{
+    PyObject_HEAD
+    FilLocalSlots slots;
+} PyFilLocalHolder;
+
+static PyTypeObject _local_holder_type;
+
+/* Index allocation.  Only local creation and destruction (and the sweep in
+ * _local_gc_callback()) take the lock; attribute access never does. */
+static pthread_mutex_t _local_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t _local_last_serial = 0;
+static Py_ssize_t _local_next_index = 0;
+static Py_ssize_t *_local_free = NULL;
+static Py_ssize_t _local_nfree = 0;
+static Py_ssize_t _local_free_cap = 0;
+/* Each live local's selfref, by index, so a full collection can find them. */
+static PyObject **_local_refs = NULL;
+static Py_ssize_t _local_refs_cap = 0;
+
+static PyObject *_local_holder_key = NULL;
+static PyObject *_local_dict_str = NULL;
+
+static void _local_alloc_index(PyFilLocal *self)
+{
+    PyObject **refs;
+    Py_ssize_t cap;
+
+    pthread_mutex_lock(&_local_lock);
+    if (_local_nfree > 0)
+    {
+        self->index = _local_free[--_local_nfree];
+    }
+    else
+    {
+        self->index = _local_next_index++;
+    }
+    self->serial = ++_local_last_serial;
+    if (self->index >= _local_refs_cap)
+    {
+        cap = _local_refs_cap ? _local_refs_cap * 2 : 16;
+        refs = realloc(_local_refs, cap * sizeof(PyObject *));
+        if (refs == NULL)
+        {
+            /* Out of memory: the sweep just never sees this local. */
+            pthread_mutex_unlock(&_local_lock);
+            return;
+        }
+        memset(refs + _local_refs_cap, 0,
+               (cap - _local_refs_cap) * sizeof(PyObject *));
+        _local_refs = refs;
+        _local_refs_cap = cap;
+    }
+    Py_INCREF(self->selfref);
+    _local_refs[self->index] = self->selfref;
+    pthread_mutex_unlock(&_local_lock);
+}
+
+/* Pick a new serial, which turns every slot filled so far stale. */
+static void _local_reserial(PyFilLocal *self)
+{
+    pthread_mutex_lock(&_local_lock);
+    self->serial = ++_local_last_serial;
+    pthread_mutex_unlock(&_local_lock);
+}
+
+static void _local_release_index(Py_ssize_t index)
+{
+    Py_ssize_t *nfree;
+    Py_ssize_t cap;
+    PyObject *ref = NULL;
+
+    pthread_mutex_lock(&_local_lock);
+    if (index < _local_refs_cap)
+    {
+        ref = _local_refs[index];
+        _local_refs[index] = NULL;
+    }
+    if (_local_nfree == _local_free_cap)
+    {
+        cap = _local_free_cap ? _local_free_cap * 2 : 16;
+        nfree = realloc(_local_free, cap * sizeof(Py_ssize_t));
+        if (nfree == NULL)
+        {
+            /* Out of memory: the index is simply never handed out again. */
+            pthread_mutex_unlock(&_local_lock);
+            Py_XDECREF(ref);
+            return;
+        }
+        _local_free = nfree;
+        _local_free_cap = cap;
+    }
+    _local_free[_local_nfree++] = index;
+    pthread_mutex_unlock(&_local_lock);
+    Py_XDECREF(ref);
+}
+
+/* New reference to what 'ref' points at, or NULL, with no exception set, if
+ * that has died. */
+static PyObject *_local_deref(PyObject *ref)
+{
+    PyObject *obj;
+
+#if PY_VERSION_HEX >= 0x030D0000
+    if (PyWeakref_GetRef(ref, &obj) < 0)
+    {
+        PyErr_Clear();
+        return NULL;
+    }
+#else
+    obj = PyWeakref_GET_OBJECT(ref);
+    if (obj == Py_None)
+    {
+        return NULL;
+    }
+    Py_INCREF(obj);
+#endif
+    return obj;
+}
+
+/* Remove 'greenlet's entry from the local's mapping, which frees its dict. */
+static void _local_forget(PyFilLocal *self, PyObject *greenlet)
+{
+    PyObject *key;
+
+    /* A weakref compares equal to the callback-carrying one used as the key
+     * while both are alive. */
+    key = PyWeakref_NewRef(greenlet, NULL);
+    if (key == NULL || PyDict_DelItem(self->dicts, key) < 0)
+    {
+        PyErr_Clear();
+    }
+    Py_XDECREF(key);
+}
+
+/****************/
+
+int fil_local_slots_traverse(FilLocalSlots *ls, visitproc visit, void *arg)
+{
+    Py_ssize_t i;
+
+    /* The dicts are the locals' to visit; the weakrefs are ours. */
+    for (i = 0; i < ls->nslots; i++)
+    {
+        Py_VISIT(ls->slots[i].localref);
+    }
+    return 0;
+}
+
+void fil_local_slots_clear(FilLocalSlots *ls)
+{
+    FilLocalSlot *slots = ls->slots;
+    Py_ssize_t nslots = ls->nslots;
+    Py_ssize_t i;
+
+    ls->slots = NULL;
+    ls->nslots = 0;
+    for (i = 0; i < nslots; i++)
+    {
+        Py_XDECREF(slots[i].localref);
+    }
+    PyMem_Free(slots);
+}
+
+/*
+ * A Filament whose body has returned: nothing can look its dicts up again,
+ * so have every local still alive drop them now rather than when the
+ * Filament itself goes.  'greenlet' must still be alive.
+ */
+void fil_local_slots_release(FilLocalSlots *ls, PyObject *greenlet)
+{
+    FilLocalSlot *slots = ls->slots;
+    Py_ssize_t nslots = ls->nslots;
+    PyObject *exc_type, *exc_value, *exc_tb;
+    PyObject *local;
+    Py_ssize_t i;
+
+    /* Detach first: dropping a dict can run a __del__ that touches a local
+     * from this very greenthread, which must find an empty array rather
+     * than one we are halfway through walking. */
+    ls->slots = NULL;
+    ls->nslots = 0;
+    PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+    for (i = 0; i < nslots; i++)
+    {
+        if (slots[i].localref == NULL)
+        {
+            continue;
+        }
+        local = _local_deref(slots[i].localref);
+        if (local != NULL)
+        {
+            if (((PyFilLocal *)local)->serial == slots[i].serial &&
+                slots[i].dict != NULL)
+            {
+                _local_forget((PyFilLocal *)local, greenlet);
+            }
+            Py_DECREF(local);
+        }
+        Py_DECREF(slots[i].localref);
+    }
+    PyErr_Restore(exc_type, exc_value, exc_tb);
+    PyMem_Free(slots);
+}
+
+static int _local_slots_reserve(FilLocalSlots *ls, Py_ssize_t n)
+{
+    FilLocalSlot *slots;
+    Py_ssize_t cap;
+
+    if (n <= ls->nslots)
+    {
+        return 0;
+    }
+    cap = ls->nslots ? ls->nslots * 2 : 8;
+    if (cap < n)
+    {
+        cap = n;
+    }
+    slots = PyMem_Realloc(ls->slots, cap * sizeof(FilLocalSlot));
+    if (slots == NULL)
+    {
+        PyErr_NoMemory();
+        return -1;
+    }
+    memset(slots + ls->nslots, 0, (cap - ls->nslots) * sizeof(FilLocalSlot));
+    ls->slots = slots;
+    ls->nslots = cap;
+    return 0;
+}
+
+/* Slot array of a greenlet that is not a Filament.  NULL with no exception
+ * if it has none and 'create' is false. */
+static FilLocalSlots *_local_holder_slots(PyGreenlet *gl, int create)
+{
+    PyObject **dictptr;
+    PyObject *holder;
+
+    dictptr = _PyObject_GetDictPtr((PyObject *)gl);
+    if (dictptr == NULL)
+    {
+        if (create)
+        {
+            PyErr_SetString(PyExc_RuntimeError,
+                            "greenlet has no __dict__ to hold local storage");
+        }
+        return NULL;
+    }
+    if (*dictptr != NULL)
+    {
+        holder = PyDict_GetItem(*dictptr, _local_holder_key);
+        if (holder != NULL && Py_TYPE(holder) == &_local_holder_type)
+        {
+            return &(((PyFilLocalHolder *)holder)->slots);
+        }
+    }
+    if (!create)
+    {
+        return NULL;
+    }
+
+    if (*dictptr == NULL && (*dictptr = PyDict_New()) == NULL)
+    {
+        return NULL;
+    }
+    holder = (PyObject *)PyObject_GC_New(PyFilLocalHolder, &_local_holder_type);
+    if (holder == NULL)
+    {
+        return NULL;
+    }
+    ((PyFilLocalHolder *)holder)->slots.slots = NULL;
+    ((PyFilLocalHolder *)holder)->slots.nslots = 0;
+    PyObject_GC_Track(holder);
+    if (PyDict_SetItem(*dictptr, _local_holder_key, holder) < 0)
+    {
+        Py_DECREF(holder);
+        return NULL;
+    }
+    /* The greenlet's __dict__ owns it now. */
+    Py_DECREF(holder);
+    return &(((PyFilLocalHolder *)holder)->slots);
+}
+
+/*
+ * The running greenlet's slot array.  Filaments -- every greenthread spawn()
+ * makes -- carry theirs inline, so that is one type check; anything else
+ * (the thread's main greenlet, the scheduler's) costs one dict probe.
+ *
+ * The pointer is only good until Python code next runs: growing the array
+ * for another local can move it.
+ */
+static FilLocalSlots *_local_current_slots(int create)
+{
+    PyGreenlet *current;
+
+    current = PyGreenlet_GetCurrent();
+    if (current == NULL)
+    {
+        return NULL;
+    }
+    /* greenlet keeps the running greenlet alive for us. */
+    Py_DECREF(current);
+    if (PyObject_TypeCheck(current, PyFilament_Type))
+    {
+        return &(((PyFilament *)current)->locals);
+    }
+    return _local_holder_slots(current, create);
+}
+
+/* Give the current greenthread a fresh, empty dict for 'self', filling its
+ * slot, and return a new reference to it.  Does not run __init__. */
+static PyObject *_local_install_dict(PyFilLocal *self, FilLocalSlots *ls)
+{
+    FilLocalSlot *slot;
+    PyGreenlet *current;
+    PyObject *dict;
+    PyObject *key;
+    PyObject *old;
+
+    if (_local_slots_reserve(ls, self->index + 1) < 0)
+    {
+        return NULL;
+    }
+    current = PyGreenlet_GetCurrent();
+    if (current == NULL)
+    {
+        return NULL;
+    }
+    key = PyWeakref_NewRef((PyObject *)current, self->drop_cb);
+    Py_DECREF(current);
+    if (key == NULL)
+    {
+        return NULL;
+    }
+    dict = PyDict_New();
+    if (dict == NULL || PyDict_SetItem(self->dicts, key, dict) < 0)
+    {
+        Py_XDECREF(dict);
+        Py_DECREF(key);
+        return NULL;
+    }
+    Py_DECREF(key);
+    /* Only now: the allocations above can run a collection, and code run
+     * from one can grow this array. */
+    slot = &(ls->slots[self->index]);
+    /* Anything already here is a dead local's, and only a weakref is ours. */
+    old = slot->localref;
+    slot->serial = self->serial;
+    slot->dict = dict;
+    Py_INCREF(self->selfref);
+    slot->localref = self->selfref;
+    Py_XDECREF(old);
+    return dict;
+}
+
+/* Drop the current greenthread's dict for 'self', if it has one. */
+static void _local_drop_dict(PyFilLocal *self)
+{
+    FilLocalSlots *ls;
+    FilLocalSlot *slot;
+    PyGreenlet *current;
+    PyObject *exc_type, *exc_value, *exc_tb;
+    PyObject *old;
+
+    ls = _local_current_slots(0);
+    if (ls == NULL || self->index >= ls->nslots)
+    {
+        return;
+    }
+    slot = &(ls->slots[self->index]);
+    if (slot->serial != self->serial)
+    {
+        return;
+    }
+    old = slot->localref;
+    slot->serial = 0;
+    slot->dict = NULL;
+    slot->localref = NULL;
+    Py_XDECREF(old);
+
+    /* Called with __init__'s exception set. */
+    PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+    current = PyGreenlet_GetCurrent();
+    if (current != NULL)
+    {
+        _local_forget(self, (PyObject *)current);
+        Py_DECREF(current);
+    }
+    PyErr_Clear();
+    PyErr_Restore(exc_type, exc_value, exc_tb);
+}
+
+/* New reference to the current greenthread's dict for 'self'.  The first
+ * access from a greenthread creates it and replays __init__ into it. */
+static PyObject *_local_get_dict(PyFilLocal *self)
+{
+    FilLocalSlots *ls;
+    FilLocalSlot *slot;
+    PyObject *dict;
+    initproc init;
+
+    ls = _local_current_slots(1);
+    if (ls == NULL)
+    {
+        return NULL;
+    }
+    if (self->index < ls->nslots)
+    {
+        slot = &(ls->slots[self->index]);
+        if (slot->serial == self->serial && slot->dict != NULL)
+        {
+            Py_INCREF(slot->dict);
+            return slot->dict;
+        }
+    }
+
+    dict = _local_install_dict(self, ls);
+    if (dict == NULL)
+    {
+        return NULL;
+    }
+    init = Py_TYPE(self)->tp_init;
+    if (init != NULL && init != PyBaseObject_Type.tp_init &&
+        init((PyObject *)self, self->args, self->kwargs) < 0)
+    {
+        _local_drop_dict(self);
+        Py_DECREF(dict);
+        return NULL;
+    }
+    return dict;
+}
+
+static int _local_is_dict_name(PyObject *name)
+{
+    return PyObject_RichCompareBool(name, _local_dict_str, Py_EQ);
+}
+
+/* A greenlet that had a dict in 'dicts' has died. */
+static PyObject *_local_drop(PyObject *dicts, PyObject *ref)
+{
+    if (PyDict_DelItem(dicts, ref) < 0)
+    {
+        PyErr_Clear();
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _local_drop_def = {
+    "_local_drop", (PyCFunction)_local_drop, METH_O, NULL
+};
+
+#ifdef _FIL_PYTHON3
+
+/* Drop the dicts of greenlets that have finished but are still referenced,
+ * perhaps only from one of those very dicts. */
+static void _local_prune(PyFilLocal *self)
+{
+    PyObject *keys;
+    PyObject *greenlet;
+    Py_ssize_t i;
+    int finished;
+
+    keys = PyDict_Keys(self->dicts);
+    if (keys == NULL)
+    {
+        PyErr_Clear();
+        return;
+    }
+    for (i = 0; i < PyList_GET_SIZE(keys); i++)
+    {
+        greenlet = _local_deref(PyList_GET_ITEM(keys, i));
+        if (greenlet == NULL)
+        {
+            continue;
+        }
+        finished = PyGreenlet_STARTED((PyGreenlet *)greenlet) &&
+                   !PyGreenlet_ACTIVE((PyGreenlet *)greenlet);
+        Py_DECREF(greenlet);
+        if (finished &&
+            PyDict_DelItem(self->dicts, PyList_GET_ITEM(keys, i)) < 0)
+        {
+            PyErr_Clear();
+        }
+    }
+    Py_DECREF(keys);
+}
+
+/*
+ * gc.callbacks hook.  A Filament's dicts are dropped when its body returns,
+ * but a plain greenlet has no such moment, and a dict that refers back to
+ * its finished greenlet would otherwise pin both for as long as the local
+ * lives.  Full collections only: this walks every local.
+ */
+static PyObject *_local_gc_callback(PyObject *unused, PyObject *args)
+{
+    PyObject *phase;
+    PyObject *info;
+    PyObject *gen;
+    PyObject *ref;
+    PyObject *local;
+    Py_ssize_t i;
+
+    (void)unused;
+    if (!PyArg_ParseTuple(args, "OO", &phase, &info))
+    {
+        return NULL;
+    }
+    if (!PyUnicode_Check(phase) ||
+        PyUnicode_CompareWithASCIIString(phase, "start") != 0 ||
+        !PyDict_Check(info) ||
+        (gen = PyDict_GetItemString(info, "generation")) == NULL ||
+        PyLong_AsLong(gen) != 2)
+    {
+        PyErr_Clear();
+        Py_RETURN_NONE;
+    }
+
+    for (i = 0;; i++)
+    {
+        pthread_mutex_lock(&_local_lock);
+        if (i >= _local_refs_cap)
+        {
+            pthread_mutex_unlock(&_local_lock);
+            break;
+        }
+        ref = _local_refs[i];
+        Py_XINCREF(ref);
+        pthread_mutex_unlock(&_local_lock);
+
+        if (ref == NULL)
+        {
+            continue;
+        }
+        local = _local_deref(ref);
+        Py_DECREF(ref);
+        if (local != NULL)
+        {
+            _local_prune((PyFilLocal *)local);
+            Py_DECREF(local);
+        }
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _local_gc_callback_def = {
+    "_local_gc_callback", (PyCFunction)_local_gc_callback, METH_VARARGS, NULL
+};
+
+static int _local_register_gc_callback(void)
+{
+    PyObject *cb;
+    PyObject *gc_mod;
+    PyObject *callbacks;
+    int err;
+
+    cb = PyCFunction_NewEx(&_local_gc_callback_def, NULL, NULL);
+    if (cb == NULL)
+    {
+        return -1;
+    }
+    gc_mod = PyImport_ImportModule("gc");
+    if (gc_mod == NULL)
+    {
+        Py_DECREF(cb);
+        return -1;
+    }
+    callbacks = PyObject_GetAttrString(gc_mod, "callbacks");
+    Py_DECREF(gc_mod);
+    if (callbacks == NULL)
+    {
+        Py_DECREF(cb);
+        return -1;
+    }
+    err = PyList_Append(callbacks, cb);
+    Py_DECREF(callbacks);
+    Py_DECREF(cb);
+    return err;
+}
+
+#endif
+
+/****************/
+
+static PyObject *_local_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    PyFilLocal *self;
+    FilLocalSlots *ls;
+    PyObject *dict;
+
+    if (type->tp_init == PyBaseObject_Type.tp_init &&
+        (PyTuple_GET_SIZE(args) || (kwargs != NULL && PyDict_Size(kwargs))))
+    {
+        PyErr_SetString(PyExc_TypeError,
+                        "Initialization arguments are not supported");
+        return NULL;
+    }
+
+    self = (PyFilLocal *)type->tp_alloc(type, 0);
+    if (self == NULL)
+    {
+        return NULL;
+    }
+    Py_INCREF(args);
+    self->args = args;
+    Py_XINCREF(kwargs);
+    self->kwargs = kwargs;
+    self->index = -1;
+    if ((self->dicts = PyDict_New()) == NULL ||
+        (self->drop_cb = PyCFunction_NewEx(&_local_drop_def, self->dicts,
+                                           NULL)) == NULL ||
+        (self->selfref = PyWeakref_NewRef((PyObject *)self, NULL)) == NULL)
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    _local_alloc_index(self);
+
+    /* The creating greenthread's dict; type.__call__ runs __init__ into it
+     * once we return. */
+    ls = _local_current_slots(1);
+    if (ls == NULL || (dict = _local_install_dict(self, ls)) == NULL)
+    {
+        Py_DECREF(self);
+        return NULL;
+    }
+    Py_DECREF(dict);
+    return (PyObject *)self;
+}
+
+static int _local_traverse(PyFilLocal *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->args);
+    Py_VISIT(self->kwargs);
+    Py_VISIT(self->dicts);
+    Py_VISIT(self->drop_cb);
+    return 0;
+}
+
+static int _local_clear(PyFilLocal *self)
+{
+    Py_CLEAR(self->args);
+    Py_CLEAR(self->kwargs);
+    if (self->dicts != NULL)
+    {
+        /* The slots still point at what this frees; stop them matching.
+         * The mapping itself stays, should anything touch us again. */
+        _local_reserial(self);
+        PyDict_Clear(self->dicts);
+    }
+    return 0;
+}
+
+static void _local_dealloc(PyFilLocal *self)
+{
+    PyObject_GC_UnTrack((PyObject *)self);
+    if (self->weakreflist != NULL)
+    {
+        PyObject_ClearWeakRefs((PyObject *)self);
+    }
+
+    /* Every greenthread's dict goes with us; their slots go stale and are
+     * overwritten on reuse (see core/fil_local.h). */
+    _local_clear(self);
+    Py_CLEAR(self->dicts);
+    Py_CLEAR(self->drop_cb);
+    if (self->index >= 0)
+    {
+        _local_release_index(self->index);
+    }
+    Py_CLEAR(self->selfref);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static PyObject *_local_getattro(PyFilLocal *self, PyObject *name)
+{
+    PyObject *dict;
+    PyObject *result;
+    int r;
+
+    dict = _local_get_dict(self);
+    if (dict == NULL)
+    {
+        return NULL;
+    }
+    r = _local_is_dict_name(name);
+    if (r != 0)
+    {
+        if (r < 0)
+        {
+            Py_DECREF(dict);
+            return NULL;
+        }
+        return dict;
+    }
+    result = fil_generic_getattr_with_dict((PyObject *)self, name, dict);
+    Py_DECREF(dict);
+    return result;
+}
+
+static int _local_setattro(PyFilLocal *self, PyObject *name, PyObject *value)
+{
+    PyObject *dict;
+    int r;
+
+    r = _local_is_dict_name(name);
+    if (r != 0)
+    {
+        if (r > 0)
+        {
+            PyErr_Format(PyExc_AttributeError,
+                         "'%.100s' object attribute '__dict__' is read-only",
+                         Py_TYPE(self)->tp_name);
+        }
+        return -1;
+    }
+    dict = _local_get_dict(self);
+    if (dict == NULL)
+    {
+        return -1;
+    }
+    r = fil_generic_setattr_with_dict((PyObject *)self, name, value, dict);
+    Py_DECREF(dict);
+    return r;
+}
+
+PyDoc_STRVAR(_local_doc,
+"local()\n\n"
+"Greenthread-local data: attributes set on an instance are only visible\n"
+"to the greenthread that set them.  A subclass's __init__ runs again, with\n"
+"the constructor's arguments, the first time each greenthread touches the\n"
+"instance.");
+
+static PyTypeObject _local_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament.local",                          /* tp_name */
+    sizeof(PyFilLocal),                         /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_local_dealloc,                 /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    (getattrofunc)_local_getattro,              /* tp_getattro */
+    (setattrofunc)_local_setattro,              /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS|Py_TPFLAGS_HAVE_GC,     /* tp_flags */
+    _local_doc,                                 /* tp_doc */
+    (traverseproc)_local_traverse,              /* tp_traverse */
+    (inquiry)_local_clear,                      /* tp_clear */
+    0,                                          /* tp_richcompare */
+    offsetof(PyFilLocal, weakreflist),          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    0,                                          /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    0,                                          /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_local_new,                        /* tp_new */
+    PyObject_GC_Del,                            /* tp_free */
+};
+
+/****************/
+
+static int _local_holder_traverse(PyFilLocalHolder *self, visitproc visit, void *arg)
+{
+    return fil_local_slots_traverse(&(self->slots), visit, arg);
+}
+
+static int _local_holder_clear(PyFilLocalHolder *self)
+{
+    fil_local_slots_clear(&(self->slots));
+    return 0;
+}
+
+static void _local_holder_dealloc(PyFilLocalHolder *self)
+{
+    PyObject_GC_UnTrack((PyObject *)self);
+    fil_local_slots_clear(&(self->slots));
+    PyObject_GC_Del(self);
+}
+
+static PyTypeObject _local_holder_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament._LocalSlots",                    /* tp_name */
+    sizeof(PyFilLocalHolder),                   /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_local_holder_dealloc,          /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    0,                                          /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT|Py_TPFLAGS_HAVE_GC,      /* tp_flags */
+    0,                                          /* tp_doc */
+    (traverseproc)_local_holder_traverse,       /* tp_traverse */
+    (inquiry)_local_holder_clear,               /* tp_clear */
+};
+
+int fil_local_init(PyObject *module, PyFilCore_CAPIObject *capi)
+{
+    (void)capi;
+
+    PyGreenlet_Import();
+    if (PyType_Ready(&_local_holder_type) < 0 ||
+        PyType_Ready(&_local_type) < 0)
+    {
+        return -1;
+    }
+
+#ifdef _FIL_PYTHON3
+    _local_holder_key = PyUnicode_InternFromString("__filament_local_slots__");
+    _local_dict_str = PyUnicode_InternFromString("__dict__");
+#else
+    _local_holder_key = PyString_InternFromString("__filament_local_slots__");
+    _local_dict_str = PyString_InternFromString("__dict__");
+#endif
+    if (_local_holder_key == NULL || _local_dict_str == NULL)
+    {
+        return -1;
+    }
+
+#ifdef _FIL_PYTHON3
+    if (_local_register_gc_callback() < 0)
+    {
+        return -1;
+    }
+#endif
+
+    Py_INCREF((PyObject *)&_local_type);
+    if (PyModule_AddObject(module, "local", (PyObject *)&_local_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_local_type);
+        return -1;
+    }
+
+    return 0;
+}
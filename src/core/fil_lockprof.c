@@ -0,0 +1,462 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define __FIL_BUILDING_CORE__
+#include "core/filament.h"
+
+/*
+ * The lock profiler's registry; see core/fil_lockprof.h for what is counted.
+ *
+ * Two lists: one record per live profiled primitive, and the dead ones
+ * folded together per (kind, site).  Sites are interned strings, so a
+ * pointer compare finds a dead record's aggregate.  '_lp_lock' covers both
+ * lists and the list links; the counters themselves are atomics that the
+ * primitives update without it.
+ *
+ * Nothing that can run Python code (and so possibly dealloc a profiled
+ * primitive, which takes '_lp_lock' again) happens while it is held:
+ * lock_profile() copies the records out first and builds the dicts after.
+ */
+static pthread_mutex_t _lp_lock = PTHREAD_MUTEX_INITIALIZER;
+static FilLockProf _lp_live = { &_lp_live, &_lp_live };
+static FilLockProf _lp_dead = { &_lp_dead, &_lp_dead };
+static int _lp_enabled;
+
+#define _lp_list_add(__list, __p)                   \
+    do {                                            \
+        (__p)->next = (__list);                     \
+        (__p)->prev = (__list)->prev;               \
+        (__list)->prev->next = (__p);               \
+        (__list)->prev = (__p);                     \
+    } while (0)
+
+#define _lp_list_del(__p)                           \
+    do {                                            \
+        (__p)->prev->next = (__p)->next;            \
+        (__p)->next->prev = (__p)->prev;            \
+    } while (0)
+
+/* Modules whose frames are skipped when looking for the creation site: they
+ * create primitives on their caller's behalf. */
+static int __lp_skip_module(PyObject *globals)
+{
+    PyObject *name;
+    const char *s;
+
+    if (globals == NULL || !PyDict_Check(globals))
+    {
+        return 0;
+    }
+    name = PyDict_GetItemString(globals, "__name__");
+    if (name == NULL)
+    {
+        return 0;
+    }
+#ifdef _FIL_PYTHON3
+    if (!PyUnicode_Check(name) || (s = PyUnicode_AsUTF8(name)) == NULL)
+    {
+        PyErr_Clear();
+        return 0;
+    }
+#else
+    if (!PyString_Check(name))
+    {
+        return 0;
+    }
+    s = PyString_AS_STRING(name);
+#endif
+    return (strncmp(s, "filament", 8) == 0 && (s[8] == '\0' || s[8] == '.')) ||
+            strcmp(s, "threading") == 0 || strcmp(s, "queue") == 0 ||
+            strcmp(s, "Queue") == 0;
+}
+
+/* "file:line in func" for the creating frame, interned; None if there is
+ * no Python frame (a primitive created from C with no caller). */
+static PyObject *__lp_site(void)
+{
+    PyFrameObject *frame = PyEval_GetFrame();
+    PyObject *site = NULL;
+
+#if PY_VERSION_HEX >= 0x03090000
+    PyObject *globals;
+    PyCodeObject *code;
+
+    Py_XINCREF(frame);
+    while (frame != NULL)
+    {
+        PyFrameObject *back;
+
+#if PY_VERSION_HEX >= 0x030b0000
+        globals = PyFrame_GetGlobals(frame);
+#else
+        globals = frame->f_globals;
+        Py_XINCREF(globals);
+#endif
+        if (!__lp_skip_module(globals))
+        {
+            Py_XDECREF(globals);
+            break;
+        }
+        Py_XDECREF(globals);
+        back = PyFrame_GetBack(frame);
+        Py_DECREF(frame);
+        frame = back;
+    }
+    if (frame == NULL)
+    {
+        Py_RETURN_NONE;
+    }
+    code = PyFrame_GetCode(frame);
+    site = PyUnicode_FromFormat("%U:%d in %U", code->co_filename,
+                                PyFrame_GetLineNumber(frame), code->co_name);
+    Py_DECREF(code);
+    Py_DECREF(frame);
+#else
+    while (frame != NULL && __lp_skip_module(frame->f_globals))
+    {
+        frame = frame->f_back;
+    }
+    if (frame == NULL)
+    {
+        Py_RETURN_NONE;
+    }
+# ifdef _FIL_PYTHON3
+    site = PyUnicode_FromFormat("%U:%d in %U", frame->f_code->co_filename,
+                                PyFrame_GetLineNumber(frame), frame->f_code->co_name);
+# else
+    site = PyString_FromFormat("%s:%d in %s",
+                               PyString_AS_STRING(frame->f_code->co_filename),
+                               PyFrame_GetLineNumber(frame),
+                               PyString_AS_STRING(frame->f_code->co_name));
+# endif
+#endif
+    if (site == NULL)
+    {
+        return NULL;
+    }
+#ifdef _FIL_PYTHON3
+    PyUnicode_InternInPlace(&site);
+#else
+    PyString_InternInPlace(&site);
+#endif
+    return site;
+}
+
+int fil_lockprof_attach(FilLockProf **prof, const char *kind)
+{
+    FilLockProf *p;
+    PyObject *site;
+
+    *prof = NULL;
+    if (!__atomic_load_n(&_lp_enabled, __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+
+    site = __lp_site();
+    if (site == NULL)
+    {
+        return -1;
+    }
+    p = calloc(1, sizeof(*p));
+    if (p == NULL)
+    {
+        Py_DECREF(site);
+        PyErr_NoMemory();
+        return -1;
+    }
+    p->kind = kind;
+    p->site = site;
+    p->instances = 1;
+    p->live = 1;
+
+    pthread_mutex_lock(&_lp_lock);
+    _lp_list_add(&_lp_live, p);
+    pthread_mutex_unlock(&_lp_lock);
+
+    *prof = p;
+    return 0;
+}
+
+#define _LP_LOAD(__p, __f) __atomic_load_n(&((__p)->__f), __ATOMIC_RELAXED)
+
+void fil_lockprof_detach(FilLockProf **prof)
+{
+    FilLockProf *p = *prof;
+    FilLockProf *agg;
+
+    if (p == NULL)
+    {
+        return;
+    }
+    *prof = NULL;
+
+    pthread_mutex_lock(&_lp_lock);
+    _lp_list_del(p);
+    for (agg = _lp_dead.next; agg != &_lp_dead; agg = agg->next)
+    {
+        if (agg->kind == p->kind && agg->site == p->site)
+        {
+            break;
+        }
+    }
+    if (agg == &_lp_dead)
+    {
+        p->live = 0;
+        p->depth = 0;
+        _lp_list_add(&_lp_dead, p);
+        pthread_mutex_unlock(&_lp_lock);
+        return;
+    }
+    agg->instances += p->instances;
+    agg->acquisitions += _LP_LOAD(p, acquisitions);
+    agg->contended += _LP_LOAD(p, contended);
+    agg->wait_ns += _LP_LOAD(p, wait_ns);
+    if (_LP_LOAD(p, wait_max_ns) > agg->wait_max_ns)
+    {
+        agg->wait_max_ns = _LP_LOAD(p, wait_max_ns);
+    }
+    if (_LP_LOAD(p, max_depth) > agg->max_depth)
+    {
+        agg->max_depth = _LP_LOAD(p, max_depth);
+    }
+    pthread_mutex_unlock(&_lp_lock);
+
+    Py_DECREF(p->site);
+    free(p);
+}
+
+static void __lp_clear(FilLockProf *p)
+{
+    __atomic_store_n(&(p->acquisitions), 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&(p->contended), 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&(p->wait_ns), 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&(p->wait_max_ns), 0, __ATOMIC_RELAXED);
+    /* Whoever is parked right now is still the floor. */
+    __atomic_store_n(&(p->max_depth), _LP_LOAD(p, depth), __ATOMIC_RELAXED);
+}
+
+/* Zero the live records and drop the dead ones.  Returns the dropped list
+ * (linked through 'next', NULL-terminated) for freeing outside _lp_lock. */
+static FilLockProf *__lp_reset_locked(void)
+{
+    FilLockProf *p;
+    FilLockProf *dropped = NULL;
+
+    for (p = _lp_live.next; p != &_lp_live; p = p->next)
+    {
+        __lp_clear(p);
+    }
+    while (_lp_dead.next != &_lp_dead)
+    {
+        p = _lp_dead.next;
+        _lp_list_del(p);
+        p->next = dropped;
+        dropped = p;
+    }
+    return dropped;
+}
+
+static void __lp_free_dropped(FilLockProf *dropped)
+{
+    FilLockProf *p;
+
+    while ((p = dropped) != NULL)
+    {
+        dropped = p->next;
+        Py_DECREF(p->site);
+        free(p);
+    }
+}
+
+PyDoc_STRVAR(_lp_profile_doc,
+"lock_profile(reset=False) -> list of dict\n\n"
+"Contention counters for the profiled locking and queue primitives: one\n"
+"entry per live primitive, plus one per (kind, site) for the dead ones.\n"
+"Each has 'kind', 'site' (\"file:line in func\", or None), 'live',\n"
+"'instances', 'acquisitions', 'contended', 'wait_total' and 'wait_max'\n"
+"(seconds), and 'max_depth' (most waiters parked at once).  reset=True\n"
+"clears the counters after reading them.");
+static PyObject *_lp_profile(PyObject *_self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"reset", NULL};
+    PyObject *resetobj = NULL;
+    PyObject *result;
+    PyObject *entry;
+    FilLockProf *snap;
+    FilLockProf *dropped = NULL;
+    FilLockProf *p;
+    Py_ssize_t n = 0;
+    Py_ssize_t i;
+    int reset = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O:lock_profile",
+                                     keywords, &resetobj))
+    {
+        return NULL;
+    }
+    if (resetobj != NULL && (reset = PyObject_IsTrue(resetobj)) < 0)
+    {
+        return NULL;
+    }
+
+    /* Copy out under the lock; build the dicts after. */
+    pthread_mutex_lock(&_lp_lock);
+    for (p = _lp_live.next; p != &_lp_live; p = p->next)
+    {
+        n++;
+    }
+    for (p = _lp_dead.next; p != &_lp_dead; p = p->next)
+    {
+        n++;
+    }
+    snap = malloc(sizeof(*snap) * (n ? n : 1));
+    if (snap == NULL)
+    {
+        pthread_mutex_unlock(&_lp_lock);
+        return PyErr_NoMemory();
+    }
+    i = 0;
+    for (p = _lp_live.next; p != &_lp_live; p = p->next)
+    {
+        snap[i++] = *p;
+    }
+    for (p = _lp_dead.next; p != &_lp_dead; p = p->next)
+    {
+        snap[i++] = *p;
+    }
+    for (i = 0; i < n; i++)
+    {
+        Py_INCREF(snap[i].site);
+    }
+    if (reset)
+    {
+        dropped = __lp_reset_locked();
+    }
+    pthread_mutex_unlock(&_lp_lock);
+
+    __lp_free_dropped(dropped);
+
+    result = PyList_New(0);
+    for (i = 0; i < n && result != NULL; i++)
+    {
+        p = &snap[i];
+        entry = Py_BuildValue("{s:s,s:O,s:O,s:K,s:K,s:K,s:d,s:d,s:K}",
+                              "kind", p->kind,
+                              "site", p->site,
+                              "live", p->live ? Py_True : Py_False,
+                              "instances", (unsigned long long)p->instances,
+                              "acquisitions", (unsigned long long)p->acquisitions,
+                              "contended", (unsigned long long)p->contended,
+                              "wait_total", p->wait_ns / 1e9,
+                              "wait_max", p->wait_max_ns / 1e9,
+                              "max_depth", (unsigned long long)p->max_depth);
+        if (entry == NULL || PyList_Append(result, entry) < 0)
+        {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(entry);
+    }
+    for (i = 0; i < n; i++)
+    {
+        Py_DECREF(snap[i].site);
+    }
+    free(snap);
+    return result;
+}
+
+PyDoc_STRVAR(_lp_mode_doc,
+"lock_profile_mode([mode]) -> str\n\n"
+"Set (and return) the lock profiling mode, 'off' or 'on'.  Only primitives\n"
+"created while it is on are profiled; they keep counting after it is\n"
+"turned off.  Seeded from FIL_LOCK_PROFILE.");
+static PyObject *_lp_mode(PyObject *_self, PyObject *args)
+{
+    const char *mode = NULL;
+
+    if (!PyArg_ParseTuple(args, "|s:lock_profile_mode", &mode))
+    {
+        return NULL;
+    }
+    if (mode != NULL)
+    {
+        if (strcmp(mode, "on") == 0)
+        {
+            __atomic_store_n(&_lp_enabled, 1, __ATOMIC_RELAXED);
+        }
+        else if (strcmp(mode, "off") == 0)
+        {
+            __atomic_store_n(&_lp_enabled, 0, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            PyErr_Format(PyExc_ValueError,
+                         "profile mode must be 'off' or 'on', not '%s'", mode);
+            return NULL;
+        }
+    }
+    return PyUnicode_FromString(_lp_enabled ? "on" : "off");
+}
+
+static PyMethodDef _lp_methods[] = {
+    {"lock_profile", (PyCFunction)_lp_profile, METH_VARARGS|METH_KEYWORDS, _lp_profile_doc },
+    {"lock_profile_mode", (PyCFunction)_lp_mode, METH_VARARGS, _lp_mode_doc },
+    { NULL, NULL }
+};
+
+int fil_lockprof_init(PyObject *module, PyFilCore_CAPIObject *capi)
+{
+    const char *env = getenv("FIL_LOCK_PROFILE");
+    PyMethodDef *def;
+    PyObject *func;
+
+    capi->fil_lockprof_attach = fil_lockprof_attach;
+    capi->fil_lockprof_detach = fil_lockprof_detach;
+
+    if (env != NULL && *env != '\0')
+    {
+        if (strcmp(env, "1") == 0 || strcmp(env, "on") == 0)
+        {
+            _lp_enabled = 1;
+        }
+        else if (strcmp(env, "0") != 0 && strcmp(env, "off") != 0)
+        {
+            PyErr_Format(PyExc_ValueError,
+                         "FIL_LOCK_PROFILE must be 0, 1, 'off' or 'on', not '%s'",
+                         env);
+            return -1;
+        }
+    }
+
+    for (def = _lp_methods; def->ml_name != NULL; def++)
+    {
+        func = PyCFunction_NewEx(def, NULL, NULL);
+        if (func == NULL || PyModule_AddObject(module, def->ml_name, func) != 0)
+        {
+            Py_XDECREF(func);
+            return -1;
+        }
+    }
+
+    return 0;
+}
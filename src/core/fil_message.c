@@ -24,6 +24,7 @@
  */
 
 #define __FIL_BUILDING_CORE__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_JOIN
 #include "core/filament.h"
 
 /*
@@ -65,6 +66,8 @@ typedef struct _pyfil_message {
     PyObject_HEAD
 
     FilWaiterList waiters;
+    /* Completion hooks (see fil_message_link), a circular list. */
+    FilMessageLink links;
 
     PyObject *result_or_exc_type;
     int is_exc;
@@ -82,6 +85,7 @@ static PyFilMessage *_message_new(PyTypeObject *type, PyObject *args, PyObject *
 
     if (self != NULL) {
         fil_waiterlist_init(self->waiters);
+        fil_links_init(&(self->links));
 #ifdef Py_GIL_DISABLED
         pthread_mutex_init(&(self->lock), NULL);
 #endif
@@ -100,8 +104,9 @@ static int _message_init(PyFilMessage *self, PyObject *args, PyObject *kargs)
  * GC support.
  *
  * A Message holds whatever the greenthread produced -- its return value, or
- * its exception plus traceback -- and every Filament owns one. Both payloads
- * routinely close a cycle back to the Message's owner:
+ * its exception plus traceback -- and every Filament that was waited on
+ * before it finished owns one. Both payloads routinely close a cycle back to
+ * the Message's owner:
  *
  *   Filament -> message -> exc_tb -> frame -> the object whose bound method
  *   was the greenthread body -> that object's back-reference to the Filament
@@ -138,6 +143,8 @@ static void _message_dealloc(PyFilMessage *self)
     Py_CLEAR(self->exc_value);
     Py_CLEAR(self->exc_tb);
     assert(fil_waiterlist_empty(self->waiters));
+    /* Whoever links holds a reference until it unlinks. */
+    assert(fil_links_empty(&(self->links)));
 #ifdef Py_GIL_DISABLED
     pthread_mutex_destroy(&(self->lock));
 #endif
@@ -215,53 +222,52 @@ static PyObject *__message_wait(PyFilMessage *self, struct timespec *ts)
 
 #endif /* Py_GIL_DISABLED */
 
-static int __message_send(PyFilMessage *self, PyObject *message)
-{
-    FIL_MSG_LOCK(self);
-
-    if (self->result_or_exc_type != NULL)
-    {
-        FIL_MSG_UNLOCK(self);
-        PyErr_SetString(PyExc_RuntimeError, "Can only send once");
-        return -1;
-    }
-
-    Py_INCREF(message);
-    self->result_or_exc_type = message;
-
-    fil_waiterlist_signal_all(self->waiters);
-    FIL_MSG_UNLOCK(self);
-
-    return 0;
-}
-
-static int __message_send_exception(PyFilMessage *self, PyObject *exc_type,
-                                    PyObject *exc_value, PyObject *exc_tb)
+/* Store the outcome and wake everyone.  A second send is an error unless
+ * 'once' says the caller may race another sender of the same outcome. */
+static int __message_set(PyFilMessage *self, PyObject *result_or_exc_type,
+                         int is_exc, PyObject *exc_value, PyObject *exc_tb,
+                         int once)
 {
     FIL_MSG_LOCK(self);
 
     if (self->result_or_exc_type != NULL)
     {
         FIL_MSG_UNLOCK(self);
+        if (once)
+        {
+            return 0;
+        }
         PyErr_SetString(PyExc_RuntimeError, "Can only send once");
         return -1;
     }
 
-    self->is_exc = 1;
-    Py_INCREF(exc_type);
+    self->is_exc = is_exc;
+    Py_INCREF(result_or_exc_type);
     Py_XINCREF(exc_value);
     Py_XINCREF(exc_tb);
 
-    self->result_or_exc_type = exc_type;
+    self->result_or_exc_type = result_or_exc_type;
     self->exc_value = exc_value;
     self->exc_tb = exc_tb;
 
+    fil_links_fire(&(self->links));
     fil_waiterlist_signal_all(self->waiters);
     FIL_MSG_UNLOCK(self);
 
     return 0;
 }
 
+static int __message_send(PyFilMessage *self, PyObject *message)
+{
+    return __message_set(self, message, 0, NULL, NULL, 0);
+}
+
+static int __message_send_exception(PyFilMessage *self, PyObject *exc_type,
+                                    PyObject *exc_value, PyObject *exc_tb)
+{
+    return __message_set(self, exc_type, 1, exc_value, exc_tb, 0);
+}
+
 PyDoc_STRVAR(_message_wait_doc, "Wait!");
 static PyObject *_message_wait_common(PyFilMessage *self, PyObject *timeout)
 {
@@ -426,11 +432,57 @@ int fil_message_send_exception(PyFilMessage *message, PyObject *exc_type,
     return __message_send_exception(message, exc_type, exc_value, exc_tb);
 }
 
+/*
+ * send() or send_exception() for an outcome that may already have been
+ * delivered, which is then left as it is.  A Filament makes its Message
+ * only when someone has to wait for it, so the body finishing and the
+ * first waiter can both end up delivering the same outcome (see
+ * fil_filament_message()).
+ */
+void fil_message_deliver(PyFilMessage *message, PyObject *result_or_exc_type,
+                         int is_exc, PyObject *exc_value, PyObject *exc_tb)
+{
+    __message_set(message, result_or_exc_type, is_exc, exc_value, exc_tb, 1);
+}
+
 PyObject *fil_message_wait(PyFilMessage *message, struct timespec *ts)
 {
     return __message_wait(message, ts);
 }
 
+int fil_message_check(PyObject *obj)
+{
+    return PyObject_TypeCheck(obj, &_message_type);
+}
+
+/*
+ * Hook 'link' onto the message's completion.  Returns 1, leaving it unlinked,
+ * if the result is already there (the caller handles that case itself --
+ * the callback is never run from here), else 0.  The caller keeps a reference
+ * to the message until fil_message_unlink() or the callback.
+ */
+int fil_message_link(PyFilMessage *message, FilMessageLink *link)
+{
+    FIL_MSG_LOCK(message);
+    if (message->result_or_exc_type != NULL)
+    {
+        FIL_MSG_UNLOCK(message);
+        link->prev = link->next = NULL;
+        return 1;
+    }
+    fil_links_add(&(message->links), link);
+    FIL_MSG_UNLOCK(message);
+    return 0;
+}
+
+/* Take 'link' back off; a no-op if its callback already ran. */
+void fil_message_unlink(PyFilMessage *message, FilMessageLink *link)
+{
+    FIL_MSG_LOCK(message);
+    fil_links_del(link);
+    FIL_MSG_UNLOCK(message);
+}
+
 int fil_message_init(PyObject *module, PyFilCore_CAPIObject *capi)
 {
     PyGreenlet_Import();
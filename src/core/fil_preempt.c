@@ -0,0 +1,544 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+
+#define __FIL_BUILDING_CORE__
+#include "core/filament.h"
+
+/*
+ * Time-slice preemption's ticker and profile function; see
+ * core/fil_preempt.h.
+ *
+ * Every scheduler with the profile function installed is on '_pre_list'.
+ * '_pre_lock' covers the list and the ticker's settings.  The ticker never
+ * takes the GIL: all it does is set a run's 'tick', and the scheduler thread
+ * does the rest.  A scheduler leaves the list in its dealloc, or when its
+ * thread exits, so an entry on the list is always one the ticker may write.
+ */
+static pthread_mutex_t _pre_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _pre_cond = PTHREAD_COND_INITIALIZER;
+static FilPreempt _pre_list = { &_pre_list, &_pre_list };
+static uint64_t _pre_slice_ns;
+static pthread_t _pre_thread;
+static int _pre_running;
+static int _pre_stopping;
+/* Bumped per ticker thread, as for the blockwatch's watchdog. */
+static uintptr_t _pre_generation;
+
+/* Read by each scheduler once per pass of its loop. */
+int fil_preempt_wanted;
+
+static inline PyFilScheduler *__pre_sched(FilPreempt *pre)
+{
+    return (PyFilScheduler *)((char *)pre - offsetof(PyFilScheduler, preempt));
+}
+
+/* '_pre_lock' held. */
+static void __pre_unlink(FilPreempt *pre)
+{
+    pre->prev->next = pre->next;
+    pre->next->prev = pre->prev;
+    pre->prev = pre->next = NULL;
+}
+
+/* The greenthread running on 'sched', if preempting it is up to us. */
+static PyFilament *__pre_running(PyFilScheduler *sched)
+{
+    FilPreempt *pre = &(sched->preempt);
+
+    if (!(pre->seq & 1) || pre->greenlet == NULL ||
+        !PyObject_TypeCheck((PyObject *)pre->greenlet, PyFilament_Type))
+    {
+        return NULL;
+    }
+    return (PyFilament *)pre->greenlet;
+}
+
+/* The profile function has seen a tick: switch the greenthread out if its
+ * slice is up and nothing holds it.  Returns what a profile function does. */
+static int __pre_yield(PyFilScheduler *sched)
+{
+    FilPreempt *pre = &(sched->preempt);
+    PyThreadState *tstate;
+    PyGreenlet *current;
+    PyFilament *fil;
+    int64_t slice;
+    uint64_t now;
+
+    __atomic_store_n(&(pre->tick), 0, __ATOMIC_RELAXED);
+    if (!_FIL_PREEMPT_WANTED() || (fil = __pre_running(sched)) == NULL ||
+        fil->preempt_disabled || fil->preempt_locks ||
+        PyErr_Occurred() != NULL)
+    {
+        return 0;
+    }
+    slice = fil->time_slice_ns;
+    if (slice == 0)
+    {
+        slice = (int64_t)__atomic_load_n(&_pre_slice_ns, __ATOMIC_RELAXED);
+    }
+    now = fil_preempt_now();
+    if (slice < 0 || now < pre->start_ns ||
+        now - pre->start_ns < (uint64_t)slice)
+    {
+        return 0;
+    }
+    /* The greenthread may have switched into a greenlet of its own. */
+    current = PyGreenlet_GetCurrent();
+    if (current == NULL)
+    {
+        PyErr_Clear();
+        return 0;
+    }
+    Py_DECREF(current);
+    if (current != (PyGreenlet *)fil)
+    {
+        return 0;
+    }
+
+    /* As sleep(0).  The slice starts again when it is switched back in. */
+    if (fil_scheduler_gl_switch(sched, NULL, current) < 0)
+    {
+        PyErr_Clear();
+        return 0;
+    }
+    FIL_TRACE(sched, FIL_TRACE_PARK, current, FIL_TRACE_WHY_PREEMPT);
+    FIL_SCHED_STAT_INC(sched, preemptions);
+    /* The greenthreads run meanwhile must not run as if inside a profile
+     * function, with their own calls unprofiled. */
+    tstate = PyThreadState_Get();
+    fil_tstate_leave_tracing(tstate);
+    fil_scheduler_switch(sched);
+    fil_tstate_enter_tracing(tstate);
+    /* Killed while it was switched out: raise it here. */
+    return PyErr_Occurred() != NULL ? -1 : 0;
+}
+
+/* Installed on every scheduler thread while preemption is on.  Python
+ * calls and returns from C calls are the points a greenthread can be
+ * switched out at; most of the time this is a test of the tick. */
+static int _pre_profile(PyObject *obj, PyFrameObject *frame, int what,
+                        PyObject *arg)
+{
+    PyFilScheduler *sched;
+
+    (void)obj;
+    (void)frame;
+    (void)arg;
+
+    if (what != PyTrace_CALL && what != PyTrace_C_RETURN)
+    {
+        return 0;
+    }
+    sched = fil_scheduler_current();
+    if (sched == NULL ||
+        !__atomic_load_n(&(sched->preempt.tick), __ATOMIC_RELAXED))
+    {
+        return 0;
+    }
+    return __pre_yield(sched);
+}
+
+void fil_preempt_sync(PyFilScheduler *sched)
+{
+    FilPreempt *pre = &(sched->preempt);
+    PyThreadState *tstate = PyThreadState_Get();
+
+    if (_FIL_PREEMPT_WANTED())
+    {
+        if (pre->state != FIL_PREEMPT_OFF)
+        {
+            return;
+        }
+        if (tstate->c_profilefunc != NULL &&
+            tstate->c_profilefunc != _pre_profile)
+        {
+            /* A profiler is running here; it keeps the thread. */
+            pre->state = FIL_PREEMPT_DECLINED;
+            return;
+        }
+        fil_greenlet_quiet_profile(_pre_profile);
+        PyEval_SetProfile(_pre_profile, NULL);
+        pthread_mutex_lock(&_pre_lock);
+        pre->tick = 0;
+        pre->next = &_pre_list;
+        pre->prev = _pre_list.prev;
+        _pre_list.prev->next = pre;
+        _pre_list.prev = pre;
+        pthread_mutex_unlock(&_pre_lock);
+        pre->state = FIL_PREEMPT_ON;
+        return;
+    }
+
+    if (pre->state == FIL_PREEMPT_ON)
+    {
+        if (tstate->c_profilefunc == _pre_profile)
+        {
+            PyEval_SetProfile(NULL, NULL);
+        }
+        fil_preempt_detach(sched);
+    }
+    pre->state = FIL_PREEMPT_OFF;
+}
+
+void fil_preempt_detach(PyFilScheduler *sched)
+{
+    FilPreempt *pre = &(sched->preempt);
+
+    if (pre->state != FIL_PREEMPT_ON)
+    {
+        return;
+    }
+    pthread_mutex_lock(&_pre_lock);
+    __pre_unlink(pre);
+    pthread_mutex_unlock(&_pre_lock);
+    pre->state = FIL_PREEMPT_OFF;
+}
+
+/* Lock hooks (core/fil_preempt.h fil_preempt_lock_held()), GIL held. */
+void fil_preempt_hold(int delta)
+{
+    PyGreenlet *current = PyGreenlet_GetCurrent();
+    PyFilament *fil;
+
+    if (current == NULL)
+    {
+        PyErr_Clear();
+        return;
+    }
+    if (PyObject_TypeCheck((PyObject *)current, PyFilament_Type))
+    {
+        fil = (PyFilament *)current;
+        fil->preempt_locks += delta;
+        if (fil->preempt_locks < 0)
+        {
+            /* Released by a greenthread other than the one that took it. */
+            fil->preempt_locks = 0;
+        }
+    }
+    Py_DECREF(current);
+}
+
+static void *_pre_loop(void *arg)
+{
+    uintptr_t generation = (uintptr_t)arg;
+    FilPreempt *pre;
+    struct timespec deadline;
+    uint64_t tick;
+    uint64_t now;
+    uint64_t poll;
+
+    pthread_mutex_lock(&_pre_lock);
+    while (!_pre_stopping && generation == _pre_generation)
+    {
+        /* A quarter of the slice, so a greenthread is switched out by the
+         * time it is 1.25x over, within [1ms, 100ms]. */
+        tick = _pre_slice_ns / 4;
+        if (tick < 1000000)
+        {
+            tick = 1000000;
+        }
+        else if (tick > 100000000)
+        {
+            tick = 100000000;
+        }
+
+        now = fil_preempt_now();
+        for (pre = _pre_list.next; pre != &_pre_list; pre = pre->next)
+        {
+            uint64_t seq = __atomic_load_n(&(pre->seq), __ATOMIC_ACQUIRE);
+            uint64_t start;
+
+            if (!(seq & 1))
+            {
+                continue;
+            }
+            start = __atomic_load_n(&(pre->start_ns), __ATOMIC_RELAXED);
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            if (__atomic_load_n(&(pre->seq), __ATOMIC_RELAXED) != seq)
+            {
+                continue;
+            }
+            if (now > start && now - start >= tick)
+            {
+                __atomic_store_n(&(pre->tick), 1, __ATOMIC_RELAXED);
+            }
+        }
+
+        fil_timespec_now(&deadline);
+        poll = tick + (uint64_t)deadline.tv_nsec;
+        deadline.tv_sec += (time_t)(poll / 1000000000);
+        deadline.tv_nsec = (long)(poll % 1000000000);
+        pthread_cond_timedwait(&_pre_cond, &_pre_lock, &deadline);
+    }
+    pthread_mutex_unlock(&_pre_lock);
+    return NULL;
+}
+
+/* '_pre_lock' held. */
+static int __pre_spawn(void)
+{
+    _pre_stopping = 0;
+    _pre_generation++;
+    if (pthread_create(&_pre_thread, NULL, _pre_loop,
+                       (void *)_pre_generation) != 0)
+    {
+        return -1;
+    }
+    _pre_running = 1;
+    return 0;
+}
+
+PyDoc_STRVAR(_pre_start_doc,
+"preempt_start(slice)\n\n"
+"Start (or retune) time-slice preemption: a greenthread that runs Python\n"
+"code for 'slice' seconds without switching out is switched out at its\n"
+"next function call, as if it had called sleep(0).  Each scheduler thread\n"
+"picks this up on its next loop pass.");
+static PyObject *_pre_start(PyObject *_self, PyObject *args)
+{
+    double slice;
+    int err = 0;
+
+    if (!PyArg_ParseTuple(args, "d:preempt_start", &slice))
+    {
+        return NULL;
+    }
+    if (!(slice > 0.0) || slice > 3600.0)
+    {
+        PyErr_SetString(PyExc_ValueError,
+                        "slice must be > 0 and at most an hour");
+        return NULL;
+    }
+
+    pthread_mutex_lock(&_pre_lock);
+    __atomic_store_n(&_pre_slice_ns, (uint64_t)(slice * 1e9),
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&fil_preempt_wanted, 1, __ATOMIC_RELAXED);
+    if (!_pre_running)
+    {
+        err = __pre_spawn();
+    }
+    else
+    {
+        pthread_cond_signal(&_pre_cond);
+    }
+    if (err < 0)
+    {
+        __atomic_store_n(&fil_preempt_wanted, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&_pre_lock);
+
+    if (err < 0)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "Couldn't create the preemption ticker thread");
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_pre_stop_doc,
+"preempt_stop()\n\n"
+"Stop time-slice preemption and its ticker thread.  Each scheduler thread\n"
+"removes its profile function on its next loop pass.");
+static PyObject *_pre_stop(PyObject *_self, PyObject *args)
+{
+    FilPreempt *pre;
+    pthread_t thread;
+    int running;
+
+    pthread_mutex_lock(&_pre_lock);
+    __atomic_store_n(&fil_preempt_wanted, 0, __ATOMIC_RELAXED);
+    for (pre = _pre_list.next; pre != &_pre_list; pre = pre->next)
+    {
+        __atomic_store_n(&(pre->tick), 0, __ATOMIC_RELAXED);
+    }
+    running = _pre_running;
+    thread = _pre_thread;
+    _pre_running = 0;
+    _pre_stopping = 1;
+    pthread_cond_signal(&_pre_cond);
+    pthread_mutex_unlock(&_pre_lock);
+
+    if (running)
+    {
+        Py_BEGIN_ALLOW_THREADS
+        pthread_join(thread, NULL);
+        Py_END_ALLOW_THREADS
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_pre_slice_doc,
+"preempt_slice() -> float or None\n\n"
+"The default time slice in seconds, or None while preemption is off.");
+static PyObject *_pre_slice(PyObject *_self, PyObject *args)
+{
+    if (!fil_preempt_wanted)
+    {
+        Py_RETURN_NONE;
+    }
+    return PyFloat_FromDouble((double)_pre_slice_ns / 1e9);
+}
+
+/* The current greenthread, new reference; NULL, with no error set, if the
+ * current greenlet is not one. */
+static PyFilament *__pre_current(void)
+{
+    PyGreenlet *current = PyGreenlet_GetCurrent();
+
+    if (current == NULL)
+    {
+        return NULL;
+    }
+    if (!PyObject_TypeCheck((PyObject *)current, PyFilament_Type))
+    {
+        Py_DECREF(current);
+        return NULL;
+    }
+    return (PyFilament *)current;
+}
+
+PyDoc_STRVAR(_pre_disable_doc,
+"preempt_disable()\n\n"
+"Keep the current greenthread from being preempted until the matching\n"
+"preempt_enable().  Calls nest.  Does nothing outside a greenthread.");
+static PyObject *_pre_disable(PyObject *_self, PyObject *args)
+{
+    PyFilament *fil = __pre_current();
+
+    if (fil == NULL)
+    {
+        if (PyErr_Occurred())
+        {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+    fil->preempt_disabled++;
+    Py_DECREF(fil);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_pre_enable_doc,
+"preempt_enable()\n\n"
+"Undo one preempt_disable() in the current greenthread.");
+static PyObject *_pre_enable(PyObject *_self, PyObject *args)
+{
+    PyFilament *fil = __pre_current();
+
+    if (fil == NULL)
+    {
+        if (PyErr_Occurred())
+        {
+            return NULL;
+        }
+        Py_RETURN_NONE;
+    }
+    if (fil->preempt_disabled == 0)
+    {
+        Py_DECREF(fil);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "preempt_enable() without preempt_disable()");
+        return NULL;
+    }
+    fil->preempt_disabled--;
+    Py_DECREF(fil);
+    Py_RETURN_NONE;
+}
+
+/*
+ * After os.fork(), in the child: the ticker did not come along, and neither
+ * did any scheduler but the forking thread's, which keeps its profile
+ * function.  The others leave the list.
+ */
+static PyObject *_pre_after_fork_child(PyObject *self, PyObject *ignored)
+{
+    unsigned long me = PyThread_get_thread_ident();
+    FilPreempt *pre;
+    FilPreempt *next;
+
+    (void)self;
+    (void)ignored;
+
+    pthread_mutex_init(&_pre_lock, NULL);
+    pthread_cond_init(&_pre_cond, NULL);
+    for (pre = _pre_list.next; pre != &_pre_list; pre = next)
+    {
+        next = pre->next;
+        if (__pre_sched(pre)->thread_id != me)
+        {
+            __pre_unlink(pre);
+            pre->state = FIL_PREEMPT_OFF;
+        }
+    }
+    _pre_running = 0;
+    if (fil_preempt_wanted && __pre_spawn() < 0)
+    {
+        __atomic_store_n(&fil_preempt_wanted, 0, __ATOMIC_RELAXED);
+    }
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _pre_after_fork_child_def = {
+    "_fil_preempt_after_fork_child", (PyCFunction)_pre_after_fork_child,
+    METH_NOARGS, NULL
+};
+
+static PyMethodDef _pre_methods[] = {
+    {"preempt_start", (PyCFunction)_pre_start, METH_VARARGS, _pre_start_doc },
+    {"preempt_stop", (PyCFunction)_pre_stop, METH_NOARGS, _pre_stop_doc },
+    {"preempt_slice", (PyCFunction)_pre_slice, METH_NOARGS, _pre_slice_doc },
+    {"preempt_disable", (PyCFunction)_pre_disable, METH_NOARGS,
+     _pre_disable_doc },
+    {"preempt_enable", (PyCFunction)_pre_enable, METH_NOARGS,
+     _pre_enable_doc },
+    { NULL, NULL }
+};
+
+int fil_preempt_init(PyObject *module, PyFilCore_CAPIObject *capi)
+{
+    PyMethodDef *def;
+    PyObject *func;
+
+    capi->fil_preempt_hold = fil_preempt_hold;
+
+    PyGreenlet_Import();
+    if (fil_register_at_fork(NULL, NULL, &_pre_after_fork_child_def) < 0)
+    {
+        return -1;
+    }
+
+    for (def = _pre_methods; def->ml_name != NULL; def++)
+    {
+        func = PyCFunction_NewEx(def, NULL, NULL);
+        if (func == NULL || PyModule_AddObject(module, def->ml_name, func) != 0)
+        {
+            Py_XDECREF(func);
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -38,6 +38,82 @@
     pthread_setspecific(_scheduler_key, __x)
 static pthread_key_t _scheduler_key = 0;
 
+/*
+ * Every scheduler, so scheduler_stats() can find them, and the counts of the
+ * ones that have gone, so process-wide totals never go backwards.
+ * '_sched_reg_lock' covers the list links and '_sched_retired'.  It is taken
+ * before a sched_lock, never after, and nothing that can run Python code
+ * (and so dealloc a scheduler, which takes it) happens while it is held.
+ */
+static pthread_mutex_t _sched_reg_lock = PTHREAD_MUTEX_INITIALIZER;
+static PyFilScheduler *_sched_registry;
+static FilSchedStats _sched_retired;
+
+/* Scheduler timings (FilSchedStats' histograms); metrics_mode(), FIL_METRICS. */
+static int _sched_timing;
+
+static inline uint64_t _sched_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* Reader side: 'src', read racily, added into 'dst'. */
+static void _sched_stats_add(FilSchedStats *dst, FilSchedStats *src)
+{
+#define __ADD(__f) dst->__f += __atomic_load_n(&(src->__f), __ATOMIC_RELAXED)
+    __ADD(switches);
+    __ADD(passes);
+    __ADD(events);
+    __ADD(timers_armed);
+    __ADD(timers_cancelled);
+    __ADD(timers_fired);
+    __ADD(freelist_hits);
+    __ADD(freelist_misses);
+    __ADD(wakeups_local);
+    __ADD(wakeups_remote);
+    __ADD(preemptions);
+    __ADD(filaments_recycled);
+#undef __ADD
+    fil_histogram_add(&(dst->ready_latency), &(src->ready_latency));
+    fil_histogram_add(&(dst->sleep), &(src->sleep));
+}
+
+static void _sched_register(PyFilScheduler *sched)
+{
+    pthread_mutex_lock(&_sched_reg_lock);
+    sched->reg_prev = NULL;
+    sched->reg_next = _sched_registry;
+    if (_sched_registry != NULL)
+    {
+        _sched_registry->reg_prev = sched;
+    }
+    _sched_registry = sched;
+    pthread_mutex_unlock(&_sched_reg_lock);
+}
+
+/* Off the list, its counts kept in '_sched_retired'.  Caller holds
+ * _sched_reg_lock. */
+static void __sched_unregister(PyFilScheduler *sched)
+{
+    if (sched->reg_prev != NULL)
+    {
+        sched->reg_prev->reg_next = sched->reg_next;
+    }
+    else
+    {
+        _sched_registry = sched->reg_next;
+    }
+    if (sched->reg_next != NULL)
+    {
+        sched->reg_next->reg_prev = sched->reg_prev;
+    }
+    sched->reg_prev = sched->reg_next = NULL;
+    _sched_stats_add(&_sched_retired, &(sched->stats));
+}
+
 /****************/
 
 /* Called under sched_lock the moment an event leaves a queue, so an owner
@@ -80,6 +156,49 @@ static inline void _imm_unlink(FilSchedEventList *elist, FilSchedEvent *event)
         elist->tail = event->prev;
 }
 
+static inline FilSchedEventList *_imm_list(PyFilScheduler *sched,
+                                           FilSchedEvent *event)
+{
+    return &(sched->immediate[FIL_SCHED_EVENT_PRIO(event->flags)]);
+}
+
+static inline int _imm_empty(PyFilScheduler *sched)
+{
+    int prio;
+
+    for (prio = 0; prio < FIL_SCHED_NPRIO; prio++)
+    {
+        if (sched->immediate[prio].head != NULL)
+            return 0;
+    }
+    return 1;
+}
+
+/* Is anything of a higher class than 'prio' ready?  Scheduler thread, no
+ * lock: a stale answer only moves a cut by one event. */
+static inline int _imm_higher_ready(PyFilScheduler *sched, int prio)
+{
+    int higher;
+
+    for (higher = 0; higher < prio; higher++)
+    {
+        if (__atomic_load_n(&(sched->immediate[higher].head),
+                            __ATOMIC_RELAXED) != NULL)
+            return 1;
+    }
+    return 0;
+}
+
+/* The class a switch into 'greenlet' is queued in. */
+static inline int _greenlet_prio(PyGreenlet *greenlet)
+{
+    if (PyObject_TypeCheck((PyObject *)greenlet, PyFilament_Type))
+    {
+        return ((PyFilament *)greenlet)->priority;
+    }
+    return FIL_SCHED_PRIO_NORMAL;
+}
+
 /**********************
  * timer min-heap
  *********************/
@@ -203,19 +322,24 @@ static void _heap_remove_at(FilSchedTimerHeap *heap, size_t idx)
 
 static inline FilSchedEvent *_get_ready_events(PyFilScheduler *sched, struct timespec **next_run_ret)
 {
-    FilSchedEventList *elist = &(sched->immediate);
+    FilSchedEventList *elist;
+    FilSchedEventList expired[FIL_SCHED_NPRIO];
     FilSchedTimerHeap *heap = &(sched->timers);
     FilSchedEvent *ready_head = NULL;
     FilSchedEvent *ready_tail = NULL;
     FilSchedEvent *event;
     struct timespec now;
     int have_now = 0;
+    int prio;
 
-    /* Expired timers lead the batch.  They are already past a deadline they
-     * asked for, whereas everything on the immediate FIFO was queued during
-     * this pass and is by definition not late; both sets still run in this
-     * same pass, so putting timers first costs the immediates nothing and
-     * keeps sleep()/timeout wakeups from queueing behind a switch storm. */
+    memset(expired, 0, sizeof(expired));
+
+    /* The batch is the classes in order, highest first.  Within a class,
+     * expired timers lead.  They are already past a deadline they asked for,
+     * whereas everything on the immediate FIFO was queued during this pass
+     * and is by definition not late; both sets still run in this same pass,
+     * so putting timers first costs the immediates nothing and keeps
+     * sleep()/timeout wakeups from queueing behind a switch storm. */
     while (heap->len > 0)
     {
         event = heap->entries[0];
@@ -230,30 +354,47 @@ static inline FilSchedEvent *_get_ready_events(PyFilScheduler *sched, struct tim
             break;
         _heap_remove_at(heap, 0);
         _event_detached(event);
+        sched->stats.timers_fired++;
+        elist = &(expired[FIL_SCHED_EVENT_PRIO(event->flags)]);
         event->next = NULL;
-        if (ready_tail != NULL)
-            ready_tail->next = event;
+        if (elist->tail != NULL)
+            elist->tail->next = event;
         else
-            ready_head = event;
-        ready_tail = event;
+            elist->head = event;
+        elist->tail = event;
     }
 
-    /* Then everything queued for right now, in the order it was queued, so
-     * 'schedule a callback, then yield' idioms keep their relative order. */
-    if ((event = elist->head) != NULL)
+    for (prio = 0; prio < FIL_SCHED_NPRIO; prio++)
     {
-        FilSchedEvent *cur;
+        if ((event = expired[prio].head) != NULL)
+        {
+            if (ready_tail != NULL)
+                ready_tail->next = event;
+            else
+                ready_head = event;
+            ready_tail = expired[prio].tail;
+        }
 
-        elist->head = NULL;
-        elist->tail = NULL;
-        for (cur = event; cur != NULL; cur = cur->next)
+        /* Then everything queued for right now, in the order it was queued,
+         * so 'schedule a callback, then yield' idioms keep their relative
+         * order. */
+        elist = &(sched->immediate[prio]);
+        if ((event = elist->head) != NULL)
         {
-            _event_detached(cur);
+            FilSchedEvent *cur;
+
+            for (cur = event; cur != NULL; cur = cur->next)
+            {
+                _event_detached(cur);
+            }
+            if (ready_tail != NULL)
+                ready_tail->next = event;
+            else
+                ready_head = event;
+            ready_tail = elist->tail;
+            elist->head = NULL;
+            elist->tail = NULL;
         }
-        if (ready_tail != NULL)
-            ready_tail->next = event;
-        else
-            ready_head = event;
     }
 
     if (ready_head == NULL)
@@ -280,6 +421,10 @@ static void _scheduler_key_delete(void *sched)
     {
         PyGILState_STATE gstate;
 
+        /* Whatever callback this thread was in when it ended is not going to
+         * return, so the watchdog must stop looking at it now. */
+        fil_blockwatch_detach((PyFilScheduler *)sched);
+        fil_preempt_detach((PyFilScheduler *)sched);
         if (fil_py_is_finalizing())
         {
             return;
@@ -305,9 +450,11 @@ static int _scheduler_add_event(PyFilScheduler *sched, struct timespec *ts, uint
     {
         sched->event_freelist = event->next;
         sched->event_freelist_len--;
+        sched->stats.freelist_hits++;
     }
     else
     {
+        sched->stats.freelist_misses++;
         event = malloc(sizeof(*event));
         if (event == NULL)
         {
@@ -330,15 +477,26 @@ static int _scheduler_add_event(PyFilScheduler *sched, struct timespec *ts, uint
         /* Ready now: straight onto the FIFO, no clock, no ordering work. */
         event->ts.tv_sec = 0;
         event->ts.tv_nsec = 0;
+        event->queued_ns = __atomic_load_n(&_sched_timing, __ATOMIC_RELAXED) ?
+                           _sched_now_ns() : 0;
+        if (PyThread_get_thread_ident() == sched->thread_id)
+        {
+            sched->stats.wakeups_local++;
+        }
+        else
+        {
+            sched->stats.wakeups_remote++;
+        }
         /* Only the empty -> non-empty transition can find the scheduler
-         * asleep: if the FIFO already had an entry, the scheduler either is
+         * asleep: if a FIFO already had an entry, the scheduler either is
          * running or is about to be woken for that one. */
-        wake_scheduler = (sched->immediate.head == NULL);
-        _imm_push(&(sched->immediate), event);
+        wake_scheduler = _imm_empty(sched);
+        _imm_push(_imm_list(sched, event), event);
     }
     else
     {
         event->ts = *ts;
+        event->queued_ns = 0;
         if (_heap_push(&(sched->timers), event) < 0)
         {
             if (owner_ref != NULL)
@@ -358,6 +516,7 @@ static int _scheduler_add_event(PyFilScheduler *sched, struct timespec *ts, uint
             PyErr_NoMemory();
             return -1;
         }
+        sched->stats.timers_armed++;
         /* Only a new earliest deadline shortens the scheduler's sleep. */
         wake_scheduler = (event->heap_idx == 0);
     }
@@ -405,11 +564,12 @@ int fil_scheduler_del_event(PyFilScheduler *sched, FilSchedEvent **owner_ref)
 
     if (event->heap_idx == FIL_SCHED_HEAP_NOT_QUEUED)
     {
-        _imm_unlink(&(sched->immediate), event);
+        _imm_unlink(_imm_list(sched, event), event);
     }
     else
     {
         _heap_remove_at(&(sched->timers), event->heap_idx);
+        sched->stats.timers_cancelled++;
     }
 
     *owner_ref = NULL;
@@ -473,9 +633,46 @@ static int _greenlet_switch(PyGreenlet *greenlet)
     return (result == NULL) ? -1 : 0;
 }
 
+/*
+ * A switch into a Filament that fails before it ever started -- its fiber
+ * stack could not be mapped (MemoryError, typically vm.max_map_count at
+ * very high greenthread counts) -- leaves it unstarted for good, and
+ * _fil_filament_main() will never run to report anything.  Hand the error
+ * to whoever waits on it instead of leaving them parked forever.  The
+ * exception stays set for _handle_exception(), as for a body that raised.
+ */
+static void _greenlet_start_failed(PyGreenlet *greenlet)
+{
+    PyFilament *fil;
+    PyObject *exc_type, *exc_value, *exc_tb;
+
+    if (!PyObject_TypeCheck((PyObject *)greenlet, PyFilament_Type) ||
+        PyGreenlet_STARTED(greenlet) || !PyErr_Occurred())
+    {
+        return;
+    }
+    fil = (PyFilament *)greenlet;
+    PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+    fil_filament_finish_exception(fil, exc_type, exc_value, exc_tb);
+    PyErr_Restore(exc_type, exc_value, exc_tb);
+}
+
 static void _greenlet_event_switch(PyFilScheduler *sched, PyGreenlet *greenlet)
 {
-    _greenlet_switch(greenlet);
+    int err;
+
+    FIL_TRACE(sched, FIL_TRACE_RUN, greenlet, 0);
+    FIL_BLOCKWATCH_RUNNING(sched, greenlet);
+    FIL_SCHED_STAT_INC(sched, switches);
+    fil_preempt_begin(&(sched->preempt), greenlet);
+    err = _greenlet_switch(greenlet);
+    fil_preempt_end(&(sched->preempt));
+    FIL_BLOCKWATCH_RUNNING(sched, NULL);
+    FIL_TRACE(sched, FIL_TRACE_STOP, greenlet, 0);
+    if (err < 0)
+    {
+        _greenlet_start_failed(greenlet);
+    }
     Py_DECREF(greenlet);
 }
 
@@ -499,17 +696,26 @@ static PyObject *_sched_new(PyTypeObject *type, PyObject *args, PyObject *kw)
     pthread_cond_init(&(self->sched_cond), NULL);
     self->greenlet = NULL;
     self->thread_state = NULL;
-    self->immediate.head = self->immediate.tail = NULL;
+    memset(self->immediate, 0, sizeof(self->immediate));
     self->timers.entries = NULL;
     self->timers.len = 0;
     self->timers.capacity = 0;
     self->event_freelist = NULL;
     self->event_freelist_len = 0;
+    self->filament_freelist = NULL;
+    self->filament_freelist_len = 0;
     self->running = 0;
     self->aborting = 0;
+    self->trace = NULL;
+    memset(&(self->blockwatch), 0, sizeof(self->blockwatch));
+    memset(&(self->preempt), 0, sizeof(self->preempt));
+    memset(&(self->stats), 0, sizeof(self->stats));
+    self->running_prio = FIL_SCHED_PRIO_NORMAL;
+    memset(self->prio_age, 0, sizeof(self->prio_age));
     /* Bind this scheduler to the creating OS thread. All greenlet switches
      * driven by this scheduler MUST happen on this thread. */
     self->thread_id = PyThread_get_thread_ident();
+    _sched_register(self);
     return (PyObject *)self;
 }
 
@@ -580,6 +786,13 @@ static void _sched_dealloc(PyFilScheduler *self)
         free(event);
     }
     self->event_freelist_len = 0;
+    fil_filament_freelist_clear(self);
+    fil_trace_detach(self);
+    fil_blockwatch_detach(self);
+    fil_preempt_detach(self);
+    pthread_mutex_lock(&_sched_reg_lock);
+    __sched_unregister(self);
+    pthread_mutex_unlock(&_sched_reg_lock);
     /* Any events still queued here would be a bug (each holds a reference to
      * something that would have kept this scheduler alive); the heap's array
      * is ours either way. */
@@ -743,12 +956,78 @@ static void _handle_exception(PyFilScheduler *self)
 }
 
 PyDoc_STRVAR(sched_main_doc, "Main entrypoint for the Scheduler greenlet.");
+/*
+ * Priority classes in _sched_main.
+ *
+ * A pass runs its batch highest class first, so work queued in a higher
+ * class before the pass started never waits behind a lower one.  Work that
+ * arrives DURING the pass -- a health check woken by the io thread while five
+ * thousand bulk greenthreads are queued -- would, though, so the pass checks
+ * between events: once a lower class has had its quantum in this pass and
+ * something higher is ready, the rest of the batch goes back to the front of
+ * its FIFOs and a new pass starts.
+ *
+ * Aging keeps the lower classes moving.  Each cut ages every class left in
+ * the cut-off remainder; a class's quantum is FIL_SCHED_PRIO_QUANTUM events
+ * doubled per age, and one at FIL_SCHED_PRIO_AGE_MAX is not cut at all.  A
+ * class's age drops back to zero once a pass gets through all of it.  So
+ * under a steady stream of high-class work the higher classes wait for at
+ * most a quantum of lower-class events, except that every
+ * FIL_SCHED_PRIO_AGE_MAX + 1 passes or so the lower classes get to run
+ * through their whole backlog.
+ */
+#define FIL_SCHED_PRIO_QUANTUM 16U
+#define FIL_SCHED_PRIO_AGE_MAX 4
+
+/* Put a cut-off remainder of a batch back in front of what has been queued
+ * since, class by class, in its order.  Caller holds sched_lock. */
+static void _sched_requeue(PyFilScheduler *sched, FilSchedEvent *events)
+{
+    FilSchedEventList back[FIL_SCHED_NPRIO];
+    FilSchedEventList *elist;
+    FilSchedEvent *event;
+    int prio;
+
+    memset(back, 0, sizeof(back));
+    while ((event = events) != NULL)
+    {
+        events = event->next;
+        prio = FIL_SCHED_EVENT_PRIO(event->flags);
+        _imm_push(&(back[prio]), event);
+    }
+    for (prio = 0; prio < FIL_SCHED_NPRIO; prio++)
+    {
+        if (back[prio].head == NULL)
+        {
+            continue;
+        }
+        if (sched->prio_age[prio] < FIL_SCHED_PRIO_AGE_MAX)
+        {
+            sched->prio_age[prio]++;
+        }
+        elist = &(sched->immediate[prio]);
+        if (elist->head != NULL)
+        {
+            back[prio].tail->next = elist->head;
+            elist->head->prev = back[prio].tail;
+        }
+        else
+        {
+            elist->tail = back[prio].tail;
+        }
+        elist->head = back[prio].head;
+    }
+}
+
 static PyObject *_sched_main(PyFilScheduler *self, PyObject *args)
 {
     struct timespec *wait_time;
     FilSchedEvent *event;
     FilSchedEvent *ready_events;
     FilSchedEvent *done_events;
+    FilSchedEvent *cut;
+    unsigned int ran;
+    int prio;
     int err;
 
     /* Allow other threads to run. */
@@ -756,14 +1035,24 @@ static PyObject *_sched_main(PyFilScheduler *self, PyObject *args)
 
     pthread_mutex_lock(&(self->sched_lock));
     self->running = 1;
-    while (!self->aborting || self->immediate.head != NULL || self->timers.len)
+    while (!self->aborting || !_imm_empty(self) || self->timers.len)
     {
         ready_events = _get_ready_events(self, &wait_time);
         if (ready_events == NULL)
         {
+            uint64_t slept = __atomic_load_n(&_sched_timing, __ATOMIC_RELAXED) ?
+                             _sched_now_ns() : 0;
+
+            FIL_TRACE(self, FIL_TRACE_IDLE, NULL, 0);
             err = fil_pthread_cond_wait_min(&(self->sched_cond),
                                             &(self->sched_lock),
                                             wait_time);
+            FIL_TRACE(self, FIL_TRACE_BUSY, NULL, 0);
+            if (slept != 0)
+            {
+                fil_histogram_record(&(self->stats.sleep),
+                                     _sched_now_ns() - slept);
+            }
             if (err == EINTR)
             {
                 pthread_mutex_unlock(&(self->sched_lock));
@@ -782,16 +1071,67 @@ static PyObject *_sched_main(PyFilScheduler *self, PyObject *args)
 
         pthread_mutex_unlock(&(self->sched_lock));
 
+        /* Tracing was turned on since this scheduler last looked. */
+        if (__atomic_load_n(&fil_trace_wanted, __ATOMIC_RELAXED) &&
+            self->trace == NULL)
+        {
+            fil_trace_attach(self);
+        }
+        /* Likewise the blocking-call detector. */
+        if (__atomic_load_n(&fil_blockwatch_wanted, __ATOMIC_RELAXED) &&
+            !self->blockwatch.registered)
+        {
+            fil_blockwatch_attach(self);
+        }
+        /* And time-slice preemption, on or off; that needs the GIL. */
+        if (fil_preempt_out_of_sync(&(self->preempt)))
+        {
+            PyEval_RestoreThread(self->thread_state);
+            self->thread_state = NULL;
+            fil_preempt_sync(self);
+            self->thread_state = PyEval_SaveThread();
+        }
+
         /* NOTE: we deliberately keep the per-event RestoreThread/SaveThread
          * pair (rather than holding the GIL across the whole batch): the
          * voluntary GIL release after every event is an important scheduling
          * point for real OS threads (thread-pool workers, io users) that are
          * competing for the GIL -- batching it measured ~3x slower on the
          * logging-from-threadpool (#137) workload. */
+        FIL_SCHED_STAT_INC(self, passes);
         done_events = NULL;
+        cut = NULL;
+        prio = -1;
+        ran = 0;
         while((event = ready_events) != NULL)
         {
+            if (FIL_SCHED_EVENT_PRIO(event->flags) != prio)
+            {
+                if (prio >= 0)
+                {
+                    /* Got through all of the class before. */
+                    self->prio_age[prio] = 0;
+                }
+                prio = FIL_SCHED_EVENT_PRIO(event->flags);
+                ran = 0;
+            }
+            else if (prio != FIL_SCHED_PRIO_HIGH &&
+                     self->prio_age[prio] < FIL_SCHED_PRIO_AGE_MAX &&
+                     ran >= (FIL_SCHED_PRIO_QUANTUM << self->prio_age[prio]) &&
+                     _imm_higher_ready(self, prio))
+            {
+                cut = event;
+                break;
+            }
+            ran++;
+            self->running_prio = prio;
             ready_events = event->next;
+            FIL_SCHED_STAT_INC(self, events);
+            if (event->queued_ns != 0)
+            {
+                fil_histogram_record(&(self->stats.ready_latency),
+                                     _sched_now_ns() - event->queued_ns);
+            }
             if (event->flags & FIL_SCHED_EVENT_FLAGS_DONTBLOCK_THREADS)
             {
                 /* FIXME(comstud): Probably should allow a way for
@@ -802,10 +1142,23 @@ static PyObject *_sched_main(PyFilScheduler *self, PyObject *args)
             }
             else
             {
+                int watched;
+
                 PyEval_RestoreThread(self->thread_state);
                 self->thread_state = NULL;
 
+                watched = self->blockwatch.registered &&
+                          __atomic_load_n(&fil_blockwatch_wanted,
+                                          __ATOMIC_RELAXED);
+                if (watched)
+                {
+                    fil_blockwatch_begin(&(self->blockwatch));
+                }
                 event->cb(self, event->cb_arg);
+                if (watched)
+                {
+                    fil_blockwatch_end(&(self->blockwatch));
+                }
 
                 if (PyErr_Occurred() != NULL || PyErr_CheckSignals())
                 {
@@ -819,9 +1172,19 @@ static PyObject *_sched_main(PyFilScheduler *self, PyObject *args)
             event->next = done_events;
             done_events = event;
         }
+        self->running_prio = FIL_SCHED_PRIO_NORMAL;
 
         pthread_mutex_lock(&(self->sched_lock));
 
+        if (cut != NULL)
+        {
+            _sched_requeue(self, cut);
+        }
+        else if (prio >= 0)
+        {
+            self->prio_age[prio] = 0;
+        }
+
         while ((event = done_events) != NULL)
         {
             done_events = event->next;
@@ -924,6 +1287,24 @@ static PyObject *_sched_greenlet(PyFilScheduler *self, PyObject *args)
     return (PyObject *)self->greenlet;
 }
 
+/* Caller holds sched->sched_lock. */
+static Py_ssize_t __sched_immediate_len(PyFilScheduler *sched)
+{
+    FilSchedEvent *event;
+    Py_ssize_t n = 0;
+    int prio;
+
+    for (prio = 0; prio < FIL_SCHED_NPRIO; prio++)
+    {
+        for (event = sched->immediate[prio].head; event != NULL;
+             event = event->next)
+        {
+            n++;
+        }
+    }
+    return n;
+}
+
 PyDoc_STRVAR(sched_queue_depth_doc,
 "queue_depth() -> (immediate_count, timer_count)\n\
 \n\
@@ -932,22 +1313,98 @@ for a deadline.  Diagnostic -- it is what tells you whether cancelled\n\
 timeouts are actually leaving the queue.");
 static PyObject *_sched_queue_depth(PyFilScheduler *self, PyObject *args)
 {
-    FilSchedEvent *event;
-    Py_ssize_t immediate = 0;
+    Py_ssize_t immediate;
     Py_ssize_t timers;
 
     pthread_mutex_lock(&(self->sched_lock));
-    for (event = self->immediate.head; event != NULL; event = event->next)
+    immediate = __sched_immediate_len(self);
+    timers = (Py_ssize_t)self->timers.len;
+    pthread_mutex_unlock(&(self->sched_lock));
+
+    return Py_BuildValue("(nn)", immediate, timers);
+}
+
+/* One scheduler's stats as a dict; the counts from a copy, so no lock is
+ * held while this allocates. */
+static PyObject *__sched_stats_dict(PyObject *thread_id, FilSchedStats *st,
+                                    Py_ssize_t immediate, Py_ssize_t timers)
+{
+    PyObject *ready_latency = fil_histogram_to_dict(&(st->ready_latency));
+    PyObject *sleep = fil_histogram_to_dict(&(st->sleep));
+
+    if (ready_latency == NULL || sleep == NULL)
+    {
+        Py_XDECREF(ready_latency);
+        Py_XDECREF(sleep);
+        return NULL;
+    }
+    return Py_BuildValue("{sOsKsKsKsKsKsKsKsKsKsKsKsKsnsnsNsN}",
+                         "thread_id", thread_id,
+                         "switches", (unsigned long long)st->switches,
+                         "passes", (unsigned long long)st->passes,
+                         "events", (unsigned long long)st->events,
+                         "timers_armed", (unsigned long long)st->timers_armed,
+                         "timers_cancelled",
+                         (unsigned long long)st->timers_cancelled,
+                         "timers_fired", (unsigned long long)st->timers_fired,
+                         "freelist_hits",
+                         (unsigned long long)st->freelist_hits,
+                         "freelist_misses",
+                         (unsigned long long)st->freelist_misses,
+                         "wakeups_local",
+                         (unsigned long long)st->wakeups_local,
+                         "wakeups_remote",
+                         (unsigned long long)st->wakeups_remote,
+                         "preemptions",
+                         (unsigned long long)st->preemptions,
+                         "filaments_recycled",
+                         (unsigned long long)st->filaments_recycled,
+                         "immediate", immediate,
+                         "timers", timers,
+                         "ready_latency", ready_latency,
+                         "sleep", sleep);
+}
+
+PyDoc_STRVAR(sched_stats_doc,
+"stats() -> dict\n\
+\n\
+What this scheduler has done since it was created: greenthread switches,\n\
+loop passes and callbacks run, timers armed/cancelled/fired, event\n\
+freelist hits and misses, wakeups queued from its own thread vs other\n\
+threads, greenthreads preempted at the end of a time slice, and\n\
+Filaments made from freed ones; the current queue depths ('immediate',\n\
+'timers'); and, with timings on (metrics_mode()), histograms of\n\
+ready-to-run latency and of idle sleeps.  Each histogram is {'count',\n\
+'sum', 'max', 'buckets'}, in ns, 'buckets' the non-empty (floor_ns,\n\
+count) pairs.");
+static PyObject *_sched_stats(PyFilScheduler *self, PyObject *args)
+{
+    FilSchedStats *copy;
+    Py_ssize_t immediate, timers;
+    PyObject *thread_id;
+    PyObject *result;
+
+    copy = calloc(1, sizeof(*copy));
+    if (copy == NULL)
     {
-        immediate++;
+        return PyErr_NoMemory();
     }
+    pthread_mutex_lock(&(self->sched_lock));
+    _sched_stats_add(copy, &(self->stats));
+    immediate = __sched_immediate_len(self);
     timers = (Py_ssize_t)self->timers.len;
     pthread_mutex_unlock(&(self->sched_lock));
 
-    return Py_BuildValue("(nn)", immediate, timers);
+    thread_id = PyLong_FromUnsignedLong(self->thread_id);
+    result = thread_id == NULL ? NULL :
+             __sched_stats_dict(thread_id, copy, immediate, timers);
+    Py_XDECREF(thread_id);
+    free(copy);
+    return result;
 }
 
 static PyMethodDef _sched_methods[] = {
+    {"stats", (PyCFunction)_sched_stats, METH_NOARGS, sched_stats_doc},
     {"queue_depth", (PyCFunction)_sched_queue_depth, METH_NOARGS, sched_queue_depth_doc},
     {"fil_switch", (PyCFunction)_sched_fil_switch, METH_O, sched_fil_switch_doc},
     {"main", (PyCFunction)_sched_main, METH_VARARGS, sched_main_doc},
@@ -1093,7 +1550,8 @@ int fil_scheduler_switch(PyFilScheduler *sched)
 int fil_scheduler_gl_switch(PyFilScheduler *sched, struct timespec *ts, PyGreenlet *greenlet)
 {
     Py_INCREF(greenlet);
-    if (fil_scheduler_add_event(sched, ts, 0,
+    if (fil_scheduler_add_event(sched, ts,
+                                FIL_SCHED_EVENT_FLAGS_PRIO(_greenlet_prio(greenlet)),
                                 (fil_event_cb_t)_greenlet_event_switch,
                                 greenlet) < 0)
     {
@@ -1110,16 +1568,305 @@ int fil_scheduler_gl_switch(PyFilScheduler *sched, struct timespec *ts, PyGreenl
     return 0;
 }
 
+/*
+ * fil_scheduler_gl_switch() for a batch: queue a deferred switch to each of
+ * greenlets[0..n-1], in order, under a single sched_lock hold and with at
+ * most one wakeup -- spawn_many() starting a fan-out, where n separate
+ * enqueues would take the lock (and possibly broadcast) n times.
+ *
+ * All or nothing: if an event node cannot be had, the nodes already taken go
+ * back to the freelist, nothing is queued, and -1 is returned with
+ * MemoryError set.  Same refcount contract as the single version.
+ */
+int fil_scheduler_gl_switch_many(PyFilScheduler *sched, PyGreenlet **greenlets,
+                                 Py_ssize_t n)
+{
+    FilSchedEventList batch = {NULL, NULL};
+    FilSchedEvent *event;
+    uint64_t queued_ns;
+    int wake_scheduler;
+    Py_ssize_t i;
+
+    if (n <= 0)
+    {
+        return 0;
+    }
+
+    queued_ns = __atomic_load_n(&_sched_timing, __ATOMIC_RELAXED) ?
+                _sched_now_ns() : 0;
+    pthread_mutex_lock(&(sched->sched_lock));
+    for (i = 0; i < n; i++)
+    {
+        if ((event = sched->event_freelist) != NULL)
+        {
+            sched->event_freelist = event->next;
+            sched->event_freelist_len--;
+            sched->stats.freelist_hits++;
+        }
+        else if ((event = malloc(sizeof(*event))) == NULL)
+        {
+            while ((event = batch.head) != NULL)
+            {
+                batch.head = event->next;
+                if (sched->event_freelist_len >= FIL_SCHED_EVENT_FREELIST_MAX)
+                {
+                    free(event);
+                    continue;
+                }
+                event->next = sched->event_freelist;
+                sched->event_freelist = event;
+                sched->event_freelist_len++;
+            }
+            pthread_mutex_unlock(&(sched->sched_lock));
+            PyErr_NoMemory();
+            return -1;
+        }
+        else
+        {
+            sched->stats.freelist_misses++;
+        }
+        event->flags = FIL_SCHED_EVENT_FLAGS_PRIO(_greenlet_prio(greenlets[i]));
+        event->cb = (fil_event_cb_t)_greenlet_event_switch;
+        event->cb_arg = greenlets[i];
+        event->owner_ref = NULL;
+        event->ts.tv_sec = 0;
+        event->ts.tv_nsec = 0;
+        event->queued_ns = queued_ns;
+        _imm_push(&batch, event);
+    }
+    if (PyThread_get_thread_ident() == sched->thread_id)
+    {
+        sched->stats.wakeups_local += n;
+    }
+    else
+    {
+        sched->stats.wakeups_remote += n;
+    }
+
+    for (i = 0; i < n; i++)
+    {
+        Py_INCREF(greenlets[i]);
+    }
+
+    /* Onto the FIFO tails, each to its class's. */
+    wake_scheduler = _imm_empty(sched);
+    while ((event = batch.head) != NULL)
+    {
+        batch.head = event->next;
+        _imm_push(_imm_list(sched, event), event);
+    }
+    pthread_mutex_unlock(&(sched->sched_lock));
+
+    if (wake_scheduler)
+    {
+        /* Broadcast for the reason given in _scheduler_add_event(). */
+        pthread_cond_broadcast(&(sched->sched_cond));
+    }
+    return 0;
+}
+
 PyGreenlet *fil_scheduler_greenlet(PyFilScheduler *sched)
 {
     return sched->greenlet;
 }
 
+PyFilScheduler *fil_scheduler_current(void)
+{
+    return _scheduler_get();
+}
+
+/*
+ * After os.fork(), in the child.  The forking thread keeps its scheduler and
+ * every greenthread on it, but an io or thread-pool thread could have been
+ * inside sched_lock (queueing a wakeup) at the instant of the fork, and it
+ * will never let go.  Nothing else can be holding it: the forking thread was
+ * running Python.  Other threads' schedulers went with their threads; their
+ * TSD slots are gone and nothing in the child runs them, so their counts are
+ * retired (and they come off the registry) here.
+ */
+static PyObject *_scheduler_after_fork_child(PyObject *self, PyObject *ignored)
+{
+    PyFilScheduler *sched = _scheduler_get();
+    PyFilScheduler *other;
+    PyFilScheduler *next;
+
+    (void)self;
+    (void)ignored;
+
+    pthread_mutex_init(&_sched_reg_lock, NULL);
+    for (other = _sched_registry; other != NULL; other = next)
+    {
+        next = other->reg_next;
+        if (other != sched)
+        {
+            __sched_unregister(other);
+        }
+    }
+    if (sched != NULL)
+    {
+        pthread_mutex_init(&(sched->sched_lock), NULL);
+        pthread_cond_init(&(sched->sched_cond), NULL);
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_scheduler_stats_doc,
+"scheduler_stats() -> list of dict\n\n"
+"Scheduler.stats() for every scheduler in the process, plus one entry with\n"
+"'thread_id' None totalling the schedulers that have gone.");
+static PyObject *_scheduler_stats(PyObject *_self, PyObject *args)
+{
+    PyFilScheduler *sched;
+    FilSchedStats *copies;
+    unsigned long *tids;
+    Py_ssize_t *depths;
+    Py_ssize_t n = 0, i;
+    PyObject *result;
+
+    /* Copied under the lock (a scheduler leaves the list in its dealloc),
+     * turned into Python objects after. */
+    pthread_mutex_lock(&_sched_reg_lock);
+    for (sched = _sched_registry; sched != NULL; sched = sched->reg_next)
+    {
+        n++;
+    }
+    copies = calloc(n + 1, sizeof(*copies));
+    tids = malloc(sizeof(*tids) * (n + 1));
+    depths = malloc(sizeof(*depths) * 2 * (n + 1));
+    if (copies == NULL || tids == NULL || depths == NULL)
+    {
+        pthread_mutex_unlock(&_sched_reg_lock);
+        free(copies);
+        free(tids);
+        free(depths);
+        return PyErr_NoMemory();
+    }
+    i = 0;
+    for (sched = _sched_registry; sched != NULL; sched = sched->reg_next)
+    {
+        pthread_mutex_lock(&(sched->sched_lock));
+        _sched_stats_add(&copies[i], &(sched->stats));
+        depths[2 * i] = __sched_immediate_len(sched);
+        depths[2 * i + 1] = (Py_ssize_t)sched->timers.len;
+        pthread_mutex_unlock(&(sched->sched_lock));
+        tids[i] = sched->thread_id;
+        i++;
+    }
+    _sched_stats_add(&copies[n], &_sched_retired);
+    depths[2 * n] = depths[2 * n + 1] = 0;
+    pthread_mutex_unlock(&_sched_reg_lock);
+
+    result = PyList_New(0);
+    for (i = 0; i <= n && result != NULL; i++)
+    {
+        PyObject *thread_id;
+        PyObject *entry;
+
+        if (i < n)
+        {
+            thread_id = PyLong_FromUnsignedLong(tids[i]);
+        }
+        else
+        {
+            thread_id = Py_None;
+            Py_INCREF(thread_id);
+        }
+        entry = thread_id == NULL ? NULL :
+                __sched_stats_dict(thread_id, &copies[i], depths[2 * i],
+                                   depths[2 * i + 1]);
+        Py_XDECREF(thread_id);
+        if (entry == NULL || PyList_Append(result, entry) < 0)
+        {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(entry);
+    }
+    free(copies);
+    free(tids);
+    free(depths);
+    return result;
+}
+
+PyDoc_STRVAR(_metrics_mode_doc,
+"metrics_mode([mode]) -> str\n\n"
+"Set (and return) whether schedulers keep timings, 'off' or 'on': the\n"
+"ready-latency and sleep histograms of Scheduler.stats().  The counters\n"
+"are always kept.  Seeded from FIL_METRICS.");
+static PyObject *_metrics_mode(PyObject *_self, PyObject *args)
+{
+    const char *mode = NULL;
+
+    if (!PyArg_ParseTuple(args, "|s:metrics_mode", &mode))
+    {
+        return NULL;
+    }
+    if (mode != NULL)
+    {
+        if (strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)
+        {
+            PyErr_Format(PyExc_ValueError,
+                         "metrics mode must be 'off' or 'on', not '%s'", mode);
+            return NULL;
+        }
+        __atomic_store_n(&_sched_timing, strcmp(mode, "on") == 0,
+                         __ATOMIC_RELAXED);
+    }
+    return PyUnicode_FromString(
+        __atomic_load_n(&_sched_timing, __ATOMIC_RELAXED) ? "on" : "off");
+}
+
+static PyMethodDef _scheduler_module_methods[] = {
+    {"scheduler_stats", (PyCFunction)_scheduler_stats, METH_NOARGS,
+     _scheduler_stats_doc },
+    {"metrics_mode", (PyCFunction)_metrics_mode, METH_VARARGS,
+     _metrics_mode_doc },
+    { NULL, NULL }
+};
+
+static PyMethodDef _scheduler_after_fork_child_def = {
+    "_fil_scheduler_after_fork_child", (PyCFunction)_scheduler_after_fork_child,
+    METH_NOARGS, NULL
+};
+
 int fil_scheduler_init(PyObject *module, PyFilCore_CAPIObject *capi)
 {
+    const char *env = getenv("FIL_METRICS");
+    PyMethodDef *def;
+    PyObject *func;
+
     pthread_key_create(&_scheduler_key, _scheduler_key_delete);
     PyGreenlet_Import();
 
+    if (env != NULL && *env != '\0')
+    {
+        if (strcmp(env, "1") == 0 || strcmp(env, "on") == 0)
+        {
+            _sched_timing = 1;
+        }
+        else if (strcmp(env, "0") != 0 && strcmp(env, "off") != 0)
+        {
+            PyErr_Format(PyExc_ValueError,
+                         "FIL_METRICS must be 0, 1, 'off' or 'on', not '%s'",
+                         env);
+            return -1;
+        }
+    }
+
+    for (def = _scheduler_module_methods; def->ml_name != NULL; def++)
+    {
+        func = PyCFunction_NewEx(def, NULL, NULL);
+        if (func == NULL || PyModule_AddObject(module, def->ml_name, func) != 0)
+        {
+            Py_XDECREF(func);
+            return -1;
+        }
+    }
+
+    if (fil_register_at_fork(NULL, NULL, &_scheduler_after_fork_child_def) < 0)
+    {
+        return -1;
+    }
+
     if (PyType_Ready(&_scheduler_type) < 0)
     {
         return -1;
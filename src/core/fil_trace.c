@@ -0,0 +1,366 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define __FIL_BUILDING_CORE__
+#include "core/filament.h"
+
+/*
+ * The trace ring registry; see core/fil_trace.h for the record format.
+ *
+ * Every ring ever attached is on '_tr_rings' until trace_mode("on") starts
+ * a new trace, which frees the ones whose scheduler has gone (their records
+ * belong to the trace before).  '_tr_lock' covers the list, the mode and
+ * the calibration anchor; writers never take it.
+ *
+ * A ring is only freed once its scheduler is gone, and a scheduler is only
+ * gone once nothing can queue a wakeup for it (a wakeup holds a reference),
+ * so no writer can be in a ring that is being freed.
+ */
+static pthread_mutex_t _tr_lock = PTHREAD_MUTEX_INITIALIZER;
+static FilTraceRing _tr_rings = { &_tr_rings, &_tr_rings };
+static size_t _tr_size = 65536;
+/* fil_trace_ticks() and CLOCK_MONOTONIC, read together at trace_mode("on"). */
+static uint64_t _tr_anchor_ticks;
+static uint64_t _tr_anchor_ns;
+
+/* Read by each scheduler once per pass of its loop. */
+int fil_trace_wanted;
+
+static uint64_t __tr_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void fil_trace_attach(PyFilScheduler *sched)
+{
+    FilTraceRing *ring;
+    size_t size;
+
+    if (sched->trace != NULL)
+    {
+        return;
+    }
+    pthread_mutex_lock(&_tr_lock);
+    if (!fil_trace_wanted)
+    {
+        pthread_mutex_unlock(&_tr_lock);
+        return;
+    }
+    size = _tr_size;
+    ring = calloc(1, sizeof(*ring) + (size - 1) * sizeof(FilTraceRecord));
+    if (ring == NULL)
+    {
+        /* Not worth failing the scheduler over: this one goes untraced. */
+        pthread_mutex_unlock(&_tr_lock);
+        return;
+    }
+    ring->mask = size - 1;
+    ring->thread_id = sched->thread_id;
+    ring->attached = 1;
+    ring->active = 1;
+    ring->next = &_tr_rings;
+    ring->prev = _tr_rings.prev;
+    _tr_rings.prev->next = ring;
+    _tr_rings.prev = ring;
+    pthread_mutex_unlock(&_tr_lock);
+
+    __atomic_store_n(&(sched->trace), ring, __ATOMIC_RELEASE);
+}
+
+void fil_trace_detach(PyFilScheduler *sched)
+{
+    FilTraceRing *ring = sched->trace;
+
+    if (ring == NULL)
+    {
+        return;
+    }
+    sched->trace = NULL;
+    pthread_mutex_lock(&_tr_lock);
+    ring->attached = 0;
+    ring->active = 0;
+    pthread_mutex_unlock(&_tr_lock);
+}
+
+PyDoc_STRVAR(_tr_mode_doc,
+"trace_mode([mode[, size]]) -> str\n\n"
+"Set (and return) the scheduler trace mode, 'off' or 'on'.  Turning it on\n"
+"starts a new trace: records from before are dropped, and each scheduler\n"
+"keeps its last 'size' records (a power of two, default 65536).  A\n"
+"scheduler's ring is sized when it is first traced and keeps that size.\n"
+"Seeded from FIL_TRACE.");
+static PyObject *_tr_mode(PyObject *_self, PyObject *args)
+{
+    const char *mode = NULL;
+    Py_ssize_t size = 0;
+    FilTraceRing *ring;
+    FilTraceRing *next;
+    FilTraceRing *dead = NULL;
+
+    if (!PyArg_ParseTuple(args, "|sn:trace_mode", &mode, &size))
+    {
+        return NULL;
+    }
+    if (size != 0 && (size < 16 || (size & (size - 1)) != 0))
+    {
+        PyErr_SetString(PyExc_ValueError,
+                        "trace size must be a power of two >= 16");
+        return NULL;
+    }
+    if (mode != NULL && strcmp(mode, "on") != 0 && strcmp(mode, "off") != 0)
+    {
+        PyErr_Format(PyExc_ValueError,
+                     "trace mode must be 'off' or 'on', not '%s'", mode);
+        return NULL;
+    }
+
+    pthread_mutex_lock(&_tr_lock);
+    if (mode != NULL && strcmp(mode, "on") == 0)
+    {
+        if (size != 0)
+        {
+            _tr_size = (size_t)size;
+        }
+        for (ring = _tr_rings.next; ring != &_tr_rings; ring = next)
+        {
+            next = ring->next;
+            if (!ring->attached)
+            {
+                ring->prev->next = ring->next;
+                ring->next->prev = ring->prev;
+                ring->next = dead;
+                dead = ring;
+                continue;
+            }
+            ring->start = __atomic_load_n(&(ring->head), __ATOMIC_RELAXED);
+            __atomic_store_n(&(ring->active), 1, __ATOMIC_RELAXED);
+        }
+        _tr_anchor_ticks = fil_trace_ticks();
+        _tr_anchor_ns = __tr_now_ns();
+        __atomic_store_n(&fil_trace_wanted, 1, __ATOMIC_RELAXED);
+    }
+    else if (mode != NULL)
+    {
+        __atomic_store_n(&fil_trace_wanted, 0, __ATOMIC_RELAXED);
+        for (ring = _tr_rings.next; ring != &_tr_rings; ring = ring->next)
+        {
+            __atomic_store_n(&(ring->active), 0, __ATOMIC_RELAXED);
+        }
+    }
+    pthread_mutex_unlock(&_tr_lock);
+
+    while ((ring = dead) != NULL)
+    {
+        dead = ring->next;
+        free(ring);
+    }
+    return PyUnicode_FromString(fil_trace_wanted ? "on" : "off");
+}
+
+/* Copy out the records of one ring still in it, oldest first, skipping any
+ * that were being overwritten while we looked. */
+static Py_ssize_t __tr_copy(FilTraceRing *ring, FilTraceRecord *out)
+{
+    uint64_t head = __atomic_load_n(&(ring->head), __ATOMIC_ACQUIRE);
+    uint64_t first = ring->start;
+    uint64_t idx;
+    Py_ssize_t n = 0;
+
+    if (head - first > ring->mask + 1)
+    {
+        first = head - (ring->mask + 1);
+    }
+    for (idx = first; idx < head; idx++)
+    {
+        FilTraceRecord *rec = &(ring->records[idx & ring->mask]);
+
+        if (__atomic_load_n(&(rec->seq), __ATOMIC_ACQUIRE) != idx + 1)
+        {
+            continue;
+        }
+        out[n] = *rec;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&(rec->seq), __ATOMIC_RELAXED) != idx + 1)
+        {
+            continue;
+        }
+        n++;
+    }
+    return n;
+}
+
+PyDoc_STRVAR(_tr_records_doc,
+"trace_records() -> list of (thread_id, records)\n\n"
+"The current trace, one entry per scheduler that recorded anything, its\n"
+"records oldest first as (ns, type, greenlet, arg, thread) tuples.  'ns' is\n"
+"CLOCK_MONOTONIC nanoseconds, 'greenlet' an id (an address, never a live\n"
+"object) and 'thread' the low 32 bits of the writing thread's ident.");
+static PyObject *_tr_records(PyObject *_self, PyObject *args)
+{
+    FilTraceRing *ring;
+    FilTraceRecord *buf = NULL;
+    unsigned long *tids = NULL;
+    Py_ssize_t *counts = NULL;
+    Py_ssize_t nrings = 0;
+    Py_ssize_t total = 0;
+    Py_ssize_t i, j, off;
+    uint64_t now_ticks, now_ns, anchor_ticks, anchor_ns;
+    double ns_per_tick;
+    PyObject *result = NULL;
+
+    /* Sized and copied under the lock (a ring is only freed under it), then
+     * turned into Python objects after. */
+    pthread_mutex_lock(&_tr_lock);
+    for (ring = _tr_rings.next; ring != &_tr_rings; ring = ring->next)
+    {
+        nrings++;
+        total += (Py_ssize_t)(ring->mask + 1);
+    }
+    buf = malloc(sizeof(*buf) * (total ? total : 1));
+    tids = malloc(sizeof(*tids) * (nrings ? nrings : 1));
+    counts = malloc(sizeof(*counts) * (nrings ? nrings : 1));
+    if (buf == NULL || tids == NULL || counts == NULL)
+    {
+        pthread_mutex_unlock(&_tr_lock);
+        free(buf);
+        free(tids);
+        free(counts);
+        return PyErr_NoMemory();
+    }
+    off = 0;
+    i = 0;
+    for (ring = _tr_rings.next; ring != &_tr_rings; ring = ring->next)
+    {
+        tids[i] = ring->thread_id;
+        counts[i] = __tr_copy(ring, buf + off);
+        off += counts[i];
+        i++;
+    }
+    anchor_ticks = _tr_anchor_ticks;
+    anchor_ns = _tr_anchor_ns;
+    now_ticks = fil_trace_ticks();
+    now_ns = __tr_now_ns();
+    pthread_mutex_unlock(&_tr_lock);
+
+    if (now_ticks > anchor_ticks && now_ns > anchor_ns)
+    {
+        ns_per_tick = (double)(now_ns - anchor_ns) /
+                      (double)(now_ticks - anchor_ticks);
+    }
+    else
+    {
+        ns_per_tick = 1.0;
+    }
+
+    result = PyList_New(0);
+    off = 0;
+    for (i = 0; i < nrings && result != NULL; i++)
+    {
+        PyObject *recs;
+        PyObject *entry;
+
+        if (counts[i] == 0)
+        {
+            continue;
+        }
+        recs = PyList_New(counts[i]);
+        for (j = 0; j < counts[i] && recs != NULL; j++)
+        {
+            FilTraceRecord *rec = &buf[off + j];
+            int64_t dt = (int64_t)(rec->ticks - anchor_ticks);
+            PyObject *item;
+
+            item = Py_BuildValue("(LIKKI)",
+                                 (long long)anchor_ns +
+                                     (long long)((double)dt * ns_per_tick),
+                                 (unsigned int)rec->type,
+                                 (unsigned long long)rec->gl,
+                                 (unsigned long long)rec->arg,
+                                 (unsigned int)rec->tid);
+            if (item == NULL)
+            {
+                Py_CLEAR(recs);
+                break;
+            }
+            PyList_SET_ITEM(recs, j, item);
+        }
+        off += counts[i];
+        entry = recs == NULL ? NULL : Py_BuildValue("(kN)", tids[i], recs);
+        if (entry == NULL || PyList_Append(result, entry) < 0)
+        {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(entry);
+    }
+    free(buf);
+    free(tids);
+    free(counts);
+    return result;
+}
+
+static PyMethodDef _tr_methods[] = {
+    {"trace_mode", (PyCFunction)_tr_mode, METH_VARARGS, _tr_mode_doc },
+    {"trace_records", (PyCFunction)_tr_records, METH_NOARGS, _tr_records_doc },
+    { NULL, NULL }
+};
+
+int fil_trace_init(PyObject *module, PyFilCore_CAPIObject *capi)
+{
+    const char *env = getenv("FIL_TRACE");
+    PyMethodDef *def;
+    PyObject *func;
+
+    (void)capi;
+
+    if (env != NULL && *env != '\0')
+    {
+        if (strcmp(env, "1") == 0 || strcmp(env, "on") == 0)
+        {
+            _tr_anchor_ticks = fil_trace_ticks();
+            _tr_anchor_ns = __tr_now_ns();
+            fil_trace_wanted = 1;
+        }
+        else if (strcmp(env, "0") != 0 && strcmp(env, "off") != 0)
+        {
+            PyErr_Format(PyExc_ValueError,
+                         "FIL_TRACE must be 0, 1, 'off' or 'on', not '%s'",
+                         env);
+            return -1;
+        }
+    }
+
+    for (def = _tr_methods; def->ml_name != NULL; def++)
+    {
+        func = PyCFunction_NewEx(def, NULL, NULL);
+        if (func == NULL || PyModule_AddObject(module, def->ml_name, func) != 0)
+        {
+            Py_XDECREF(func);
+            return -1;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,539 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define __FIL_BUILDING_CORE__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_WAITSET
+#include "core/filament.h"
+
+/*
+ * WaitSet: wait for the first / the Nth of many completions.
+ *
+ * Built for joinall()/iwait()/wait() over thousands of greenthreads.  Waiting
+ * on each in turn parks once per greenthread and needs a Python Timeout to
+ * bound the whole thing; here every source gets one FilMessageLink on its
+ * Message at construction (O(n) registrations, no waiters), the completions
+ * collect on a ready FIFO as they happen, and wait() parks a single FilWaiter
+ * only while fewer than 'count' are ready.  One deadline, absolute, fixed
+ * when the set is built, covers every wait() on it.
+ *
+ * Sources are Filaments (their result Message), Messages, and whatever
+ * other extensions register with fil_waitset_register_type() -- the locking
+ * module's Event and AsyncResult.  wait() hands back positions in the source
+ * sequence, in completion order; the caller maps them back to whatever it was
+ * given (filament/greenthread.py does).
+ *
+ * Locking mirrors the Message: none on a GIL build, where link callbacks run
+ * inside send()/set() with the GIL held; a mutex on a free-threaded one, taken
+ * inside the source's own lock (msg_lock -> ws lock -> waiter_lock).
+ */
+#ifdef Py_GIL_DISABLED
+#  define FIL_WS_LOCK(__w)    pthread_mutex_lock(&((__w)->lock))
+#  define FIL_WS_UNLOCK(__w)  pthread_mutex_unlock(&((__w)->lock))
+#else
+#  define FIL_WS_LOCK(__w)    ((void)0)
+#  define FIL_WS_UNLOCK(__w)  ((void)0)
+#endif
+
+typedef struct _pyfil_waitset PyFilWaitSet;
+
+typedef struct
+{
+    PyTypeObject *type;
+    fil_waitable_link_t link;
+    fil_waitable_unlink_t unlink;
+} FilWaitableType;
+
+typedef struct
+{
+    FilMessageLink link;        /* first: the callback casts back to us */
+    PyFilWaitSet *ws;
+    PyObject *source;           /* owned until released */
+    const FilWaitableType *kind;
+    Py_ssize_t next_ready;
+} FilWaitSetEntry;
+
+static int _ws_message_link(PyObject *obj, FilMessageLink *link)
+{
+    return fil_message_link((PyFilMessage *)obj, link);
+}
+
+static void _ws_message_unlink(PyObject *obj, FilMessageLink *link)
+{
+    fil_message_unlink((PyFilMessage *)obj, link);
+}
+
+static const FilWaitableType _ws_message_kind = {
+    NULL, _ws_message_link, _ws_message_unlink
+};
+
+/* A handful at most (Event, AsyncResult); registered at module init, under
+ * the GIL, and never removed. */
+#define FIL_WS_MAX_KINDS 8
+static FilWaitableType _ws_kinds[FIL_WS_MAX_KINDS];
+static int _ws_nkinds;
+
+struct _pyfil_waitset
+{
+    PyObject_HEAD
+    FilWaitSetEntry *entries;
+    Py_ssize_t n;
+    /* Completed, not yet handed out by wait(); FIFO through next_ready. */
+    Py_ssize_t ready_head;
+    Py_ssize_t ready_tail;
+    Py_ssize_t ready_len;
+    /* Not yet handed out, ready or not. */
+    Py_ssize_t remaining;
+    /* The parked wait(), and how many ready entries it needs to wake. */
+    FilWaiter *waiter;
+    Py_ssize_t want;
+    struct timespec deadline_buf;
+    struct timespec *deadline;
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_t lock;
+#endif
+};
+
+/* Caller holds the ws lock. */
+static void _ws_push_ready(PyFilWaitSet *ws, Py_ssize_t idx)
+{
+    ws->entries[idx].next_ready = -1;
+    if (ws->ready_tail < 0)
+    {
+        ws->ready_head = idx;
+    }
+    else
+    {
+        ws->entries[ws->ready_tail].next_ready = idx;
+    }
+    ws->ready_tail = idx;
+    ws->ready_len++;
+}
+
+static void _ws_entry_done(FilMessageLink *link)
+{
+    FilWaitSetEntry *entry = (FilWaitSetEntry *)link;
+    PyFilWaitSet *ws = entry->ws;
+
+    FIL_WS_LOCK(ws);
+    _ws_push_ready(ws, entry - ws->entries);
+    if (ws->waiter != NULL && ws->ready_len >= ws->want)
+    {
+        fil_waiter_signal(ws->waiter);
+    }
+    FIL_WS_UNLOCK(ws);
+}
+
+/* Unhook every entry still linked and drop the source references. */
+static void _ws_release(PyFilWaitSet *ws)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < ws->n; i++)
+    {
+        FilWaitSetEntry *entry = &(ws->entries[i]);
+
+        if (entry->source != NULL)
+        {
+            entry->kind->unlink(entry->source, &(entry->link));
+            Py_CLEAR(entry->source);
+        }
+    }
+}
+
+/* Fill in entry->source (a new reference) and entry->kind for 'obj'. */
+static int _ws_resolve(PyObject *obj, FilWaitSetEntry *entry)
+{
+    int i;
+
+    if (PyObject_TypeCheck(obj, PyFilament_Type))
+    {
+        PyFilMessage *message;
+
+        if (((PyFilament *)obj)->flags & FIL_FILAMENT_FLAGS_NO_RESULT)
+        {
+            PyErr_SetString(PyExc_TypeError,
+                            "greenthreads started by spawn_n() cannot be "
+                            "waited on");
+            return -1;
+        }
+        message = fil_filament_message((PyFilament *)obj);
+        if (message == NULL)
+        {
+            return -1;
+        }
+        obj = (PyObject *)message;
+    }
+    if (fil_message_check(obj))
+    {
+        entry->kind = &_ws_message_kind;
+    }
+    else
+    {
+        for (i = 0; i < _ws_nkinds; i++)
+        {
+            if (PyObject_TypeCheck(obj, _ws_kinds[i].type))
+            {
+                entry->kind = &(_ws_kinds[i]);
+                break;
+            }
+        }
+        if (entry->kind == NULL)
+        {
+            PyErr_Format(PyExc_TypeError,
+                         "WaitSet cannot watch %.200s objects",
+                         Py_TYPE(obj)->tp_name);
+            return -1;
+        }
+    }
+    Py_INCREF(obj);
+    entry->source = obj;
+    return 0;
+}
+
+static PyObject *_ws_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"sources", "timeout", NULL};
+    PyObject *sources;
+    PyObject *timeout = NULL;
+    PyObject *seq;
+    PyFilWaitSet *self;
+    Py_ssize_t i;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O:WaitSet", keywords,
+                                     &sources, &timeout))
+    {
+        return NULL;
+    }
+
+    seq = PySequence_Fast(sources, "WaitSet() sources must be iterable");
+    if (seq == NULL)
+    {
+        return NULL;
+    }
+
+    self = (PyFilWaitSet *)type->tp_alloc(type, 0);
+    if (self == NULL)
+    {
+        Py_DECREF(seq);
+        return NULL;
+    }
+    self->ready_head = self->ready_tail = -1;
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_init(&(self->lock), NULL);
+#endif
+
+    if (fil_timespec_from_pyobj_interval(timeout, &(self->deadline_buf),
+                                         &(self->deadline)) < 0)
+    {
+        goto fail;
+    }
+
+    self->n = PySequence_Fast_GET_SIZE(seq);
+    if (self->n)
+    {
+        self->entries = PyMem_Calloc(self->n, sizeof(FilWaitSetEntry));
+        if (self->entries == NULL)
+        {
+            self->n = 0;
+            PyErr_NoMemory();
+            goto fail;
+        }
+    }
+
+    /* Resolve everything before linking anything, so a bad source fails
+     * the constructor without completions racing in. */
+    for (i = 0; i < self->n; i++)
+    {
+        if (_ws_resolve(PySequence_Fast_GET_ITEM(seq, i),
+                        &(self->entries[i])) < 0)
+        {
+            goto fail;
+        }
+        self->entries[i].ws = self;
+        self->entries[i].link.cb = _ws_entry_done;
+    }
+    Py_CLEAR(seq);
+
+    self->remaining = self->n;
+    for (i = 0; i < self->n; i++)
+    {
+        FilWaitSetEntry *entry = &(self->entries[i]);
+
+        if (entry->kind->link(entry->source, &(entry->link)))
+        {
+            FIL_WS_LOCK(self);
+            _ws_push_ready(self, i);
+            FIL_WS_UNLOCK(self);
+        }
+    }
+
+    return (PyObject *)self;
+
+fail:
+    Py_XDECREF(seq);
+    Py_DECREF(self);
+    return NULL;
+}
+
+static int _ws_traverse(PyFilWaitSet *self, visitproc visit, void *arg)
+{
+    Py_ssize_t i;
+
+    for (i = 0; i < self->n; i++)
+    {
+        Py_VISIT(self->entries[i].source);
+    }
+    return 0;
+}
+
+static int _ws_clear(PyFilWaitSet *self)
+{
+    _ws_release(self);
+    return 0;
+}
+
+static void _ws_dealloc(PyFilWaitSet *self)
+{
+    PyObject_GC_UnTrack((PyObject *)self);
+    _ws_release(self);
+    PyMem_Free(self->entries);
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_destroy(&(self->lock));
+#endif
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/* Hand out everything ready, as a list of source positions. */
+static PyObject *_ws_take_ready(PyFilWaitSet *self)
+{
+    PyObject *result;
+    Py_ssize_t idx;
+    Py_ssize_t i = 0;
+
+    FIL_WS_LOCK(self);
+    result = PyList_New(self->ready_len);
+    if (result == NULL)
+    {
+        FIL_WS_UNLOCK(self);
+        return NULL;
+    }
+    while ((idx = self->ready_head) >= 0)
+    {
+        PyObject *pos = PyLong_FromSsize_t(idx);
+
+        if (pos == NULL)
+        {
+            /* Keep the untaken ones queued; drop the partial list. */
+            FIL_WS_UNLOCK(self);
+            Py_DECREF(result);
+            return NULL;
+        }
+        self->ready_head = self->entries[idx].next_ready;
+        if (self->ready_head < 0)
+        {
+            self->ready_tail = -1;
+        }
+        self->ready_len--;
+        self->remaining--;
+        PyList_SET_ITEM(result, i++, pos);
+    }
+    FIL_WS_UNLOCK(self);
+    return result;
+}
+
+PyDoc_STRVAR(_ws_wait_doc,
+"wait(count=1) -> list of source positions\n\n"
+"Park until at least 'count' sources not yet handed out have completed\n"
+"(fewer if fewer remain), then return the positions of all completed\n"
+"ones, in completion order.  Past the set's deadline, return whatever\n"
+"has completed, possibly nothing.");
+static PyObject *_ws_wait(PyFilWaitSet *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"count", NULL};
+    Py_ssize_t count = 1;
+    FilWaiter *waiter;
+    int err;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|n:wait", keywords, &count))
+    {
+        return NULL;
+    }
+
+    FIL_WS_LOCK(self);
+    if (self->waiter != NULL)
+    {
+        FIL_WS_UNLOCK(self);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "another greenthread is already waiting on this WaitSet");
+        return NULL;
+    }
+    if (count > self->remaining)
+    {
+        count = self->remaining;
+    }
+    if (self->ready_len >= count)
+    {
+        FIL_WS_UNLOCK(self);
+        return _ws_take_ready(self);
+    }
+
+    waiter = fil_waiter_alloc();
+    if (waiter == NULL)
+    {
+        FIL_WS_UNLOCK(self);
+        return NULL;
+    }
+    self->waiter = waiter;
+    self->want = count;
+    FIL_WS_UNLOCK(self);
+
+    err = fil_waiter_wait(waiter, self->deadline, NULL);
+
+    FIL_WS_LOCK(self);
+    self->waiter = NULL;
+    FIL_WS_UNLOCK(self);
+    fil_waiter_decref(waiter);
+
+    if (err == -ETIMEDOUT)
+    {
+        /* Deadline: not an error here, the caller sees a short list. */
+        PyErr_Clear();
+    }
+    else if (err)
+    {
+        /* Thrown into (kill, an outer Timeout).  Completions stay queued
+         * for the next wait(). */
+        return NULL;
+    }
+    return _ws_take_ready(self);
+}
+
+PyDoc_STRVAR(_ws_close_doc,
+"close()\n\n"
+"Stop watching the sources that have not completed.");
+static PyObject *_ws_close(PyFilWaitSet *self, PyObject *unused)
+{
+    _ws_release(self);
+    FIL_WS_LOCK(self);
+    self->remaining = self->ready_len;
+    FIL_WS_UNLOCK(self);
+    Py_RETURN_NONE;
+}
+
+static Py_ssize_t _ws_len(PyFilWaitSet *self)
+{
+    return self->remaining;
+}
+
+static PySequenceMethods _ws_as_sequence = {
+    (lenfunc)_ws_len,                           /* sq_length */
+};
+
+static PyMethodDef _ws_methods[] = {
+    {"wait", (PyCFunction)_ws_wait, METH_VARARGS|METH_KEYWORDS, _ws_wait_doc},
+    {"close", (PyCFunction)_ws_close, METH_NOARGS, _ws_close_doc},
+    { NULL, NULL }
+};
+
+PyDoc_STRVAR(_ws_doc,
+"WaitSet(sources, timeout=None)\n\n"
+"Watch many Filaments, Messages, Events and AsyncResults for completion\n"
+"at once; see wait().\n"
+"'timeout' fixes one deadline for the set's whole lifetime.  len() is\n"
+"the number of sources not yet handed out.");
+
+static PyTypeObject _ws_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament.WaitSet",                        /* tp_name */
+    sizeof(PyFilWaitSet),                       /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_ws_dealloc,                    /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    &_ws_as_sequence,                           /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS|Py_TPFLAGS_HAVE_GC,     /* tp_flags */
+    _ws_doc,                                    /* tp_doc */
+    (traverseproc)_ws_traverse,                 /* tp_traverse */
+    (inquiry)_ws_clear,                         /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    _ws_methods,                                /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    0,                                          /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_ws_new,                           /* tp_new */
+    PyObject_GC_Del,                            /* tp_free */
+};
+
+int fil_waitset_register_type(PyTypeObject *type, fil_waitable_link_t link, fil_waitable_unlink_t unlink)
+{
+    if (_ws_nkinds == FIL_WS_MAX_KINDS)
+    {
+        PyErr_SetString(PyExc_RuntimeError, "too many WaitSet source types");
+        return -1;
+    }
+    _ws_kinds[_ws_nkinds].type = type;
+    _ws_kinds[_ws_nkinds].link = link;
+    _ws_kinds[_ws_nkinds].unlink = unlink;
+    _ws_nkinds++;
+    return 0;
+}
+
+int fil_waitset_init(PyObject *module, PyFilCore_CAPIObject *capi)
+{
+    capi->fil_waitset_register_type = fil_waitset_register_type;
+
+    PyGreenlet_Import();
+    if (PyType_Ready(&_ws_type) < 0)
+    {
+        return -1;
+    }
+
+    Py_INCREF((PyObject *)&_ws_type);
+    if (PyModule_AddObject(module, "WaitSet", (PyObject *)&_ws_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_ws_type);
+        return -1;
+    }
+
+    return 0;
+}
@@ -51,9 +51,95 @@ static PyObject *_fil_filament_new(PyTypeObject *type, PyObject *args, PyObject
     return PyGreenlet_Type.tp_new(type, args, kwargs);
 }
 
-static int _fil_filament_init_common(PyFilament *self, PyObject *method, PyObject *args, PyObject *kwargs)
+/*
+ * Freelist of Filament shells.
+ *
+ * By the time green_dealloc() calls tp_free it has released everything the
+ * Filament owned -- its pimpl, dict and weakrefs -- so what reaches tp_free
+ * is an untracked block the size of a Filament.  Rather than hand it back
+ * and ask for another on the next spawn(), the freeing thread's scheduler
+ * keeps up to FIL_FILAMENT_FREELIST_MAX of them and tp_alloc gives them out
+ * again; green_new() still builds a fresh pimpl in each.  Only exact
+ * Filaments are kept (a subclass's are another size), and only on a thread
+ * with a scheduler.  The TSD slot holds a reference to that scheduler, so it
+ * is not the one being torn down; _sched_dealloc() frees what is left.
+ *
+ * Off on free-threaded builds, whose lock-free readers count on a freed
+ * object's memory going back through the allocator.
+ */
+
+/* A shell on the list is dead memory; the word after its header is the
+ * link. */
+#define _FIL_SHELL_NEXT(__fil) (*(PyFilament **)((PyObject *)(__fil) + 1))
+
+#ifndef Py_GIL_DISABLED
+#define _FIL_FILAMENT_FREELIST 1
+
+static PyTypeObject _fil_filament_type;
+
+static PyObject *_fil_filament_alloc(PyTypeObject *type, Py_ssize_t nitems)
 {
-    /* Returns -1 on error */
+    PyFilScheduler *sched;
+    PyFilament *self;
+
+    if (type != &_fil_filament_type ||
+        (sched = fil_scheduler_current()) == NULL ||
+        (self = sched->filament_freelist) == NULL)
+    {
+        return PyType_GenericAlloc(type, nitems);
+    }
+    sched->filament_freelist = _FIL_SHELL_NEXT(self);
+    sched->filament_freelist_len--;
+    FIL_SCHED_STAT_INC(sched, filaments_recycled);
+
+    /* What PyType_GenericAlloc() does to a fresh block. */
+    memset(self, 0, type->tp_basicsize);
+    PyObject_Init((PyObject *)self, type);
+    PyObject_GC_Track((PyObject *)self);
+    return (PyObject *)self;
+}
+
+static void _fil_filament_free(void *ptr)
+{
+    PyFilament *self = (PyFilament *)ptr;
+    PyFilScheduler *sched;
+
+    if (Py_TYPE(self) != &_fil_filament_type ||
+        (sched = fil_scheduler_current()) == NULL ||
+        sched->filament_freelist_len >= FIL_FILAMENT_FREELIST_MAX)
+    {
+        PyObject_GC_Del(ptr);
+        return;
+    }
+    _FIL_SHELL_NEXT(self) = sched->filament_freelist;
+    sched->filament_freelist = self;
+    sched->filament_freelist_len++;
+}
+#endif
+
+void fil_filament_freelist_clear(PyFilScheduler *sched)
+{
+    PyFilament *self;
+
+    while ((self = sched->filament_freelist) != NULL)
+    {
+        sched->filament_freelist = _FIL_SHELL_NEXT(self);
+        PyObject_GC_Del(self);
+    }
+    sched->filament_freelist_len = 0;
+}
+
+static PyObject *_fil_filament_main_callable(PyFilament *self);
+
+static int _fil_filament_init_common(PyFilament *self, PyObject *method, PyObject *args,
+                                     Py_ssize_t args_start, PyObject *kwargs,
+                                     Py_ssize_t stack_size, int priority, int start)
+{
+    /* Returns -1 on error.  The body gets args[args_start:]: spawn() and
+     * Filament() keep the tuple they were called with, callable first, rather
+     * than slicing it.  'start' queues the initial switch; spawn_many()
+     * passes 0 and queues its whole batch at once.  'priority' is a
+     * FIL_SCHED_PRIO_* class, or -1 for the spawner's. */
     PyObject *main_method;
     PyGreenlet *sched_greenlet;
 
@@ -76,10 +162,11 @@ static int _fil_filament_init_common(PyFilament *self, PyObject *method, PyObjec
 
     self->method = method;
     self->method_args = args;
+    self->method_args_start = args_start;
     self->method_kwargs = kwargs;
     /* going forward, the above will be defrefed on dealloc */
 
-    main_method = PyObject_GetAttrString((PyObject *)self, "main");
+    main_method = _fil_filament_main_callable(self);
     if (main_method == NULL)
     {
         return -1;
@@ -91,13 +178,12 @@ static int _fil_filament_init_common(PyFilament *self, PyObject *method, PyObjec
         Py_DECREF(main_method);
         return -1;
     }
-
-    self->message = fil_message_alloc();
-    if (self->message == NULL)
-    {
-        Py_DECREF(main_method);
-        return -1;
-    }
+    /* The class of whatever is running now: the spawning greenthread's, or
+     * normal from outside the scheduler. */
+    self->priority = priority >= 0 ? priority : self->sched->running_prio;
+    self->time_slice_ns = 0;
+    self->preempt_disabled = 0;
+    self->preempt_locks = 0;
 
     sched_greenlet = fil_scheduler_greenlet(self->sched);
 
@@ -118,10 +204,17 @@ static int _fil_filament_init_common(PyFilament *self, PyObject *method, PyObjec
 
     Py_DECREF(gl_args);
 
+    /* Stack size class and depth-profiling site for the fiber; must be
+     * settled before the first switch allocates its stack. */
+    if (fil_greenlet_configure_stack((PyGreenlet *)self, method, stack_size) < 0)
+    {
+        return -1;
+    }
+
     /* Enqueue the initial switch into this filament. Propagate failure so a
      * half-constructed filament (whose body will never be scheduled) isn't
      * handed back as if it were live. */
-    if (fil_scheduler_gl_switch(self->sched, NULL, (PyGreenlet *)self) < 0)
+    if (start && fil_scheduler_gl_switch(self->sched, NULL, (PyGreenlet *)self) < 0)
     {
         return -1;
     }
@@ -131,29 +224,15 @@ static int _fil_filament_init_common(PyFilament *self, PyObject *method, PyObjec
 
 static int _fil_filament_init(PyFilament *self, PyObject *args, PyObject *kwargs)
 {
-    PyObject *method;
-    PyObject *method_args;
-    int result;
-    Py_ssize_t args_len;
-
-    args_len = PyTuple_GET_SIZE(args);
-    if (!args_len)
+    if (!PyTuple_GET_SIZE(args))
     {
         PyErr_SetString(PyExc_TypeError,
                         "Filament() takes at least 1 argument");
         return -1;
     }
 
-    method = PyTuple_GET_ITEM(args, 0);
-    method_args = PyTuple_GetSlice(args, 1, args_len);
-    if (method_args == NULL)
-    {
-        return -1;
-    }
-
-    result = _fil_filament_init_common(self, method, method_args, kwargs);
-    Py_DECREF(method_args);
-    return result;
+    return _fil_filament_init_common(self, PyTuple_GET_ITEM(args, 0), args, 1,
+                                     kwargs, -1, -1, 1);
 }
 
 /*
@@ -186,6 +265,8 @@ static int _fil_filament_init(PyFilament *self, PyObject *args, PyObject *kwargs
  */
 static int _fil_filament_traverse(PyFilament *self, visitproc visit, void *arg)
 {
+    int err;
+
     Py_VISIT(self->method);
     Py_VISIT(self->method_args);
     Py_VISIT(self->method_kwargs);
@@ -199,6 +280,16 @@ static int _fil_filament_traverse(PyFilament *self, visitproc visit, void *arg)
      * 'sched' is not visited: PyFilScheduler is not GC-tracked and holds no
      * reference that can lead back to user objects. */
     Py_VISIT(self->message);
+    /* The same outcome, kept on the Filament itself; these are cleared. */
+    Py_VISIT(self->result_or_exc_type);
+    Py_VISIT(self->exc_value);
+    Py_VISIT(self->exc_tb);
+
+    err = fil_local_slots_traverse(&(self->locals), visit, arg);
+    if (err != 0)
+    {
+        return err;
+    }
 
     if (PyGreenlet_Type.tp_traverse != NULL)
     {
@@ -213,6 +304,10 @@ static int _fil_filament_clear(PyFilament *self)
     Py_CLEAR(self->method);
     Py_CLEAR(self->method_args);
     Py_CLEAR(self->method_kwargs);
+    Py_CLEAR(self->result_or_exc_type);
+    Py_CLEAR(self->exc_value);
+    Py_CLEAR(self->exc_tb);
+    fil_local_slots_clear(&(self->locals));
 
     if (PyGreenlet_Type.tp_clear != NULL)
     {
@@ -231,11 +326,16 @@ static void _fil_filament_dealloc(PyFilament *self)
      * handling) remain intact -- untracking twice is a no-op. */
     PyObject_GC_UnTrack((PyObject *)self);
 
+    self->flags |= FIL_FILAMENT_FLAGS_DEALLOC;
     Py_CLEAR(self->message);
+    Py_CLEAR(self->result_or_exc_type);
+    Py_CLEAR(self->exc_value);
+    Py_CLEAR(self->exc_tb);
     Py_CLEAR(self->sched);
     Py_CLEAR(self->method);
     Py_CLEAR(self->method_args);
     Py_CLEAR(self->method_kwargs);
+    fil_local_slots_clear(&(self->locals));
 
     /*
      * Chain to greenlet's tp_dealloc rather than calling tp_free ourselves.
@@ -253,15 +353,151 @@ static void _fil_filament_dealloc(PyFilament *self)
      * GreenletExit into a still-suspended greenlet to unwind it, and that
      * unwinding runs the tail of _fil_filament_main() -- but that function
      * holds its own references to method/args/kwargs for the duration of the
-     * call and NULL-checks 'message', precisely so this ordering is legal.
+     * call, and FIL_FILAMENT_FLAGS_DEALLOC makes it drop its outcome,
+     * precisely so this ordering is legal.
      */
     PyGreenlet_Type.tp_dealloc((PyObject *)self);
 }
 
+/*
+ * The result Message is made on demand.  Most greenthreads are waited for
+ * after they have finished, if at all, and wait() then reads the outcome
+ * straight off the Filament.  Only a waiter that has to park, or a WaitSet
+ * watching the greenthread, needs a Message.
+ *
+ * On a free-threaded build the body can finish on one thread while another
+ * thread installs the Message.  The body stores 'finished' and then looks
+ * for a Message; a waiter installs the Message and then looks at
+ * 'finished'.  Both are sequentially consistent, so at least one side sees
+ * the other and delivers the outcome, and fil_message_deliver() turns a
+ * second delivery into a no-op.  With the GIL neither side can run in
+ * between.
+ */
+#ifdef Py_GIL_DISABLED
+#  define FIL_FIL_LOAD(__p)        __atomic_load_n(&(__p), __ATOMIC_SEQ_CST)
+#  define FIL_FIL_STORE(__p, __v)  __atomic_store_n(&(__p), (__v), __ATOMIC_SEQ_CST)
+#else
+#  define FIL_FIL_LOAD(__p)        (__p)
+#  define FIL_FIL_STORE(__p, __v)  ((__p) = (__v))
+#endif
+
+/* Borrowed; NULL with an exception set only if allocating it failed.  Not
+ * for spawn_n() greenthreads, which never have one. */
+PyFilMessage *fil_filament_message(PyFilament *self)
+{
+    PyFilMessage *message = FIL_FIL_LOAD(self->message);
+
+    if (message != NULL)
+    {
+        return message;
+    }
+    message = fil_message_alloc();
+    if (message == NULL)
+    {
+        return NULL;
+    }
+#ifdef Py_GIL_DISABLED
+    {
+        PyFilMessage *installed = NULL;
+
+        if (!__atomic_compare_exchange_n(&(self->message), &installed,
+                                         message, 0, __ATOMIC_SEQ_CST,
+                                         __ATOMIC_SEQ_CST))
+        {
+            /* Another waiter got there first; theirs does the delivering. */
+            Py_DECREF(message);
+            return installed;
+        }
+    }
+#else
+    /* Allocating can collect, and a finalizer could have waited on us. */
+    if (self->message != NULL)
+    {
+        Py_DECREF(message);
+        return self->message;
+    }
+    self->message = message;
+#endif
+    if (FIL_FIL_LOAD(self->finished))
+    {
+        fil_message_deliver(message, self->result_or_exc_type, self->is_exc,
+                            self->exc_value, self->exc_tb);
+    }
+    return message;
+}
+
+/* Keep the body's outcome and hand it to the Message, if there is one yet.
+ * The references are borrowed. */
+static void _fil_filament_finish(PyFilament *self, PyObject *result_or_exc_type,
+                                 int is_exc, PyObject *exc_value,
+                                 PyObject *exc_tb)
+{
+    PyFilMessage *message;
+
+    if (self->finished ||
+        (self->flags & (FIL_FILAMENT_FLAGS_NO_RESULT |
+                        FIL_FILAMENT_FLAGS_DEALLOC)))
+    {
+        return;
+    }
+    Py_INCREF(result_or_exc_type);
+    Py_XINCREF(exc_value);
+    Py_XINCREF(exc_tb);
+    self->result_or_exc_type = result_or_exc_type;
+    self->is_exc = is_exc;
+    self->exc_value = exc_value;
+    self->exc_tb = exc_tb;
+    FIL_FIL_STORE(self->finished, 1);
+    message = FIL_FIL_LOAD(self->message);
+    if (message != NULL)
+    {
+        fil_message_deliver(message, result_or_exc_type, is_exc, exc_value,
+                            exc_tb);
+    }
+}
+
+void fil_filament_finish_exception(PyFilament *self, PyObject *exc_type,
+                                   PyObject *exc_value, PyObject *exc_tb)
+{
+    _fil_filament_finish(self, exc_type, 1, exc_value, exc_tb);
+}
+
 PyDoc_STRVAR(_fil_filament_wait_doc, "Wait!");
 static PyObject *_fil_filament_wait(PyFilament *self, PyObject *args)
 {
-    return fil_message_wait(self->message, NULL);
+    PyFilMessage *message;
+
+    if (self->flags & FIL_FILAMENT_FLAGS_NO_RESULT)
+    {
+        PyErr_SetString(PyExc_RuntimeError,
+                        "greenthreads started by spawn_n() have no result "
+                        "to wait for");
+        return NULL;
+    }
+    if (FIL_FIL_LOAD(self->finished))
+    {
+        if (self->result_or_exc_type == NULL)
+        {
+            /* Cleared by the collector: nothing left to hand back. */
+            Py_RETURN_NONE;
+        }
+        Py_INCREF(self->result_or_exc_type);
+        if (self->is_exc)
+        {
+            Py_XINCREF(self->exc_value);
+            Py_XINCREF(self->exc_tb);
+            PyErr_Restore(self->result_or_exc_type, self->exc_value,
+                          self->exc_tb);
+            return NULL;
+        }
+        return self->result_or_exc_type;
+    }
+    message = fil_filament_message(self);
+    if (message == NULL)
+    {
+        return NULL;
+    }
+    return fil_message_wait(message, NULL);
 }
 
 PyDoc_STRVAR(_fil_filament_main_doc, "Main entrypoint for the Filament.");
@@ -269,7 +505,7 @@ static PyObject *_fil_filament_main(PyFilament *self, PyObject *args)
 {
     PyObject *result;
     /*
-     * Take our own references for the duration of the call. PyObject_Call()
+     * Take our own references for the duration of the call. The call
      * only borrows its arguments, so without this the callee could drop the
      * last reference to us -- clearing self->method out from under an
      * in-flight call -- simply by discarding the wrapper object that owns the
@@ -279,12 +515,35 @@ static PyObject *_fil_filament_main(PyFilament *self, PyObject *args)
     PyObject *method = self->method;
     PyObject *method_args = self->method_args;
     PyObject *method_kwargs = self->method_kwargs;
+    Py_ssize_t start = self->method_args_start;
 
     Py_XINCREF(method);
     Py_XINCREF(method_args);
     Py_XINCREF(method_kwargs);
 
-    result = PyObject_Call(method, method_args, method_kwargs);
+#ifdef _FIL_PYTHON3
+    result = PyObject_VectorcallDict(method,
+                                     &PyTuple_GET_ITEM(method_args, start),
+                                     PyTuple_GET_SIZE(method_args) - start,
+                                     method_kwargs);
+#else
+    if (start)
+    {
+        PyObject *call_args = PyTuple_GetSlice(method_args, start,
+                                               PyTuple_GET_SIZE(method_args));
+
+        result = NULL;
+        if (call_args != NULL)
+        {
+            result = PyObject_Call(method, call_args, method_kwargs);
+            Py_DECREF(call_args);
+        }
+    }
+    else
+    {
+        result = PyObject_Call(method, method_args, method_kwargs);
+    }
+#endif
 
     Py_XDECREF(method);
     Py_XDECREF(method_args);
@@ -303,10 +562,14 @@ static PyObject *_fil_filament_main(PyFilament *self, PyObject *args)
      * allocation rate easily outruns collection.
      *
      * Note these are already NULL if tp_clear ran first; Py_CLEAR copes.
+     *
+     * The same goes for the greenthread-local dicts: nothing can look them
+     * up once the body is done.
      */
     Py_CLEAR(self->method);
     Py_CLEAR(self->method_args);
     Py_CLEAR(self->method_kwargs);
+    fil_local_slots_release(&(self->locals), (PyObject *)self);
 
     if (result == NULL)
     {
@@ -325,13 +588,25 @@ static PyObject *_fil_filament_main(PyFilament *self, PyObject *args)
             return NULL;
         }
 
-        /* 'message' is NULL only when tp_dealloc cleared it and then had
-         * greenlet unwind us with a GreenletExit; there is by definition
+        if (self->flags & FIL_FILAMENT_FLAGS_NO_RESULT)
+        {
+            /* spawn_n(): nobody will ever look, so print it -- a kill()
+             * (GreenletExit) is a normal way to finish and stays quiet.
+             * The error is then restored below like any other body's, and
+             * the scheduler's _handle_exception() squashes it (or re-raises
+             * the system exceptions in the main greenlet). */
+            if (!PyErr_GivenExceptionMatches(exc_type, PyExc_GreenletExit))
+            {
+                PyErr_NormalizeException(&exc_type, &exc_value, &exc_tb);
+                PyErr_Display(exc_type, exc_value, exc_tb);
+            }
+        }
+        /* Otherwise kept for wait(); dropped when tp_dealloc had greenlet
+         * unwind us with a GreenletExit, since there is by definition
          * nobody left to deliver the result to in that case. */
-        if (self->message != NULL)
+        else
         {
-            fil_message_send_exception(self->message, exc_type, exc_value,
-                                       exc_tb);
+            _fil_filament_finish(self, exc_type, 1, exc_value, exc_tb);
         }
         /* Restore this so the scheduler can catch and force the main
          * greenlet to raise if they are system exceptions.
@@ -341,23 +616,142 @@ static PyObject *_fil_filament_main(PyFilament *self, PyObject *args)
     }
     else
     {
-        if (self->message != NULL)
-        {
-            fil_message_send(self->message, result);
-        }
+        _fil_filament_finish(self, result, 0, NULL, NULL);
         Py_DECREF(result);
     }
 
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(_fil_filament_priority_doc,
+"Scheduling class: 0 (PRIORITY_HIGH), 1 (PRIORITY_NORMAL) or 2\n"
+"(PRIORITY_LOW).  A change applies from the greenthread's next wakeup.");
+static PyObject *_fil_filament_get_priority(PyFilament *self, void *closure)
+{
+    return PyInt_FromLong(self->priority);
+}
+
+static int _fil_priority_from_object(PyObject *value, int *priority);
+
+static int _fil_filament_set_priority(PyFilament *self, PyObject *value,
+                                      void *closure)
+{
+    PyGreenlet *current;
+    int priority;
+
+    if (value == NULL)
+    {
+        PyErr_SetString(PyExc_AttributeError, "can't delete priority");
+        return -1;
+    }
+    if (_fil_priority_from_object(value, &priority) < 0)
+    {
+        return -1;
+    }
+    self->priority = priority;
+    /* A greenthread changing its own class: what it parks on next is
+     * queued from the running class (see fil_waiter_wait()). */
+    current = PyGreenlet_GetCurrent();
+    if (current == (PyGreenlet *)self && self->sched != NULL)
+    {
+        self->sched->running_prio = priority;
+    }
+    Py_XDECREF(current);
+    return 0;
+}
+
+PyDoc_STRVAR(_fil_filament_time_slice_doc,
+"Time slice in seconds under time-slice preemption (preempt_start()):\n"
+"None for the default, 0.0 never to be preempted.");
+static PyObject *_fil_filament_get_time_slice(PyFilament *self,
+                                              void *closure)
+{
+    if (self->time_slice_ns == 0)
+    {
+        Py_RETURN_NONE;
+    }
+    if (self->time_slice_ns < 0)
+    {
+        return PyFloat_FromDouble(0.0);
+    }
+    return PyFloat_FromDouble((double)self->time_slice_ns / 1e9);
+}
+
+static int _fil_filament_set_time_slice(PyFilament *self, PyObject *value,
+                                        void *closure)
+{
+    double slice;
+
+    if (value == NULL)
+    {
+        PyErr_SetString(PyExc_AttributeError, "can't delete time_slice");
+        return -1;
+    }
+    if (value == Py_None)
+    {
+        self->time_slice_ns = 0;
+        return 0;
+    }
+    slice = PyFloat_AsDouble(value);
+    if (slice == -1.0 && PyErr_Occurred())
+    {
+        return -1;
+    }
+    if (!(slice >= 0.0) || slice > 3600.0)
+    {
+        PyErr_SetString(PyExc_ValueError,
+                        "time_slice must be >= 0 and at most an hour");
+        return -1;
+    }
+    self->time_slice_ns = slice == 0.0 ? -1 : (int64_t)(slice * 1e9);
+    if (self->time_slice_ns == 0)
+    {
+        /* Under a nanosecond: as short as it gets. */
+        self->time_slice_ns = 1;
+    }
+    return 0;
+}
+
+static PyGetSetDef _fil_filament_getset[] = {
+    {"priority", (getter)_fil_filament_get_priority,
+     (setter)_fil_filament_set_priority, _fil_filament_priority_doc, NULL},
+    {"time_slice", (getter)_fil_filament_get_time_slice,
+     (setter)_fil_filament_set_time_slice, _fil_filament_time_slice_doc,
+     NULL},
+    { NULL }
+};
+
+/* main() is in the method table and also bound directly, through its own
+ * definition, by _fil_filament_main_callable(). */
+#define _FIL_FILAMENT_MAIN_METHOD                                           \
+    {"main", (PyCFunction)_fil_filament_main, METH_NOARGS, _fil_filament_main_doc}
+
+static PyMethodDef _fil_filament_main_def = _FIL_FILAMENT_MAIN_METHOD;
+
 static PyMethodDef _fil_filament_methods[] = {
     {"wait", (PyCFunction)_fil_filament_wait, METH_VARARGS, _fil_filament_wait_doc},
     {"join", (PyCFunction)_fil_filament_wait, METH_VARARGS, _fil_filament_wait_doc},
-    {"main", (PyCFunction)_fil_filament_main, METH_NOARGS, _fil_filament_main_doc},
+    _FIL_FILAMENT_MAIN_METHOD,
     { NULL, NULL }
 };
 
+static PyTypeObject _fil_filament_type;
+
+/*
+ * The greenlet 'run' callable: self.main.  Subclasses may override main(),
+ * so they get the attribute lookup; plain Filaments -- everything spawn()
+ * creates -- bind the method entry directly and skip the name lookup
+ * through the MRO.
+ */
+static PyObject *_fil_filament_main_callable(PyFilament *self)
+{
+    if (Py_TYPE(self) == &_fil_filament_type)
+    {
+        return PyCFunction_New(&_fil_filament_main_def, (PyObject *)self);
+    }
+    return PyObject_GetAttrString((PyObject *)self, "main");
+}
+
 static PyTypeObject _fil_filament_type = {
     PyVarObject_HEAD_INIT(0, 0)                 /* Must fill in type
                                                    value later */
@@ -392,7 +786,7 @@ static PyTypeObject _fil_filament_type = {
     0,                                          /* tp_iternext */
     _fil_filament_methods,                      /* tp_methods */
     0,                                          /* tp_members */
-    0,                                          /* tp_getset */
+    _fil_filament_getset,                       /* tp_getset */
     0,                                          /* tp_base */
     0,                                          /* tp_dict */
     0,                                          /* tp_descr_get */
@@ -449,6 +843,8 @@ static PyObject *_fil_sleep(PyObject *_self, PyObject *timeout)
                 Py_DECREF(fil_scheduler);
                 return NULL;
             }
+            FIL_TRACE(fil_scheduler, FIL_TRACE_PARK, current_gl,
+                      FIL_TRACE_WHY_YIELD);
             Py_DECREF(current_gl);
             fil_scheduler_switch(fil_scheduler);
             if (PyErr_Occurred())
@@ -538,7 +934,7 @@ static PyObject *_fil_sleep(PyObject *_self, PyObject *timeout)
         return NULL;
     }
 
-    err = fil_waiter_wait(waiter, ts, NULL);
+    err = fil_waiter_wait_why(waiter, ts, NULL, FIL_TRACE_WHY_SLEEP);
     fil_waiter_decref(waiter);
     Py_DECREF(fil_scheduler);
 
@@ -592,6 +988,7 @@ static PyObject *_fil_yield(PyObject *_self, PyObject *_args)
         Py_DECREF(fil_scheduler);
         return NULL;
     }
+    FIL_TRACE(fil_scheduler, FIL_TRACE_PARK, current_gl, FIL_TRACE_WHY_YIELD);
     Py_DECREF(current_gl);
     fil_scheduler_switch(fil_scheduler);
     if (PyErr_Occurred())
@@ -603,57 +1000,260 @@ static PyObject *_fil_yield(PyObject *_self, PyObject *_args)
     Py_RETURN_NONE;
 }
 
-PyDoc_STRVAR(_fil_spawn_doc, "Spawn a Filament.");
-static PyFilament *_fil_spawn(PyObject *_self, PyObject *args, PyObject *kwargs)
+static PyFilament *_fil_filament_alloc_sized(PyObject *method, PyObject *args,
+                                             Py_ssize_t args_start, PyObject *kwargs,
+                                             Py_ssize_t stack_size, int priority,
+                                             uint32_t flags, int start);
+
+/* A priority class from Python: 0 (high) to 2 (low). */
+static int _fil_priority_from_object(PyObject *value, int *priority)
+{
+    long p = PyInt_AsLong(value);
+
+    if (p == -1 && PyErr_Occurred())
+    {
+        return -1;
+    }
+    if (p < FIL_SCHED_PRIO_HIGH || p > FIL_SCHED_PRIO_LOW)
+    {
+        PyErr_Format(PyExc_ValueError,
+                     "priority must be between %d and %d, not %ld",
+                     FIL_SCHED_PRIO_HIGH, FIL_SCHED_PRIO_LOW, p);
+        return -1;
+    }
+    *priority = (int)p;
+    return 0;
+}
+
+/*
+ * spawn()'s own keywords: 'stack_size' sizes the new greenthread's fiber
+ * stack and 'priority' sets its class instead of being handed to the
+ * target (wrap the target with functools.partial to pass it one of those
+ * names).  Removes them from a copy of *kwargs and stores the size and the
+ * class, each -1 when not given (or None).  Returns 1 when *kwargs was
+ * replaced by the copy.
+ */
+static int _fil_spawn_pop_options(PyObject **kwargs, Py_ssize_t *stack_size,
+                                  int *priority)
+{
+    PyObject *size_value;
+    PyObject *prio_value;
+    PyObject *copy;
+
+    *stack_size = -1;
+    *priority = -1;
+    if (*kwargs == NULL)
+    {
+        return 0;
+    }
+    size_value = PyDict_GetItemString(*kwargs, "stack_size");
+    prio_value = PyDict_GetItemString(*kwargs, "priority");
+    if (size_value == NULL && prio_value == NULL)
+    {
+        return 0;
+    }
+    if (size_value != NULL && size_value != Py_None)
+    {
+        *stack_size = PyNumber_AsSsize_t(size_value, PyExc_OverflowError);
+        if (*stack_size == -1 && PyErr_Occurred())
+        {
+            return -1;
+        }
+        if (*stack_size < 0)
+        {
+            PyErr_SetString(PyExc_ValueError, "stack_size must be >= 0");
+            return -1;
+        }
+    }
+    if (prio_value != NULL && prio_value != Py_None &&
+        _fil_priority_from_object(prio_value, priority) < 0)
+    {
+        return -1;
+    }
+    copy = PyDict_Copy(*kwargs);
+    if (copy == NULL ||
+        (size_value != NULL && PyDict_DelItemString(copy, "stack_size") < 0) ||
+        (prio_value != NULL && PyDict_DelItemString(copy, "priority") < 0))
+    {
+        Py_XDECREF(copy);
+        return -1;
+    }
+    *kwargs = copy;
+    return 1;
+}
+
+/* spawn() and spawn_n(): 'name' is only for error messages. */
+static PyFilament *_fil_spawn_common(PyObject *args, PyObject *kwargs,
+                                     uint32_t flags, const char *name)
 {
     PyObject *method;
-    PyObject *method_args;
     PyFilament *fil;
-    Py_ssize_t args_len;
+    Py_ssize_t stack_size;
+    int priority;
+    int kwargs_copied;
 
-    args_len = PyTuple_GET_SIZE(args);
-    if (!args_len)
+    if (!PyTuple_GET_SIZE(args))
     {
-        PyErr_SetString(PyExc_TypeError,
-                        "spawn() takes at least 1 argument");
+        PyErr_Format(PyExc_TypeError,
+                     "%s() takes at least 1 argument", name);
         return NULL;
     }
 
     method = PyTuple_GET_ITEM(args, 0);
     if (!PyCallable_Check(method))
     {
-        PyErr_SetString(PyExc_TypeError,
-                        "spawn() first argument should be a callable");
+        PyErr_Format(PyExc_TypeError,
+                     "%s() first argument should be a callable", name);
         return NULL;
     }
 
-    method_args = PyTuple_GetSlice(args, 1, args_len);
-    if (method_args == NULL)
+    kwargs_copied = _fil_spawn_pop_options(&kwargs, &stack_size, &priority);
+    if (kwargs_copied < 0)
     {
         return NULL;
     }
 
-    fil = filament_alloc(method, method_args, kwargs);
-    Py_DECREF(method_args);
+    fil = _fil_filament_alloc_sized(method, args, 1, kwargs, stack_size,
+                                    priority, flags, 1);
+    if (kwargs_copied)
+    {
+        Py_DECREF(kwargs);
+    }
     return fil;
 }
 
+PyDoc_STRVAR(_fil_spawn_doc, "Spawn a Filament.");
+static PyFilament *_fil_spawn(PyObject *_self, PyObject *args, PyObject *kwargs)
+{
+    return _fil_spawn_common(args, kwargs, 0, "spawn");
+}
+
+PyDoc_STRVAR(_fil_spawn_n_doc, "Spawn a fire-and-forget Filament; returns None.");
+static PyObject *_fil_spawn_n(PyObject *_self, PyObject *args, PyObject *kwargs)
+{
+    /* The greenthread runs the callable itself -- no wrapper frame -- and
+     * has no Message: the result is dropped and an exception is printed
+     * from _fil_filament_main().  The scheduler's queued switch holds the
+     * only reference once we drop ours. */
+    PyFilament *fil = _fil_spawn_common(args, kwargs,
+                                        FIL_FILAMENT_FLAGS_NO_RESULT,
+                                        "spawn_n");
+    if (fil == NULL)
+    {
+        return NULL;
+    }
+    Py_DECREF(fil);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_fil_spawn_many_doc,
+"spawn_many(fn, iterable_of_args) -> list of Filaments\n\n"
+"Spawn fn(*args) for each argument sequence, as itertools.starmap\n"
+"would call it.  All of them are queued to start together, in order,\n"
+"once the whole iterable has been consumed; if anything fails on the\n"
+"way, none of them runs.");
+static PyObject *_fil_spawn_many(PyObject *_self, PyObject *args)
+{
+    PyObject *method;
+    PyObject *iterable;
+    PyObject *it;
+    PyObject *item;
+    PyObject *item_args;
+    PyObject *result;
+    PyFilament *fil;
+    Py_ssize_t n;
+
+    if (!PyArg_ParseTuple(args, "OO:spawn_many", &method, &iterable))
+    {
+        return NULL;
+    }
+    if (!PyCallable_Check(method))
+    {
+        PyErr_SetString(PyExc_TypeError,
+                        "spawn_many() first argument should be a callable");
+        return NULL;
+    }
+
+    it = PyObject_GetIter(iterable);
+    if (it == NULL)
+    {
+        return NULL;
+    }
+    result = PyList_New(0);
+    if (result == NULL)
+    {
+        Py_DECREF(it);
+        return NULL;
+    }
+
+    while ((item = PyIter_Next(it)) != NULL)
+    {
+        item_args = PySequence_Tuple(item);
+        Py_DECREF(item);
+        if (item_args == NULL)
+        {
+            goto fail;
+        }
+        fil = _fil_filament_alloc_sized(method, item_args, 0, NULL, -1, -1, 0, 0);
+        Py_DECREF(item_args);
+        if (fil == NULL)
+        {
+            goto fail;
+        }
+        if (PyList_Append(result, (PyObject *)fil) < 0)
+        {
+            Py_DECREF(fil);
+            goto fail;
+        }
+        Py_DECREF(fil);
+    }
+    if (PyErr_Occurred())
+    {
+        goto fail;
+    }
+    Py_CLEAR(it);
+
+    /* Every Filament was created on this thread, so they share one
+     * scheduler. */
+    n = PyList_GET_SIZE(result);
+    if (n && fil_scheduler_gl_switch_many(
+                 ((PyFilament *)PyList_GET_ITEM(result, 0))->sched,
+                 (PyGreenlet **)PySequence_Fast_ITEMS(result), n) < 0)
+    {
+        goto fail;
+    }
+    return result;
+
+fail:
+    /* None of them was queued: dropping the list frees them unstarted. */
+    Py_XDECREF(it);
+    Py_DECREF(result);
+    return NULL;
+}
+
 PyDoc_STRVAR(cext_doc, "Filament _filament module.");
 static PyMethodDef cext_methods[] = {
     {"sleep", (PyCFunction)_fil_sleep, METH_O, _fil_sleep_doc },
     {"spawn", (PyCFunction)_fil_spawn, METH_VARARGS|METH_KEYWORDS, _fil_spawn_doc },
+    {"spawn_n", (PyCFunction)_fil_spawn_n, METH_VARARGS|METH_KEYWORDS, _fil_spawn_n_doc },
+    {"spawn_many", (PyCFunction)_fil_spawn_many, METH_VARARGS, _fil_spawn_many_doc },
     {"yield_thread", (PyCFunction)_fil_yield, METH_NOARGS, _fil_yield_doc },
     { NULL, NULL }
 };
 
-PyFilament *filament_alloc(PyObject *method, PyObject *args, PyObject *kwargs)
+static PyFilament *_fil_filament_alloc_sized(PyObject *method, PyObject *args,
+                                             Py_ssize_t args_start, PyObject *kwargs,
+                                             Py_ssize_t stack_size, int priority,
+                                             uint32_t flags, int start)
 {
     PyFilament *self;
 
     self = (PyFilament *)_fil_filament_new(&_fil_filament_type, NULL, NULL);
     if (self == NULL)
         return NULL;
-    if (_fil_filament_init_common(self, method, args, kwargs) < 0)
+    self->flags = flags;
+    if (_fil_filament_init_common(self, method, args, args_start, kwargs,
+                                  stack_size, priority, start) < 0)
     {
         Py_DECREF(self);
         return NULL;
@@ -661,6 +1261,25 @@ PyFilament *filament_alloc(PyObject *method, PyObject *args, PyObject *kwargs)
     return self;
 }
 
+PyFilament *filament_alloc(PyObject *method, PyObject *args, PyObject *kwargs)
+{
+    return _fil_filament_alloc_sized(method, args, 0, kwargs, -1, -1, 0, 1);
+}
+
+/* spawn_n() for C callers: no Filament handed back, nothing to wait on. */
+int filament_spawn_n(PyObject *method, PyObject *args, PyObject *kwargs)
+{
+    PyFilament *fil = _fil_filament_alloc_sized(method, args, 0, kwargs, -1, -1,
+                                                FIL_FILAMENT_FLAGS_NO_RESULT, 1);
+
+    if (fil == NULL)
+    {
+        return -1;
+    }
+    Py_DECREF(fil);
+    return 0;
+}
+
 _FIL_MODULE_INIT_FN_NAME(core)
 {
     PyObject *m;
@@ -704,6 +1323,13 @@ _FIL_MODULE_INIT_FN_NAME(core)
         _fil_filament_type.tp_traverse = NULL;
         _fil_filament_type.tp_clear = NULL;
     }
+#ifdef _FIL_FILAMENT_FREELIST
+    else
+    {
+        _fil_filament_type.tp_alloc = _fil_filament_alloc;
+        _fil_filament_type.tp_free = _fil_filament_free;
+    }
+#endif
 
     if (PyType_Ready(&_fil_filament_type) < 0)
     {
@@ -718,11 +1344,26 @@ _FIL_MODULE_INIT_FN_NAME(core)
         return _FIL_MODULE_INIT_ERROR;
     }
 
+    if (PyModule_AddIntConstant(m, "PRIORITY_HIGH", FIL_SCHED_PRIO_HIGH) < 0 ||
+        PyModule_AddIntConstant(m, "PRIORITY_NORMAL", FIL_SCHED_PRIO_NORMAL) < 0 ||
+        PyModule_AddIntConstant(m, "PRIORITY_LOW", FIL_SCHED_PRIO_LOW) < 0)
+    {
+        return _FIL_MODULE_INIT_ERROR;
+    }
+
     PyFilament_Type = &_fil_filament_type;
     _PY_FIL_CORE_API->filament_type = PyFilament_Type;
     _PY_FIL_CORE_API->filament_alloc = filament_alloc;
+    _PY_FIL_CORE_API->filament_spawn_n = filament_spawn_n;
 
     if (fil_message_init(m, _PY_FIL_CORE_API) < 0 ||
+        fil_waitset_init(m, _PY_FIL_CORE_API) < 0 ||
+        fil_fanout_init(m, _PY_FIL_CORE_API) < 0 ||
+        fil_lockprof_init(m, _PY_FIL_CORE_API) < 0 ||
+        fil_trace_init(m, _PY_FIL_CORE_API) < 0 ||
+        fil_blockwatch_init(m, _PY_FIL_CORE_API) < 0 ||
+        fil_preempt_init(m, _PY_FIL_CORE_API) < 0 ||
+        fil_local_init(m, _PY_FIL_CORE_API) < 0 ||
         fil_scheduler_init(m, _PY_FIL_CORE_API) < 0)
     {
         return _FIL_MODULE_INIT_ERROR;
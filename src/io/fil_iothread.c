@@ -40,9 +40,16 @@ typedef struct _pyfil_iothread
     struct event *interrupt_event;
     PyThreadState *thread_state;
     pthread_t thr_id;
+    /* From FIL_IOTHREAD_CPUS; see _iothread_affinity_from_env(). */
+    FilAffinity affinity;
 #define FIL_IOTHR_FLAGS_RUNNING  0x00000001
 #define FIL_IOTHR_FLAGS_SHUTDOWN 0x00000002
     uint32_t flags;
+    /* os.fork() handshake; see _iothread_before_fork(). */
+    pthread_mutex_t fork_lock;
+    pthread_cond_t fork_cond;
+    int fork_pause;
+    int fork_parked;
 } PyFilIOThread;
 
 typedef int (*event_processor_t)(evutil_socket_t fd, void *processor_arg);
@@ -133,6 +140,22 @@ struct _event_cb_info
 
 static PyFilIOThread *_IOThreadObj = NULL;
 
+/*
+ * For iothread_stats().  'events' is only bumped by the io thread; the waits
+ * by whichever thread waits, hence the atomic adds.
+ */
+static struct
+{
+    uint64_t events;            /* io callbacks run */
+    uint64_t classic_waits;     /* one-shot event per wait */
+    uint64_t cached_waits;      /* parked on a cached fd waiter */
+    uint64_t cached_retries;    /* an edge came first: no park needed */
+    uint64_t cached_fallbacks;  /* wait_cached sent the caller to classic */
+} _iothread_stats;
+
+#define _IOTHREAD_STAT_ADD(__field)                                         \
+    __atomic_fetch_add(&(_iothread_stats.__field), 1, __ATOMIC_RELAXED)
+
 /*
  *
  *
@@ -280,6 +303,7 @@ static void _iothread_event_cb(evutil_socket_t fd, short what, void *arg)
 {
     struct _event_cb_info *ecbi = (struct _event_cb_info *)arg;
 
+    _IOTHREAD_STAT_ADD(events);
     pthread_mutex_lock(&(ecbi->ecbi_lock));
 
     assert(!(ecbi->flags & IOTHR_ECBI_FLAGS_DONE));
@@ -370,9 +394,34 @@ static void _iothread_wakeup_cb(evutil_socket_t fd, short what, void *arg)
     (void)arg;
 }
 
+/* Between two loop iterations the io thread holds no libevent lock and is
+ * inside no callback, so that is where a fork waits for it. */
+static void _iothread_fork_checkpoint(PyFilIOThread *self)
+{
+    if (!__atomic_load_n(&(self->fork_pause), __ATOMIC_ACQUIRE))
+    {
+        return;
+    }
+    pthread_mutex_lock(&(self->fork_lock));
+    if (self->fork_pause)
+    {
+        self->fork_parked = 1;
+        pthread_cond_broadcast(&(self->fork_cond));
+        while (self->fork_pause)
+        {
+            pthread_cond_wait(&(self->fork_cond), &(self->fork_lock));
+        }
+        self->fork_parked = 0;
+    }
+    pthread_mutex_unlock(&(self->fork_lock));
+}
+
 static void *_iothread_loop(PyFilIOThread *self)
 {
     PyGILState_STATE gstate;
+
+    fil_affinity_apply(&(self->affinity), 0);
+
     gstate = PyGILState_Ensure();
 
     /* NOTE(comstud): We mostly run outside of the GIL, but callbacks
@@ -385,6 +434,7 @@ static void *_iothread_loop(PyFilIOThread *self)
         event_base_loop(self->event_base, EVLOOP_ONCE);
         if (self->flags & FIL_IOTHR_FLAGS_SHUTDOWN)
             break;
+        _iothread_fork_checkpoint(self);
     }
 
     /* Shutdown-only exit (driven by _iothread_atexit during interpreter
@@ -528,6 +578,47 @@ static int _iothread_register_py_atexit(void)
     return 0;
 }
 
+/*
+ * The io thread does the kernel-to-user copies for every parked socket and
+ * signals the scheduler threads that wait on them, so where it runs relative
+ * to them is a good part of what benchmarks/METHODOLOGY.md calls placement
+ * variance.  It is created lazily by the first scheduler thread that does
+ * socket I/O, so FIL_IOTHREAD_CPUS=numa keeps it on that thread's NUMA node;
+ * anything else is a CPU list ("2,3", "0-7") it may float over.  Unset means
+ * the kernel decides, as before.  There is deliberately no SCHED_BATCH or
+ * nice knob here: this thread is on every wakeup's critical path.
+ */
+static int _iothread_affinity_from_env(FilAffinity *aff)
+{
+    const char *env = getenv("FIL_IOTHREAD_CPUS");
+    int err;
+
+    fil_affinity_init(aff);
+    if (env == NULL || *env == '\0')
+    {
+        return 0;
+    }
+#ifdef __linux__
+    if (!strcmp(env, "numa"))
+    {
+        aff->numa_local = 1;
+    }
+    else if (fil_affinity_parse_cpulist(env, &(aff->cpus)) < 0 ||
+             CPU_COUNT(&(aff->cpus)) == 0)
+    {
+        PyErr_Format(PyExc_ValueError, "FIL_IOTHREAD_CPUS: invalid CPU list: '%s'", env);
+        return -1;
+    }
+#endif
+    if ((err = fil_affinity_resolve(aff)) != 0)
+    {
+        PyErr_Format(PyExc_ValueError,
+                     "FIL_IOTHREAD_CPUS='%s' is not usable here (errno %d)", env, err);
+        return -1;
+    }
+    return 0;
+}
+
 static int _iothread_init(PyFilIOThread *self, PyObject *args, PyObject *kargs)
 {
     struct timeval tv;
@@ -536,6 +627,11 @@ static int _iothread_init(PyFilIOThread *self, PyObject *args, PyObject *kargs)
     tv.tv_sec = 60;
     tv.tv_usec = 0;
 
+    if (_iothread_affinity_from_env(&(self->affinity)) < 0)
+    {
+        return -1;
+    }
+
     self->event_base = event_base_new();
     if (self->event_base == NULL)
     {
@@ -563,6 +659,9 @@ static int _iothread_init(PyFilIOThread *self, PyObject *args, PyObject *kargs)
         return -1;
     }
 
+    pthread_mutex_init(&(self->fork_lock), NULL);
+    pthread_cond_init(&(self->fork_cond), NULL);
+
     err = pthread_create(&(self->thr_id), NULL,
                          (void *(*)(void *))_iothread_loop, self);
     /* pthread_create returns a positive errno on failure, not -1. */
@@ -597,6 +696,8 @@ static void _iothread_dealloc(PyFilIOThread *self)
     if (self->event_base != NULL)
     {
         event_base_free(self->event_base);
+        pthread_mutex_destroy(&(self->fork_lock));
+        pthread_cond_destroy(&(self->fork_cond));
     }
 
     /* Respect tp_free: Python subclass instances are GC-allocated, and
@@ -676,6 +777,7 @@ static int _iothread_process(PyFilIOThread *iothr, int fd, short event,
     /* TODO(comstud): Can optimize this by not polling if we're in a Thread
      * that doesn't have any filaments
      */
+    _IOTHREAD_STAT_ADD(classic_waits);
     waiter = fil_waiter_alloc();
     if (waiter == NULL)
     {
@@ -730,7 +832,9 @@ static int _iothread_process(PyFilIOThread *iothr, int fd, short event,
         return -1;
     }
 
-    err = fil_waiter_wait(waiter, NULL, timeout_exc);
+    err = fil_waiter_wait_why(waiter, NULL, timeout_exc,
+                              (event & EV_WRITE) ? FIL_TRACE_WHY_FD_WRITE
+                                                 : FIL_TRACE_WHY_FD_READ);
 
     pthread_mutex_lock(&(ecbi->ecbi_lock));
 
@@ -905,6 +1009,7 @@ static void _iothread_fdwait_event_cb(evutil_socket_t fd, short what, void *arg)
 
     (void)what;
 
+    _IOTHREAD_STAT_ADD(events);
     pthread_mutex_lock(&(fdw->lock));
     fdw->edge_seq++;
     waiter = fdw->waiter;
@@ -1032,6 +1137,7 @@ int fil_iothread_wait_cached(PyFilIOThread *iothr, FilIOFDWait **cachep, int fd,
         if (!(event_base_get_features(iothr->event_base) & EV_FEATURE_ET))
         {
             /* Backend without edge-trigger support: use the classic path. */
+            _IOTHREAD_STAT_ADD(cached_fallbacks);
             return 1;
         }
 
@@ -1075,6 +1181,7 @@ int fil_iothread_wait_cached(PyFilIOThread *iothr, FilIOFDWait **cachep, int fd,
          * arrived (and, in the multi-reader case, was only delivered to a
          * DIFFERENT waiter's wakeup). */
         pthread_mutex_unlock(&(fdw->lock));
+        _IOTHREAD_STAT_ADD(cached_retries);
         return 0;
     }
 
@@ -1083,6 +1190,7 @@ int fil_iothread_wait_cached(PyFilIOThread *iothr, FilIOFDWait **cachep, int fd,
         /* Another greenlet is already parked on this (fd, direction); rare.
          * Let the caller take the classic multi-waiter-capable path. */
         pthread_mutex_unlock(&(fdw->lock));
+        _IOTHREAD_STAT_ADD(cached_fallbacks);
         return 1;
     }
 
@@ -1131,8 +1239,11 @@ int fil_iothread_wait_cached(PyFilIOThread *iothr, FilIOFDWait **cachep, int fd,
     fdw->waiter = waiter;
     fdw->busy++;
     pthread_mutex_unlock(&(fdw->lock));
+    _IOTHREAD_STAT_ADD(cached_waits);
 
-    err = fil_waiter_wait(waiter, timeout, timeout_exc);
+    err = fil_waiter_wait_why(waiter, timeout, timeout_exc,
+                              for_write ? FIL_TRACE_WHY_FD_WRITE
+                                        : FIL_TRACE_WHY_FD_READ);
 
     pthread_mutex_lock(&(fdw->lock));
     if (err && fdw->waiter == waiter)
@@ -1331,6 +1442,114 @@ PyFilIOThread *fil_iothread_get(void)
     return _IOThreadObj;
 }
 
+/*
+ * os.fork() support.
+ *
+ * Only the forking thread exists in the child, so the io thread is gone, and
+ * had it been inside event_base_loop() at that instant its libevent locks and
+ * our fd-waiter locks could be frozen held.  So before forking we park it at
+ * _iothread_fork_checkpoint() -- with the GIL released, since the wakeup it
+ * is processing may need it -- and the parent lets it go again afterwards.
+ *
+ * The child keeps the same event base: event_reinit() gives it a fresh
+ * epoll set (the parent's is shared with us until then) and re-adds every
+ * event, and a new thread runs the loop.  That keeps the persistent events
+ * cached on sockets created before the fork (a listening socket shared by
+ * pre-forked workers, say) working in the child.  Greenthreads of the other,
+ * now vanished, threads that were parked on an fd are simply never resumed.
+ */
+static PyObject *_iothread_before_fork(PyObject *self, PyObject *ignored)
+{
+    PyFilIOThread *iothr = _IOThreadObj;
+
+    (void)self;
+    (void)ignored;
+
+    if (iothr == NULL || !(iothr->flags & FIL_IOTHR_FLAGS_RUNNING))
+    {
+        Py_RETURN_NONE;
+    }
+
+    pthread_mutex_lock(&(iothr->fork_lock));
+    __atomic_store_n(&(iothr->fork_pause), 1, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&(iothr->fork_lock));
+    _iothread_wakeup(iothr);
+
+    Py_BEGIN_ALLOW_THREADS
+    pthread_mutex_lock(&(iothr->fork_lock));
+    while (!iothr->fork_parked)
+    {
+        pthread_cond_wait(&(iothr->fork_cond), &(iothr->fork_lock));
+    }
+    pthread_mutex_unlock(&(iothr->fork_lock));
+    Py_END_ALLOW_THREADS
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *_iothread_after_fork_parent(PyObject *self, PyObject *ignored)
+{
+    PyFilIOThread *iothr = _IOThreadObj;
+
+    (void)self;
+    (void)ignored;
+
+    if (iothr == NULL || !(iothr->flags & FIL_IOTHR_FLAGS_RUNNING))
+    {
+        Py_RETURN_NONE;
+    }
+
+    pthread_mutex_lock(&(iothr->fork_lock));
+    __atomic_store_n(&(iothr->fork_pause), 0, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&(iothr->fork_cond));
+    pthread_mutex_unlock(&(iothr->fork_lock));
+
+    Py_RETURN_NONE;
+}
+
+static PyObject *_iothread_after_fork_child(PyObject *self, PyObject *ignored)
+{
+    PyFilIOThread *iothr = _IOThreadObj;
+
+    (void)self;
+    (void)ignored;
+
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_init(&_iothread_singleton_lock, NULL);
+#endif
+
+    if (iothr == NULL || !(iothr->flags & FIL_IOTHR_FLAGS_RUNNING))
+    {
+        Py_RETURN_NONE;
+    }
+
+    iothr->flags &= ~(FIL_IOTHR_FLAGS_RUNNING | FIL_IOTHR_FLAGS_SHUTDOWN);
+    pthread_mutex_init(&(iothr->fork_lock), NULL);
+    pthread_cond_init(&(iothr->fork_cond), NULL);
+    iothr->fork_pause = 0;
+    iothr->fork_parked = 0;
+
+    if (event_reinit(iothr->event_base) < 0 ||
+        pthread_create(&(iothr->thr_id), NULL,
+                       (void *(*)(void *))_iothread_loop, iothr) != 0)
+    {
+        /* Leak it (its dealloc would join a thread that does not exist)
+         * and let the next blocking op build a fresh one.  Sockets that
+         * cached an event on this base will not wake in this process. */
+        _IOThreadObj = NULL;
+        Py_RETURN_NONE;
+    }
+
+    iothr->flags |= FIL_IOTHR_FLAGS_RUNNING;
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _iothread_fork_defs[] = {
+    { "_fil_iothread_before_fork", (PyCFunction)_iothread_before_fork, METH_NOARGS, NULL },
+    { "_fil_iothread_after_fork_parent", (PyCFunction)_iothread_after_fork_parent, METH_NOARGS, NULL },
+    { "_fil_iothread_after_fork_child", (PyCFunction)_iothread_after_fork_child, METH_NOARGS, NULL },
+};
+
 int fil_iothread_read_ready(PyFilIOThread *iothr, int fd,
                             struct timespec *timeout,
                             PyObject *timeout_exc)
@@ -1531,8 +1750,35 @@ ssize_t fil_iothread_send(PyFilIOThread *iothr, int fd, void *buffer,
     return -1;
 }
 
+PyDoc_STRVAR(_iothread_stats_doc,
+"iothread_stats() -> dict\n\n"
+"Counts since the process started: 'events', io callbacks the io thread\n"
+"has run; 'classic_waits', waits that armed a one-shot event; and for the\n"
+"cached fd waiters, 'cached_waits' (parked on one), 'cached_retries' (an\n"
+"edge had already come, so the caller retried instead of parking) and\n"
+"'cached_fallbacks' (sent back to the classic path).");
+static PyObject *_iothread_stats_py(PyObject *self, PyObject *ignored)
+{
+#define __GET(__f) \
+    (unsigned long long)__atomic_load_n(&(_iothread_stats.__f), __ATOMIC_RELAXED)
+    return Py_BuildValue("{sKsKsKsKsK}",
+                         "events", __GET(events),
+                         "classic_waits", __GET(classic_waits),
+                         "cached_waits", __GET(cached_waits),
+                         "cached_retries", __GET(cached_retries),
+                         "cached_fallbacks", __GET(cached_fallbacks));
+#undef __GET
+}
+
+static PyMethodDef _iothread_stats_def = {
+    "iothread_stats", (PyCFunction)_iothread_stats_py, METH_NOARGS,
+    _iothread_stats_doc
+};
+
 int fil_iothread_init(PyObject *module)
 {
+    PyObject *func;
+
     PyFilCore_Import();
     PyEval_InitThreads();
 
@@ -1548,6 +1794,12 @@ int fil_iothread_init(PyObject *module)
         return -1;
     }
 
+    if (fil_register_at_fork(&_iothread_fork_defs[0], &_iothread_fork_defs[1],
+                             &_iothread_fork_defs[2]) < 0)
+    {
+        return -1;
+    }
+
     if (PyType_Ready(&_iothread_type) < 0)
     {
         return -1;
@@ -1563,6 +1815,14 @@ int fil_iothread_init(PyObject *module)
 
     PyFilIOThread_Type = &_iothread_type;
 
+    func = PyCFunction_NewEx(&_iothread_stats_def, NULL, NULL);
+    if (func == NULL ||
+        PyModule_AddObject(module, "iothread_stats", func) != 0)
+    {
+        Py_XDECREF(func);
+        return -1;
+    }
+
     FIL_COPY_IO_API();
 
     return 0;
@@ -24,6 +24,7 @@
  */
 
 #define __FIL_BUILDING_LOCKING__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_COND
 #include "core/filament.h"
 #include "locking/fil_cond.h"
 #include "locking/fil_lock.h"
@@ -64,6 +65,7 @@ typedef struct _pyfil_cond {
 #endif
     PyObject *verbose;
     FilWaiterList waiters;
+    FilLockProf *prof;
 } PyFilCond;
 
 
@@ -77,6 +79,11 @@ static PyFilCond *_cond_new(PyTypeObject *type, PyObject *args, PyObject *kw)
 #ifdef Py_GIL_DISABLED
         pthread_mutex_init(&(self->mutex), NULL);
 #endif
+        if (fil_lockprof_attach(&(self->prof), "Condition") < 0)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
     }
 
     return self;
@@ -145,6 +152,7 @@ static void _cond_dealloc(PyFilCond *self)
 #ifdef Py_GIL_DISABLED
     pthread_mutex_destroy(&(self->mutex));
 #endif
+    fil_lockprof_detach(&(self->prof));
     Py_CLEAR(self->lock);
     Py_CLEAR(self->verbose);
 
@@ -158,6 +166,7 @@ static int __cond_wait(PyFilCond *cond, struct timespec *ts)
     PyObject *result;
     FilWaiter *waiter;
     FilWaiterList *entry;
+    uint64_t start;
     int err;
 
     waiter = fil_waiter_alloc();
@@ -211,6 +220,9 @@ static int __cond_wait(PyFilCond *cond, struct timespec *ts)
         return -1;
     }
 
+    /* Every wait() parks: to the profiler it is a contended acquisition,
+     * and one that a notify() ended is the acquisition. */
+    start = cond->prof != NULL ? fil_lockprof_wait_begin(cond->prof) : 0;
     err = fil_waiter_wait(waiter, ts, NULL);
 
     FIL_COND_LOCK(cond);
@@ -239,6 +251,10 @@ static int __cond_wait(PyFilCond *cond, struct timespec *ts)
     }
     FIL_COND_UNLOCK(cond);
     fil_waiter_decref(waiter);
+    if (cond->prof != NULL)
+    {
+        fil_lockprof_wait_end(cond->prof, start, err == 0);
+    }
 
     if (err)
     {
@@ -0,0 +1,994 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define __FIL_BUILDING_LOCKING__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_EVENT
+#include "core/filament.h"
+#include "locking/fil_event.h"
+
+/*
+ * Event and AsyncResult.
+ *
+ * These used to be Python classes, an Event on a Condition and an AsyncResult
+ * on a Message plus Python-side state, and they sit under every GreenPile,
+ * gevent Greenlet.join and select() helper.  Here each is a flag or a stored
+ * result next to a FilWaiterList: set() signals every waiter in one C loop,
+ * wait(timeout) parks on the scheduler's timer heap, and waiters may be
+ * native OS threads (they park on the waiter's condvar, as with Queue).
+ *
+ * Both carry a completion link list too, so a WaitSet can watch them without
+ * a relay greenthread (see fil_waitset_register_type).
+ *
+ * Locking follows fil_semaphore.c: nothing on a stock build, where the GIL is
+ * held from testing the state through joining the waiter list; a mutex on a
+ * free-threading one, dropped across the park.  Order: event mutex ->
+ * WaitSet lock -> waiter_lock -> sched_lock.  Nothing that can run Python
+ * code (link callbacks, dropping an old value) happens under the mutex.
+ */
+#ifdef Py_GIL_DISABLED
+#  define FIL_EV_LOCK(__e)    pthread_mutex_lock(&((__e)->mutex))
+#  define FIL_EV_UNLOCK(__e)  pthread_mutex_unlock(&((__e)->mutex))
+#  define FIL_EV_WAIT(__e, __ts) \
+       fil_waiterlist_wait_locked((__e)->waiters, __ts, NULL, &((__e)->mutex))
+#else
+#  define FIL_EV_LOCK(__e)    ((void)0)
+#  define FIL_EV_UNLOCK(__e)  ((void)0)
+#  define FIL_EV_WAIT(__e, __ts) \
+       fil_waiterlist_wait((__e)->waiters, __ts, NULL)
+#endif
+
+typedef struct _pyfil_event {
+    PyObject_HEAD
+    int flag;
+    /* Bumped by every set(), so a waiter can tell it was set (and maybe
+     * cleared again) while it was parked: gevent 1.1 semantics. */
+    unsigned long set_count;
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_t mutex;
+#endif
+    FilWaiterList waiters;
+    FilMessageLink links;
+    PyObject *weakreflist;
+} PyFilEvent;
+
+typedef struct _pyfil_asyncresult {
+    PyObject_HEAD
+    int ready;
+    PyObject *value;            /* NULL reads as None */
+    PyObject *exc_info;         /* (type, value, tb) once failed, else NULL */
+    PyObject *callbacks;        /* link() callbacks not yet run, or NULL */
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_t mutex;
+#endif
+    FilWaiterList waiters;
+    FilMessageLink links;
+} PyFilAsyncResult;
+
+static PyTypeObject _event_type;
+static PyTypeObject _asyncresult_type;
+
+
+/**************** Event ****************/
+
+static PyFilEvent *_event_new(PyTypeObject *type, PyObject *args, PyObject *kw)
+{
+    PyFilEvent *self = (PyFilEvent *)type->tp_alloc(type, 0);
+
+    if (self != NULL)
+    {
+        fil_waiterlist_init(self->waiters);
+        fil_links_init(&(self->links));
+#ifdef Py_GIL_DISABLED
+        pthread_mutex_init(&(self->mutex), NULL);
+#endif
+    }
+
+    return self;
+}
+
+static void _event_dealloc(PyFilEvent *self)
+{
+    assert(fil_waiterlist_empty(self->waiters));
+    /* A WaitSet holds a reference for as long as it is linked. */
+    assert(fil_links_empty(&(self->links)));
+    if (self->weakreflist != NULL)
+    {
+        PyObject_ClearWeakRefs((PyObject *)self);
+    }
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_destroy(&(self->mutex));
+#endif
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+PyDoc_STRVAR(_event_is_set_doc, "Return True if the event is set.");
+static PyObject *_event_is_set(PyFilEvent *self, PyObject *unused)
+{
+    return PyBool_FromLong(self->flag);
+}
+
+PyDoc_STRVAR(_event_set_doc, "Set the flag and wake every waiter.");
+static PyObject *_event_set(PyFilEvent *self, PyObject *unused)
+{
+    FIL_EV_LOCK(self);
+    self->flag = 1;
+    self->set_count++;
+    fil_links_fire(&(self->links));
+    fil_waiterlist_signal_all(self->waiters);
+    FIL_EV_UNLOCK(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_event_clear_doc, "Reset the flag to unset (later waiters will block again).");
+static PyObject *_event_clear(PyFilEvent *self, PyObject *unused)
+{
+    FIL_EV_LOCK(self);
+    self->flag = 0;
+    FIL_EV_UNLOCK(self);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_event_wait_doc,
+"wait(timeout=None) -> bool\n\n"
+"Block until the flag is set, or until 'timeout' seconds elapse.  Returns\n"
+"True if it was set at any point while waiting (even if cleared again\n"
+"since), False on timeout; never raises on timeout (threading.Event).");
+static PyObject *_event_wait_common(PyFilEvent *self, PyObject *timeout)
+{
+    struct timespec tsbuf;
+    struct timespec *ts;
+    unsigned long start;
+    int changed;
+    int err;
+
+    if (self->flag)
+    {
+        Py_RETURN_TRUE;
+    }
+
+    if (fil_timespec_from_pyobj_interval(timeout, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    FIL_EV_LOCK(self);
+    if (self->flag)
+    {
+        FIL_EV_UNLOCK(self);
+        Py_RETURN_TRUE;
+    }
+    start = self->set_count;
+    err = FIL_EV_WAIT(self, ts);
+    changed = (self->set_count != start);
+    FIL_EV_UNLOCK(self);
+
+    if (err == -ETIMEDOUT)
+    {
+        /* Our own deadline: report, don't raise.  An outer Timeout thrown
+         * into us comes back as -1 and propagates. */
+        PyErr_Clear();
+        return PyBool_FromLong(changed);
+    }
+    if (err)
+    {
+        /* Including SIGNALED_UNWIND: set() wakes everybody, so there is no
+         * hand-over to pass on; just leave with the exception. */
+        return NULL;
+    }
+    Py_RETURN_TRUE;
+}
+
+#ifdef _FIL_PYTHON3
+static PyObject *_event_wait(PyFilEvent *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char * const keywords[] = {"timeout"};
+    PyObject *argv[1];
+
+    if (fil_fastcall_parse(args, nargs, kwnames, "wait",
+                           0, 1, keywords, argv) < 0)
+    {
+        return NULL;
+    }
+
+    return _event_wait_common(self, argv[0]);
+}
+#else
+static PyObject *_event_wait(PyFilEvent *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"timeout", NULL};
+    PyObject *timeout = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O:wait", keywords,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    return _event_wait_common(self, timeout);
+}
+#endif
+
+static int _event_link(PyObject *obj, FilMessageLink *link)
+{
+    PyFilEvent *self = (PyFilEvent *)obj;
+
+    FIL_EV_LOCK(self);
+    if (self->flag)
+    {
+        FIL_EV_UNLOCK(self);
+        link->prev = link->next = NULL;
+        return 1;
+    }
+    fil_links_add(&(self->links), link);
+    FIL_EV_UNLOCK(self);
+    return 0;
+}
+
+static void _event_unlink(PyObject *obj, FilMessageLink *link)
+{
+    /* Cast inside the macros: they are empty on GIL builds. */
+    FIL_EV_LOCK((PyFilEvent *)obj);
+    fil_links_del(link);
+    FIL_EV_UNLOCK((PyFilEvent *)obj);
+}
+
+static PyMethodDef _event_methods[] = {
+    {"is_set", (PyCFunction)_event_is_set, METH_NOARGS, _event_is_set_doc},
+    /* gevent/eventlet spell it 'ready'; old threading spells it 'isSet'. */
+    {"ready", (PyCFunction)_event_is_set, METH_NOARGS, _event_is_set_doc},
+    {"isSet", (PyCFunction)_event_is_set, METH_NOARGS, _event_is_set_doc},
+    {"set", (PyCFunction)_event_set, METH_NOARGS, _event_set_doc},
+    {"clear", (PyCFunction)_event_clear, METH_NOARGS, _event_clear_doc},
+#ifdef _FIL_PYTHON3
+    {"wait", (PyCFunction)(void (*)(void))_event_wait, METH_FASTCALL|METH_KEYWORDS, _event_wait_doc},
+#else
+    {"wait", (PyCFunction)_event_wait, METH_VARARGS|METH_KEYWORDS, _event_wait_doc},
+#endif
+    { NULL, NULL }
+};
+
+PyDoc_STRVAR(_event_doc,
+"Event()\n\n"
+"A cooperative, re-settable event flag.  Many greenthreads (or OS threads)\n"
+"may wait(); a single set() releases them all; clear() makes it reusable.\n"
+"set() never blocks, so it is safe from the scheduler thread (a Timer\n"
+"callback).");
+
+static PyTypeObject _event_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament.locking.Event",                  /* tp_name */
+    sizeof(PyFilEvent),                         /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_event_dealloc,                 /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS,                        /* tp_flags */
+    _event_doc,                                 /* tp_doc */
+    0,                                          /* tp_traverse */
+    0,                                          /* tp_clear */
+    0,                                          /* tp_richcompare */
+    offsetof(PyFilEvent, weakreflist),          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    _event_methods,                             /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    0,                                          /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_event_new,                        /* tp_new */
+    PyObject_Del,                               /* tp_free */
+};
+
+
+/**************** AsyncResult ****************/
+
+static PyFilAsyncResult *_ar_new(PyTypeObject *type, PyObject *args, PyObject *kw)
+{
+    PyFilAsyncResult *self = (PyFilAsyncResult *)type->tp_alloc(type, 0);
+
+    if (self != NULL)
+    {
+        fil_waiterlist_init(self->waiters);
+        fil_links_init(&(self->links));
+#ifdef Py_GIL_DISABLED
+        pthread_mutex_init(&(self->mutex), NULL);
+#endif
+    }
+
+    return self;
+}
+
+static int _ar_traverse(PyFilAsyncResult *self, visitproc visit, void *arg)
+{
+    Py_VISIT(self->value);
+    Py_VISIT(self->exc_info);
+    Py_VISIT(self->callbacks);
+    return 0;
+}
+
+static int _ar_clear(PyFilAsyncResult *self)
+{
+    Py_CLEAR(self->value);
+    Py_CLEAR(self->exc_info);
+    Py_CLEAR(self->callbacks);
+    return 0;
+}
+
+static void _ar_dealloc(PyFilAsyncResult *self)
+{
+    PyObject_GC_UnTrack(self);
+    assert(fil_waiterlist_empty(self->waiters));
+    assert(fil_links_empty(&(self->links)));
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_destroy(&(self->mutex));
+#endif
+    _ar_clear(self);
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+/*
+ * Raise the timeout this class reports.  filament.event's subclass names
+ * filament.timeout.Timeout in '_timeout_class' so that 'except gevent.Timeout'
+ * catches an expired get(); the bare C type raises the core's Timeout.
+ * 'seconds' NULL means the non-blocking get(), which gevent reports as
+ * Timeout(exception=None).
+ */
+static void _ar_set_timeout(PyFilAsyncResult *self, PyObject *seconds)
+{
+    PyObject *cls;
+    PyObject *exc;
+
+    cls = PyObject_GetAttrString((PyObject *)Py_TYPE(self), "_timeout_class");
+    if (cls == NULL)
+    {
+        PyErr_Clear();
+        fil_set_timeout_exc(NULL);
+        return;
+    }
+
+    if (seconds != NULL)
+    {
+        exc = PyObject_CallFunctionObjArgs(cls, seconds, NULL);
+    }
+    else
+    {
+        PyObject *kwargs = Py_BuildValue("{s:O}", "exception", Py_None);
+
+        exc = NULL;
+        if (kwargs != NULL)
+        {
+            exc = PyObject_Call(cls, fil_empty_tuple(), kwargs);
+            Py_DECREF(kwargs);
+        }
+    }
+    Py_DECREF(cls);
+
+    if (exc != NULL)
+    {
+        PyErr_SetObject((PyObject *)Py_TYPE(exc), exc);
+        Py_DECREF(exc);
+    }
+}
+
+/* Caller holds the mutex and has seen 'ready'.  Returns the value, or NULL
+ * with the stored exception raised -- with its stored traceback if there is
+ * one, else the instance's own, as a Python 'raise' would. */
+static PyObject *_ar_result(PyFilAsyncResult *self)
+{
+    PyObject *exc_type, *exc_value, *exc_tb;
+
+    if (self->exc_info == NULL)
+    {
+        PyObject *value = self->value ? self->value : Py_None;
+
+        Py_INCREF(value);
+        return value;
+    }
+
+    exc_type = PyTuple_GET_ITEM(self->exc_info, 0);
+    exc_value = PyTuple_GET_ITEM(self->exc_info, 1);
+    exc_tb = PyTuple_GET_ITEM(self->exc_info, 2);
+
+    if (exc_tb == Py_None)
+    {
+        if (exc_value == Py_None)
+        {
+            PyErr_SetNone(exc_type);
+        }
+        else
+        {
+            PyErr_SetObject(exc_type, exc_value);
+        }
+        return NULL;
+    }
+
+    Py_INCREF(exc_type);
+    Py_INCREF(exc_tb);
+    if (exc_value == Py_None)
+    {
+        exc_value = NULL;
+    }
+    Py_XINCREF(exc_value);
+    PyErr_Restore(exc_type, exc_value, exc_tb);
+    return NULL;
+}
+
+/*
+ * Park until ready.  Returns 0 (mutex held, ready), or -1 with the mutex
+ * released: -ETIMEDOUT's exception is left for the caller to replace, and
+ * anything else -- including a throw that raced the set(), which has nothing
+ * to hand back -- is the caller's to propagate.  'err' says which.
+ */
+static int __ar_wait_ready(PyFilAsyncResult *self, struct timespec *ts, int *errp)
+{
+    while (!self->ready)
+    {
+        int err = FIL_EV_WAIT(self, ts);
+
+        if (err)
+        {
+            FIL_EV_UNLOCK(self);
+            *errp = err;
+            return -1;
+        }
+        /* Woken, but reset() can have run in between: wait again. */
+    }
+    return 0;
+}
+
+static int _ar_fire_callbacks(PyFilAsyncResult *self, PyObject *callbacks)
+{
+    PyObject *args = PyTuple_Pack(1, (PyObject *)self);
+    Py_ssize_t i;
+    int err = 0;
+
+    if (args == NULL)
+    {
+        return -1;
+    }
+    /* Each in its own fire-and-forget greenthread, as gevent runs links in
+     * the hub: a slow or raising callback cannot disturb the setter. */
+    for (i = 0; i < PyList_GET_SIZE(callbacks); i++)
+    {
+        if (filament_spawn_n(PyList_GET_ITEM(callbacks, i), args, NULL) < 0)
+        {
+            err = -1;
+            break;
+        }
+    }
+    Py_DECREF(args);
+    return err;
+}
+
+/* set() / set_exception(): exactly one of 'value' / 'exc_info' non-NULL. */
+static PyObject *__ar_complete(PyFilAsyncResult *self, PyObject *value, PyObject *exc_info)
+{
+    PyObject *old_value, *old_exc_info, *callbacks;
+    int err = 0;
+
+    Py_XINCREF(value);
+    Py_XINCREF(exc_info);
+
+    FIL_EV_LOCK(self);
+    old_value = self->value;
+    old_exc_info = self->exc_info;
+    self->value = value;
+    self->exc_info = exc_info;
+    self->ready = 1;
+    callbacks = self->callbacks;
+    self->callbacks = NULL;
+    FIL_EV_UNLOCK(self);
+
+    /* Links before waiters, and do not reorder: gevent notifies both from
+     * one ordered list, so a link registered before a get() has run by the
+     * time that get() returns.  The scheduler's immediate queue is FIFO, so
+     * link greenthreads must be queued before waiters are woken. */
+    if (callbacks != NULL)
+    {
+        err = _ar_fire_callbacks(self, callbacks);
+        Py_DECREF(callbacks);
+    }
+
+    FIL_EV_LOCK(self);
+    fil_links_fire(&(self->links));
+    fil_waiterlist_signal_all(self->waiters);
+    FIL_EV_UNLOCK(self);
+
+    /* Overwriting a ready result (gevent allows it) can free the old one,
+     * which runs arbitrary code: only now, with nothing held. */
+    Py_XDECREF(old_value);
+    Py_XDECREF(old_exc_info);
+
+    if (err)
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_ar_set_doc,
+"set(value=None)\n\n"
+"Store 'value' and wake all waiters.  Setting a ready result overwrites it\n"
+"(gevent); waiters already released keep what they saw.");
+static PyObject *_ar_set(PyFilAsyncResult *self, PyObject *args)
+{
+    PyObject *value = Py_None;
+
+    if (!PyArg_ParseTuple(args, "|O:set", &value))
+    {
+        return NULL;
+    }
+    return __ar_complete(self, value, NULL);
+}
+
+PyDoc_STRVAR(_ar_set_exception_doc,
+"set_exception(exception, exc_info=None)\n\n"
+"Store an exception for get() to raise.  'exc_info', a (type, value, tb)\n"
+"triple, preserves a traceback.  Overwrites like set().");
+static PyObject *_ar_set_exception(PyFilAsyncResult *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"exception", "exc_info", NULL};
+    PyObject *exception;
+    PyObject *exc_info = Py_None;
+    PyObject *res;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|O:set_exception",
+                                     keywords, &exception, &exc_info))
+    {
+        return NULL;
+    }
+
+    if (exc_info == Py_None)
+    {
+        exc_info = PyTuple_Pack(3, (PyObject *)Py_TYPE(exception), exception,
+                                Py_None);
+    }
+    else
+    {
+        exc_info = PySequence_Tuple(exc_info);
+        if (exc_info != NULL && PyTuple_GET_SIZE(exc_info) != 3)
+        {
+            Py_DECREF(exc_info);
+            PyErr_SetString(PyExc_TypeError,
+                            "exc_info must be a (type, value, tb) triple");
+            return NULL;
+        }
+    }
+    if (exc_info == NULL)
+    {
+        return NULL;
+    }
+
+    res = __ar_complete(self, NULL, exc_info);
+    Py_DECREF(exc_info);
+    return res;
+}
+
+static PyObject *_ar_get_common(PyFilAsyncResult *self, int block, PyObject *timeout)
+{
+    struct timespec tsbuf;
+    struct timespec *ts;
+    PyObject *res;
+    int err;
+
+    FIL_EV_LOCK(self);
+    if (!self->ready)
+    {
+        FIL_EV_UNLOCK(self);
+        if (!block)
+        {
+            _ar_set_timeout(self, NULL);
+            return NULL;
+        }
+        if (fil_timespec_from_pyobj_interval(timeout, &tsbuf, &ts) < 0)
+        {
+            return NULL;
+        }
+        FIL_EV_LOCK(self);
+        if (__ar_wait_ready(self, ts, &err) < 0)
+        {
+            if (err == -ETIMEDOUT)
+            {
+                PyErr_Clear();
+                _ar_set_timeout(self, timeout ? timeout : Py_None);
+            }
+            return NULL;
+        }
+    }
+    res = _ar_result(self);
+    FIL_EV_UNLOCK(self);
+    return res;
+}
+
+PyDoc_STRVAR(_ar_get_doc,
+"get(block=True, timeout=None)\n\n"
+"Return the value, or raise the stored exception.  Not ready: with\n"
+"block=False raise Timeout at once, else wait, raising Timeout after\n"
+"'timeout' seconds.");
+#ifdef _FIL_PYTHON3
+static PyObject *_ar_get(PyFilAsyncResult *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char * const keywords[] = {"block", "timeout"};
+    PyObject *argv[2];
+    int block = 1;
+
+    if (fil_fastcall_parse(args, nargs, kwnames, "get",
+                           0, 2, keywords, argv) < 0)
+    {
+        return NULL;
+    }
+
+    if (argv[0] != NULL && (block = PyObject_IsTrue(argv[0])) < 0)
+    {
+        return NULL;
+    }
+
+    return _ar_get_common(self, block, argv[1]);
+}
+#else
+static PyObject *_ar_get(PyFilAsyncResult *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"block", "timeout", NULL};
+    PyObject *blockobj = NULL;
+    PyObject *timeout = NULL;
+    int block = 1;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO:get", keywords,
+                                     &blockobj, &timeout))
+    {
+        return NULL;
+    }
+
+    if (blockobj != NULL && (block = PyObject_IsTrue(blockobj)) < 0)
+    {
+        return NULL;
+    }
+
+    return _ar_get_common(self, block, timeout);
+}
+#endif
+
+PyDoc_STRVAR(_ar_get_nowait_doc, "Non-blocking get(); raises Timeout if not ready.");
+static PyObject *_ar_get_nowait(PyFilAsyncResult *self, PyObject *unused)
+{
+    return _ar_get_common(self, 0, NULL);
+}
+
+PyDoc_STRVAR(_ar_wait_doc,
+"wait(timeout=None)\n\n"
+"Block until ready and return the value.  Unlike get(), never raises the\n"
+"stored exception (returns None) and returns None on timeout (gevent).");
+static PyObject *_ar_wait_common(PyFilAsyncResult *self, PyObject *timeout)
+{
+    struct timespec tsbuf;
+    struct timespec *ts;
+    PyObject *value;
+    int err;
+
+    FIL_EV_LOCK(self);
+    if (!self->ready)
+    {
+        FIL_EV_UNLOCK(self);
+        if (fil_timespec_from_pyobj_interval(timeout, &tsbuf, &ts) < 0)
+        {
+            return NULL;
+        }
+        FIL_EV_LOCK(self);
+        if (__ar_wait_ready(self, ts, &err) < 0)
+        {
+            if (err == -ETIMEDOUT)
+            {
+                PyErr_Clear();
+                Py_RETURN_NONE;
+            }
+            return NULL;
+        }
+    }
+    value = self->value ? self->value : Py_None;
+    Py_INCREF(value);
+    FIL_EV_UNLOCK(self);
+    return value;
+}
+
+#ifdef _FIL_PYTHON3
+static PyObject *_ar_wait(PyFilAsyncResult *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char * const keywords[] = {"timeout"};
+    PyObject *argv[1];
+
+    if (fil_fastcall_parse(args, nargs, kwnames, "wait",
+                           0, 1, keywords, argv) < 0)
+    {
+        return NULL;
+    }
+
+    return _ar_wait_common(self, argv[0]);
+}
+#else
+static PyObject *_ar_wait(PyFilAsyncResult *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"timeout", NULL};
+    PyObject *timeout = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O:wait", keywords,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    return _ar_wait_common(self, timeout);
+}
+#endif
+
+PyDoc_STRVAR(_ar_ready_doc, "True once a value or exception has been stored.");
+static PyObject *_ar_ready(PyFilAsyncResult *self, PyObject *unused)
+{
+    return PyBool_FromLong(self->ready);
+}
+
+PyDoc_STRVAR(_ar_successful_doc, "True if ready AND it holds a value (not an exception).");
+static PyObject *_ar_successful(PyFilAsyncResult *self, PyObject *unused)
+{
+    return PyBool_FromLong(self->ready && self->exc_info == NULL);
+}
+
+PyDoc_STRVAR(_ar_link_doc,
+"link(callback)\n\n"
+"Call callback(self) in its own greenthread once this is ready (right\n"
+"away if it already is).");
+static PyObject *_ar_link(PyFilAsyncResult *self, PyObject *callback)
+{
+    PyObject *callbacks;
+    int err = 0;
+
+    FIL_EV_LOCK(self);
+    if (self->callbacks == NULL)
+    {
+        self->callbacks = PyList_New(0);
+    }
+    if (self->callbacks == NULL ||
+        PyList_Append(self->callbacks, callback) < 0)
+    {
+        FIL_EV_UNLOCK(self);
+        return NULL;
+    }
+    callbacks = NULL;
+    if (self->ready)
+    {
+        callbacks = self->callbacks;
+        self->callbacks = NULL;
+    }
+    FIL_EV_UNLOCK(self);
+
+    if (callbacks != NULL)
+    {
+        err = _ar_fire_callbacks(self, callbacks);
+        Py_DECREF(callbacks);
+    }
+    if (err)
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_ar_reset_doc,
+"reset()\n\n"
+"eventlet: discard the result (and pending links) so it can be reused.");
+static PyObject *_ar_reset(PyFilAsyncResult *self, PyObject *unused)
+{
+    PyObject *value, *exc_info, *callbacks;
+
+    FIL_EV_LOCK(self);
+    value = self->value;
+    exc_info = self->exc_info;
+    callbacks = self->callbacks;
+    self->value = self->exc_info = self->callbacks = NULL;
+    self->ready = 0;
+    FIL_EV_UNLOCK(self);
+
+    Py_XDECREF(value);
+    Py_XDECREF(exc_info);
+    Py_XDECREF(callbacks);
+    Py_RETURN_NONE;
+}
+
+static PyObject *_ar_get_value(PyFilAsyncResult *self, void *closure)
+{
+    PyObject *value = self->value ? self->value : Py_None;
+
+    Py_INCREF(value);
+    return value;
+}
+
+static PyObject *_ar_get_exception(PyFilAsyncResult *self, void *closure)
+{
+    PyObject *exc = self->exc_info ? PyTuple_GET_ITEM(self->exc_info, 1) : Py_None;
+
+    Py_INCREF(exc);
+    return exc;
+}
+
+static PyObject *_ar_get_exc_info(PyFilAsyncResult *self, void *closure)
+{
+    PyObject *exc_info = self->exc_info ? self->exc_info : Py_None;
+
+    Py_INCREF(exc_info);
+    return exc_info;
+}
+
+static int _ar_link_ws(PyObject *obj, FilMessageLink *link)
+{
+    PyFilAsyncResult *self = (PyFilAsyncResult *)obj;
+
+    FIL_EV_LOCK(self);
+    if (self->ready)
+    {
+        FIL_EV_UNLOCK(self);
+        link->prev = link->next = NULL;
+        return 1;
+    }
+    fil_links_add(&(self->links), link);
+    FIL_EV_UNLOCK(self);
+    return 0;
+}
+
+static void _ar_unlink_ws(PyObject *obj, FilMessageLink *link)
+{
+    FIL_EV_LOCK((PyFilAsyncResult *)obj);
+    fil_links_del(link);
+    FIL_EV_UNLOCK((PyFilAsyncResult *)obj);
+}
+
+static PyMethodDef _ar_methods[] = {
+    {"set", (PyCFunction)_ar_set, METH_VARARGS, _ar_set_doc},
+    {"set_exception", (PyCFunction)_ar_set_exception, METH_VARARGS|METH_KEYWORDS, _ar_set_exception_doc},
+#ifdef _FIL_PYTHON3
+    {"get", (PyCFunction)(void (*)(void))_ar_get, METH_FASTCALL|METH_KEYWORDS, _ar_get_doc},
+    {"wait", (PyCFunction)(void (*)(void))_ar_wait, METH_FASTCALL|METH_KEYWORDS, _ar_wait_doc},
+#else
+    {"get", (PyCFunction)_ar_get, METH_VARARGS|METH_KEYWORDS, _ar_get_doc},
+    {"wait", (PyCFunction)_ar_wait, METH_VARARGS|METH_KEYWORDS, _ar_wait_doc},
+#endif
+    {"get_nowait", (PyCFunction)_ar_get_nowait, METH_NOARGS, _ar_get_nowait_doc},
+    {"ready", (PyCFunction)_ar_ready, METH_NOARGS, _ar_ready_doc},
+    {"successful", (PyCFunction)_ar_successful, METH_NOARGS, _ar_successful_doc},
+    {"link", (PyCFunction)_ar_link, METH_O, _ar_link_doc},
+    {"reset", (PyCFunction)_ar_reset, METH_NOARGS, _ar_reset_doc},
+    { NULL, NULL }
+};
+
+static PyGetSetDef _ar_getset[] = {
+    {"value", (getter)_ar_get_value, NULL,
+     "The stored value (None if not ready or holding an exception).", NULL},
+    {"exception", (getter)_ar_get_exception, NULL,
+     "The stored exception instance, or None.", NULL},
+    {"exc_info", (getter)_ar_get_exc_info, NULL,
+     "The stored (type, value, tb) triple if failed, else None.", NULL},
+    { NULL },
+};
+
+PyDoc_STRVAR(_ar_doc,
+"AsyncResult()\n\n"
+"A one-shot future holding a value or an exception.  filament.event\n"
+"subclasses it with gevent's Timeout and the eventlet aliases.");
+
+static PyTypeObject _asyncresult_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament.locking.AsyncResult",            /* tp_name */
+    sizeof(PyFilAsyncResult),                   /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_ar_dealloc,                    /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS|Py_TPFLAGS_HAVE_GC,     /* tp_flags */
+    _ar_doc,                                    /* tp_doc */
+    (traverseproc)_ar_traverse,                 /* tp_traverse */
+    (inquiry)_ar_clear,                         /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    _ar_methods,                                /* tp_methods */
+    0,                                          /* tp_members */
+    _ar_getset,                                 /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    0,                                          /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_ar_new,                           /* tp_new */
+    /* Must match tp_alloc for a GC type; see fil_cond.c. */
+    PyObject_GC_Del,                            /* tp_free */
+};
+
+
+/****************/
+
+int fil_event_type_init(PyObject *module)
+{
+    PyFilCore_Import();
+
+    if (PyType_Ready(&_event_type) < 0 ||
+        PyType_Ready(&_asyncresult_type) < 0)
+    {
+        return -1;
+    }
+
+    /* A core built before WaitSet existed leaves the slot NULL; the types
+     * still work, a WaitSet just cannot watch them. */
+    if (fil_waitset_register_type != NULL &&
+        (fil_waitset_register_type(&_event_type, _event_link, _event_unlink) < 0 ||
+         fil_waitset_register_type(&_asyncresult_type, _ar_link_ws, _ar_unlink_ws) < 0))
+    {
+        return -1;
+    }
+
+    Py_INCREF((PyObject *)&_event_type);
+    if (PyModule_AddObject(module, "Event", (PyObject *)&_event_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_event_type);
+        return -1;
+    }
+
+    Py_INCREF((PyObject *)&_asyncresult_type);
+    if (PyModule_AddObject(module, "AsyncResult",
+                           (PyObject *)&_asyncresult_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_asyncresult_type);
+        return -1;
+    }
+
+    return 0;
+}
@@ -26,7 +26,9 @@
 #define __FIL_BUILDING_LOCKING__
 #include "core/filament.h"
 #include "locking/fil_cond.h"
+#include "locking/fil_event.h"
 #include "locking/fil_lock.h"
+#include "locking/fil_rwlock.h"
 #include "locking/fil_semaphore.h"
 
 PyDoc_STRVAR(_fil_locking_module_doc, "Filament _filament.locking module.");
@@ -48,6 +50,8 @@ _FIL_MODULE_INIT_FN_NAME(locking)
 
     if (fil_lock_type_init(m) < 0 ||
             fil_cond_type_init(m) < 0 ||
+            fil_event_type_init(m) < 0 ||
+            fil_rwlock_type_init(m) < 0 ||
             fil_semaphore_type_init(m) < 0)
     {
         return _FIL_MODULE_INIT_ERROR;
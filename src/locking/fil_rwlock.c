@@ -0,0 +1,941 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+#define __FIL_BUILDING_LOCKING__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_LOCK
+#include "core/filament.h"
+#include "locking/fil_rwlock.h"
+
+/*
+ * Reader-writer lock with an upgradable-read mode.
+ *
+ * Any number of shared (read) holds, or one exclusive (write) hold.  One of
+ * the shared holds may instead be *upgradable*: it coexists with plain
+ * readers but not with another upgradable hold or a writer, and its owner can
+ * later turn it into the write hold without letting anybody in between --
+ * the read-check-then-write pattern, without the deadlock two readers get
+ * when both try to upgrade.
+ *
+ * Policy is writer-preferring but phase-fair, so neither side starves:
+ *
+ *   - a reader arriving while a writer holds the lock OR is queued for it
+ *     waits, so a stream of readers cannot keep a writer out;
+ *   - when a writer releases, every reader queued behind it is let in
+ *     before the next writer, so a stream of writers cannot keep readers out
+ *     for longer than one write hold;
+ *   - a pending upgrade() goes ahead of everything: the upgrader already
+ *     excludes other writers, and making it queue behind them would deadlock
+ *     (they are waiting for its read hold to go away).
+ *
+ * Hand-off is the same as Lock's: whoever releases grants the lock to the
+ * waiters it wakes (bumps 'readers', sets 'writer') before signaling them, so
+ * a late arrival cannot slip in between the wakeup and the waiter running.
+ * A waiter that is woken but leaves with an exception gives its grant back
+ * through the usual release path.  Waiters may be native OS threads, which
+ * park on the waiter's condvar.
+ *
+ * Locking follows fil_lock.c: nothing on a stock build, a mutex on a
+ * free-threading one, dropped across the park.  Order: rwlock mutex ->
+ * waiter_lock -> sched_lock.
+ *
+ * Read holds are not owned: re-acquiring a read hold while a writer is queued
+ * waits behind that writer, so a greenthread that already reads must not read
+ * again recursively -- the same rule as pthread_rwlock with writer
+ * preference.
+ */
+#ifdef Py_GIL_DISABLED
+#  define FIL_RW_LOCK(__rw)    pthread_mutex_lock(&((__rw)->mutex))
+#  define FIL_RW_UNLOCK(__rw)  pthread_mutex_unlock(&((__rw)->mutex))
+#  define FIL_RW_WAIT(__rw, __list, __ts) \
+       fil_waiterlist_wait_locked(__list, __ts, NULL, &((__rw)->mutex))
+#else
+#  define FIL_RW_LOCK(__rw)    ((void)0)
+#  define FIL_RW_UNLOCK(__rw)  ((void)0)
+#  define FIL_RW_WAIT(__rw, __list, __ts) \
+       fil_waiterlist_wait(__list, __ts, NULL)
+#endif
+
+typedef struct _pyfil_rwlock {
+    PyObject_HEAD
+    /* Shared holds, the upgradable one included while it is not writing. */
+    Py_ssize_t readers;
+    int writer;
+    int upgradable;
+    uint64_t writer_owner;
+    uint64_t upgradable_owner;
+    FilWaiterList read_waiters;
+    FilWaiterList write_waiters;
+    FilWaiterList upgradable_waiters;
+    /* The upgradable holder, waiting for the plain readers to drain. */
+    FilWaiterList upgrade_waiters;
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_t mutex;
+#endif
+    FilLockProf *prof;
+} PyFilRWLock;
+
+typedef struct _pyfil_rwlock_guard {
+    PyObject_HEAD
+    PyFilRWLock *rwlock;
+    int mode;
+#define FIL_RW_MODE_READ        0
+#define FIL_RW_MODE_WRITE       1
+#define FIL_RW_MODE_UPGRADABLE  2
+} PyFilRWLockGuard;
+
+static PyTypeObject _rwlock_guard_type;
+
+
+static PyFilRWLock *_rwlock_new(PyTypeObject *type, PyObject *args, PyObject *kw)
+{
+    PyFilRWLock *self = (PyFilRWLock *)type->tp_alloc(type, 0);
+
+    if (self != NULL)
+    {
+        fil_waiterlist_init(self->read_waiters);
+        fil_waiterlist_init(self->write_waiters);
+        fil_waiterlist_init(self->upgradable_waiters);
+        fil_waiterlist_init(self->upgrade_waiters);
+#ifdef Py_GIL_DISABLED
+        pthread_mutex_init(&(self->mutex), NULL);
+#endif
+        if (fil_lockprof_attach(&(self->prof), "RWLock") < 0)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
+    }
+
+    return self;
+}
+
+static int _rwlock_init(PyFilRWLock *self, PyObject *args, PyObject *kwargs)
+{
+    return 0;
+}
+
+static void _rwlock_dealloc(PyFilRWLock *self)
+{
+    assert(fil_waiterlist_empty(self->read_waiters));
+    assert(fil_waiterlist_empty(self->write_waiters));
+    assert(fil_waiterlist_empty(self->upgradable_waiters));
+    assert(fil_waiterlist_empty(self->upgrade_waiters));
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_destroy(&(self->mutex));
+#endif
+    fil_lockprof_detach(&(self->prof));
+
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+static inline int __rwlock_can_read(PyFilRWLock *rw)
+{
+    return !rw->writer &&
+        fil_waiterlist_empty(rw->write_waiters) &&
+        fil_waiterlist_empty(rw->upgrade_waiters);
+}
+
+/*
+ * Hand the lock to whoever may have it now.  Called with the rwlock mutex
+ * held after anything that can unblock a waiter: a release, or a waiter
+ * giving up.  'readers_first' is set when a writer has just released: the
+ * readers that queued behind it go before the next writer.
+ */
+static void __rwlock_grant(PyFilRWLock *rw, int readers_first)
+{
+    if (rw->writer)
+    {
+        return;
+    }
+
+    if (!fil_waiterlist_empty(rw->upgrade_waiters))
+    {
+        /* Nothing else gets in while an upgrade is pending; it only waits
+         * for the plain readers to leave. */
+        if (rw->readers == 1)
+        {
+            rw->readers = 0;
+            rw->writer = 1;
+            fil_waiterlist_signal_first(rw->upgrade_waiters);
+        }
+        return;
+    }
+
+    if (!fil_waiterlist_empty(rw->write_waiters) &&
+            !(readers_first && (!fil_waiterlist_empty(rw->read_waiters) ||
+                                !fil_waiterlist_empty(rw->upgradable_waiters))))
+    {
+        if (rw->readers == 0)
+        {
+            rw->writer = 1;
+            fil_waiterlist_signal_first(rw->write_waiters);
+        }
+        return;
+    }
+
+    while (!fil_waiterlist_empty(rw->read_waiters))
+    {
+        rw->readers++;
+        fil_waiterlist_signal_first(rw->read_waiters);
+    }
+
+    if (!rw->upgradable && !fil_waiterlist_empty(rw->upgradable_waiters))
+    {
+        rw->upgradable = 1;
+        rw->readers++;
+        fil_waiterlist_signal_first(rw->upgradable_waiters);
+    }
+}
+
+/* __rwlock_grant() while an exception is unwinding the caller; signaling can
+ * raise, and that must not replace the one being propagated. */
+static void __rwlock_grant_keep_exc(PyFilRWLock *rw, int readers_first)
+{
+    PyObject *exc_type, *exc_value, *exc_tb;
+
+    PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+    __rwlock_grant(rw, readers_first);
+    PyErr_Restore(exc_type, exc_value, exc_tb);
+}
+
+/* Every kind of hold counts toward one profile record. */
+static inline void __rwlock_acquired(PyFilRWLock *rw)
+{
+    if (rw->prof != NULL)
+    {
+        fil_lockprof_acquired(rw->prof);
+    }
+}
+
+static int __rwlock_wait(PyFilRWLock *rw, FilWaiterList *list, struct timespec *ts)
+{
+    uint64_t start;
+    int err;
+
+    if (rw->prof == NULL)
+    {
+        return FIL_RW_WAIT(rw, *list, ts);
+    }
+    start = fil_lockprof_wait_begin(rw->prof);
+    err = FIL_RW_WAIT(rw, *list, ts);
+    fil_lockprof_wait_end(rw->prof, start, err == 0);
+    return err;
+}
+
+static int __rwlock_acquire_read(PyFilRWLock *rw, int blocking, struct timespec *ts)
+{
+    FIL_RW_LOCK(rw);
+
+    if (__rwlock_can_read(rw))
+    {
+        rw->readers++;
+        FIL_RW_UNLOCK(rw);
+        __rwlock_acquired(rw);
+        return 0;
+    }
+
+    if (!blocking)
+    {
+        FIL_RW_UNLOCK(rw);
+        return 1;
+    }
+
+    /* A reader giving up unblocks nobody, so a timeout needs no grant. */
+    int err = __rwlock_wait(rw, &(rw->read_waiters), ts);
+    if (err < 0)
+    {
+        FIL_RW_UNLOCK(rw);
+        return err;
+    }
+
+    if (err == FIL_WAITER_SIGNALED_UNWIND)
+    {
+        rw->readers--;
+        __rwlock_grant_keep_exc(rw, 0);
+        FIL_RW_UNLOCK(rw);
+        return -1;
+    }
+
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+static int __rwlock_release_read(PyFilRWLock *rw)
+{
+    FIL_RW_LOCK(rw);
+
+    /* The upgradable hold is counted in 'readers' but released on its own. */
+    if (rw->readers - (rw->upgradable && !rw->writer) <= 0)
+    {
+        FIL_RW_UNLOCK(rw);
+        PyErr_SetString(PyExc_RuntimeError, "release_read() without a read hold");
+        return -1;
+    }
+
+    rw->readers--;
+    __rwlock_grant(rw, 0);
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+static int __rwlock_acquire_write(PyFilRWLock *rw, int blocking, struct timespec *ts)
+{
+    uint64_t owner = fil_get_ident();
+
+    FIL_RW_LOCK(rw);
+
+    if (!rw->writer && rw->readers == 0 &&
+            fil_waiterlist_empty(rw->write_waiters) &&
+            fil_waiterlist_empty(rw->read_waiters) &&
+            fil_waiterlist_empty(rw->upgradable_waiters))
+    {
+        rw->writer = 1;
+        rw->writer_owner = owner;
+        FIL_RW_UNLOCK(rw);
+        __rwlock_acquired(rw);
+        return 0;
+    }
+
+    if (rw->writer && rw->writer_owner == owner)
+    {
+        FIL_RW_UNLOCK(rw);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "acquire_write() would deadlock: already the writer");
+        return -1;
+    }
+
+    if (!blocking)
+    {
+        FIL_RW_UNLOCK(rw);
+        return 1;
+    }
+
+    int err = __rwlock_wait(rw, &(rw->write_waiters), ts);
+    if (err < 0)
+    {
+        /* Readers may have been held back for us alone. */
+        __rwlock_grant_keep_exc(rw, 0);
+        FIL_RW_UNLOCK(rw);
+        return err;
+    }
+
+    assert(rw->writer);
+
+    if (err == FIL_WAITER_SIGNALED_UNWIND)
+    {
+        rw->writer = 0;
+        __rwlock_grant_keep_exc(rw, 1);
+        FIL_RW_UNLOCK(rw);
+        return -1;
+    }
+
+    rw->writer_owner = owner;
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+static int __rwlock_release_write(PyFilRWLock *rw)
+{
+    FIL_RW_LOCK(rw);
+
+    if (!rw->writer || rw->writer_owner != fil_get_ident())
+    {
+        FIL_RW_UNLOCK(rw);
+        PyErr_SetString(PyExc_RuntimeError, "release_write() without the write hold");
+        return -1;
+    }
+
+    rw->writer = 0;
+    rw->writer_owner = 0;
+    /* A write hold reached through upgrade() ends the upgradable one too. */
+    if (rw->upgradable)
+    {
+        rw->upgradable = 0;
+        rw->upgradable_owner = 0;
+    }
+    __rwlock_grant(rw, 1);
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+static int __rwlock_acquire_upgradable(PyFilRWLock *rw, int blocking, struct timespec *ts)
+{
+    uint64_t owner = fil_get_ident();
+
+    FIL_RW_LOCK(rw);
+
+    if (__rwlock_can_read(rw) && !rw->upgradable &&
+            fil_waiterlist_empty(rw->upgradable_waiters))
+    {
+        rw->upgradable = 1;
+        rw->upgradable_owner = owner;
+        rw->readers++;
+        FIL_RW_UNLOCK(rw);
+        __rwlock_acquired(rw);
+        return 0;
+    }
+
+    if (rw->upgradable && rw->upgradable_owner == owner)
+    {
+        FIL_RW_UNLOCK(rw);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "acquire_upgradable() would deadlock: already upgradable");
+        return -1;
+    }
+
+    if (!blocking)
+    {
+        FIL_RW_UNLOCK(rw);
+        return 1;
+    }
+
+    int err = __rwlock_wait(rw, &(rw->upgradable_waiters), ts);
+    if (err < 0)
+    {
+        FIL_RW_UNLOCK(rw);
+        return err;
+    }
+
+    if (err == FIL_WAITER_SIGNALED_UNWIND)
+    {
+        rw->upgradable = 0;
+        rw->readers--;
+        __rwlock_grant_keep_exc(rw, 0);
+        FIL_RW_UNLOCK(rw);
+        return -1;
+    }
+
+    rw->upgradable_owner = owner;
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+static int __rwlock_release_upgradable(PyFilRWLock *rw)
+{
+    FIL_RW_LOCK(rw);
+
+    if (!rw->upgradable || rw->writer ||
+            rw->upgradable_owner != fil_get_ident())
+    {
+        FIL_RW_UNLOCK(rw);
+        PyErr_SetString(PyExc_RuntimeError,
+                        "release_upgradable() without the upgradable hold");
+        return -1;
+    }
+
+    rw->upgradable = 0;
+    rw->upgradable_owner = 0;
+    rw->readers--;
+    __rwlock_grant(rw, 0);
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+/* On failure (timeout, non-blocking, exception) the caller still holds the
+ * upgradable read. */
+static int __rwlock_upgrade(PyFilRWLock *rw, int blocking, struct timespec *ts)
+{
+    uint64_t owner = fil_get_ident();
+
+    FIL_RW_LOCK(rw);
+
+    if (!rw->upgradable || rw->writer || rw->upgradable_owner != owner)
+    {
+        FIL_RW_UNLOCK(rw);
+        PyErr_SetString(PyExc_RuntimeError, "upgrade() without the upgradable hold");
+        return -1;
+    }
+
+    if (rw->readers == 1)
+    {
+        rw->readers = 0;
+        rw->writer = 1;
+        rw->writer_owner = owner;
+        FIL_RW_UNLOCK(rw);
+        __rwlock_acquired(rw);
+        return 0;
+    }
+
+    if (!blocking)
+    {
+        FIL_RW_UNLOCK(rw);
+        return 1;
+    }
+
+    int err = __rwlock_wait(rw, &(rw->upgrade_waiters), ts);
+    if (err < 0)
+    {
+        /* Readers queued behind the pending upgrade can come in now. */
+        __rwlock_grant_keep_exc(rw, 0);
+        FIL_RW_UNLOCK(rw);
+        return err;
+    }
+
+    assert(rw->writer);
+
+    if (err == FIL_WAITER_SIGNALED_UNWIND)
+    {
+        /* Back to the upgradable read we came in with. */
+        rw->writer = 0;
+        rw->readers = 1;
+        __rwlock_grant_keep_exc(rw, 1);
+        FIL_RW_UNLOCK(rw);
+        return -1;
+    }
+
+    rw->writer_owner = owner;
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+static int __rwlock_downgrade(PyFilRWLock *rw)
+{
+    FIL_RW_LOCK(rw);
+
+    if (!rw->writer || rw->writer_owner != fil_get_ident())
+    {
+        FIL_RW_UNLOCK(rw);
+        PyErr_SetString(PyExc_RuntimeError, "downgrade() without the write hold");
+        return -1;
+    }
+
+    rw->writer = 0;
+    rw->writer_owner = 0;
+    rw->upgradable = 0;
+    rw->upgradable_owner = 0;
+    rw->readers = 1;
+    /* We were the writer, so the readers queued behind us join us now. */
+    __rwlock_grant(rw, 1);
+    FIL_RW_UNLOCK(rw);
+    return 0;
+}
+
+
+/**************** Python interface ****************/
+
+typedef int (*fil_rwlock_acquire_fn)(PyFilRWLock *, int, struct timespec *);
+
+static PyObject *_rwlock_acquire_common(PyFilRWLock *self, fil_rwlock_acquire_fn fn,
+                                        PyObject *blockingobj, PyObject *timeout)
+{
+    struct timespec tsbuf;
+    struct timespec *ts;
+    int blocking;
+    int err;
+
+    if (fil_timespec_from_pyobj_interval(timeout, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    blocking = (blockingobj == NULL || blockingobj == Py_True);
+    err = fn(self, blocking, ts);
+    if (err < 0 && err != -ETIMEDOUT)
+    {
+        return NULL;
+    }
+
+    if (err == 0)
+    {
+        /* upgrade() turns a hold the caller has into another. */
+        if (fn != __rwlock_upgrade)
+        {
+            fil_preempt_lock_held(1);
+        }
+        Py_RETURN_TRUE;
+    }
+
+    /* See _lock_acquire in fil_lock.c: a timeout is reported by returning
+     * False, so the pending exc.Timeout has to go. */
+    if (err == -ETIMEDOUT)
+    {
+        PyErr_Clear();
+    }
+
+    Py_RETURN_FALSE;
+}
+
+#ifdef _FIL_PYTHON3
+#  define _RW_ACQUIRE_ARGS \
+       PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames
+#  define _RW_ACQUIRE_PASS args, nargs, kwnames
+#  define _RW_ACQUIRE_FLAGS METH_FASTCALL|METH_KEYWORDS
+#  define _RW_ACQUIRE_CAST(__f) (PyCFunction)(void (*)(void))(__f)
+
+static PyObject *_rwlock_acquire_parse(PyFilRWLock *self, fil_rwlock_acquire_fn fn,
+                                       const char *fname, _RW_ACQUIRE_ARGS)
+{
+    static const char * const keywords[] = {"blocking", "timeout"};
+    PyObject *argv[2];
+
+    if (fil_fastcall_parse(args, nargs, kwnames, fname,
+                           0, 2, keywords, argv) < 0)
+    {
+        return NULL;
+    }
+
+    if (argv[0] != NULL && !PyBool_Check(argv[0]))
+    {
+        PyErr_Format(PyExc_TypeError,
+                     "%s() argument 'blocking' must be bool", fname);
+        return NULL;
+    }
+
+    return _rwlock_acquire_common(self, fn, argv[0], argv[1]);
+}
+#else
+#  define _RW_ACQUIRE_ARGS PyObject *args, PyObject *kwargs
+#  define _RW_ACQUIRE_PASS args, kwargs
+#  define _RW_ACQUIRE_FLAGS METH_VARARGS|METH_KEYWORDS
+#  define _RW_ACQUIRE_CAST(__f) (PyCFunction)(__f)
+
+static PyObject *_rwlock_acquire_parse(PyFilRWLock *self, fil_rwlock_acquire_fn fn,
+                                       const char *fname, _RW_ACQUIRE_ARGS)
+{
+    static char *keywords[] = {"blocking", "timeout", NULL};
+    PyObject *blockingobj = NULL;
+    PyObject *timeout = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O!O",
+                                     keywords,
+                                     &PyBool_Type,
+                                     &blockingobj, &timeout))
+    {
+        return NULL;
+    }
+
+    return _rwlock_acquire_common(self, fn, blockingobj, timeout);
+}
+#endif
+
+PyDoc_STRVAR(_rwlock_acquire_read_doc,
+"acquire_read(blocking=True, timeout=None) -> bool\n\n"
+"Take a shared hold.  Waits while a writer holds the lock or is queued.");
+static PyObject *_rwlock_acquire_read(PyFilRWLock *self, _RW_ACQUIRE_ARGS)
+{
+    return _rwlock_acquire_parse(self, __rwlock_acquire_read,
+                                 "acquire_read", _RW_ACQUIRE_PASS);
+}
+
+PyDoc_STRVAR(_rwlock_acquire_write_doc,
+"acquire_write(blocking=True, timeout=None) -> bool\n\n"
+"Take the exclusive hold.");
+static PyObject *_rwlock_acquire_write(PyFilRWLock *self, _RW_ACQUIRE_ARGS)
+{
+    return _rwlock_acquire_parse(self, __rwlock_acquire_write,
+                                 "acquire_write", _RW_ACQUIRE_PASS);
+}
+
+PyDoc_STRVAR(_rwlock_acquire_upgradable_doc,
+"acquire_upgradable(blocking=True, timeout=None) -> bool\n\n"
+"Take a shared hold that can later be upgrade()d.  At most one exists at\n"
+"a time; plain readers are still admitted alongside it.");
+static PyObject *_rwlock_acquire_upgradable(PyFilRWLock *self, _RW_ACQUIRE_ARGS)
+{
+    return _rwlock_acquire_parse(self, __rwlock_acquire_upgradable,
+                                 "acquire_upgradable", _RW_ACQUIRE_PASS);
+}
+
+PyDoc_STRVAR(_rwlock_upgrade_doc,
+"upgrade(blocking=True, timeout=None) -> bool\n\n"
+"Turn the caller's upgradable hold into the write hold once the other\n"
+"readers have left.  On False the upgradable hold is kept.");
+static PyObject *_rwlock_upgrade(PyFilRWLock *self, _RW_ACQUIRE_ARGS)
+{
+    return _rwlock_acquire_parse(self, __rwlock_upgrade,
+                                 "upgrade", _RW_ACQUIRE_PASS);
+}
+
+PyDoc_STRVAR(_rwlock_release_read_doc, "Release a shared hold.");
+static PyObject *_rwlock_release_read(PyFilRWLock *self)
+{
+    if (__rwlock_release_read(self) < 0)
+    {
+        return NULL;
+    }
+    fil_preempt_lock_held(-1);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_rwlock_release_write_doc,
+"Release the write hold (and the upgradable hold it came from, if any).");
+static PyObject *_rwlock_release_write(PyFilRWLock *self)
+{
+    if (__rwlock_release_write(self) < 0)
+    {
+        return NULL;
+    }
+    fil_preempt_lock_held(-1);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_rwlock_release_upgradable_doc, "Release the upgradable hold.");
+static PyObject *_rwlock_release_upgradable(PyFilRWLock *self)
+{
+    if (__rwlock_release_upgradable(self) < 0)
+    {
+        return NULL;
+    }
+    fil_preempt_lock_held(-1);
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_rwlock_downgrade_doc,
+"Turn the write hold into a plain read hold, admitting queued readers.");
+static PyObject *_rwlock_downgrade(PyFilRWLock *self)
+{
+    if (__rwlock_downgrade(self) < 0)
+    {
+        return NULL;
+    }
+    Py_RETURN_NONE;
+}
+
+static PyObject *_rwlock_get_readers(PyFilRWLock *self, void *closure)
+{
+    return PyInt_FromSsize_t(self->readers);
+}
+
+static PyObject *_rwlock_get_write_locked(PyFilRWLock *self, void *closure)
+{
+    return PyBool_FromLong(self->writer);
+}
+
+static PyObject *_rwlock_guard(PyFilRWLock *self, void *closure)
+{
+    PyFilRWLockGuard *guard = PyObject_New(PyFilRWLockGuard, &_rwlock_guard_type);
+
+    if (guard == NULL)
+    {
+        return NULL;
+    }
+
+    Py_INCREF(self);
+    guard->rwlock = self;
+    guard->mode = (int)(intptr_t)closure;
+
+    return (PyObject *)guard;
+}
+
+static PyMethodDef _rwlock_methods[] = {
+    { "acquire_read", _RW_ACQUIRE_CAST(_rwlock_acquire_read), _RW_ACQUIRE_FLAGS, _rwlock_acquire_read_doc },
+    { "release_read", (PyCFunction)_rwlock_release_read, METH_NOARGS, _rwlock_release_read_doc },
+    { "acquire_write", _RW_ACQUIRE_CAST(_rwlock_acquire_write), _RW_ACQUIRE_FLAGS, _rwlock_acquire_write_doc },
+    { "release_write", (PyCFunction)_rwlock_release_write, METH_NOARGS, _rwlock_release_write_doc },
+    { "acquire_upgradable", _RW_ACQUIRE_CAST(_rwlock_acquire_upgradable), _RW_ACQUIRE_FLAGS, _rwlock_acquire_upgradable_doc },
+    { "release_upgradable", (PyCFunction)_rwlock_release_upgradable, METH_NOARGS, _rwlock_release_upgradable_doc },
+    { "upgrade", _RW_ACQUIRE_CAST(_rwlock_upgrade), _RW_ACQUIRE_FLAGS, _rwlock_upgrade_doc },
+    { "downgrade", (PyCFunction)_rwlock_downgrade, METH_NOARGS, _rwlock_downgrade_doc },
+    { NULL, NULL }
+};
+
+static PyGetSetDef _rwlock_getset[] = {
+    {"readers", (getter)_rwlock_get_readers, NULL,
+     "Number of shared holds, the upgradable one included.", NULL},
+    {"write_locked", (getter)_rwlock_get_write_locked, NULL,
+     "True while the write hold is taken.", NULL},
+    {"reader", (getter)_rwlock_guard, NULL,
+     "Context manager for a read hold.", (void *)FIL_RW_MODE_READ},
+    {"writer", (getter)_rwlock_guard, NULL,
+     "Context manager for the write hold.", (void *)FIL_RW_MODE_WRITE},
+    {"upgradable", (getter)_rwlock_guard, NULL,
+     "Context manager for the upgradable hold.  If upgrade() is called\n"
+     "inside it, leaving releases the write hold instead.",
+     (void *)FIL_RW_MODE_UPGRADABLE},
+    { NULL },
+};
+
+PyDoc_STRVAR(_rwlock_doc,
+"RWLock()\n\n"
+"Reader-writer lock with an upgradable-read mode.  Writer-preferring, but\n"
+"readers queued behind a writer go before the next one.  Usable from\n"
+"greenthreads and native OS threads alike.\n\n"
+"    with rw.reader: ...\n"
+"    with rw.writer: ...\n"
+"    with rw.upgradable:\n"
+"        if needs_change():\n"
+"            rw.upgrade()\n"
+"            change()");
+
+static PyTypeObject _rwlock_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament.locking.RWLock",                 /* tp_name */
+    sizeof(PyFilRWLock),                        /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_rwlock_dealloc,                /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS,                        /* tp_flags */
+    _rwlock_doc,                                /* tp_doc */
+    0,                                          /* tp_traverse */
+    0,                                          /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    _rwlock_methods,                            /* tp_methods */
+    0,                                          /* tp_members */
+    _rwlock_getset,                             /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    (initproc)_rwlock_init,                     /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_rwlock_new,                       /* tp_new */
+    PyObject_Del,                               /* tp_free */
+};
+
+
+/**************** Guard ****************/
+
+static void _rwlock_guard_dealloc(PyFilRWLockGuard *self)
+{
+    Py_DECREF(self->rwlock);
+    PyObject_Del(self);
+}
+
+static PyObject *_rwlock_guard_enter(PyFilRWLockGuard *self)
+{
+    static const fil_rwlock_acquire_fn fns[] = {
+        __rwlock_acquire_read,
+        __rwlock_acquire_write,
+        __rwlock_acquire_upgradable,
+    };
+    int err = fns[self->mode](self->rwlock, 1, NULL);
+
+    if (err)
+    {
+        if (!PyErr_Occurred())
+        {
+            PyErr_Format(PyExc_RuntimeError, "unexpected failure in RWLock guard __enter__: %d", err);
+        }
+        return NULL;
+    }
+    fil_preempt_lock_held(1);
+
+    Py_INCREF(self->rwlock);
+    return (PyObject *)self->rwlock;
+}
+
+static PyObject *_rwlock_guard_exit(PyFilRWLockGuard *self, PyObject *args)
+{
+    PyFilRWLock *rw = self->rwlock;
+    int err;
+
+    switch (self->mode)
+    {
+        case FIL_RW_MODE_READ:
+            err = __rwlock_release_read(rw);
+            break;
+        case FIL_RW_MODE_WRITE:
+            err = __rwlock_release_write(rw);
+            break;
+        default:
+            /* upgrade() inside the block leaves us holding the write lock,
+             * whose release ends the upgradable hold as well. */
+            err = rw->writer ? __rwlock_release_write(rw) :
+                               __rwlock_release_upgradable(rw);
+            break;
+    }
+
+    if (err < 0)
+    {
+        return NULL;
+    }
+    fil_preempt_lock_held(-1);
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _rwlock_guard_methods[] = {
+    { "__enter__", (PyCFunction)_rwlock_guard_enter, METH_NOARGS, NULL },
+    { "__exit__", (PyCFunction)_rwlock_guard_exit, METH_VARARGS, NULL },
+    { NULL, NULL }
+};
+
+static PyTypeObject _rwlock_guard_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "_filament.locking._RWLockGuard",           /* tp_name */
+    sizeof(PyFilRWLockGuard),                   /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_rwlock_guard_dealloc,          /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    0,                                          /* tp_as_number */
+    0,                                          /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    Py_TPFLAGS_DEFAULT,                         /* tp_flags */
+    0,                                          /* tp_doc */
+    0,                                          /* tp_traverse */
+    0,                                          /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    0,                                          /* tp_iter */
+    0,                                          /* tp_iternext */
+    _rwlock_guard_methods,                      /* tp_methods */
+};
+
+
+/****************/
+
+int fil_rwlock_type_init(PyObject *module)
+{
+    PyFilCore_Import();
+
+    if (PyType_Ready(&_rwlock_type) < 0 ||
+        PyType_Ready(&_rwlock_guard_type) < 0)
+    {
+        return -1;
+    }
+
+    Py_INCREF((PyObject *)&_rwlock_type);
+    if (PyModule_AddObject(module, "RWLock", (PyObject *)&_rwlock_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_rwlock_type);
+        return -1;
+    }
+
+    return 0;
+}
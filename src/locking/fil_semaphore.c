@@ -24,6 +24,7 @@
  */
 
 #define __FIL_BUILDING_LOCKING__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_LOCK
 #include "core/filament.h"
 #include "locking/fil_semaphore.h"
 
@@ -58,6 +59,7 @@ typedef struct _pyfil_semaphore {
     pthread_mutex_t mutex;
 #endif
     FilWaiterList waiters;
+    FilLockProf *prof;
 } PyFilSemaphore;
 
 static PyFilSemaphore *_semaphore_new(PyTypeObject *type, PyObject *args, PyObject *kw)
@@ -71,6 +73,11 @@ static PyFilSemaphore *_semaphore_new(PyTypeObject *type, PyObject *args, PyObje
 #ifdef Py_GIL_DISABLED
         pthread_mutex_init(&(self->mutex), NULL);
 #endif
+        if (fil_lockprof_attach(&(self->prof), "Semaphore") < 0)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
     }
 
     return self;
@@ -82,6 +89,7 @@ static void _semaphore_dealloc(PyFilSemaphore *self)
 #ifdef Py_GIL_DISABLED
     pthread_mutex_destroy(&(self->mutex));
 #endif
+    fil_lockprof_detach(&(self->prof));
 
     /* Respect tp_free: Python subclass instances are GC-allocated, and
      * PyObject_Del on them frees the wrong pointer (heap corruption). */
@@ -130,6 +138,10 @@ static int __semaphore_acquire(PyFilSemaphore *sema, int blocking, struct timesp
     {
         sema->counter--;
         FIL_SEMA_UNLOCK(sema);
+        if (sema->prof != NULL)
+        {
+            fil_lockprof_acquired(sema->prof);
+        }
         return 0;
     }
 
@@ -142,7 +154,12 @@ static int __semaphore_acquire(PyFilSemaphore *sema, int blocking, struct timesp
     /* Preserve the error code (-ETIMEDOUT vs other) so acquire() can report
      * a timeout by returning False like Lock/RLock do.
      */
+    uint64_t start = sema->prof != NULL ? fil_lockprof_wait_begin(sema->prof) : 0;
     int err = FIL_SEMA_WAIT(sema, sema->waiters, ts, NULL);
+    if (sema->prof != NULL)
+    {
+        fil_lockprof_wait_end(sema->prof, start, err == 0);
+    }
     if (err < 0)
     {
         FIL_SEMA_UNLOCK(sema);
@@ -0,0 +1,573 @@
+/*
+ * The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+ *
+ * Copyright (c) 2019, Chris Behrens
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ *
+ */
+
+/*
+ * PriorityQueue and LifoQueue: the same interface and task accounting as
+ * Queue (fil_queue.c) over a FilWHeapQ instead of a FilWFifoQ.  Two types
+ * sharing one set of methods; only tp_new differs.
+ */
+
+#define __FIL_BUILDING_QUEUE__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_QUEUE
+#include "queue/fil_queue.h"
+
+PyTypeObject *_FIL_PRIORITY_QUEUE_TYPE = NULL;
+PyTypeObject *_FIL_LIFO_QUEUE_TYPE = NULL;
+
+static PyFilHeapQueue *_heap_queue_new_common(PyTypeObject *type, PyObject *args, PyObject *kwargs,
+                                              int lifo, const char *fmt, const char *kind)
+{
+    PyFilHeapQueue *self;
+
+    static char *keywords[] = {"maxsize", NULL};
+    PyObject *maxsize_obj = NULL;
+    long maxsize = 0;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, fmt,
+                                     keywords,
+                                     &maxsize_obj))
+    {
+        return NULL;
+    }
+
+    /* None, 0, and negatives all mean "unbounded", as for Queue. */
+    if (maxsize_obj != NULL && maxsize_obj != Py_None)
+    {
+        maxsize = PyInt_AsLong(maxsize_obj);
+        if (maxsize == -1 && PyErr_Occurred())
+        {
+            return NULL;
+        }
+    }
+
+    if ((self = (PyFilHeapQueue *)type->tp_alloc(type, 0)) != NULL)
+    {
+        if (maxsize < 0)
+        {
+            maxsize = 0;
+        }
+
+        if (fil_wheapq_init(&(self->queue), maxsize, lifo, _FIL_QUEUE_EMPTY_ERROR, _FIL_QUEUE_FULL_ERROR))
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
+        if (fil_lockprof_attach(&(self->queue.prof), kind) < 0)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
+
+        fil_waiterlist_init(self->task_done_waiters);
+    }
+
+    return self;
+}
+
+static PyFilHeapQueue *_priority_queue_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    return _heap_queue_new_common(type, args, kwargs, 0, "|O:PriorityQueue", "PriorityQueue");
+}
+
+static PyFilHeapQueue *_lifo_queue_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
+{
+    return _heap_queue_new_common(type, args, kwargs, 1, "|O:LifoQueue", "LifoQueue");
+}
+
+static int _heap_queue_init(PyFilHeapQueue *self, PyObject *args, PyObject *kwargs)
+{
+    return 0;
+}
+
+/* GC support; see _queue_traverse() in fil_queue.c. */
+static int _heap_queue_traverse(PyFilHeapQueue *self, visitproc visit, void *arg)
+{
+    return fil_wheapq_traverse(&(self->queue), visit, arg);
+}
+
+static int _heap_queue_clear(PyFilHeapQueue *self)
+{
+    fil_wheapq_clear_items(&(self->queue));
+    return 0;
+}
+
+static void _heap_queue_dealloc(PyFilHeapQueue *self)
+{
+    PyObject_GC_UnTrack(self);
+    fil_wheapq_deinit(&(self->queue));
+    Py_TYPE(self)->tp_free((PyObject *)self);
+}
+
+PyDoc_STRVAR(_heap_queue_qsize_doc, "Length of queue.");
+static PyObject *_heap_queue_qsize(PyFilHeapQueue *self, PyObject *args)
+{
+    return PyInt_FromLong(fil_wheapq_len(&(self->queue)));
+}
+
+PyDoc_STRVAR(_heap_queue_empty_doc, "Is the queue empty?");
+static PyObject *_heap_queue_empty(PyFilHeapQueue *self, PyObject *args)
+{
+    PyObject *res = fil_wheapq_empty(&(self->queue)) ? Py_True : Py_False;
+    Py_INCREF(res);
+    return res;
+}
+
+PyDoc_STRVAR(_heap_queue_full_doc, "Is the queue full?");
+static PyObject *_heap_queue_full(PyFilHeapQueue *self, PyObject *args)
+{
+    PyObject *res = fil_wheapq_full(&(self->queue)) ? Py_True : Py_False;
+    Py_INCREF(res);
+    return res;
+}
+
+PyDoc_STRVAR(_heap_queue_get_nowait_doc, "Get from queue without blocking.");
+static PyObject *_heap_queue_get_nowait(PyFilHeapQueue *self)
+{
+    return fil_wheapq_get(&(self->queue), 0, NULL);
+}
+
+PyDoc_STRVAR(_heap_queue_get_doc, "Get from queue.");
+static PyObject *_heap_queue_get_common(PyFilHeapQueue *self, PyObject *block, PyObject *timeout)
+{
+    struct timespec tsbuf, *ts;
+    int blocking;
+
+    if (_fil_queue_block_args(block, timeout, &blocking, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    return fil_wheapq_get(&(self->queue), blocking, ts);
+}
+
+#ifdef _FIL_PYTHON3
+static PyObject *_heap_queue_get(PyFilHeapQueue *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char * const keywords[] = {"block", "timeout"};
+    PyObject *argv[2];
+
+    if (fil_fastcall_parse(args, nargs, kwnames, "get",
+                           0, 2, keywords, argv) < 0)
+    {
+        return NULL;
+    }
+
+    return _heap_queue_get_common(self, argv[0], argv[1]);
+}
+#else
+static PyObject *_heap_queue_get(PyFilHeapQueue *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"block", "timeout", NULL};
+    PyObject *block = NULL, *timeout = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|OO",
+                                     keywords,
+                                     &block,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    return _heap_queue_get_common(self, block, timeout);
+}
+#endif
+
+/* Tasks are counted before the item can be seen and rolled back if it never
+ * went in; see the comments above _queue_uncount_tasks() in fil_queue.c. */
+static void _heap_queue_uncount_task(PyFilHeapQueue *self)
+{
+    FIL_WHEAPQ_LOCK(&(self->queue));
+    if (--self->unfinished_tasks == 0 &&
+        !fil_waiterlist_empty(self->task_done_waiters))
+    {
+        PyObject *exc_type, *exc_value, *exc_tb;
+
+        PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+        fil_waiterlist_signal_all(self->task_done_waiters);
+        PyErr_Restore(exc_type, exc_value, exc_tb);
+    }
+    FIL_WHEAPQ_UNLOCK(&(self->queue));
+}
+
+static PyObject *_heap_queue_put_counted(PyFilHeapQueue *self, PyObject *item, int blocking,
+                                         struct timespec *ts)
+{
+    PyObject *res;
+
+    FIL_WHEAPQ_LOCK(&(self->queue));
+    self->unfinished_tasks++;
+    FIL_WHEAPQ_UNLOCK(&(self->queue));
+
+    res = fil_wheapq_put(&(self->queue), item, blocking, ts);
+    if (res == NULL)
+    {
+        _heap_queue_uncount_task(self);
+    }
+    return res;
+}
+
+PyDoc_STRVAR(_heap_queue_put_nowait_doc, "Put into queue.");
+static PyObject *_heap_queue_put_nowait(PyFilHeapQueue *self, PyObject *item)
+{
+    return _heap_queue_put_counted(self, item, 0, NULL);
+}
+
+PyDoc_STRVAR(_heap_queue_put_doc, "Put into queue.");
+static PyObject *_heap_queue_put_common(PyFilHeapQueue *self, PyObject *item, PyObject *block, PyObject *timeout)
+{
+    struct timespec tsbuf, *ts;
+    int blocking;
+
+    if (_fil_queue_block_args(block, timeout, &blocking, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    return _heap_queue_put_counted(self, item, blocking, ts);
+}
+
+#ifdef _FIL_PYTHON3
+static PyObject *_heap_queue_put(PyFilHeapQueue *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
+{
+    static const char * const keywords[] = {"item", "block", "timeout"};
+    PyObject *argv[3];
+
+    if (fil_fastcall_parse(args, nargs, kwnames, "put",
+                           1, 3, keywords, argv) < 0)
+    {
+        return NULL;
+    }
+
+    return _heap_queue_put_common(self, argv[0], argv[1], argv[2]);
+}
+#else
+static PyObject *_heap_queue_put(PyFilHeapQueue *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"item", "block", "timeout", NULL};
+    PyObject *item, *block = NULL, *timeout = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO",
+                                     keywords,
+                                     &item,
+                                     &block,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    return _heap_queue_put_common(self, item, block, timeout);
+}
+#endif
+
+PyDoc_STRVAR(_heap_queue_task_done_doc,
+"Indicate that a formerly enqueued task is complete.\n\
+\n\
+See Queue.task_done().\n");
+static PyObject *_heap_queue_task_done(PyFilHeapQueue *self)
+{
+    FIL_WHEAPQ_LOCK(&(self->queue));
+
+    if (self->unfinished_tasks == 0)
+    {
+        FIL_WHEAPQ_UNLOCK(&(self->queue));
+        PyErr_SetString(PyExc_ValueError, "task_done() called too many times");
+        return NULL;
+    }
+
+    self->unfinished_tasks--;
+    fil_waiterlist_signal_all(self->task_done_waiters);
+    FIL_WHEAPQ_UNLOCK(&(self->queue));
+
+    Py_RETURN_NONE;
+}
+
+PyDoc_STRVAR(_heap_queue_join_doc,
+"Blocks until all items in the queue have been gotten and processed.\n\
+\n\
+See Queue.join(), including the 'timeout' extension: returns True once\n\
+every task is done, False if the timeout expires first.\n");
+static PyObject *_heap_queue_join(PyFilHeapQueue *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"timeout", NULL};
+    PyObject *timeout = NULL;
+    struct timespec tsbuf, *ts = NULL;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|O",
+                                     keywords,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    if (fil_timespec_from_pyobj_interval(timeout, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    FIL_WHEAPQ_LOCK(&(self->queue));
+
+    while (self->unfinished_tasks)
+    {
+        /* Full error only tells a timeout apart from anything else. */
+        if (FIL_WHEAPQ_WAIT(&(self->queue), self->task_done_waiters, ts,
+                            _FIL_QUEUE_FULL_ERROR))
+        {
+            PyObject *exc_type, *exc_value, *exc_tb;
+
+            FIL_WHEAPQ_UNLOCK(&(self->queue));
+
+            PyErr_Fetch(&exc_type, &exc_value, &exc_tb);
+            if (!PyErr_GivenExceptionMatches(exc_type, _FIL_QUEUE_FULL_ERROR))
+            {
+                PyErr_Restore(exc_type, exc_value, exc_tb);
+                return NULL;
+            }
+
+            Py_DECREF(exc_type);
+            Py_XDECREF(exc_value);
+            Py_XDECREF(exc_tb);
+
+            Py_RETURN_FALSE;
+        }
+    }
+
+    FIL_WHEAPQ_UNLOCK(&(self->queue));
+    Py_RETURN_TRUE;
+}
+
+static PyMethodDef _heap_queue_methods[] = {
+#ifdef _FIL_PYTHON3
+    { "get", (PyCFunction)(void (*)(void))_heap_queue_get, METH_FASTCALL|METH_KEYWORDS, _heap_queue_get_doc },
+#else
+    { "get", (PyCFunction)_heap_queue_get, METH_VARARGS|METH_KEYWORDS, _heap_queue_get_doc },
+#endif
+    { "get_nowait", (PyCFunction)_heap_queue_get_nowait, METH_NOARGS, _heap_queue_get_nowait_doc },
+#ifdef _FIL_PYTHON3
+    { "put", (PyCFunction)(void (*)(void))_heap_queue_put, METH_FASTCALL|METH_KEYWORDS, _heap_queue_put_doc },
+#else
+    { "put", (PyCFunction)_heap_queue_put, METH_VARARGS|METH_KEYWORDS, _heap_queue_put_doc },
+#endif
+    { "put_nowait", (PyCFunction)_heap_queue_put_nowait, METH_O, _heap_queue_put_nowait_doc },
+    { "qsize", (PyCFunction)_heap_queue_qsize, METH_NOARGS, _heap_queue_qsize_doc },
+    { "empty", (PyCFunction)_heap_queue_empty, METH_NOARGS, _heap_queue_empty_doc },
+    { "full", (PyCFunction)_heap_queue_full, METH_NOARGS, _heap_queue_full_doc },
+    { "task_done", (PyCFunction)_heap_queue_task_done, METH_NOARGS, _heap_queue_task_done_doc },
+    { "join", (PyCFunction)_heap_queue_join, METH_VARARGS|METH_KEYWORDS, _heap_queue_join_doc },
+    { NULL, NULL }
+};
+
+static Py_ssize_t _heap_queue_len(PyFilHeapQueue *self)
+{
+    return fil_wheapq_len(&(self->queue));
+}
+
+static PySequenceMethods _heap_queue_as_sequence = {
+    (lenfunc)_heap_queue_len,                   /* sq_length */
+    0,                                          /*sq_concat*/
+    0,                                          /*sq_repeat*/
+    0,                                          /*sq_item*/
+    0,                                          /*sq_slice*/
+    0,                                          /*sq_ass_item*/
+    0,                                          /*sq_ass_slice*/
+};
+
+/* Unconditionally truthy, as Queue is (gevent parity). */
+static int _heap_queue_bool(PyFilHeapQueue *self)
+{
+    return 1;
+}
+
+static PyNumberMethods _heap_queue_as_number = {
+#ifdef _FIL_PYTHON3
+    .nb_bool = (inquiry)_heap_queue_bool,
+#else
+    .nb_nonzero = (inquiry)_heap_queue_bool,
+#endif
+};
+
+/* ``for item in q`` blocks on get() and ends on the StopIteration class. */
+static PyObject *_heap_queue_iternext(PyFilHeapQueue *self)
+{
+    PyObject *item = fil_wheapq_get(&(self->queue), 1, NULL);
+
+    if (item == NULL)
+    {
+        return NULL;
+    }
+
+    if (item == PyExc_StopIteration)
+    {
+        Py_DECREF(item);
+        return NULL;
+    }
+
+    return item;
+}
+
+PyDoc_STRVAR(_priority_queue_doc,
+"PriorityQueue(maxsize=None)\n\
+\n\
+A Queue that hands out the lowest item first (by <, as heapq does).\n\
+Item comparisons must not use the queue itself.\n");
+static PyTypeObject _priority_queue_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "filament.queue.PriorityQueue",             /* tp_name */
+    sizeof(PyFilHeapQueue),                     /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_heap_queue_dealloc,            /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    &_heap_queue_as_number,                     /* tp_as_number */
+    &_heap_queue_as_sequence,                   /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS|Py_TPFLAGS_HAVE_GC,     /* tp_flags */
+    _priority_queue_doc,                        /* tp_doc */
+    (traverseproc)_heap_queue_traverse,         /* tp_traverse */
+    (inquiry)_heap_queue_clear,                 /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    PyObject_SelfIter,                          /* tp_iter */
+    (iternextfunc)_heap_queue_iternext,         /* tp_iternext */
+    _heap_queue_methods,                        /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    (initproc)_heap_queue_init,                 /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_priority_queue_new,               /* tp_new */
+    PyObject_GC_Del,                            /* tp_free */
+    0,                                          /* tp_is_gc */
+    0,                                          /* tp_bases */
+    0,                                          /* tp_mro */
+    0,                                          /* tp_cache */
+    0,                                          /* tp_subclasses */
+    0,                                          /* tp_weaklist */
+    0,                                          /* tp_del */
+    0,                                          /* tp_version_tag */
+};
+
+PyDoc_STRVAR(_lifo_queue_doc,
+"LifoQueue(maxsize=None)\n\
+\n\
+A Queue that hands out the most recently put item first.\n");
+static PyTypeObject _lifo_queue_type = {
+    PyVarObject_HEAD_INIT(0, 0)
+    "filament.queue.LifoQueue",                 /* tp_name */
+    sizeof(PyFilHeapQueue),                     /* tp_basicsize */
+    0,                                          /* tp_itemsize */
+    (destructor)_heap_queue_dealloc,            /* tp_dealloc */
+    0,                                          /* tp_print */
+    0,                                          /* tp_getattr */
+    0,                                          /* tp_setattr */
+    0,                                          /* tp_compare */
+    0,                                          /* tp_repr */
+    &_heap_queue_as_number,                     /* tp_as_number */
+    &_heap_queue_as_sequence,                   /* tp_as_sequence */
+    0,                                          /* tp_as_mapping */
+    0,                                          /* tp_hash */
+    0,                                          /* tp_call */
+    0,                                          /* tp_str */
+    PyObject_GenericGetAttr,                    /* tp_getattro */
+    0,                                          /* tp_setattro */
+    0,                                          /* tp_as_buffer */
+    FIL_DEFAULT_TPFLAGS|Py_TPFLAGS_HAVE_GC,     /* tp_flags */
+    _lifo_queue_doc,                            /* tp_doc */
+    (traverseproc)_heap_queue_traverse,         /* tp_traverse */
+    (inquiry)_heap_queue_clear,                 /* tp_clear */
+    0,                                          /* tp_richcompare */
+    0,                                          /* tp_weaklistoffset */
+    PyObject_SelfIter,                          /* tp_iter */
+    (iternextfunc)_heap_queue_iternext,         /* tp_iternext */
+    _heap_queue_methods,                        /* tp_methods */
+    0,                                          /* tp_members */
+    0,                                          /* tp_getset */
+    0,                                          /* tp_base */
+    0,                                          /* tp_dict */
+    0,                                          /* tp_descr_get */
+    0,                                          /* tp_descr_set */
+    0,                                          /* tp_dictoffset */
+    (initproc)_heap_queue_init,                 /* tp_init */
+    PyType_GenericAlloc,                        /* tp_alloc */
+    (newfunc)_lifo_queue_new,                   /* tp_new */
+    PyObject_GC_Del,                            /* tp_free */
+    0,                                          /* tp_is_gc */
+    0,                                          /* tp_bases */
+    0,                                          /* tp_mro */
+    0,                                          /* tp_cache */
+    0,                                          /* tp_subclasses */
+    0,                                          /* tp_weaklist */
+    0,                                          /* tp_del */
+    0,                                          /* tp_version_tag */
+};
+
+/****************/
+
+int fil_heapqueue_init(PyObject *m)
+{
+    if (PyFilCore_Import() < 0)
+    {
+        return -1;
+    }
+
+    if (PyType_Ready(&_priority_queue_type) < 0 ||
+        PyType_Ready(&_lifo_queue_type) < 0)
+    {
+        return -1;
+    }
+
+    _FIL_PRIORITY_QUEUE_TYPE = &_priority_queue_type;
+    _FIL_LIFO_QUEUE_TYPE = &_lifo_queue_type;
+
+    Py_INCREF((PyObject *)&_priority_queue_type);
+    if (PyModule_AddObject(m, "PriorityQueue",
+                           (PyObject *)&_priority_queue_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_priority_queue_type);
+        return -1;
+    }
+
+    Py_INCREF((PyObject *)&_lifo_queue_type);
+    if (PyModule_AddObject(m, "LifoQueue",
+                           (PyObject *)&_lifo_queue_type) != 0)
+    {
+        Py_DECREF((PyObject *)&_lifo_queue_type);
+        return -1;
+    }
+
+    return 0;
+}
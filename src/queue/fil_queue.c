@@ -24,6 +24,7 @@
  */
 
 #define __FIL_BUILDING_QUEUE__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_QUEUE
 #include "queue/fil_queue.h"
 
 PyTypeObject *_FIL_QUEUE_TYPE = NULL;
@@ -67,6 +68,11 @@ static PyFilQueue *_queue_new(PyTypeObject *type, PyObject *args, PyObject *kwar
             Py_DECREF(self);
             return NULL;
         }
+        if (fil_lockprof_attach(&(self->queue.prof), "Queue") < 0)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
 
         fil_waiterlist_init(self->task_done_waiters);
     }
@@ -222,7 +228,7 @@ static PyObject *_queue_get(PyFilQueue *self, PyObject *args, PyObject *kwargs)
  */
 
 /*
- * Roll back the pre-counted task for a put that never enqueued.
+ * Roll back the pre-counted tasks for puts that never enqueued.
  *
  * If the rollback is what brings the count to zero, task_done_waiters must be
  * woken here: no task_done() is coming for a count that is already zero, so a
@@ -235,10 +241,10 @@ static PyObject *_queue_get(PyFilQueue *self, PyObject *args, PyObject *kwargs)
  * hold the caller's exception out of the way.  Cold path -- only runs when a
  * put fails -- so sharing it costs nothing.
  */
-static void _queue_uncount_task(PyFilQueue *self)
+static void _queue_uncount_tasks(PyFilQueue *self, uint64_t n)
 {
     FIL_WFIFOQ_LOCK(&(self->queue));
-    if (--self->unfinished_tasks == 0 &&
+    if ((self->unfinished_tasks -= n) == 0 &&
         !fil_waiterlist_empty(self->task_done_waiters))
     {
         PyObject *exc_type, *exc_value, *exc_tb;
@@ -262,7 +268,7 @@ static PyObject *_queue_put_nowait(PyFilQueue *self, PyObject *item)
     res = fil_wfifoq_put_nowait(&(self->queue), item);
     if (res == NULL)
     {
-        _queue_uncount_task(self);
+        _queue_uncount_tasks(self, 1);
     }
     return res;
 }
@@ -301,7 +307,7 @@ static PyObject *_queue_put_common(PyFilQueue *self, PyObject *item, PyObject *b
         res = fil_wfifoq_put_nowait(&(self->queue), item);
         if (res == NULL)
         {
-            _queue_uncount_task(self);
+            _queue_uncount_tasks(self, 1);
         }
         return res;
     }
@@ -318,11 +324,101 @@ static PyObject *_queue_put_common(PyFilQueue *self, PyObject *item, PyObject *b
     res = fil_wfifoq_put(&(self->queue), item, ts);
     if (res == NULL)
     {
-        _queue_uncount_task(self);
+        _queue_uncount_tasks(self, 1);
     }
     return res;
 }
 
+PyDoc_STRVAR(_queue_put_many_doc,
+"put_many(items, block=True, timeout=None) -> int\n\
+\n\
+Put every item of the iterable 'items', in order, under one lock hold per\n\
+run of free slots, waking one getter per item at most.  Returns how many\n\
+went in: all of them unless block is false or the timeout expires first,\n\
+in which case the rest were not put.  Raises Full only if none went in.\n\
+Each item put counts toward join() like a put().\n");
+static PyObject *_queue_put_many(PyFilQueue *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"items", "block", "timeout", NULL};
+    PyObject *items, *block = NULL, *timeout = NULL;
+    struct timespec tsbuf, *ts;
+    Py_ssize_t done, n;
+    int blocking;
+    int err;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO:put_many",
+                                     keywords,
+                                     &items,
+                                     &block,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    if (_fil_queue_block_args(block, timeout, &blocking, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    /* A snapshot: a list could change under us while we wait for room. */
+    items = PySequence_Tuple(items);
+    if (items == NULL)
+    {
+        return NULL;
+    }
+    n = PyTuple_GET_SIZE(items);
+
+    /* Counted up front for the same reason as put(); see above. */
+    FIL_WFIFOQ_LOCK(&(self->queue));
+    self->unfinished_tasks += n;
+    FIL_WFIFOQ_UNLOCK(&(self->queue));
+
+    err = fil_wfifoq_put_many(&(self->queue), PySequence_Fast_ITEMS(items), n,
+                              blocking, ts, &done);
+    Py_DECREF(items);
+    if (done < n)
+    {
+        _queue_uncount_tasks(self, n - done);
+    }
+    if (err)
+    {
+        return NULL;
+    }
+    return PyInt_FromSsize_t(done);
+}
+
+PyDoc_STRVAR(_queue_get_many_doc,
+"get_many(max_items, block=True, timeout=None) -> list\n\
+\n\
+Wait like get() for the queue to be non-empty, then take up to max_items\n\
+items at once, waking one putter per item at most.  Raises Empty if\n\
+nothing arrived.\n");
+static PyObject *_queue_get_many(PyFilQueue *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"max_items", "block", "timeout", NULL};
+    PyObject *max_obj, *block = NULL, *timeout = NULL;
+    struct timespec tsbuf, *ts;
+    Py_ssize_t max_items;
+    int blocking;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO:get_many",
+                                     keywords,
+                                     &max_obj,
+                                     &block,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    if (_fil_queue_max_items(max_obj, &max_items) < 0 ||
+        _fil_queue_block_args(block, timeout, &blocking, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    return fil_wfifoq_get_many(&(self->queue), max_items, blocking, ts);
+}
+
 #ifdef _FIL_PYTHON3
 static PyObject *_queue_put(PyFilQueue *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
 {
@@ -471,6 +567,8 @@ static PyMethodDef _queue_methods[] = {
     { "put", (PyCFunction)_queue_put, METH_VARARGS|METH_KEYWORDS, _queue_put_doc },
 #endif
     { "put_nowait", (PyCFunction)_queue_put_nowait, METH_O, _queue_put_nowait_doc },
+    { "put_many", (PyCFunction)_queue_put_many, METH_VARARGS|METH_KEYWORDS, _queue_put_many_doc },
+    { "get_many", (PyCFunction)_queue_get_many, METH_VARARGS|METH_KEYWORDS, _queue_get_many_doc },
     { "qsize", (PyCFunction)_queue_qsize, METH_NOARGS, _queue_qsize_doc },
     { "empty", (PyCFunction)_queue_empty, METH_NOARGS, _queue_empty_doc },
     { "full", (PyCFunction)_queue_full, METH_NOARGS, _queue_full_doc },
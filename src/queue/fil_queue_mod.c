@@ -99,6 +99,11 @@ _FIL_MODULE_INIT_FN_NAME(queue)
         return _FIL_MODULE_INIT_ERROR;
     }
 
+    if (fil_heapqueue_init(m))
+    {
+        return _FIL_MODULE_INIT_ERROR;
+    }
+
     return _FIL_MODULE_INIT_SUCCESS(m);
 
 failure:
@@ -24,6 +24,7 @@
  */
 
 #define __FIL_BUILDING_QUEUE__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_QUEUE
 #include "queue/fil_queue.h"
 
 PyTypeObject *_FIL_SIMPLE_QUEUE_TYPE = NULL;
@@ -46,6 +47,11 @@ static PyFilSimpleQueue *_queue_new(PyTypeObject *type, PyObject *args, PyObject
             Py_DECREF(self);
             return NULL;
         }
+        if (fil_lockprof_attach(&(self->queue.prof), "SimpleQueue") < 0)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
     }
 
     return self;
@@ -203,6 +209,81 @@ static PyObject *_queue_put_common(PyFilSimpleQueue *self, PyObject *item, PyObj
     return fil_wfifoq_put(&(self->queue), item, ts);
 }
 
+PyDoc_STRVAR(_queue_put_many_doc,
+"put_many(items, block=True, timeout=None) -> int\n\
+\n\
+Put every item of the iterable 'items', in order, under one lock hold,\n\
+waking one getter per item at most.  Returns how many went in.\n");
+static PyObject *_queue_put_many(PyFilSimpleQueue *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"items", "block", "timeout", NULL};
+    PyObject *items, *block = NULL, *timeout = NULL;
+    struct timespec tsbuf, *ts;
+    Py_ssize_t done;
+    int blocking;
+    int err;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO:put_many",
+                                     keywords,
+                                     &items,
+                                     &block,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    /* Unbounded, so block/timeout never matter; accepted for Queue parity. */
+    if (_fil_queue_block_args(block, timeout, &blocking, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    items = PySequence_Tuple(items);
+    if (items == NULL)
+    {
+        return NULL;
+    }
+    err = fil_wfifoq_put_many(&(self->queue), PySequence_Fast_ITEMS(items),
+                              PyTuple_GET_SIZE(items), blocking, ts, &done);
+    Py_DECREF(items);
+    if (err)
+    {
+        return NULL;
+    }
+    return PyInt_FromSsize_t(done);
+}
+
+PyDoc_STRVAR(_queue_get_many_doc,
+"get_many(max_items, block=True, timeout=None) -> list\n\
+\n\
+Wait like get() for the queue to be non-empty, then take up to max_items\n\
+items at once.  Raises Empty if nothing arrived.\n");
+static PyObject *_queue_get_many(PyFilSimpleQueue *self, PyObject *args, PyObject *kwargs)
+{
+    static char *keywords[] = {"max_items", "block", "timeout", NULL};
+    PyObject *max_obj, *block = NULL, *timeout = NULL;
+    struct timespec tsbuf, *ts;
+    Py_ssize_t max_items;
+    int blocking;
+
+    if (!PyArg_ParseTupleAndKeywords(args, kwargs, "O|OO:get_many",
+                                     keywords,
+                                     &max_obj,
+                                     &block,
+                                     &timeout))
+    {
+        return NULL;
+    }
+
+    if (_fil_queue_max_items(max_obj, &max_items) < 0 ||
+        _fil_queue_block_args(block, timeout, &blocking, &tsbuf, &ts) < 0)
+    {
+        return NULL;
+    }
+
+    return fil_wfifoq_get_many(&(self->queue), max_items, blocking, ts);
+}
+
 #ifdef _FIL_PYTHON3
 static PyObject *_queue_put(PyFilSimpleQueue *self, PyObject *const *args, Py_ssize_t nargs, PyObject *kwnames)
 {
@@ -249,6 +330,8 @@ static PyMethodDef _queue_methods[] = {
     { "put", (PyCFunction)_queue_put, METH_VARARGS|METH_KEYWORDS, _queue_put_doc },
 #endif
     { "put_nowait", (PyCFunction)_queue_put_nowait, METH_O, _queue_put_nowait_doc },
+    { "put_many", (PyCFunction)_queue_put_many, METH_VARARGS|METH_KEYWORDS, _queue_put_many_doc },
+    { "get_many", (PyCFunction)_queue_get_many, METH_VARARGS|METH_KEYWORDS, _queue_get_many_doc },
     { "qsize", (PyCFunction)_queue_qsize, METH_NOARGS, _queue_qsize_doc },
     { "empty", (PyCFunction)_queue_empty, METH_NOARGS, _queue_empty_doc },
     { NULL, NULL }
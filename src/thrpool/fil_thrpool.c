@@ -24,6 +24,7 @@
  */
 
 #define __FIL_BUILDING_THRPOOL__
+#define FIL_WAIT_WHY FIL_TRACE_WHY_THRPOOL
 #include "core/filament.h"
 
 static PyObject *_EMPTY_TUPLE;
@@ -217,6 +218,151 @@ static void _thrpool_deinitthr_cb(PyFilThrState *thr_state)
     }
 }
 
+/* The text of a str argument; NULL if it is not one (or on error). */
+static const char *_thrpool_str_arg(PyObject *obj)
+{
+#ifdef _FIL_PYTHON3
+    return PyUnicode_Check(obj) ? PyUnicode_AsUTF8(obj) : NULL;
+#else
+    return PyString_Check(obj) ? PyString_AS_STRING(obj) : NULL;
+#endif
+}
+
+/*
+ * ThreadPool(cpus=, placement=, sched_batch=, nice=) -> FilAffinity.
+ *
+ * cpus is None (no restriction), "numa" (the NUMA node of the thread creating
+ * the pool), a kernel-style CPU list string ("0-3,8"), or an iterable of CPU
+ * numbers.  placement is "shared" (the default once cpus is given), "compact"
+ * or "spread"; giving only a placement spreads over the process's own mask.
+ * The set is checked against the process's mask when the pool is created,
+ * not here.
+ */
+static int _thrpool_parse_affinity(FilAffinity *aff, PyObject *cpus, PyObject *placement,
+                                   int sched_batch, PyObject *nice)
+{
+    fil_affinity_init(aff);
+
+    if (placement != NULL && placement != Py_None)
+    {
+        const char *str = _thrpool_str_arg(placement);
+
+        if (str == NULL)
+        {
+            if (!PyErr_Occurred())
+            {
+                PyErr_SetString(PyExc_TypeError, "placement must be a string");
+            }
+            return -1;
+        }
+        if (!strcmp(str, "shared"))
+        {
+            aff->placement = FIL_AFFINITY_PLACEMENT_SHARED;
+        }
+        else if (!strcmp(str, "compact"))
+        {
+            aff->placement = FIL_AFFINITY_PLACEMENT_COMPACT;
+        }
+        else if (!strcmp(str, "spread"))
+        {
+            aff->placement = FIL_AFFINITY_PLACEMENT_SPREAD;
+        }
+        else
+        {
+            PyErr_SetString(PyExc_ValueError,
+                            "placement must be 'shared', 'compact' or 'spread'");
+            return -1;
+        }
+    }
+
+    if (cpus != NULL && cpus != Py_None)
+    {
+#ifdef __linux__
+        const char *str = _thrpool_str_arg(cpus);
+
+        if (str == NULL && PyErr_Occurred())
+        {
+            return -1;
+        }
+        if (str != NULL)
+        {
+            if (!strcmp(str, "numa"))
+            {
+                aff->numa_local = 1;
+            }
+            else if (fil_affinity_parse_cpulist(str, &(aff->cpus)) < 0 ||
+                     CPU_COUNT(&(aff->cpus)) == 0)
+            {
+                PyErr_Format(PyExc_ValueError, "invalid CPU list: '%s'", str);
+                return -1;
+            }
+        }
+        else
+        {
+            PyObject *iter, *item;
+
+            if ((iter = PyObject_GetIter(cpus)) == NULL)
+            {
+                return -1;
+            }
+            while ((item = PyIter_Next(iter)) != NULL)
+            {
+                long cpu = PyInt_AsLong(item);
+
+                Py_DECREF(item);
+                if (cpu == -1 && PyErr_Occurred())
+                {
+                    Py_DECREF(iter);
+                    return -1;
+                }
+                if (cpu < 0 || cpu >= CPU_SETSIZE)
+                {
+                    Py_DECREF(iter);
+                    PyErr_Format(PyExc_ValueError, "invalid CPU number: %ld", cpu);
+                    return -1;
+                }
+                CPU_SET((int)cpu, &(aff->cpus));
+            }
+            Py_DECREF(iter);
+            if (PyErr_Occurred())
+            {
+                return -1;
+            }
+            if (CPU_COUNT(&(aff->cpus)) == 0)
+            {
+                PyErr_SetString(PyExc_ValueError, "cpus must not be empty");
+                return -1;
+            }
+        }
+#else
+        PyErr_SetString(PyExc_NotImplementedError,
+                        "thread placement is only supported on Linux");
+        return -1;
+#endif
+    }
+
+    aff->sched_batch = sched_batch ? 1 : 0;
+
+    if (nice != NULL && nice != Py_None)
+    {
+        long val = PyInt_AsLong(nice);
+
+        if (val == -1 && PyErr_Occurred())
+        {
+            return -1;
+        }
+        if (val < -20 || val > 19)
+        {
+            PyErr_SetString(PyExc_ValueError, "nice must be between -20 and 19");
+            return -1;
+        }
+        aff->set_nice = 1;
+        aff->nice = (int)val;
+    }
+
+    return 0;
+}
+
 static PyFilThrPool *_thrpool_new(PyTypeObject *type, PyObject *args, PyObject *kwargs)
 {
     PyFilThrPool *self = NULL;
@@ -224,18 +370,22 @@ static PyFilThrPool *_thrpool_new(PyTypeObject *type, PyObject *args, PyObject *
     self = (PyFilThrPool *)type->tp_alloc(type, 0);
     if (self != NULL)
     {
-        static char *keywords[] = {"min_threads", "max_threads", "stack_size", NULL};
+        static char *keywords[] = {"min_threads", "max_threads", "stack_size",
+                                   "cpus", "placement", "sched_batch", "nice", NULL};
 
         /* Before any error path can Py_DECREF(self): dealloc destroys it. */
         FIL_TPOBJ_INIT(self);
         _FIL_TPOOL_ENABLE_TRY_INCREF(self);
         int min_threads = FIL_THRPOOL_DEFAULT_MIN_THREADS, max_threads = FIL_THRPOOL_DEFAULT_MAX_THREADS;
         int stack_size = FIL_THRPOOL_DEFAULT_STACK_SIZE;
+        PyObject *cpus = NULL, *placement = NULL, *nice = NULL;
+        int sched_batch = 0;
         FilThrPoolOpt tpool_opt;
         FilThrPool *tpool;
 
-        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iii:ThreadPool", keywords,
-                    &min_threads, &max_threads, &stack_size))
+        if (!PyArg_ParseTupleAndKeywords(args, kwargs, "|iiiOOiO:ThreadPool", keywords,
+                    &min_threads, &max_threads, &stack_size,
+                    &cpus, &placement, &sched_batch, &nice))
         {
             Py_DECREF(self);
             return NULL;
@@ -270,6 +420,13 @@ static PyFilThrPool *_thrpool_new(PyTypeObject *type, PyObject *args, PyObject *
         tpool_opt.thr_init_cb_arg = self;
         tpool_opt.thr_deinit_cb = (FilThrPoolDeinitThrCallback)_thrpool_deinitthr_cb;
 
+        if (_thrpool_parse_affinity(&(tpool_opt.affinity), cpus, placement,
+                                    sched_batch, nice) < 0)
+        {
+            Py_DECREF(self);
+            return NULL;
+        }
+
         /* Drop the GIL for the create: if spawning the Nth worker fails,
          * fil_thrpool_create() shuts the pool back down and waits for the
          * workers it did start -- and each of those is sitting in its
@@ -288,6 +445,16 @@ static PyFilThrPool *_thrpool_new(PyTypeObject *type, PyObject *args, PyObject *
             {
                 PyErr_SetString(PyExc_MemoryError, "out of memory");
             }
+            else if (create_errno == EINVAL)
+            {
+                PyErr_SetString(PyExc_ValueError,
+                                "cpus leaves no CPU this process may run on");
+            }
+            else if (create_errno == ENOSYS)
+            {
+                PyErr_SetString(PyExc_NotImplementedError,
+                                "thread placement is only supported on Linux");
+            }
             else
             {
                 PyErr_Format(PyExc_RuntimeError, "Error creating thread pool: %d", create_errno);
@@ -953,7 +1120,38 @@ static PyObject *_thrpool_shutdown(PyFilThrPool *self, PyObject *args, PyObject
     Py_RETURN_NONE;
 }
 
+PyDoc_STRVAR(_thrpool_stats_doc,
+"stats() -> dict\n\
+\n\
+The pool's workers ('threads', 'min_threads', 'max_threads' and how many\n\
+are 'busy' in a callback), the callbacks 'queued' for a worker, and how many\n\
+have been 'submitted' and 'completed' since it was created.");
+static PyObject *_thrpool_stats(PyFilThrPool *self, PyObject *args)
+{
+    FilThrPoolStats stats;
+
+    FIL_TPOBJ_LOCK(self);
+    if (self->is_shutdown || self->tpool == NULL)
+    {
+        FIL_TPOBJ_UNLOCK(self);
+        PyErr_SetString(PyExc_RuntimeError, "thread pool is shut down");
+        return NULL;
+    }
+    fil_thrpool_stats(self->tpool, &stats);
+    FIL_TPOBJ_UNLOCK(self);
+
+    return Py_BuildValue("{sIsIsIsIsIsKsK}",
+                         "threads", stats.num_threads,
+                         "min_threads", stats.min_thr,
+                         "max_threads", stats.max_thr,
+                         "busy", stats.busy,
+                         "queued", stats.queued,
+                         "submitted", (unsigned long long)stats.submitted,
+                         "completed", (unsigned long long)stats.completed);
+}
+
 static PyMethodDef _thrpool_methods[] = {
+    { "stats", (PyCFunction)_thrpool_stats, METH_NOARGS, _thrpool_stats_doc },
     { "run", (PyCFunction)_thrpool_run, METH_VARARGS|METH_KEYWORDS, _thrpool_run_doc },
     { "shutdown", (PyCFunction)_thrpool_shutdown, METH_VARARGS|METH_KEYWORDS, _thrpool_shutdown_doc },
     { NULL, NULL }
@@ -1120,8 +1318,114 @@ static int _thrpool_register_atexit(void)
     return 0;
 }
 
+/*
+ * After os.fork(), in the child: no pool has a single worker left, so give
+ * each live one a new set (fil_thrpool_after_fork_child).  Module-level pools
+ * -- tpool's default, the DNS resolver -- keep working in a pre-forked child
+ * instead of queueing work nobody will ever run.
+ */
+static PyObject *_thrpool_after_fork_child(PyObject *self, PyObject *ignored)
+{
+    PyFilThrPool *pool;
+
+    (void)self;
+    (void)ignored;
+
+#ifdef Py_GIL_DISABLED
+    pthread_mutex_init(&_thrpool_registry_lock, NULL);
+#endif
+    for (pool = _thrpool_registry; pool != NULL; pool = pool->registry_next)
+    {
+        FIL_TPOBJ_INIT(pool);
+        if (pool->tpool != NULL && !pool->is_shutdown)
+        {
+            fil_thrpool_after_fork_child(pool->tpool);
+        }
+    }
+
+    Py_RETURN_NONE;
+}
+
+static PyMethodDef _thrpool_after_fork_child_def = {
+    "_fil_thrpool_after_fork_child", (PyCFunction)_thrpool_after_fork_child,
+    METH_NOARGS, NULL
+};
+
+PyDoc_STRVAR(_thrpool_pool_stats_doc,
+"pool_stats() -> list of (pool, stats)\n\n"
+"ThreadPool.stats() for every pool that has not been shut down.");
+static PyObject *_thrpool_pool_stats(PyObject *self, PyObject *ignored)
+{
+    PyFilThrPool *pool;
+    PyFilThrPool **pools;
+    Py_ssize_t n = 0, i, got = 0;
+    PyObject *result = NULL;
+
+    (void)self;
+    (void)ignored;
+
+    /* References taken under the registry lock (see _thrpool_atexit() for
+     * why that has to be a TryIncRef), stats() called after. */
+    FIL_TPREG_LOCK();
+    for (pool = _thrpool_registry; pool != NULL; pool = pool->registry_next)
+    {
+        n++;
+    }
+    pools = malloc(sizeof(*pools) * (n ? n : 1));
+    if (pools == NULL)
+    {
+        FIL_TPREG_UNLOCK();
+        return PyErr_NoMemory();
+    }
+    for (pool = _thrpool_registry; pool != NULL; pool = pool->registry_next)
+    {
+        if (_FIL_TPOOL_TRY_INCREF(pool))
+        {
+            pools[got++] = pool;
+        }
+    }
+    FIL_TPREG_UNLOCK();
+
+    result = PyList_New(0);
+    for (i = 0; i < got; i++)
+    {
+        PyObject *stats;
+        PyObject *entry;
+
+        if (result == NULL)
+        {
+            break;
+        }
+        stats = _thrpool_stats(pools[i], NULL);
+        if (stats == NULL)
+        {
+            /* Shut down since we looked; it is no longer one of them. */
+            if (PyErr_ExceptionMatches(PyExc_RuntimeError))
+            {
+                PyErr_Clear();
+                continue;
+            }
+            Py_CLEAR(result);
+            break;
+        }
+        entry = Py_BuildValue("(ON)", (PyObject *)pools[i], stats);
+        if (entry == NULL || PyList_Append(result, entry) < 0)
+        {
+            Py_CLEAR(result);
+        }
+        Py_XDECREF(entry);
+    }
+    for (i = 0; i < got; i++)
+    {
+        Py_DECREF(pools[i]);
+    }
+    free(pools);
+    return result;
+}
+
 PyDoc_STRVAR(_fil_thrpool_module_doc, "Filament _filament.thrpool module.");
 static PyMethodDef _fil_thrpool_module_methods[] = {
+    { "pool_stats", (PyCFunction)_thrpool_pool_stats, METH_NOARGS, _thrpool_pool_stats_doc },
     { NULL, },
 };
 
@@ -1160,5 +1464,10 @@ _FIL_MODULE_INIT_FN_NAME(thrpool)
         return _FIL_MODULE_INIT_ERROR;
     }
 
+    if (fil_register_at_fork(NULL, NULL, &_thrpool_after_fork_child_def) < 0)
+    {
+        return _FIL_MODULE_INIT_ERROR;
+    }
+
     return _FIL_MODULE_INIT_SUCCESS(m);
 }
@@ -0,0 +1,197 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+Blocking-call detection (filament.blockwatch, FIL_BLOCKWATCH).
+
+The detector is process-wide, so each test starts it with its own callback
+and stops it before returning.
+"""
+
+from __future__ import absolute_import
+
+import logging
+import os
+import threading
+import time
+
+import pytest
+
+import _filament.core as _core
+import filament
+from filament import blockwatch
+
+from tests._helpers import run_py
+
+
+@pytest.fixture
+def reports():
+    got = []
+    blockwatch.start(0.02, callback=got.append)
+    try:
+        yield got
+    finally:
+        blockwatch.stop()
+
+
+def _spin(seconds):
+    end = time.time() + seconds
+    while time.time() < end:
+        pass
+
+
+def _settle():
+    # Let the watchdog get round to a run that just ended.
+    filament.sleep(0.05)
+
+
+def test_cpu_loop_reported_once(reports):
+    def hog():
+        _spin(0.12)
+
+    g = filament.spawn(hog)
+    g.wait()
+    _settle()
+    assert len(reports) == 1, reports
+    report = reports[0]
+    assert report.greenlet is g
+    assert report.thread_id == threading.current_thread().ident
+    assert 0.02 <= report.elapsed < 0.12
+    assert report.stack[-1][2] == "_spin"
+    assert [name for _, _, name in report.stack[-2:]] == ["hog", "_spin"]
+    assert "_spin" in str(report)
+
+
+def test_unpatched_blocking_call(reports):
+    def nap():
+        time.sleep(0.08)
+
+    filament.spawn(nap).wait()
+    _settle()
+    assert [r.stack[-1][2] for r in reports] == ["nap"]
+
+
+def test_cooperative_code_not_reported(reports):
+    def polite():
+        for _ in range(20):
+            filament.sleep(0.005)
+
+    filament.joinall([filament.spawn(polite) for _ in range(5)])
+    _settle()
+    assert reports == []
+
+
+def test_histogram_counts_runs(reports):
+    blockwatch.histogram(reset=True)
+    filament.joinall([filament.spawn(filament.sleep, 0) for _ in range(100)])
+    hist = blockwatch.histogram()
+    assert sum(n for _, n in hist) >= 200
+    bounds = [b for b, _ in hist]
+    assert bounds == sorted(bounds) and bounds[0] == 1e-6
+    assert bounds[-1] == float("inf")
+    mine = blockwatch.histogram(per_thread=True)
+    assert threading.current_thread().ident in mine
+
+
+def test_default_report_is_logged(caplog):
+    blockwatch.start(0.02)
+    try:
+        with caplog.at_level(logging.WARNING, logger="filament.blockwatch"):
+            filament.spawn(_spin, 0.08).wait()
+            _settle()
+    finally:
+        blockwatch.stop()
+    assert any("_spin" in rec.getMessage() for rec in caplog.records), \
+        caplog.records
+
+
+def test_start_stop_and_threshold():
+    assert not blockwatch.enabled()
+    blockwatch.start(0.25)
+    try:
+        assert blockwatch.threshold() == 0.25
+        blockwatch.start(0.5)
+        assert blockwatch.threshold() == 0.5
+    finally:
+        blockwatch.stop()
+    assert blockwatch.threshold() is None
+    with pytest.raises(ValueError):
+        blockwatch.start(0)
+    with pytest.raises(TypeError):
+        _core.blockwatch_start(0.1, None)
+
+
+def test_stop_from_the_callback():
+    got = []
+
+    def once(report):
+        got.append(report)
+        blockwatch.stop()
+
+    blockwatch.start(0.02, callback=once)
+    try:
+        filament.spawn(_spin, 0.08).wait()
+        _settle()
+        assert len(got) == 1 and not blockwatch.enabled()
+    finally:
+        blockwatch.stop()
+
+
+def test_other_threads_schedulers(reports):
+    ident = []
+
+    def body():
+        ident.append(threading.current_thread().ident)
+        filament.spawn(_spin, 0.08).wait()
+
+    t = threading.Thread(target=body)
+    t.start()
+    t.join()
+    _settle()
+    assert [r.thread_id for r in reports] == ident
+
+
+def test_env_var_starts_it():
+    res = run_py('''
+import logging
+import time
+import filament
+from filament import blockwatch
+
+logging.basicConfig()
+assert blockwatch.threshold() == 0.02
+
+def hog():
+    end = time.time() + 0.08
+    while time.time() < end:
+        pass
+
+filament.spawn(hog).wait()
+filament.sleep(0.05)
+''', extra_env={"FIL_BLOCKWATCH": "20"})
+    assert res.ok(), repr(res)
+    assert "in hog" in res.stderr, repr(res)
+
+
+@pytest.mark.skipif(not hasattr(os, "register_at_fork"),
+                    reason="needs os.register_at_fork()")
+def test_watchdog_runs_in_forked_child():
+    res = run_py('''
+import os
+import time
+import filament
+from filament import blockwatch
+
+got = []
+blockwatch.start(0.02, callback=got.append)
+filament.spawn(filament.sleep, 0).wait()
+pid = os.fork()
+if pid == 0:
+    end = time.time() + 0.08
+    while time.time() < end:
+        pass
+    filament.sleep(0.05)
+    os._exit(0 if got else 3)
+_, status = os.waitpid(pid, 0)
+assert os.WEXITSTATUS(status) == 0, status
+print("OK")
+''')
+    assert res.ok() and "OK" in res.stdout, repr(res)
@@ -242,3 +242,46 @@ def test_event_set_then_clear_during_wait_returns_true():
     ev.clear()                 # clear before the waiter gets to run
     g.wait()
     assert got == [True]
+
+
+def test_event_and_asyncresult_wake_native_threads():
+    import threading
+
+    ev = filament.Event()
+    ar = filament.AsyncResult()
+    got = []
+
+    def native():
+        got.append(ev.wait(5))
+        got.append(ar.get(timeout=5))
+
+    t = threading.Thread(target=native)
+    t.start()
+    filament.sleep(0.02)
+    ev.set()
+    filament.sleep(0.02)
+    ar.set("from-greenthread")
+    t.join(5)
+    assert got == [True, "from-greenthread"]
+
+
+def test_asyncresult_reset_keeps_parked_waiter_for_next_set():
+    ar = filament.AsyncResult()
+    g = filament.spawn(ar.get)
+    filament.sleep(0)
+    ar.set(1)
+    ar.reset()                 # before the woken waiter runs
+    filament.sleep(0)
+    assert not g.dead
+    ar.set(2)
+    assert g.wait() == 2
+
+
+def test_asyncresult_own_timeout_is_the_context_manager_class():
+    ar = filament.AsyncResult()
+    with pytest.raises(filament.Timeout) as info:
+        ar.get(timeout=0.01)
+    assert info.value.seconds == 0.01
+    with pytest.raises(filament.Timeout):
+        ar.get(block=False)
+    assert ar.wait(0.01) is None
@@ -0,0 +1,331 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+Fiber stack pool: returning idle stack memory to the OS.
+
+Pooled stacks beyond the dirty-stack watermarks get their pages released with
+madvise() (see vendor/greenlet/fil_fiber.hpp), so a spike of greenthreads with
+deep C recursion does not pin its RSS forever.  Only meaningful with the
+private-stack fiber core; skipped elsewhere.
+"""
+
+from __future__ import absolute_import
+
+import json
+
+import pytest
+
+import filament
+
+from tests._helpers import run_py
+
+try:
+    import _fil_greenlet
+except ImportError:  # py2.7 classic-greenlet builds
+    _fil_greenlet = None
+
+needs_fiber = pytest.mark.skipif(
+    not hasattr(_fil_greenlet, "fiber_stack_stats"),
+    reason="fiber core not built")
+
+
+def _deep_c_recursion():
+    # Nested lists make repr() recurse in C, touching real stack pages on
+    # the fiber (Python-to-Python calls would stay on the heap datastack).
+    nested = []
+    for _ in range(500):
+        nested = [nested]
+    repr(nested)
+
+
+def _spike(n):
+    def work(ev):
+        _deep_c_recursion()
+        ev.wait()
+
+    ev = filament.Event()
+    gts = [filament.spawn(work, ev) for _ in range(n)]
+    filament.sleep(0)
+    ev.set()
+    for gt in gts:
+        gt.wait()
+
+
+@needs_fiber
+def test_deaths_above_high_watermark_release_down_to_low():
+    old = _fil_greenlet.fiber_stack_watermarks()
+    try:
+        assert _fil_greenlet.fiber_stack_watermarks(4, 2) == (4, 2)
+        before = _fil_greenlet.fiber_stack_stats()
+        # Well past what the per-thread cache holds (two batches), so most
+        # of these deaths reach the shared depot.
+        _spike(4 * before["magazine"] + 32)
+        after = _fil_greenlet.fiber_stack_stats()
+        assert after["pooled_dirty"] <= 4
+        assert after["released_stacks"] > before["released_stacks"]
+        assert after["released_bytes"] > before["released_bytes"]
+        assert after["pooled"] >= after["pooled_dirty"]
+        assert after["retained_bytes"] == \
+            (after["pooled"] + after["cached"]) * after["stack_size"]
+    finally:
+        _fil_greenlet.fiber_stack_watermarks(*old)
+
+
+@needs_fiber
+def test_trim_releases_and_pool_still_reuses():
+    _spike(8)
+    _fil_greenlet.fiber_stack_trim(0)
+    st = _fil_greenlet.fiber_stack_stats()
+    assert st["pooled_dirty"] == 0
+    # Released stacks keep their reservation: spawning again reuses them
+    # rather than mapping new ones.
+    _spike(min(st["pooled"], 8))
+    assert _fil_greenlet.fiber_stack_stats()["mapped"] == st["mapped"]
+
+
+@needs_fiber
+def test_trim_flushes_the_calling_threads_cache():
+    import threading
+
+    out = []
+
+    def body():
+        # Fewer deaths than the cache holds: without the flush, trim()
+        # would find nothing of this thread's in the depot.
+        _spike(8)
+        before = _fil_greenlet.fiber_stack_stats()
+        _fil_greenlet.fiber_stack_trim(0)
+        out.append((before, _fil_greenlet.fiber_stack_stats()))
+
+    t = threading.Thread(target=body)
+    t.start()
+    t.join()
+    before, after = out[0]
+    if not before["magazine"]:
+        pytest.skip("per-thread caches disabled (FIL_FIBER_MAGAZINE=0)")
+    assert after["cached"] <= before["cached"] - 8
+    assert after["pooled_dirty"] == 0
+    assert after["released_stacks"] >= before["released_stacks"] + 8
+
+
+@needs_fiber
+def test_thread_caches_flush_to_depot_at_thread_exit():
+    import threading
+    import time
+
+    magazine = _fil_greenlet.fiber_stack_stats()["magazine"]
+    if not magazine:
+        pytest.skip("per-thread caches disabled (FIL_FIBER_MAGAZINE=0)")
+
+    threads = [threading.Thread(target=_spike, args=(2 * magazine + 8,))
+               for _ in range(8)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    # Eight full caches would be 16 batches.  Once the threads are gone
+    # (their exit hooks run just after join() returns) only this thread's
+    # cache -- at most two batches -- may remain.
+    deadline = time.time() + 10
+    while time.time() < deadline:
+        if _fil_greenlet.fiber_stack_stats()["cached"] <= 2 * magazine:
+            break
+        time.sleep(0.01)
+    assert _fil_greenlet.fiber_stack_stats()["cached"] <= 2 * magazine
+
+
+@needs_fiber
+def test_trim_rejects_negative_keep():
+    with pytest.raises(ValueError):
+        _fil_greenlet.fiber_stack_trim(-1)
+
+
+@needs_fiber
+def test_watermarks_from_environment():
+    res = run_py(
+        "import json, _fil_greenlet\n"
+        "print(json.dumps(_fil_greenlet.fiber_stack_watermarks()))\n",
+        extra_env={"FIL_FIBER_POOL_HIGH": "64", "FIL_FIBER_POOL_LOW": "128"})
+    assert res.ok(), res
+    # low is clamped to high
+    assert json.loads(res.stdout.strip().splitlines()[-1]) == [64, 64]
+
+
+@needs_fiber
+def test_gr_stack_size_picks_a_size_class():
+    g = _fil_greenlet.greenlet(_deep_c_recursion)
+    default = _fil_greenlet.fiber_stack_stats()["stack_size"]
+    assert g.gr_stack_size == default
+    g.gr_stack_size = 100 * 1024
+    assert g.gr_stack_size == 128 * 1024
+    g.switch()
+    assert g.dead
+    classes = _fil_greenlet.fiber_stack_stats()["classes"]
+    assert classes[128 * 1024]["mapped"] >= 1
+    with pytest.raises(ValueError):
+        _fil_greenlet.greenlet().gr_stack_size = 1 << 40
+    with pytest.raises(ValueError):
+        _fil_greenlet.greenlet().gr_stack_size = -1
+
+
+@needs_fiber
+def test_gr_stack_size_fixed_once_started():
+    def body():
+        _fil_greenlet.getcurrent().parent.switch()
+
+    g = _fil_greenlet.greenlet(body)
+    g.switch()
+    with pytest.raises(ValueError):
+        g.gr_stack_size = 64 * 1024
+    g.switch()
+
+
+@needs_fiber
+def test_spawn_stack_size_is_not_passed_to_target():
+    def target(**kwargs):
+        return kwargs
+
+    gt = filament.spawn(target, stack_size=64 * 1024, x=1)
+    assert gt.gr_stack_size == 64 * 1024
+    assert gt.wait() == {"x": 1}
+    with pytest.raises(ValueError):
+        filament.spawn(target, stack_size=-5)
+
+
+def test_target_with_its_own_stack_size_keyword():
+    import functools
+
+    def target(stack_size=None):
+        return stack_size
+
+    # spawn() keeps stack_size= for itself; partial gets it to the target.
+    assert filament.spawn(target, stack_size=128 * 1024).wait() is None
+    gt = filament.spawn(functools.partial(target, stack_size=12345))
+    assert gt.wait() == 12345
+
+
+@needs_fiber
+def test_profile_records_depth_per_spawn_site():
+    def shallow():
+        pass
+
+    old = _fil_greenlet.fiber_stack_profile_mode("on")
+    try:
+        # Stacks pooled dirty before profiling was on read deep once:
+        # run one round to clean them, then start counting.
+        for fn in [shallow, _deep_c_recursion]:
+            filament.spawn(fn).wait()
+        filament.sleep(0)
+        _fil_greenlet.fiber_stack_profile(reset=True)
+        for fn in [shallow, _deep_c_recursion] * 4:
+            filament.spawn(fn).wait()
+        # The last one dies on the way back to us; let the release happen.
+        filament.sleep(0)
+        sites = dict((e["site"], e) for e in
+                     _fil_greenlet.fiber_stack_profile(reset=True))
+    finally:
+        _fil_greenlet.fiber_stack_profile_mode(old)
+    deep = sites[_deep_c_recursion.__code__]
+    light = sites[shallow.__code__]
+    assert deep["count"] == light["count"] == 4
+    assert deep["max_depth"] > light["max_depth"] > 0
+    assert sum(deep["histogram"].values()) == 4
+    assert all(e["auto_stack_size"] == 0 for e in sites.values())
+
+
+@needs_fiber
+def test_profile_mode_rejects_unknown():
+    with pytest.raises(ValueError):
+        _fil_greenlet.fiber_stack_profile_mode("sometimes")
+
+
+@needs_fiber
+def test_auto_mode_sizes_shallow_sites_down():
+    res = run_py(
+        "import json, filament, _fil_greenlet\n"
+        "def shallow():\n"
+        "    pass\n"
+        "for _ in range(80):\n"
+        "    filament.spawn(shallow).wait()\n"
+        "filament.sleep(0)\n"
+        "gt = filament.spawn(shallow)\n"
+        "print(json.dumps([_fil_greenlet.fiber_stack_profile_mode(),\n"
+        "                  gt.gr_stack_size,\n"
+        "                  _fil_greenlet.fiber_stack_stats()['stack_size']]))\n"
+        "gt.wait()\n",
+        extra_env={"FIL_FIBER_STACK_PROFILE": "auto"})
+    assert res.ok(), res
+    mode, size, default = json.loads(res.stdout.strip().splitlines()[-1])
+    assert mode == "auto"
+    assert size < default
+    # A site that only ever ran a few pages deep still gets the floor.
+    assert size >= 256 * 1024
+
+
+_COUNT_VMAS = (
+    "import json, filament, _fil_greenlet\n"
+    "def vmas():\n"
+    "    with open('/proc/self/maps') as fh:\n"
+    "        return sum(1 for _ in fh)\n"
+    "ev = filament.Event()\n"
+    "before = vmas()\n"
+    "gts = [filament.spawn(ev.wait) for _ in range(2000)]\n"
+    "filament.sleep(0)\n"
+    "grown = vmas() - before\n"
+    "ev.set()\n"
+    "for gt in gts:\n"
+    "    gt.wait()\n"
+    "st = _fil_greenlet.fiber_stack_stats()\n"
+    "print(json.dumps([grown, st['guard'], st['arenas']]))\n")
+
+
+@needs_fiber
+@pytest.mark.skipif(not __import__("sys").platform.startswith("linux"),
+                    reason="counts /proc/self/maps")
+@pytest.mark.parametrize("arena", ["0", "64"])
+def test_parked_fibers_do_not_cost_a_vma_each(arena):
+    res = run_py(_COUNT_VMAS, extra_env={"FIL_FIBER_ARENA": arena})
+    assert res.ok(), res
+    grown, guard, arenas = json.loads(res.stdout.strip().splitlines()[-1])
+    if arena != "0":
+        assert arenas >= 2000 // int(arena)
+    else:
+        assert arenas == 0
+    if guard == "madvise":
+        # Guards in the page tables: stacks stay (mergeable) single mappings.
+        assert grown < 200
+    else:
+        assert guard == "mprotect"
+        assert grown >= 2000
+
+
+@needs_fiber
+def test_forced_mprotect_guards_split_mappings():
+    res = run_py(_COUNT_VMAS, extra_env={"FIL_FIBER_GUARD": "mprotect",
+                                         "FIL_FIBER_ARENA": "16"})
+    assert res.ok(), res
+    grown, guard, _ = json.loads(res.stdout.strip().splitlines()[-1])
+    assert guard == "mprotect"
+    assert grown >= 2000
+
+
+@needs_fiber
+def test_unmappable_stack_fails_the_spawn_instead_of_hanging():
+    # Cap the address space just above what is in use: 4 MiB stacks run out
+    # after a few, and the greenthreads that never got one must report it.
+    res = run_py(
+        "import resource, filament\n"
+        "with open('/proc/self/statm') as fh:\n"
+        "    vsz = int(fh.read().split()[0]) * resource.getpagesize()\n"
+        "limit = vsz + (64 << 20)\n"
+        "resource.setrlimit(resource.RLIMIT_AS, (limit, limit))\n"
+        "gts = [filament.spawn(filament.sleep, 0.01) for _ in range(200)]\n"
+        "failed = 0\n"
+        "for gt in gts:\n"
+        "    try:\n"
+        "        gt.wait()\n"
+        "    except MemoryError:\n"
+        "        failed += 1\n"
+        "print(failed)\n",
+        extra_env={"FIL_FIBER_MAGAZINE": "0"})
+    assert res.ok(), res
+    assert 0 < int(res.stdout.strip().splitlines()[-1]) < 200
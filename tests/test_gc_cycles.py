@@ -2,17 +2,20 @@
 """
 Reference cycles routed through the C containers must be collectable.
 
-Queue, SimpleQueue and Condition hold strong references to arbitrary user
-objects (queued items; the condition's lock).  Without tp_traverse the
-collector cannot see those edges, so the ubiquitous "task carries its reply
-queue" pattern leaked the queue, the items and everything they pin, forever.
+The C queues, Condition and local hold strong references to arbitrary user
+objects (queued items; the condition's lock; a local's per-greenthread dicts).
+Without tp_traverse the collector cannot see those edges, so the ubiquitous
+"task carries its reply queue" pattern leaked the queue, the items and
+everything they pin, forever.
 These tests pin each shape with a weakref and demand the cycle actually dies.
 """
 import gc
 import weakref
 
+from _fil_greenlet import greenlet, getcurrent
+from _filament.core import local
 from _filament.locking import Condition
-from _filament.queue import Queue, SimpleQueue
+from _filament.queue import LifoQueue, PriorityQueue, Queue, SimpleQueue
 
 
 class Node(object):
@@ -64,6 +67,21 @@ def test_simple_queue_item_cycle_is_collectable():
     _assert_dies(build)
 
 
+def test_heap_queue_item_cycles_are_collectable():
+    for cls in (PriorityQueue, LifoQueue):
+        def build():
+            q = cls()
+            first = Node()
+            first.q = q
+            q.put((0, 0, first))
+            for i in range(100):
+                n = Node()
+                n.q = q
+                q.put((1, i, n))
+            return first
+        _assert_dies(build)
+
+
 def test_condition_lock_cycle_is_collectable():
     def build():
         n = Node()
@@ -97,3 +115,62 @@ def test_queue_self_cycle_is_collectable():
         q.put(n)
         return n
     _assert_dies(build)
+
+
+def test_local_init_args_cycle_is_collectable():
+    class MyLocal(local):
+        def __init__(self, node):
+            pass
+
+    def build():
+        n = Node()
+        n.loc = MyLocal(n)         # local -> its constructor args -> node
+        return n
+    _assert_dies(build)
+
+
+_greenlet_local = local()
+
+
+def test_greenlet_local_dict_cycle_is_collectable():
+    # A plain greenlet that has finished, with a dict that points back at it,
+    # must not be pinned by the (still live) local that owns the dict.
+    def build():
+        n = Node()
+
+        def body():
+            _greenlet_local.me = getcurrent()
+            _greenlet_local.node = n
+
+        greenlet(body).switch()
+        return n
+    _assert_dies(build)
+
+
+def test_local_self_cycle_is_collectable():
+    # The main greenlet outlives everything here, so a dict it owned would
+    # pin the local; the local owns it instead, and can see the cycle.
+    def build():
+        loc = local()
+        loc.me = loc
+        return loc
+    _assert_dies(build)
+
+
+def test_dead_local_frees_other_greenlets_values():
+    loc = local()
+    n = Node()
+    ref = weakref.ref(n)
+
+    def body():
+        loc.node = n
+        getcurrent().parent.switch()
+
+    g = greenlet(body)
+    g.switch()                     # g now suspended, its dict holding n
+    del n
+    assert ref() is not None
+    del loc
+    gc.collect()
+    assert ref() is None, "a dead local's value outlived it in a live greenlet"
+    g.switch()
@@ -278,6 +278,86 @@ print("OK")
 ''' % (keyfile, certfile))
 
 
+@pytest.mark.skipif(not hasattr(__import__("socket"), "SO_REUSEPORT"),
+                    reason="needs SO_REUSEPORT")
+def test_gevent_server_workers():
+    _check('''
+import threading
+import time
+from gevent.server import StreamServer
+from gevent.pool import Pool
+import filament.socket as fsocket
+
+threads = set()
+
+def echo(sock, addr):
+    threads.add(threading.get_ident())
+    sock.sendall(sock.recv(100))
+
+srv = StreamServer(("127.0.0.1", 0), echo, spawn=4, workers=3)
+srv.start()
+assert len(srv._threads) == 2
+for i in range(120):
+    c = fsocket.create_connection(srv.address)
+    c.sendall(b"w%d" % i)
+    assert c.recv(100) == b"w%d" % i
+    c.close()
+# The kernel spreads connections over all three listeners.
+assert len(threads) == 3, threads
+srv.stop(timeout=1)
+assert srv._threads == [] and srv.started is False
+try:
+    fsocket.create_connection(srv.address, timeout=1)
+except OSError:
+    pass
+else:
+    raise AssertionError("a listener outlived stop()")
+
+# stop() drains in-flight handlers on every thread, then kills stragglers.
+finished = []
+
+def slow(sock, addr):
+    # "slow" clients hang past the drain timeout; "fast" ones finish in it.
+    kind = sock.recv(100)
+    gevent.sleep(10 if kind == b"slow" else 0.2)
+    finished.append(kind)
+
+srv = StreamServer(("127.0.0.1", 0), slow, spawn=32, workers=2)
+srv.start()
+clients = []
+for i in range(20):
+    c = fsocket.create_connection(srv.address)
+    c.sendall(b"slow" if i % 2 else b"fast")
+    clients.append(c)
+gevent.sleep(0.1)
+t0 = time.time()
+srv.stop(timeout=0.5)
+took = time.time() - t0
+assert 0.05 < took < 3, took
+assert finished.count(b"fast") == 10 and b"slow" not in finished, finished
+for c in clients:
+    c.close()
+
+# Misuse is refused up front.
+for kwargs in ({"workers": 0}, {"workers": 2, "spawn": Pool(2)}):
+    try:
+        StreamServer(("127.0.0.1", 0), echo, **kwargs)
+    except ValueError:
+        pass
+    else:
+        raise AssertionError(kwargs)
+lsock = fsocket.socket()
+try:
+    StreamServer(lsock, echo, workers=2)
+except ValueError:
+    pass
+else:
+    raise AssertionError("socket listener accepted with workers=2")
+lsock.close()
+print("OK")
+''')
+
+
 def test_gevent_queue_more():
     _check('''
 import collections
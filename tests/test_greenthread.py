@@ -10,6 +10,9 @@ callers use.
 
 from __future__ import absolute_import
 
+import sysconfig
+import threading
+
 import pytest
 
 import filament
@@ -233,6 +236,25 @@ def test_joinall_raise_error():
         filament.joinall(gs, raise_error=True)
 
 
+def test_joinall_raise_error_raises_the_first_to_fail():
+    # Not the first in the list: the later greenthread fails first, and
+    # joinall raises that without waiting for the earlier one.
+    def fails_late():
+        filament.sleep(0.05)
+        raise KeyError("late")
+
+    def fails_now():
+        raise ValueError("now")
+
+    late = filament.spawn(fails_late)
+    gs = [late, filament.spawn(fails_now)]
+    with pytest.raises(ValueError):
+        filament.joinall(gs, raise_error=True)
+    assert not late.dead
+    with pytest.raises(KeyError):
+        late.wait()
+
+
 def test_wait_and_iwait():
     gs = [filament.spawn(lambda i=i: i) for i in range(5)]
     done = filament.wait(gs)
@@ -250,5 +272,234 @@ def test_wait_count_limits():
     filament.joinall(gs)
 
 
+def test_count_zero_returns_nothing_without_waiting():
+    g = filament.spawn(filament.sleep, 0.05)
+    assert list(filament.iwait([g], count=0)) == []
+    assert filament.wait([g], count=0) == []
+    assert not g.dead
+    g.wait()
+
+
 def test_wait_none_returns_empty():
     assert filament.wait(None) == []
+
+
+def test_greenthreads_reuse_frame_stacks_across_deep_and_shallow_bodies():
+    # On 3.11+ a finished greenthread hands its root frame chunk to the next
+    # one started on the thread; bodies that grew extra chunks must still
+    # see a clean stack, and results must not bleed between them.
+    def deep(n):
+        return n if n == 0 else deep(n - 1) + 1
+
+    depths = [(i % 10) * 50 for i in range(200)]
+    gs = [filament.spawn(deep if i % 2 else int, d)
+          for i, d in enumerate(depths)]
+    assert [g.wait() for g in gs] == depths
+
+
+def test_filament_subclass_main_override_is_used():
+    ran = []
+
+    class Sub(filament.Filament):
+        def main(self):
+            ran.append(True)
+            return super(Sub, self).main()
+
+    f = Sub(lambda: 7)
+    assert f.wait() == 7
+    assert ran == [True]
+
+
+def test_no_message_for_a_greenthread_waited_on_after_it_finished():
+    import gc
+
+    def messages():
+        return sum(1 for o in gc.get_objects() if type(o) is filament.Message)
+
+    gc.collect()
+    before = messages()
+    g = filament.spawn(lambda: 5)
+    filament.sleep(0)
+    assert g.wait() == 5
+    assert g.wait() == 5
+    assert messages() == before
+
+
+def test_waiters_parked_before_the_body_finishes_all_get_its_outcome():
+    ev = filament.Event()
+    out = []
+
+    def body():
+        ev.wait()
+        raise ValueError("late")
+
+    def waiter():
+        try:
+            g.wait()
+        except ValueError as e:
+            out.append(str(e))
+
+    g = filament.spawn(body)
+    waiters = [filament.spawn(waiter) for _ in range(3)]
+    watched = filament.spawn(filament.wait, [g])
+    filament.sleep(0)
+    ev.set()
+    filament.joinall(waiters)
+    assert out == ["late"] * 3
+    assert watched.wait() == [g]
+    with pytest.raises(ValueError):
+        g.wait()
+    # A WaitSet on a greenthread that has already finished.
+    assert filament.wait([g]) == [g]
+
+
+@pytest.mark.skipif(bool(sysconfig.get_config_var("Py_GIL_DISABLED")),
+                    reason="no Filament freelist on free-threaded builds")
+def test_freed_greenthreads_are_recycled():
+    import weakref
+    import _filament.core as _core
+
+    def recycled():
+        ident = threading.current_thread().ident
+        return [s for s in _core.scheduler_stats()
+                if s["thread_id"] == ident][0]["filaments_recycled"]
+
+    gs = [filament.spawn(int, i) for i in range(50)]
+    assert [g.wait() for g in gs] == list(range(50))
+    for g in gs:
+        g.seen = True
+    del gs, g
+    before = recycled()
+    gs = [filament.spawn(str, i) for i in range(50)]
+    assert recycled() - before >= 50
+    # Nothing carried over from the Filament that was freed.
+    assert not any(g.dead or hasattr(g, "seen") for g in gs)
+    refs = [weakref.ref(g) for g in gs]
+    assert [g.wait() for g in gs] == [str(i) for i in range(50)]
+    assert all(r() is g for r, g in zip(refs, gs))
+
+
+def test_spawn_n_prints_exception_but_not_greenlet_exit(capsys):
+    def boom():
+        raise ValueError("spawn_n boom")
+
+    def quiet():
+        raise filament.GreenletExit()
+
+    filament.spawn_n(boom)
+    filament.spawn_n(quiet)
+    filament.sleep(0)
+    err = capsys.readouterr().err
+    assert "ValueError: spawn_n boom" in err
+    assert "GreenletExit" not in err
+
+
+def test_spawn_n_greenthread_has_nothing_to_wait_for():
+    seen = []
+
+    def body(x, y=None):
+        seen.append((x, y))
+        with pytest.raises(RuntimeError):
+            filament.getcurrent().wait()
+
+    filament.spawn_n(body, 1, y=2)
+    filament.sleep(0)
+    assert seen == [(1, 2)]
+    with pytest.raises(TypeError):
+        filament.spawn_n(42)
+
+
+def test_spawn_many_queues_in_order_and_returns_filaments():
+    order = []
+
+    def work(i, tag):
+        order.append(i)
+        return (i, tag)
+
+    gs = filament.spawn_many(work, ((i, "t") for i in range(50)))
+    assert len(gs) == 50
+    assert not order  # queued, not started
+    assert [g.wait() for g in gs] == [(i, "t") for i in range(50)]
+    assert order == list(range(50))
+    assert filament.spawn_many(work, []) == []
+
+
+def test_spawn_many_is_all_or_nothing():
+    ran = []
+
+    def items():
+        yield (1,)
+        yield (2,)
+        raise KeyError("iterable failed")
+
+    with pytest.raises(KeyError):
+        filament.spawn_many(ran.append, items())
+    with pytest.raises(TypeError):
+        filament.spawn_many(ran.append, [(1,), 5])
+    filament.sleep(0)
+    assert ran == []
+
+
+def test_iwait_yields_in_completion_order_across_kinds():
+    ev = filament.Event()
+    ar = filament.AsyncResult()
+    slow = filament.spawn(filament.sleep, 0.06)
+    fast = filament.spawn(filament.sleep, 0.01)
+    filament.spawn(lambda: (filament.sleep(0.03), ar.set(1), ev.set()))
+    assert list(filament.iwait([slow, ev, ar, fast])) == [fast, ar, ev, slow]
+
+
+def test_iwait_relays_foreign_waitables():
+    class Foreign(object):
+        def __init__(self):
+            self.ev = filament.Event()
+
+        def wait(self):
+            self.ev.wait()
+
+    a, b = Foreign(), Foreign()
+    filament.spawn(b.ev.set)
+    assert filament.wait_any([a, b], timeout=1) is b
+    assert filament.wait([a, b], timeout=0.01) == [b]
+
+
+def test_wait_any_and_wait_all():
+    never = filament.Event()
+    gs = [filament.spawn(filament.sleep, 0.01 * (3 - i)) for i in range(3)]
+    assert filament.wait_any(gs) is gs[2]
+    assert filament.wait_any([never], timeout=0.01) is None
+    assert filament.wait_all(gs, timeout=1)
+    assert not filament.wait_all(gs + [never], timeout=0.01)
+
+
+def test_joinall_parks_once_for_many_greenthreads():
+    from _filament.core import WaitSet
+
+    ev = filament.Event()
+    gs = [filament.spawn(ev.wait) for _ in range(2000)]
+    ws = WaitSet(gs)
+    assert len(ws) == 2000
+    filament.spawn(ev.set)
+    assert sorted(ws.wait(count=len(gs))) == list(range(2000))
+    assert len(ws) == 0 and ws.wait() == []
+
+
+def test_waitset_deadline_is_absolute_and_wait_is_exclusive():
+    from _filament.core import WaitSet
+    import time as _t
+
+    gs = [filament.spawn(filament.sleep, 0.02), filament.spawn(filament.sleep, 5)]
+    ws = WaitSet(gs, timeout=0.1)
+    t0 = _t.time()
+    assert ws.wait() == [0]
+    # The second wait shares the first one's deadline.
+    assert ws.wait() == []
+    assert _t.time() - t0 < 0.5
+    assert len(ws) == 1
+
+    waiter = filament.spawn(WaitSet(gs[1:]).wait)
+    filament.sleep(0)
+    filament.kill(waiter)
+    assert waiter.dead
+    ws.close()
+    filament.killall(gs)
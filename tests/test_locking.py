@@ -371,6 +371,267 @@ def test_bounded_semaphore_over_release_raises():
     run(body)
 
 
+# --------------------------------------------------------------------------- #
+# Native-thread spinning (FIL_LOCK_SPIN) and the contention counters
+# --------------------------------------------------------------------------- #
+
+SPIN_SCRIPT = r'''
+import json, sys, threading
+import filament
+from _filament import locking
+
+def body(cls):
+    lk = cls()
+    lk.acquire()
+    t = threading.Thread(target=lambda: (lk.acquire(), lk.release()))
+    t.start()
+    filament.sleep(0.05)       # far longer than any spin: it must park
+    lk.release()
+    while t.is_alive():
+        filament.sleep(0.001)
+    return lk.spin_stats()
+
+out = [filament.spawn(body, cls).wait() for cls in (locking.Lock, locking.RLock)]
+sys.stdout.write(json.dumps(out) + "\n")
+'''
+
+
+@pytest.mark.parametrize("spin", ["0", "1000"])
+def test_lock_native_thread_spins_then_parks(spin):
+    import json
+
+    res = run_py(SPIN_SCRIPT, timeout=30, extra_env={"FIL_LOCK_SPIN": spin})
+    assert res.returncode == 0, repr(res)
+    for stats in json.loads(res.stdout.strip().splitlines()[-1]):
+        assert stats["parks"] == 1, stats
+        assert stats["spin_acquired"] == 0, stats
+        assert stats["spins"] == (0 if spin == "0" else 1), stats
+
+
+def test_lock_greenthreads_never_spin():
+    def body():
+        lk = locking.Lock()
+        lk.acquire()
+        g = filament.spawn(lambda: (lk.acquire(), lk.release()))
+        filament.sleep(0)
+        lk.release()
+        g.wait()
+        return lk.spin_stats()
+
+    stats = run(body)
+    assert (stats["spins"], stats["parks"]) == (0, 1), stats
+
+
+def test_lock_spin_env_rejects_garbage():
+    res = run_py("import _filament.locking", extra_env={"FIL_LOCK_SPIN": "lots"})
+    assert res.returncode != 0
+    assert "FIL_LOCK_SPIN" in res.stderr, repr(res)
+
+
+# --------------------------------------------------------------------------- #
+# RWLock
+# --------------------------------------------------------------------------- #
+
+def test_rwlock_readers_share():
+    def body():
+        rw = locking.RWLock()
+        inside = [0]
+        peak = [0]
+
+        def reader():
+            with rw.reader:
+                inside[0] += 1
+                peak[0] = max(peak[0], inside[0])
+                filament.sleep(0.01)
+                inside[0] -= 1
+
+        filament.joinall([filament.spawn(reader) for _ in range(5)])
+        return peak[0], rw.readers
+
+    assert run(body) == (5, 0)
+
+
+def test_rwlock_writer_excludes_readers_and_writers():
+    def body():
+        rw = locking.RWLock()
+        rw.acquire_write()
+        assert rw.write_locked is True
+        assert rw.acquire_read(blocking=False) is False
+        assert rw.acquire_upgradable(blocking=False) is False
+        rw.release_write()
+        assert rw.acquire_read() is True
+        assert rw.acquire_write(timeout=0.01) is False
+        rw.release_read()
+        assert rw.acquire_write(blocking=False) is True
+        rw.release_write()
+        assert (rw.readers, rw.write_locked) == (0, False)
+    run(body)
+
+
+def test_rwlock_queued_writer_holds_back_new_readers():
+    """Writer preference: once a writer queues, later readers wait for it."""
+    def body():
+        rw = locking.RWLock()
+        order = []
+        rw.acquire_read()
+
+        def writer():
+            with rw.writer:
+                order.append("writer")
+
+        def late_reader():
+            with rw.reader:
+                order.append("reader")
+
+        w = filament.spawn(writer)
+        filament.sleep(0)
+        r = filament.spawn(late_reader)
+        filament.sleep(0)
+        assert order == []
+        rw.release_read()
+        filament.joinall([w, r])
+        return order
+
+    assert run(body) == ["writer", "reader"]
+
+
+def test_rwlock_queued_readers_go_before_next_writer():
+    """A writer releasing lets every reader queued behind it in first."""
+    def body():
+        rw = locking.RWLock()
+        order = []
+        rw.acquire_write()
+
+        def reader(i):
+            with rw.reader:
+                order.append("r%d" % i)
+                filament.sleep(0)
+
+        def writer(i):
+            with rw.writer:
+                order.append("w%d" % i)
+
+        gts = [filament.spawn(reader, 0), filament.spawn(writer, 0),
+               filament.spawn(reader, 1), filament.spawn(writer, 1)]
+        filament.sleep(0)
+        rw.release_write()
+        filament.joinall(gts)
+        return order
+
+    order = run(body)
+    assert sorted(order[:2]) == ["r0", "r1"], order
+    assert order[2:] == ["w0", "w1"], order
+
+
+def test_rwlock_upgradable_coexists_with_readers_not_itself():
+    def body():
+        rw = locking.RWLock()
+        assert rw.acquire_upgradable() is True
+        assert rw.acquire_read(blocking=False) is True
+        out = []
+
+        def other():
+            out.append(rw.acquire_upgradable(timeout=0.01))
+
+        filament.spawn(other).wait()
+        rw.release_read()
+        rw.release_upgradable()
+        return out, rw.readers
+
+    assert run(body) == ([False], 0)
+
+
+def test_rwlock_upgrade_waits_for_readers():
+    def body():
+        rw = locking.RWLock()
+        order = []
+
+        def reader():
+            with rw.reader:
+                filament.sleep(0.02)
+                order.append("reader done")
+
+        r = filament.spawn(reader)
+        filament.sleep(0)
+        with rw.upgradable:
+            assert rw.upgrade(timeout=0.001) is False   # still upgradable
+            assert rw.upgrade() is True
+            order.append("upgraded")
+            assert rw.write_locked is True
+        r.wait()
+        return order, rw.readers, rw.write_locked
+
+    assert run(body) == (["reader done", "upgraded"], 0, False)
+
+
+def test_rwlock_upgrade_goes_ahead_of_queued_writer():
+    def body():
+        rw = locking.RWLock()
+        order = []
+        rw.acquire_upgradable()
+
+        def writer():
+            with rw.writer:
+                order.append("writer")
+
+        w = filament.spawn(writer)
+        filament.sleep(0)
+        rw.upgrade()
+        order.append("upgraded")
+        rw.downgrade()
+        assert rw.readers == 1
+        rw.release_read()
+        w.wait()
+        return order
+
+    assert run(body) == ["upgraded", "writer"]
+
+
+def test_rwlock_release_errors():
+    def body():
+        rw = locking.RWLock()
+        with pytest.raises(RuntimeError):
+            rw.release_read()
+        with pytest.raises(RuntimeError):
+            rw.release_write()
+        with pytest.raises(RuntimeError):
+            rw.upgrade()
+        rw.acquire_upgradable()
+        # The upgradable hold is not a plain read hold.
+        with pytest.raises(RuntimeError):
+            rw.release_read()
+        rw.release_upgradable()
+        rw.acquire_write()
+        with pytest.raises(RuntimeError):
+            rw.acquire_write()
+        rw.release_write()
+    run(body)
+
+
+def test_rwlock_shared_with_native_thread():
+    import threading
+
+    def body():
+        rw = locking.RWLock()
+        rw.acquire_write()
+        got = []
+
+        def native():
+            with rw.reader:
+                got.append(rw.readers)
+
+        t = threading.Thread(target=native)
+        t.start()
+        filament.sleep(0.02)
+        assert got == []
+        rw.release_write()
+        while t.is_alive():
+            filament.sleep(0.001)
+        return got
+
+    assert run(body) == [1]
+
+
 # --------------------------------------------------------------------------- #
 # Killed while being handed the lock / permit / notification
 #
@@ -515,6 +776,35 @@ def test_semaphore_permit_returned_when_acquirer_is_killed():
     assert run(body) is True
 
 
+def test_rwlock_grant_returned_when_acquirer_is_killed():
+    def body():
+        rw = locking.RWLock()
+        rw.acquire_write()
+        out = []
+
+        def victim():
+            with rw.reader:
+                out.append("victim")
+
+        def survivor():
+            with rw.writer:
+                out.append("survivor")
+
+        v = filament.spawn(victim)
+        s = filament.spawn(survivor)
+        filament.sleep(0)
+
+        _queue_throw(v)
+        rw.release_write()             # grants the read hold to the victim
+
+        filament.sleep(0.05)
+        assert v.dead
+        s.wait()
+        return out, rw.readers, rw.write_locked
+
+    assert run(body) == (["survivor"], 0, False)
+
+
 def test_condition_notification_passed_on_when_waiter_is_killed():
     def body():
         lk = locking.Lock()
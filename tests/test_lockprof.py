@@ -0,0 +1,210 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+Lock/queue contention profiling (filament.lockprof, FIL_LOCK_PROFILE).
+
+The profile is process-wide, so every test turns it on only around the
+primitives it creates, and picks its own rows out by creation site.
+"""
+
+from __future__ import absolute_import
+
+import io
+import json
+
+import pytest
+
+import filament
+from filament import lockprof
+from _filament import locking
+from _filament import queue as fqueue
+
+from tests._helpers import run_py
+
+
+def run(fn):
+    return filament.spawn(fn).wait()
+
+
+@pytest.fixture
+def profiling():
+    was = lockprof.enabled()
+    lockprof.enable()
+    try:
+        yield
+    finally:
+        if not was:
+            lockprof.disable()
+
+
+def _rows(func_name, kind=None):
+    return [e for e in lockprof.snapshot()
+            if e["site"] is not None and e["site"].endswith(" in " + func_name)
+            and (kind is None or e["kind"] == kind)]
+
+
+def test_off_by_default_and_not_recorded():
+    assert lockprof.enabled() is False
+
+    def unprofiled_site():
+        return locking.Lock()
+
+    lk = unprofiled_site()
+    lk.acquire()
+    lk.release()
+    assert _rows("unprofiled_site") == []
+
+
+def test_lock_contention_counted(profiling):
+    def lock_site():
+        return locking.Lock()
+
+    lk = lock_site()
+
+    def holder():
+        with lk:
+            filament.sleep(0.02)
+
+    def body():
+        gts = [filament.spawn(holder) for _ in range(4)]
+        for g in gts:
+            g.wait()
+
+    run(body)
+    [row] = _rows("lock_site")
+    assert row["kind"] == "Lock"
+    assert row["live"] is True
+    assert row["instances"] == 1
+    assert row["acquisitions"] == 4
+    assert row["contended"] == 3
+    assert row["max_depth"] == 3
+    assert row["wait_max"] >= 0.015
+    assert row["wait_total"] >= row["wait_max"]
+
+
+def test_timeout_is_contended_not_acquired(profiling):
+    def sema_site():
+        return locking.Semaphore(0)
+
+    sema = sema_site()
+
+    def body():
+        return sema.acquire(timeout=0.01)
+
+    assert run(body) is False
+    [row] = _rows("sema_site")
+    assert (row["kind"], row["acquisitions"], row["contended"]) == ("Semaphore", 0, 1)
+
+
+def test_queue_waits_counted(profiling):
+    def queue_site():
+        return fqueue.Queue(1)
+
+    q = queue_site()
+
+    def body():
+        getters = [filament.spawn(q.get) for _ in range(3)]
+        filament.sleep(0.01)
+        for i in range(3):
+            q.put(i)
+        for g in getters:
+            g.wait()
+
+    run(body)
+    [row] = _rows("queue_site")
+    assert row["kind"] == "Queue"
+    # 3 gets + 3 puts; every get waited, and a put that found the one slot
+    # taken waited alongside getters that were woken but had not run yet.
+    assert row["acquisitions"] == 6
+    assert row["contended"] >= 3
+    assert row["max_depth"] >= 3
+
+
+def test_dead_instances_fold_by_site(profiling):
+    def loop_site():
+        return locking.RLock()
+
+    for _ in range(5):
+        lk = loop_site()
+        lk.acquire()
+        lk.acquire()
+        lk.release()
+        lk.release()
+    del lk
+
+    [row] = _rows("loop_site")
+    assert (row["live"], row["instances"], row["acquisitions"]) == (False, 5, 10)
+
+
+def test_kinds(profiling):
+    def kinds_site():
+        return [locking.Lock(), locking.RLock(), locking.Semaphore(),
+                locking.Condition(), locking.RWLock(), fqueue.Queue(),
+                fqueue.SimpleQueue(), fqueue.PriorityQueue(), fqueue.LifoQueue()]
+
+    objs = kinds_site()
+    kinds = sorted(e["kind"] for e in _rows("kinds_site"))
+    # Condition() brings its own RLock, created from the same site.
+    assert kinds == sorted(["Lock", "RLock", "RLock", "Semaphore", "Condition",
+                            "RWLock", "Queue", "SimpleQueue", "PriorityQueue",
+                            "LifoQueue"])
+    del objs
+
+
+def test_reset(profiling):
+    def reset_site():
+        return locking.Lock()
+
+    lk = reset_site()
+    lk.acquire()
+    lk.release()
+    assert _rows("reset_site")[0]["acquisitions"] == 1
+    lockprof.reset()
+    assert _rows("reset_site")[0]["acquisitions"] == 0
+
+
+def test_report_and_json(profiling):
+    def report_site():
+        return locking.Lock()
+
+    lk = report_site()
+    lk.acquire()
+    lk.release()
+
+    out = io.StringIO() if str is not bytes else io.BytesIO()
+    lockprof.report(sort_by="acquisitions", file=out)
+    lines = out.getvalue().splitlines()
+    assert lines[0].split()[:2] == ["kind", "n"]
+    assert any(l.endswith(" in report_site") for l in lines[1:])
+
+    buf = io.StringIO() if str is not bytes else io.BytesIO()
+    lockprof.dump_json(buf)
+    entries = json.loads(buf.getvalue())
+    assert [e for e in entries if e["site"] and e["site"].endswith(" in report_site")]
+    waits = [e["wait_total"] for e in entries]
+    assert waits == sorted(waits, reverse=True)
+
+    with pytest.raises(ValueError):
+        lockprof.report(sort_by="site", file=out)
+
+
+def test_env_enables():
+    res = run_py(r'''
+import sys
+from filament import lockprof
+from _filament import locking
+
+def env_site():
+    return locking.Lock()
+
+lk = env_site()
+rows = [e for e in lockprof.snapshot() if e["site"] and e["site"].endswith("env_site")]
+sys.stdout.write("%s %d\n" % (lockprof.enabled(), len(rows)))
+''', extra_env={"FIL_LOCK_PROFILE": "1"})
+    assert res.returncode == 0, repr(res)
+    assert res.stdout.strip().splitlines()[-1] == "True 1"
+
+
+def test_env_rejects_garbage():
+    res = run_py("import _filament.core", extra_env={"FIL_LOCK_PROFILE": "lots"})
+    assert res.returncode != 0
+    assert "FIL_LOCK_PROFILE" in res.stderr, repr(res)
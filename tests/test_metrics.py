@@ -0,0 +1,255 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+Runtime metrics (Scheduler.stats(), filament.metrics, FIL_METRICS).
+
+The counters are process-wide and never reset, so the tests look at how they
+move across a bit of work rather than at absolute values.
+"""
+
+from __future__ import absolute_import
+
+import re
+import threading
+
+import pytest
+
+import _filament.core as _core
+import filament
+from filament import metrics
+from filament import tpool
+
+from tests._helpers import run_py
+
+
+@pytest.fixture
+def timings():
+    metrics.enable()
+    try:
+        yield
+    finally:
+        metrics.disable()
+
+
+def _mine():
+    ident = threading.current_thread().ident
+    return [s for s in _core.scheduler_stats() if s["thread_id"] == ident][0]
+
+
+def test_scheduler_counters_move():
+    filament.spawn(filament.sleep, 0).wait()
+    before = _mine()
+    filament.joinall([filament.spawn(filament.sleep, 0.001)
+                      for _ in range(50)])
+    after = _mine()
+
+    def delta(name):
+        return after[name] - before[name]
+
+    assert delta("switches") >= 100
+    assert delta("events") >= delta("switches")
+    assert delta("passes") >= 1
+    assert delta("timers_armed") >= 50
+    assert delta("timers_fired") >= 50
+    assert delta("freelist_hits") + delta("freelist_misses") >= 100
+    assert delta("wakeups_local") >= 50
+    assert after["immediate"] == 0 and after["timers"] == 0
+
+
+def test_cancelled_timer_counted():
+    filament.spawn(filament.sleep, 0).wait()
+    before = _mine()["timers_cancelled"]
+    with pytest.raises(filament.Timeout):
+        with filament.Timeout(5):
+            raise filament.Timeout()
+    assert _mine()["timers_cancelled"] > before
+
+
+def test_remote_wakeups_counted():
+    filament.spawn(filament.sleep, 0).wait()
+    before = _mine()["wakeups_remote"]
+    for _ in range(5):
+        tpool.execute(lambda: None)
+    assert _mine()["wakeups_remote"] - before >= 5
+
+
+def test_scheduler_stats_method_matches():
+    sched = filament.Scheduler()
+    stats = sched.stats()
+    assert stats["thread_id"] == threading.current_thread().ident
+    assert set(stats["ready_latency"]) == {"count", "sum", "max", "buckets"}
+
+
+def test_histograms_only_with_timings():
+    assert not metrics.enabled()
+    filament.spawn(filament.sleep, 0).wait()
+    before = _mine()["ready_latency"]["count"]
+    filament.joinall([filament.spawn(filament.sleep, 0) for _ in range(20)])
+    assert _mine()["ready_latency"]["count"] == before
+
+
+def test_ready_latency_and_sleep(timings):
+    before = _mine()
+    filament.joinall([filament.spawn(filament.sleep, 0.002)
+                      for _ in range(20)])
+    after = _mine()
+    got = after["ready_latency"]["count"] - before["ready_latency"]["count"]
+    assert got >= 20
+    assert after["sleep"]["count"] > before["sleep"]["count"]
+    assert after["sleep"]["max"] >= 1000000
+    floors = [f for f, _ in after["ready_latency"]["buckets"]]
+    assert floors == sorted(floors)
+    assert sum(n for _, n in after["ready_latency"]["buckets"]) == \
+        after["ready_latency"]["count"]
+
+
+def test_percentile():
+    hist = {"count": 4, "sum": 0, "max": 1000,
+            "buckets": [(8, 2), (16, 1), (960, 1)]}
+    assert metrics.percentile(hist, 50) == 8e-9
+    assert metrics.percentile(hist, 75) == 17e-9
+    assert metrics.percentile(hist, 100) == 1000e-9
+    assert metrics.percentile({"count": 0, "sum": 0, "max": 0,
+                               "buckets": []}, 50) is None
+
+
+def test_other_threads_and_retired():
+    ident = []
+
+    def body():
+        ident.append(threading.current_thread().ident)
+        filament.joinall([filament.spawn(filament.sleep, 0)
+                          for _ in range(10)])
+        assert [s for s in _core.scheduler_stats()
+                if s["thread_id"] == ident[0]][0]["switches"] >= 10
+
+    retired = [s for s in _core.scheduler_stats()
+               if s["thread_id"] is None][0]["switches"]
+    t = threading.Thread(target=body)
+    t.start()
+    t.join()
+    totals = metrics.snapshot()["totals"]["switches"]
+    assert totals >= 10
+    # Once its scheduler is gone, the thread's counts are kept as retired.
+    import gc
+    gc.collect()
+    stats = _core.scheduler_stats()
+    if ident[0] not in [s["thread_id"] for s in stats]:
+        now = [s for s in stats if s["thread_id"] is None][0]["switches"]
+        assert now >= retired + 10
+
+
+def test_snapshot_shape_and_rates():
+    metrics.snapshot()
+    filament.joinall([filament.spawn(filament.sleep, 0) for _ in range(20)])
+    tpool.execute(lambda: None)
+    snap = metrics.snapshot()
+    assert snap["totals"]["switches_per_sec"] > 0
+    assert snap["totals"]["events_per_sec"] > 0
+    assert snap["io"]["events_per_sec"] is not None
+    for key in ("events", "classic_waits", "cached_waits", "cached_retries",
+                "cached_fallbacks"):
+        assert key in snap["io"]
+    assert snap["pools"]
+    pool = snap["pools"][0]
+    assert pool["completed"] <= pool["submitted"]
+    assert pool["min_threads"] <= pool["threads"] <= pool["max_threads"]
+    assert set(snap["totals"]["ready_latency"]) >= {"count", "p50", "p99"}
+
+
+def test_io_thread_counters():
+    import filament.socket as fsocket
+
+    before = metrics.snapshot()["io"]
+    a, b = fsocket.socketpair()
+    try:
+        def reader():
+            for _ in range(5):
+                b.recv(1)
+
+        g = filament.spawn(reader)
+        for _ in range(5):
+            filament.sleep(0.002)
+            a.send(b"x")
+        g.wait()
+    finally:
+        a.close()
+        b.close()
+    after = metrics.snapshot()["io"]
+    assert after["events"] - before["events"] >= 5
+    waits = (after["cached_waits"] + after["classic_waits"] -
+             before["cached_waits"] - before["classic_waits"])
+    assert waits >= 5
+
+
+def test_thread_pool_stats():
+    pool = tpool._get_pool()
+    before = pool.stats()
+    for _ in range(3):
+        tpool.execute(lambda: None)
+    after = pool.stats()
+    assert after["submitted"] - before["submitted"] == 3
+    assert after["completed"] - before["completed"] == 3
+    assert after["busy"] == 0 and after["queued"] == 0
+
+
+_LINE = re.compile(r'^[a-z_]+(\{[a-z_]+="[^"]*"(,[a-z_]+="[^"]*")*\})? '
+                   r'[-+0-9.e]+$')
+
+
+def test_prometheus_text(timings):
+    filament.joinall([filament.spawn(filament.sleep, 0.001)
+                      for _ in range(10)])
+    tpool.execute(lambda: None)
+    text = metrics.prometheus_text()
+    assert text.endswith("\n")
+    samples = {}
+    for line in text.splitlines():
+        if line.startswith("#"):
+            assert line.split()[1] in ("HELP", "TYPE")
+            continue
+        assert _LINE.match(line), line
+        name, value = line.rsplit(" ", 1)
+        samples[name] = float(value)
+    ident = threading.current_thread().ident
+    assert samples['filament_scheduler_switches_total{thread="%d"}' % ident] \
+        > 0
+    assert "filament_io_events_total" in samples
+    assert any(k.startswith("filament_thrpool_completed_total{pool=")
+               for k in samples)
+    # Histogram buckets are cumulative and end at the count.
+    prefix = "filament_scheduler_ready_latency_seconds_bucket{"
+    label = 'thread="%d"' % ident
+    buckets = [(k, v) for k, v in samples.items()
+               if k.startswith(prefix) and label in k]
+    finite = sorted((float(re.search(r'le="([^"]+)"', k).group(1)), v)
+                    for k, v in buckets if "+Inf" not in k)
+    counts = [v for _, v in finite]
+    assert counts == sorted(counts)
+    inf = [v for k, v in buckets if "+Inf" in k][0]
+    assert counts[-1] <= inf
+    assert inf == samples[
+        "filament_scheduler_ready_latency_seconds_count{%s}" % label]
+
+
+def test_metrics_mode():
+    assert _core.metrics_mode() == "off"
+    try:
+        assert _core.metrics_mode("on") == "on"
+        assert metrics.enabled()
+    finally:
+        _core.metrics_mode("off")
+    with pytest.raises(ValueError):
+        _core.metrics_mode("sometimes")
+
+
+def test_env_var_turns_timings_on():
+    res = run_py('''
+import filament
+from filament import metrics
+
+assert metrics.enabled()
+filament.joinall([filament.spawn(filament.sleep, 0) for _ in range(5)])
+assert metrics.snapshot()["totals"]["ready_latency"]["count"] >= 5
+print("OK")
+''', extra_env={"FIL_METRICS": "1"})
+    assert res.ok() and "OK" in res.stdout, repr(res)
@@ -57,6 +57,15 @@ def test_group_imap_reraises():
         list(g.imap(f, [1, 2, 3]))
 
 
+def test_group_imap_tracks_workers_while_running():
+    g = filament.Group()
+    it = g.imap(lambda x, y: (filament.sleep(0.01), x + y)[1], [1, 2], [3, 4])
+    filament.sleep(0)              # work starts without waiting for next()
+    assert len(g) >= 1
+    assert list(it) == [4, 6]
+    assert len(g) == 0             # workers leave once the input is drained
+
+
 def test_group_kill():
     g = filament.Group()
 
@@ -215,3 +224,112 @@ def test_pool_imap_unordered_all_present():
     pool = filament.Pool(4)
     results = set(pool.imap_unordered(lambda x: x * x, [1, 2, 3, 4, 5]))
     assert results == set([1, 4, 9, 16, 25])
+
+
+# --------------------------------------------------------------------------- #
+# map family on the C Fanout engine
+# --------------------------------------------------------------------------- #
+
+def test_imap_unordered_yields_in_completion_order():
+    pool = filament.Pool(4)
+
+    def f(x):
+        filament.sleep(0.05 if x == 0 else 0.001 * x)
+        return x
+
+    assert list(pool.imap_unordered(f, [0, 1, 2, 3])) == [1, 2, 3, 0]
+
+
+def test_pool_imap_reuses_bounded_workers_and_pulls_lazily():
+    pool = filament.Pool(3)
+    pulled = []
+    workers = set()
+    state = {'active': 0, 'peak': 0}
+
+    def source():
+        for i in range(50):
+            pulled.append(i)
+            yield i
+
+    def f(x):
+        workers.add(filament.getcurrent())
+        state['active'] += 1
+        state['peak'] = max(state['peak'], state['active'])
+        filament.sleep(0.001)
+        state['active'] -= 1
+        return x * 2
+
+    it = pool.imap(f, source())
+    for consumed, value in enumerate(it, 1):
+        assert value == (consumed - 1) * 2
+        # At most 'size' items taken beyond what has been handed out.
+        assert len(pulled) <= consumed + 3
+    assert state['peak'] <= 3
+    assert len(workers) <= 3
+
+
+def test_imap_abandoned_stops_pulling_input():
+    pool = filament.Pool(2)
+    pulled = []
+
+    def source():
+        for i in range(100):
+            pulled.append(i)
+            yield i
+
+    it = pool.imap(lambda x: (filament.sleep(0.001), x)[1], source())
+    assert next(it) == 0
+    del it
+    pool.join()
+    assert len(pulled) < 10
+
+
+def test_imap_input_error_raised_in_order():
+    def source():
+        yield 1
+        yield 2
+        raise KeyError('input')
+
+    it = filament.Pool(4).imap(lambda x: x * 10, source())
+    assert next(it) == 10
+    assert next(it) == 20
+    with pytest.raises(KeyError):
+        next(it)
+
+
+def test_fanout_refuses_other_threads():
+    import threading
+
+    it = filament.Pool(2).imap(lambda x: x, [1, 2])
+    errors = []
+
+    def other():
+        try:
+            next(it)
+        except RuntimeError as e:
+            errors.append(e)
+
+    t = threading.Thread(target=other)
+    t.start()
+    t.join()
+    assert len(errors) == 1
+    assert list(it) == [1, 2]
+
+
+def test_greenpile_spawn_blocks_when_pool_full():
+    pool = filament.Pool(2)
+    pile = filament.GreenPile(pool)
+    order = []
+
+    def f(x):
+        order.append(('start', x))
+        filament.sleep(0.01)
+        return x
+
+    for i in range(4):
+        pile.spawn(f, i)
+        order.append(('spawned', i))
+    # The third spawn had to wait for one of the first two to finish.
+    assert order.index(('spawned', 2)) > order.index(('start', 0))
+    assert list(pile) == [0, 1, 2, 3]
+    assert list(pile) == []
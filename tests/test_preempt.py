@@ -0,0 +1,293 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+Time-slice preemption (filament.preempt, FIL_PREEMPT).
+
+Preemption is process-wide, so each test turns it on and off again before
+returning.  Latency is measured by a greenthread that is spawned ahead of the
+hog and sleeps 1ms at a time: how late it wakes is how long the hog kept the
+scheduler.
+"""
+
+from __future__ import absolute_import
+
+import sys
+import threading
+import time
+
+import pytest
+
+import _filament.core as _core
+import filament
+from filament import preempt
+
+from tests._helpers import run_py
+
+
+def _pass():
+    # Preemption is picked up (or dropped) on a scheduler loop pass.
+    filament.spawn(filament.sleep, 0).wait()
+
+
+@pytest.fixture
+def preempting():
+    preempt.enable(0.005)
+    _pass()
+    try:
+        yield
+    finally:
+        preempt.disable()
+        _pass()
+
+
+def _spin(seconds):
+    end = time.time() + seconds
+    while time.time() < end:
+        pass
+
+
+def _preemptions():
+    ident = threading.current_thread().ident
+    return [s for s in _core.scheduler_stats()
+            if s["thread_id"] == ident][0]["preemptions"]
+
+
+def _ticks(seconds, out):
+    # How late each of a run of 1ms sleeps woke up.
+    end = time.time() + seconds
+    while time.time() < end:
+        start = time.time()
+        filament.sleep(0.001)
+        out.append(time.time() - start)
+
+
+def _lateness(hog, *args):
+    lateness = []
+    ticker = filament.spawn(_ticks, 0.01, lateness)
+    g = filament.spawn(hog, *args)
+    ticker.wait()
+    g.wait()
+    return lateness
+
+
+def test_hog_is_switched_out(preempting):
+    before = _preemptions()
+    lateness = []
+    ticker = filament.spawn(_ticks, 0.15, lateness)
+    hog = filament.spawn(_spin, 0.2)
+    ticker.wait()
+    hog.wait()
+    assert len(lateness) >= 5
+    assert max(lateness) < 0.05, lateness
+    assert _preemptions() - before >= 5
+
+
+def test_two_hogs_take_turns(preempting):
+    order = []
+
+    def hog(name):
+        end = time.time() + 0.1
+        while time.time() < end:
+            if not order or order[-1] != name:
+                order.append(name)
+
+    filament.joinall([filament.spawn(hog, "a"), filament.spawn(hog, "b")])
+    assert len(order) >= 4, order
+
+
+def test_not_preempted_when_off():
+    assert not preempt.enabled()
+    assert _lateness(_spin, 0.05)[0] >= 0.04
+
+
+def test_own_slice_of_zero_exempts(preempting):
+    def exempt():
+        preempt.set_slice(0)
+        _spin(0.08)
+
+    assert _lateness(exempt)[0] >= 0.06
+
+
+def test_set_and_get_slice():
+    g = filament.spawn(filament.sleep, 0)
+    assert preempt.get_slice(g) is None
+    preempt.set_slice(0.02, g)
+    assert preempt.get_slice(g) == pytest.approx(0.02)
+    preempt.set_slice(0, g)
+    assert preempt.get_slice(g) == 0.0
+    g.time_slice = None
+    assert g.time_slice is None
+    with pytest.raises(ValueError):
+        preempt.set_slice(-1, g)
+    with pytest.raises(TypeError):
+        preempt.get_slice(object())
+    g.wait()
+
+
+def test_lock_holder_is_left_alone(preempting):
+    lock = filament.Lock()
+
+    def holder():
+        with lock:
+            _spin(0.08)
+
+    assert _lateness(holder)[0] >= 0.06
+
+
+def test_rwlock_holders_are_left_alone(preempting):
+    rw = filament.RWLock()
+
+    def reader():
+        with rw.reader:
+            _spin(0.08)
+
+    def upgrader():
+        with rw.upgradable:
+            rw.upgrade()
+            _spin(0.08)
+
+    assert _lateness(reader)[0] >= 0.06
+    assert _lateness(upgrader)[0] >= 0.06
+    # All released: preempted again.
+    assert max(_lateness(_spin, 0.08)) < 0.05
+
+
+def test_release_counted_while_preemption_is_off(preempting):
+    lock = filament.Lock()
+
+    def hog():
+        lock.acquire()
+        preempt.disable()
+        lock.release()
+        preempt.enable(0.005)
+        filament.sleep(0)
+        _spin(0.08)
+
+    assert max(_lateness(hog)) < 0.05
+
+
+def test_disabled_block(preempting):
+    def hog():
+        with preempt.disabled():
+            with preempt.disabled():
+                _spin(0.04)
+            _spin(0.04)
+        _spin(0.04)
+
+    # Held off for the two disabled spins, then let in.
+    lateness = _lateness(hog)
+    assert 0.07 <= lateness[0] < 0.11, lateness
+
+
+def test_unbalanced_enable():
+    with pytest.raises(RuntimeError):
+        filament.spawn(_core.preempt_enable).wait()
+    # Outside a greenthread both do nothing.
+    _core.preempt_disable()
+    _core.preempt_enable()
+
+
+def test_kill_while_preempted(preempting):
+    ran = []
+
+    def hog():
+        try:
+            _spin(1.0)
+        finally:
+            ran.append(True)
+
+    g = filament.spawn(hog)
+    filament.sleep(0.02)
+    start = time.time()
+    filament.kill(g)
+    # Raised at the call it was preempted at.
+    with pytest.raises(filament.GreenletExit):
+        g.wait()
+    assert ran
+    assert g.dead
+    assert time.time() - start < 0.5
+
+
+def test_enable_disable_and_slice():
+    assert preempt.time_slice() is None
+    preempt.enable(0.02)
+    try:
+        assert preempt.enabled()
+        assert preempt.time_slice() == pytest.approx(0.02)
+        preempt.enable(0.03)
+        assert preempt.time_slice() == pytest.approx(0.03)
+    finally:
+        preempt.disable()
+    assert not preempt.enabled()
+    with pytest.raises(ValueError):
+        preempt.enable(0)
+
+
+def test_nothing_preempted_after_disable():
+    preempt.enable(0.005)
+    _pass()
+    preempt.disable()
+    _pass()
+    before = _preemptions()
+    filament.spawn(_spin, 0.03).wait()
+    assert _preemptions() == before
+
+
+def test_existing_profiler_keeps_its_thread():
+    calls = []
+
+    def profiler(frame, event, arg):
+        calls.append(event)
+
+    sys.setprofile(profiler)
+    try:
+        preempt.enable(0.005)
+        _pass()
+        before = _preemptions()
+        filament.spawn(_spin, 0.03).wait()
+        assert _preemptions() == before
+        assert calls
+    finally:
+        sys.setprofile(None)
+        preempt.disable()
+        _pass()
+
+
+def test_other_threads_schedulers(preempting):
+    out = []
+
+    def body():
+        out.append(max(_lateness(_spin, 0.1)))
+
+    t = threading.Thread(target=body)
+    t.start()
+    t.join()
+    assert out[0] < 0.05, out
+
+
+def test_env_var_turns_it_on():
+    res = run_py('''
+import time
+import filament
+from filament import preempt
+
+assert abs(preempt.time_slice() - 0.005) < 1e-9
+
+def spin():
+    end = time.time() + 0.1
+    while time.time() < end:
+        pass
+
+def tick(out):
+    start = time.time()
+    filament.sleep(0.001)
+    out.append(time.time() - start)
+
+out = []
+ticker = filament.spawn(tick, out)
+hog = filament.spawn(spin)
+ticker.wait()
+hog.wait()
+assert out[0] < 0.05, out
+print("OK")
+''', extra_env={"FIL_PREEMPT": "5"})
+    assert res.ok() and "OK" in res.stdout, repr(res)
@@ -0,0 +1,203 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+os.fork() with filament running, and the filament.prefork supervisor.
+
+The fork scenarios run in a fresh subprocess (run_py) so the children are
+never copies of pytest.  The supervisor test drives a real supervisor from
+here with plain blocking sockets and signals, as an operator would.
+"""
+
+from __future__ import absolute_import
+
+import os
+import signal
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+import pytest
+
+from tests._helpers import REPO_ROOT, run_py
+
+pytestmark = pytest.mark.skipif(not hasattr(os, "register_at_fork"),
+                                reason="needs os.register_at_fork")
+
+
+def test_fork_child_has_working_runtime():
+    # The parent warms up everything that carries state across a fork: the
+    # io thread (and a persistent event cached on the listening socket), the
+    # default thread pool, pooled fiber stacks.  The child must be able to
+    # use all of it, and the parent must carry on afterwards.
+    res = run_py('''
+import os, sys
+import filament
+import filament.socket as fs
+from filament import tpool
+
+l = fs.socket()
+l.setsockopt(fs.SOL_SOCKET, fs.SO_REUSEADDR, 1)
+l.bind(("127.0.0.1", 0))
+l.listen(16)
+addr = l.getsockname()
+
+def echo_once():
+    c, a = l.accept()
+    c.sendall(c.recv(10))
+    c.close()
+
+def round_trip(msg):
+    g = filament.spawn(echo_once)
+    c = fs.create_connection(addr)
+    c.sendall(msg)
+    got = c.recv(10)
+    c.close()
+    g.wait()
+    return got
+
+assert round_trip(b"p") == b"p"
+assert tpool.execute(lambda: 41) + 1 == 42
+filament.joinall([filament.spawn(filament.sleep, 0) for _ in range(100)])
+
+pid = os.fork()
+if pid == 0:
+    code = 1
+    try:
+        assert round_trip(b"c") == b"c"
+        assert tpool.execute(lambda: 7) == 7
+        filament.joinall([filament.spawn(filament.sleep, 0.001)
+                          for _ in range(100)])
+        code = 0
+    finally:
+        sys.stdout.flush()
+        os._exit(code)
+
+_, status = os.waitpid(pid, 0)
+assert status == 0, status
+assert round_trip(b"q") == b"q"
+assert tpool.execute(lambda: 1) == 1
+print("OK")
+''', timeout=30)
+    assert res.ok(), repr(res)
+    assert "OK" in res.stdout, repr(res)
+
+
+_SUPERVISOR = '''
+import os, sys
+import filament
+from filament import prefork
+from filament.gevent_compat.server import StreamServer
+
+def handle(sock, addr):
+    if sock.recv(100) == b"slow":
+        filament.sleep(0.5)
+    sock.sendall(str(os.getpid()).encode())
+
+server = StreamServer(("127.0.0.1", 0), handle, spawn=10)
+print(server.server_port)
+sys.stdout.flush()
+prefork.serve(server, processes=2, grace=2)
+print("stopped")
+'''
+
+
+def _ask(port, msg=b"x"):
+    s = socket.create_connection(("127.0.0.1", port), timeout=10)
+    try:
+        s.sendall(msg)
+        return int(s.recv(100))
+    finally:
+        s.close()
+
+
+def _wait_for(predicate, timeout=10):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if predicate():
+            return True
+        time.sleep(0.02)
+    return False
+
+
+def _alive(pid):
+    # The supervisor reaps its workers, so a finished one disappears.
+    try:
+        os.kill(pid, 0)
+    except OSError:
+        return False
+    return True
+
+
+def test_prefork_serve_reload_respawn_and_stop():
+    env = dict(os.environ, PYTHONPATH=REPO_ROOT)
+    sup = subprocess.Popen([sys.executable, "-c", _SUPERVISOR],
+                           stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                           env=env, cwd=REPO_ROOT)
+    try:
+        port = int(sup.stdout.readline())
+
+        # Both workers accept on the one inherited listener.
+        seen = set()
+        assert _wait_for(lambda: seen.add(_ask(port)) or len(seen) == 2), seen
+        assert sup.pid not in seen
+        old = set(seen)
+
+        # A reload forks new workers before the old ones stop, and an old
+        # worker finishes the request it was in the middle of.
+        slow = []
+        t = threading.Thread(target=lambda: slow.append(_ask(port, b"slow")))
+        t.start()
+        time.sleep(0.2)
+        os.kill(sup.pid, signal.SIGHUP)
+        fresh = set()
+
+        def new_generation():
+            pid = _ask(port)
+            if pid not in old:
+                fresh.add(pid)
+            return len(fresh) == 2
+        assert _wait_for(new_generation), fresh
+        t.join(10)
+        assert slow and slow[0] in old, slow
+        assert _wait_for(lambda: not any(_alive(p) for p in old))
+
+        # A worker that dies is replaced.
+        victim = sorted(fresh)[0]
+        os.kill(victim, signal.SIGKILL)
+        replaced = set()
+
+        def replacement():
+            pid = _ask(port)
+            if pid not in fresh and pid not in old:
+                replaced.add(pid)
+            return bool(replaced)
+        assert _wait_for(replacement), replaced
+
+        # SIGTERM stops everything and closes the listener.
+        os.kill(sup.pid, signal.SIGTERM)
+        out, err = sup.communicate(timeout=20)
+        assert sup.returncode == 0, err
+        assert b"stopped" in out, (out, err)
+        with pytest.raises(socket.error):
+            _ask(port)
+    finally:
+        if sup.poll() is None:
+            sup.kill()
+            sup.wait()
+
+
+def test_prefork_serve_refuses_started_server():
+    res = run_py('''
+from filament import prefork
+from filament.gevent_compat.server import StreamServer
+
+server = StreamServer(("127.0.0.1", 0), lambda s, a: None)
+server.start()
+try:
+    prefork.serve(server, processes=1)
+except ValueError:
+    print("OK")
+server.stop()
+''')
+    assert res.ok() and "OK" in res.stdout, repr(res)
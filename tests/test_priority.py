@@ -0,0 +1,173 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+Greenthread priority classes (spawn(priority=), set_priority()).
+"""
+
+from __future__ import absolute_import
+
+import pytest
+
+import _filament.core as _core
+import filament
+from filament import PRIORITY_HIGH, PRIORITY_LOW, PRIORITY_NORMAL
+
+
+def test_constants():
+    assert (PRIORITY_HIGH, PRIORITY_NORMAL, PRIORITY_LOW) == (0, 1, 2)
+    assert _core.PRIORITY_NORMAL == PRIORITY_NORMAL
+
+
+def test_high_runs_before_queued_normal():
+    order = []
+    filament.spawn(order.append, "n1")
+    filament.spawn(order.append, "low", priority=PRIORITY_LOW)
+    filament.spawn(order.append, "n2")
+    filament.spawn(order.append, "high", priority=PRIORITY_HIGH)
+    filament.sleep(0.01)
+    assert order == ["high", "n1", "n2", "low"]
+
+
+def test_high_wakeup_cuts_a_normal_batch():
+    evt = filament.Event()
+    order = []
+
+    def urgent():
+        evt.wait()
+        order.append("high")
+
+    def normal(i):
+        if i == 0:
+            evt.set()
+        order.append(i)
+
+    filament.spawn(urgent, priority=PRIORITY_HIGH)
+    filament.sleep(0)
+    filament.joinall([filament.spawn(normal, i) for i in range(100)])
+    filament.sleep(0)
+    # One quantum of normals goes on running, then the woken high one.
+    assert "high" in order
+    assert order.index("high") <= 20, order
+
+
+def test_low_is_not_starved():
+    stop = []
+    ran = []
+
+    def busy():
+        while not stop:
+            filament.sleep(0)
+
+    busies = [filament.spawn(busy) for _ in range(50)]
+    filament.spawn(ran.append, True, priority=PRIORITY_LOW)
+    for _ in range(200):
+        if ran:
+            break
+        filament.sleep(0)
+    stop.append(True)
+    filament.joinall(busies)
+    assert ran
+
+
+def test_wakeup_keeps_the_class():
+    evt = filament.Event()
+    lock = filament.Lock()
+    order = []
+
+    def on_event():
+        evt.wait()
+        order.append("event")
+
+    def on_lock():
+        with lock:
+            order.append("lock")
+
+    lock.acquire()
+    gts = [filament.spawn(on_event, priority=PRIORITY_HIGH),
+           filament.spawn(on_lock, priority=PRIORITY_HIGH)]
+    filament.sleep(0)
+    gts.extend(filament.spawn(order.append, i) for i in range(3))
+    evt.set()
+    lock.release()
+    filament.joinall(gts)
+    # Both wakeups were queued after the normal spawns, yet run first.
+    assert sorted(order[:2]) == ["event", "lock"], order
+
+
+def test_timeout_wakeup_keeps_the_class():
+    order = []
+
+    def sleeper():
+        filament.sleep(0.005)
+        order.append("high")
+
+    def spinner(i):
+        filament.sleep(0.005)
+        order.append(i)
+
+    gts = [filament.spawn(spinner, i) for i in range(10)]
+    gts.append(filament.spawn(sleeper, priority=PRIORITY_HIGH))
+    filament.joinall(gts)
+    assert order[0] == "high", order
+
+
+def test_spawn_inherits_the_class():
+    got = []
+
+    def child():
+        got.append(filament.get_priority())
+
+    def parent():
+        filament.spawn(child).wait()
+        filament.spawn(child, priority=PRIORITY_NORMAL).wait()
+
+    filament.spawn(parent, priority=PRIORITY_LOW).wait()
+    filament.spawn(child).wait()
+    assert got == [PRIORITY_LOW, PRIORITY_NORMAL, PRIORITY_NORMAL]
+
+
+def test_set_priority():
+    g = filament.spawn(filament.sleep, 0.01)
+    assert g.priority == PRIORITY_NORMAL
+    filament.set_priority(PRIORITY_HIGH, g)
+    assert filament.get_priority(g) == PRIORITY_HIGH
+    g.wait()
+
+    got = []
+
+    def body():
+        filament.set_priority(PRIORITY_LOW)
+        filament.sleep(0)
+        got.append(filament.get_priority())
+        got.append(filament.spawn(filament.get_priority).wait())
+
+    filament.spawn(body).wait()
+    assert got == [PRIORITY_LOW, PRIORITY_LOW]
+    assert filament.get_priority() == PRIORITY_NORMAL
+
+
+def test_bad_values():
+    with pytest.raises(ValueError):
+        filament.spawn(filament.sleep, 0, priority=3)
+    with pytest.raises(ValueError):
+        filament.spawn_n(filament.sleep, 0, priority=-1)
+    with pytest.raises(TypeError):
+        filament.spawn(filament.sleep, 0, priority="high")
+    g = filament.spawn(filament.sleep, 0)
+    with pytest.raises(ValueError):
+        g.priority = 7
+    with pytest.raises(TypeError):
+        filament.set_priority(PRIORITY_HIGH, object())
+    g.wait()
+
+
+def test_priority_and_stack_size_together():
+    g = filament.spawn(filament.get_priority, priority=PRIORITY_HIGH,
+                       stack_size=128 * 1024)
+    assert g.wait() == PRIORITY_HIGH
+
+
+def test_keyword_not_passed_to_target():
+    def target(**kwargs):
+        return kwargs
+
+    assert filament.spawn(target, a=1, priority=None).wait() == {"a": 1}
@@ -102,6 +102,81 @@ def test_fully_mixed_single_queue():
                                  list(range(100000, 100000 + n)))
 
 
+def test_batches_native_and_green():
+    # put_many/get_many from both sides of a bounded queue: every batch has
+    # to wait for room or items partway through.
+    n = 2000
+    q = filq.Queue(maxsize=16)
+    got = []
+
+    def native_producer():
+        for i in range(0, n, 100):
+            q.put_many(range(i, i + 100))
+
+    def native_consumer():
+        while len(got) < n:
+            got.extend(q.get_many(37))
+
+    native = [_native(native_producer), _native(native_consumer)]
+    _join_all(native)
+    assert got == list(range(n))
+
+    del got[:]
+    t = _native(native_consumer)
+
+    def green_producer():
+        q.put_many(range(n))
+
+    filament.wait([filament.spawn(green_producer)])
+    _join_all([t])
+    assert got == list(range(n))
+
+
+class _Prio(object):
+    # A Python-level __lt__: the interpreter may hand the GIL to another
+    # thread in the middle of a heap sift.
+    __slots__ = ("v",)
+
+    def __init__(self, v):
+        self.v = v
+
+    def __lt__(self, other):
+        return self.v < other.v
+
+
+def test_priority_queue_mixed_with_python_compare():
+    import sys
+
+    n = 400
+    q = filq.PriorityQueue(maxsize=25)
+    got = []
+    got_lock = threading.Lock()
+
+    def producer(base):
+        for i in range(n):
+            q.put(_Prio(base + i))
+
+    def consumer():
+        for _ in range(n):
+            v = q.get().v
+            with got_lock:
+                got.append(v)
+            q.task_done()
+
+    interval = sys.getswitchinterval()
+    sys.setswitchinterval(1e-6)
+    try:
+        native = [_native(producer, 100000), _native(consumer)]
+        filament.wait([filament.spawn(producer, 0),
+                       filament.spawn(consumer)])
+        _join_all(native)
+    finally:
+        sys.setswitchinterval(interval)
+    assert sorted(got) == sorted(list(range(n)) +
+                                 list(range(100000, 100000 + n)))
+    assert q.join(timeout=1) is True
+
+
 def test_native_thread_get_timeout():
     # Timed q.get() from a native thread must raise Empty, not hang.
     q = filq.Queue()
@@ -318,3 +318,221 @@ def test_put_wakeup_passed_on_when_putter_is_killed():
     done, item = run(body)
     assert done == ["survivor"], done
     assert item == "survivor"
+
+
+# --------------------------------------------------------------------------- #
+# put_many / get_many
+# --------------------------------------------------------------------------- #
+
+@pytest.mark.parametrize("cls", [cqueue.Queue, cqueue.SimpleQueue])
+def test_batch_order_across_chunks(cls):
+    # Well past one FilFifoQ chunk, mixed with single gets.
+    q = cls()
+    assert q.put_many(range(50000)) == 50000
+    assert q.get() == 0
+    assert q.get_many(30000) == list(range(1, 30001))
+    assert q.put_many(iter(range(50000, 60000))) == 10000
+    assert q.get_many(100000) == list(range(30001, 60000))
+    assert q.qsize() == 0
+
+
+def test_put_many_partial_progress():
+    q = cqueue.Queue(maxsize=5)
+    assert q.put_many([1, 2, 3]) == 3
+    assert q.put_many("abcd", block=False) == 2
+    with pytest.raises(cqueue.Full):
+        q.put_many(["x"], block=False)
+    assert q.put_many([]) == 0
+    assert q.get_many(10) == [1, 2, 3, "a", "b"]
+
+    q.put_many(range(4))
+    assert run(lambda: q.put_many(range(3), timeout=0.01)) == 1
+    with pytest.raises(cqueue.Full):
+        run(lambda: q.put_many(range(3), timeout=0.01))
+
+
+def test_get_many_empty_and_bad_max():
+    q = cqueue.Queue()
+    with pytest.raises(cqueue.Empty):
+        q.get_many(3, block=False)
+    with pytest.raises(cqueue.Empty):
+        run(lambda: q.get_many(3, timeout=0.01))
+    with pytest.raises(ValueError):
+        q.get_many(0)
+
+
+def test_put_many_waits_for_room_and_counts_tasks():
+    def body():
+        q = cqueue.Queue(maxsize=3)
+        got = []
+
+        def consumer():
+            while len(got) < 100:
+                got.extend(q.get_many(4))
+
+        c = filament.spawn(consumer)
+        assert q.put_many(range(100)) == 100
+        c.wait()
+        assert q.join(timeout=0.01) is False
+        for _ in got:
+            q.task_done()
+        return got, q.join(timeout=0.01)
+
+    got, joined = run(body)
+    assert got == list(range(100))
+    assert joined is True
+
+
+def test_put_many_wakes_one_getter_per_item():
+    def body():
+        q = cqueue.Queue()
+        got = []
+        getters = [filament.spawn(lambda: got.append(q.get())) for _ in range(5)]
+        filament.sleep(0)              # all parked in get()
+        q.put_many(["a", "b"])
+        filament.sleep(0)
+        woke = len(got)
+        q.put_many(["c", "d", "e"])
+        filament.joinall(getters)
+        return woke, sorted(got)
+
+    woke, got = run(body)
+    assert woke == 2
+    assert got == ["a", "b", "c", "d", "e"]
+
+
+# --------------------------------------------------------------------------- #
+# C PriorityQueue / LifoQueue
+# --------------------------------------------------------------------------- #
+
+class _Key(object):
+    """Orders by .v through a Python-level __lt__ that can be made to raise."""
+
+    def __init__(self, v):
+        self.v = v
+
+    def __lt__(self, other):
+        if self.v is None or other.v is None:
+            raise ZeroDivisionError("uncomparable")
+        return self.v < other.v
+
+
+def test_priority_order_matches_sorted():
+    import random
+
+    rnd = random.Random(40)
+    keys = ([rnd.random() for _ in range(2000)] +
+            [rnd.randint(-50, 50) for _ in range(2000)] +
+            [2 ** 70, -2 ** 70, float("inf")])
+    tuples = [(rnd.randint(0, 5), rnd.random(), i) for i in range(2000)]
+    mixed = [(rnd.randint(0, 3), str(rnd.randint(0, 3)), i) for i in range(500)]
+
+    for items in (keys, tuples, mixed):
+        q = cqueue.PriorityQueue()
+        for x in items:
+            q.put(x)
+        assert len(q) == len(items)
+        # Interleave some puts with the gets so the heap shrinks and regrows.
+        out = [q.get() for _ in range(len(items) // 2)]
+        for x in out[-100:]:
+            q.put(x)
+        out = out[:-100] + [q.get() for _ in range(q.qsize())]
+        assert sorted(out) == sorted(items)
+        assert out == sorted(out)
+
+
+def test_lifo_order_and_bounds():
+    q = cqueue.LifoQueue(maxsize=3)
+    for i in range(3):
+        q.put(i)
+    assert q.full()
+    with pytest.raises(cqueue.Full):
+        q.put_nowait(3)
+    with pytest.raises(cqueue.Full):
+        q.put(3, timeout=0.01)
+    assert [q.get() for _ in range(3)] == [2, 1, 0]
+    with pytest.raises(cqueue.Empty):
+        q.get_nowait()
+    with pytest.raises(cqueue.Empty):
+        q.get(block=False)
+
+
+@pytest.mark.parametrize("cls", [cqueue.PriorityQueue, cqueue.LifoQueue])
+def test_heap_queues_block_and_join(cls):
+    def body():
+        q = cls(maxsize=2)
+        done = []
+
+        def worker():
+            for item in q:
+                done.append(item)
+                q.task_done()
+
+        w = filament.spawn(worker)
+        for i in (5, 3, 9, 1, 7):
+            q.put(i)                 # blocks on the full queue
+        joined = q.join(timeout=5)
+        q.put(StopIteration)
+        w.wait()
+        return joined, sorted(done)
+
+    joined, done = run(body)
+    assert joined is True
+    assert done == [1, 3, 5, 7, 9]
+
+
+def test_priority_failed_compare_leaves_queue_intact():
+    q = cqueue.PriorityQueue()
+    keys = [_Key(i) for i in range(40)]
+    for k in keys:
+        q.put(k)
+
+    with pytest.raises(ZeroDivisionError):
+        q.put(_Key(None))
+    assert q.qsize() == 40
+
+    # Put in order, so keys[-1] sits in the heap's last slot, and get()
+    # moves it to the root to sift down: make it uncomparable and the get
+    # must fail with the queue unchanged.
+    keys[-1].v = None
+    with pytest.raises(ZeroDivisionError):
+        q.get()
+    assert q.qsize() == 40
+    keys[-1].v = 39
+    assert [q.get().v for _ in range(40)] == list(range(40))
+
+
+def test_priority_failed_put_is_not_a_task():
+    def body():
+        q = cqueue.PriorityQueue()
+        q.put(_Key(1))
+        with pytest.raises(ZeroDivisionError):
+            q.put(_Key(None))
+        q.get()
+        q.task_done()
+        return q.join(timeout=1)
+
+    assert run(body) is True
+
+
+def test_priority_compare_that_yields():
+    # A __lt__ that switches greenthreads mid-sift: other gets and puts
+    # wait for the sift instead of seeing a half-sifted heap.
+    class Slow(_Key):
+        def __lt__(self, other):
+            filament.sleep(0)
+            return _Key.__lt__(self, other)
+
+    def body():
+        q = cqueue.PriorityQueue()
+
+        def producer(base):
+            for i in range(50):
+                q.put(Slow(base + i))
+
+        filament.joinall([filament.spawn(producer, b) for b in (0, 1000, 2000)])
+        return [q.get().v for _ in range(150)]
+
+    out = run(body)
+    assert out == sorted(out)
+    assert len(out) == 150
@@ -10,12 +10,14 @@ other greenthreads make progress while the worker thread blocks.
 
 from __future__ import absolute_import
 
+import os
 import time as _real_time
 
 import pytest
 
 import filament
 import filament.tpool as tpool
+from _filament.thrpool import ThreadPool
 
 
 def test_execute_returns_value():
@@ -116,3 +118,83 @@ def test_set_num_threads():
         return tpool.execute(lambda: "ok")
 
     assert filament.spawn(driver).wait() == "ok"
+
+
+_linux_only = pytest.mark.skipif(not hasattr(os, "sched_getaffinity"),
+                                 reason="thread placement is Linux-only")
+
+
+def _run_in(pool, func):
+    return filament.spawn(
+        lambda: pool.run(tpool._tpool_call, func, (), {})).wait()
+
+
+@_linux_only
+def test_placement_compact_pins_each_worker():
+    allowed = sorted(os.sched_getaffinity(0))
+    pool = ThreadPool(min_threads=2, max_threads=2, cpus=allowed,
+                      placement="compact")
+    try:
+        mask = _run_in(pool, lambda: os.sched_getaffinity(0))
+    finally:
+        pool.shutdown(wait=True)
+    assert len(mask) == 1
+    assert mask <= set(allowed)
+
+
+@_linux_only
+def test_placement_numa_shared_stays_in_process_mask():
+    allowed = os.sched_getaffinity(0)
+    pool = ThreadPool(min_threads=1, max_threads=1, cpus="numa")
+    try:
+        mask = _run_in(pool, lambda: os.sched_getaffinity(0))
+    finally:
+        pool.shutdown(wait=True)
+    assert mask and mask <= allowed
+
+
+@_linux_only
+def test_sched_batch_and_nice_apply_to_workers_only():
+    before = (os.sched_getscheduler(0), os.getpriority(os.PRIO_PROCESS, 0))
+    pool = ThreadPool(min_threads=1, max_threads=1, sched_batch=True, nice=5)
+    try:
+        policy, prio = _run_in(
+            pool, lambda: (os.sched_getscheduler(0),
+                           os.getpriority(os.PRIO_PROCESS, 0)))
+    finally:
+        pool.shutdown(wait=True)
+    assert policy == os.SCHED_BATCH
+    assert prio == 5
+    # Per-thread on Linux: the calling thread is untouched.
+    assert (os.sched_getscheduler(0),
+            os.getpriority(os.PRIO_PROCESS, 0)) == before
+
+
+@pytest.mark.parametrize("kwargs", [
+    {"cpus": "0-"},
+    {"cpus": []},
+    {"cpus": [-1]},
+    {"placement": "scattered"},
+    {"nice": 40},
+])
+def test_bad_placement_options_raise(kwargs):
+    with pytest.raises(ValueError):
+        ThreadPool(min_threads=1, max_threads=1, **kwargs)
+
+
+@_linux_only
+def test_cpus_outside_process_mask_raise():
+    outside = max(os.sched_getaffinity(0)) + 1
+    with pytest.raises(ValueError):
+        ThreadPool(min_threads=1, max_threads=1, cpus=[outside])
+
+
+def test_configure_applies_to_default_pool():
+    def driver():
+        tpool.configure(placement="shared")
+        try:
+            return tpool.execute(lambda: "ok")
+        finally:
+            tpool._pool_options.clear()
+
+    assert filament.spawn(driver).wait() == "ok"
@@ -0,0 +1,263 @@
+# The MIT License (MIT): http://opensource.org/licenses/mit-license.php
+"""
+Scheduler tracing (filament.trace, FIL_TRACE) and its Chrome / Perfetto
+output.
+
+Tracing is process-wide, so each test starts its own trace and stops it
+before returning, and picks its own greenthreads out by id.
+"""
+
+from __future__ import absolute_import
+
+import io
+import json
+import struct
+
+import pytest
+
+import filament
+import filament.socket as fsocket
+from filament import tpool
+from filament import trace
+
+from tests._helpers import run_py
+
+
+@pytest.fixture
+def tracing():
+    trace.start()
+    try:
+        yield
+    finally:
+        trace.stop()
+
+
+def _gl_id(g):
+    return "0x%x" % id(g)
+
+
+def _runs(events, g):
+    return [e for e in events
+            if e.get("cat") == "run" and e["args"]["greenthread"] == _gl_id(g)]
+
+
+def test_park_reasons(tracing):
+    lock = filament.Lock()
+    q = filament.Queue()
+    a, b = fsocket.socketpair()
+
+    def holder():
+        with lock:
+            filament.sleep(0.01)
+
+    def contender():
+        with lock:
+            pass
+
+    def consumer():
+        q.get()
+
+    def reader():
+        b.recv(10)
+
+    def offload():
+        tpool.execute(lambda: 1)
+
+    gts = dict((f.__name__, filament.spawn(f))
+               for f in (holder, contender, consumer, reader, offload))
+    filament.sleep(0.005)
+    q.put(1)
+    a.sendall(b"x")
+    filament.joinall(list(gts.values()))
+    trace.stop()
+    a.close()
+    b.close()
+
+    events = trace.chrome_events()
+    expect = {"holder": "sleep", "contender": "lock", "consumer": "queue",
+              "reader": "fd-read", "offload": "thrpool"}
+    for name, why in expect.items():
+        parks = [e["args"].get("parked") for e in _runs(events, gts[name])]
+        assert why in parks, (name, parks)
+
+
+def test_wakes_link_to_runs(tracing):
+    a, b = fsocket.socketpair()
+    g = filament.spawn(b.recv, 10)
+    filament.sleep(0.01)
+    a.sendall(b"x")
+    assert g.wait() == b"x"
+    trace.stop()
+    a.close()
+    b.close()
+
+    events = trace.chrome_events()
+    runs = _runs(events, g)
+    assert len(runs) >= 2, runs
+    wakes = [e for e in events if e.get("cat") == "wake" and e["ph"] == "X"
+             and e["args"]["greenthread"] == _gl_id(g)]
+    assert wakes, events
+    # The io thread queued the wakeup from its own track, and the flow from
+    # it ends on the run it caused.
+    sched_tid = runs[0]["tid"]
+    assert any(w["tid"] != sched_tid for w in wakes), wakes
+    starts = dict((e["id"], e) for e in events if e["ph"] == "s")
+    ends = [e for e in events if e["ph"] == "f" and e["id"] in starts]
+    assert any(e["tid"] == sched_tid and
+               any(abs(r["ts"] - e["ts"]) < 1e-6 for r in runs)
+               for e in ends), ends
+    # Run slices carry a duration and names label the tracks.
+    assert all(r["dur"] >= 0 for r in runs)
+    assert any(e["ph"] == "M" and e["tid"] == sched_tid and
+               e["args"]["name"].startswith("scheduler:") for e in events)
+
+
+def test_off_records_nothing():
+    trace.start()
+    trace.stop()
+    before = sum(len(r) for _, r in trace.records())
+    filament.joinall([filament.spawn(filament.sleep, 0) for _ in range(50)])
+    assert sum(len(r) for _, r in trace.records()) == before
+    assert not trace.enabled()
+
+
+def test_ring_keeps_the_latest():
+    # In a fresh process: a scheduler's ring is sized when it is first traced.
+    res = run_py('''
+import filament
+from filament import trace
+
+trace.start(size=64)
+
+def spin():
+    for _ in range(500):
+        filament.sleep(0)
+
+filament.spawn(spin).wait()
+trace.stop()
+traced = [r for _, r in trace.records() if r]
+assert len(traced) == 1 and len(traced[0]) == 64, traced
+stamps = [rec[0] for rec in traced[0]]
+assert stamps == sorted(stamps)
+print("OK")
+''')
+    assert res.ok() and "OK" in res.stdout, repr(res)
+
+
+def test_bad_size():
+    with pytest.raises(ValueError):
+        trace.start(size=100)
+
+
+def test_traces_other_threads():
+    res = run_py('''
+import threading
+import filament
+from filament import trace
+
+trace.start()
+t = threading.Thread(target=lambda: filament.joinall(
+    [filament.spawn(filament.sleep, 0.001) for _ in range(3)]))
+t.start()
+t.join()
+trace.stop()
+ident = t.ident
+assert any(tid == ident and recs for tid, recs in trace.records()), \\
+    [(tid, len(r)) for tid, r in trace.records()]
+print("OK")
+''')
+    assert res.ok() and "OK" in res.stdout, repr(res)
+
+
+def test_env_var_starts_tracing():
+    res = run_py('''
+import filament
+from filament import trace
+assert trace.enabled()
+filament.spawn(filament.sleep, 0).wait()
+assert any(recs for _, recs in trace.records())
+print("OK")
+''', extra_env={"FIL_TRACE": "1"})
+    assert res.ok() and "OK" in res.stdout, repr(res)
+
+
+def test_dump_chrome_is_json(tracing):
+    filament.spawn(filament.sleep, 0.001).wait()
+    trace.stop()
+    out = io.StringIO() if str is not bytes else io.BytesIO()
+    trace.dump_chrome(out)
+    doc = json.loads(out.getvalue())
+    assert any(e.get("cat") == "run" for e in doc["traceEvents"])
+
+
+# -- a protobuf reader, just enough to check the Perfetto output's shape ----
+
+def _varint(buf, pos):
+    shift = value = 0
+    while True:
+        byte = bytearray(buf[pos:pos + 1])[0]
+        pos += 1
+        value |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            return value, pos
+
+
+def _fields(buf):
+    pos = 0
+    out = []
+    while pos < len(buf):
+        key, pos = _varint(buf, pos)
+        field, wire = key >> 3, key & 7
+        if wire == 0:
+            value, pos = _varint(buf, pos)
+        elif wire == 1:
+            value = struct.unpack("<Q", buf[pos:pos + 8])[0]
+            pos += 8
+        elif wire == 2:
+            size, pos = _varint(buf, pos)
+            value = buf[pos:pos + size]
+            pos += size
+        else:
+            raise AssertionError("unexpected wire type %d" % wire)
+        out.append((field, value))
+    assert pos == len(buf)
+    return out
+
+
+def test_perfetto_protobuf(tracing):
+    a, b = fsocket.socketpair()
+    g = filament.spawn(b.recv, 10)
+    filament.sleep(0.005)
+    a.sendall(b"x")
+    g.wait()
+    trace.stop()
+    a.close()
+    b.close()
+
+    data = trace.perfetto_trace()
+    packets = [dict(_fields(v)) for f, v in _fields(data) if f == 1]
+    descriptors = [dict(_fields(p[60])) for p in packets if 60 in p]
+    tracks = set(d[1] for d in descriptors)
+    assert len(tracks) >= 2, descriptors          # scheduler + io thread
+    events = []
+    last = 0
+    for p in packets:
+        assert p[10] == 1                          # sequence id
+        if 11 in p:
+            assert p[8] >= last                    # time-ordered
+            last = p[8]
+            ev = _fields(p[11])
+            evd = dict(ev)
+            assert evd[11] in tracks
+            events.append((evd[9], evd.get(23), ev))
+    names = set(name for _, name, _ in events if name is not None)
+    assert ("greenthread 0x%x" % id(g)).encode() in names, names
+    # Every begin has its end, and the wake's flow is terminated by a run.
+    kinds = [k for k, _, _ in events]
+    assert kinds.count(1) == kinds.count(2)
+    flows = set(v for k, _, ev in events if k == 3
+                for f, v in ev if f == 47)
+    ended = set(v for k, _, ev in events if k == 1
+                for f, v in ev if f == 48)
+    assert flows & ended, (flows, ended)
@@ -8,7 +8,9 @@ copy_globals with a plain-dict source.
 
 _threading_local: TypeError on args without a custom __init__, per-greenthread
 __init__ re-runs, attribute isolation across greenthreads, __delattr__, and
-the read-only __dict__ guards.
+the read-only __dict__ guards -- for both the C ``local`` and ``pylocal`` --
+plus the C version's slot lifetime: dicts dropped when a Filament's body
+returns or the local dies, recycled indices, and plain greenlets.
 """
 
 from __future__ import absolute_import
@@ -132,21 +134,26 @@ def test_copy_globals_from_module_source():
 # _threading_local.local
 # --------------------------------------------------------------------------- #
 
-def test_local_args_without_custom_init_raises():
+@pytest.fixture(params=['local', 'pylocal'])
+def local_cls(request):
+    return getattr(fil_local, request.param)
+
+
+def test_local_args_without_custom_init_raises(local_cls):
     with pytest.raises(TypeError):
-        fil_local.local(1)
+        local_cls(1)
     with pytest.raises(TypeError):
-        fil_local.local(x=1)
+        local_cls(x=1)
 
 
-def test_local_basic_attribute_roundtrip():
-    loc = fil_local.local()
+def test_local_basic_attribute_roundtrip(local_cls):
+    loc = local_cls()
     loc.value = 'main'
     assert loc.value == 'main'
 
 
-def test_local_isolation_across_greenthreads():
-    loc = fil_local.local()
+def test_local_isolation_across_greenthreads(local_cls):
+    loc = local_cls()
     loc.value = 'main'
     seen = []
 
@@ -166,10 +173,10 @@ def test_local_isolation_across_greenthreads():
     assert loc.value == 'main'     # main greenthread's value untouched
 
 
-def test_local_subclass_init_reruns_per_greenthread():
+def test_local_subclass_init_reruns_per_greenthread(local_cls):
     inits = []
 
-    class MyLocal(fil_local.local):
+    class MyLocal(local_cls):
         def __init__(self, base):
             inits.append(base)
             self.base = base
@@ -192,8 +199,8 @@ def test_local_subclass_init_reruns_per_greenthread():
     assert loc.base == 10           # worker's overwrite did not leak to main
 
 
-def test_local_delattr():
-    loc = fil_local.local()
+def test_local_delattr(local_cls):
+    loc = local_cls()
     loc.value = 1
     del loc.value
     assert not hasattr(loc, 'value')
@@ -201,8 +208,8 @@ def test_local_delattr():
         del loc.never_set
 
 
-def test_local_dict_is_readonly():
-    loc = fil_local.local()
+def test_local_dict_is_readonly(local_cls):
+    loc = local_cls()
     with pytest.raises(AttributeError):
         loc.__dict__ = {}
     with pytest.raises(AttributeError):
@@ -210,10 +217,106 @@ def test_local_dict_is_readonly():
 
 
 def test_local_private_bookkeeping_accessible():
-    loc = fil_local.local()
+    loc = fil_local.pylocal()
     loc.value = 'x'
     # The name-mangled bookkeeping slots resolve through __getattribute__'s
     # special-case branch.
     assert isinstance(loc._local__dicts, weakref.WeakKeyDictionary)
     args, kwargs = loc._local__args
     assert args == () and kwargs == {}
+
+
+class _Payload(object):
+    pass
+
+
+def test_c_local_dict_released_when_body_returns():
+    loc = fil_local.local()
+    refs = []
+
+    def worker():
+        obj = _Payload()
+        refs.append(weakref.ref(obj))
+        loc.obj = obj
+
+    g = filament.spawn(worker)
+    g.join()
+    # 'g' is still referenced, but its body is done: its dicts are gone.
+    assert refs[0]() is None
+
+
+def test_c_local_dict_released_when_local_dies():
+    loc = fil_local.local()
+    obj = _Payload()
+    ref = weakref.ref(obj)
+    loc.obj = obj
+    del obj
+    assert ref() is not None
+    del loc
+    assert ref() is None
+
+
+def test_c_local_recycled_index_starts_empty():
+    loc = fil_local.local()
+    loc.value = 'old'
+    seen = []
+
+    def worker(first):
+        first.value = 'stale'
+        filament.sleep(0)
+        # 'first' died while we were parked and its index went to 'second';
+        # the stale dict in this greenthread's slot must not show through.
+        second = fil_local.local()
+        seen.append(hasattr(second, 'value'))
+
+    g = filament.spawn(worker, loc)
+    del loc
+    filament.sleep(0)
+    g.join()
+    assert seen == [False]
+
+
+def test_c_local_plain_greenlets_are_isolated():
+    from _fil_greenlet import greenlet
+
+    loc = fil_local.local()
+    loc.value = 'main'
+
+    def body():
+        seen = hasattr(loc, 'value')
+        loc.value = 'child'
+        return seen, loc.value
+
+    assert greenlet(body).switch() == (False, 'child')
+    assert loc.value == 'main'
+
+
+def test_c_local_failed_init_retries():
+    calls = []
+
+    class Flaky(fil_local.local):
+        def __init__(self):
+            calls.append(1)
+            if len(calls) == 2:
+                raise ValueError('boom')
+            self.ok = True
+
+    loc = Flaky()
+
+    def worker():
+        with pytest.raises(ValueError):
+            loc.ok
+        return loc.ok
+
+    assert filament.spawn(worker).wait() is True
+    assert len(calls) == 3
+
+
+def test_c_local_is_weakrefable_and_subclassable():
+    class Sub(fil_local.local):
+        __slots__ = ()
+
+    loc = Sub()
+    ref = weakref.ref(loc)
+    loc.x = 1
+    assert ref() is loc and loc.__dict__ == {'x': 1}
@@ -133,3 +133,205 @@ server.stop()
 assert all(results), results
 print("OK")
 ''', timeout=25)
+
+
+_COUNTING = '''
+sends = []
+
+
+class CountingSocket(object):
+    # Just the two calls the handler makes on its socket.
+    def __init__(self, sock):
+        self._sock = sock
+
+    def recv(self, size):
+        return self._sock.recv(size)
+
+    def sendall(self, data, *flags):
+        sends.append(data)
+        return self._sock.sendall(data, *flags)
+
+
+class CountingHandler(pywsgi.WSGIHandler):
+    def __init__(self, sock, address, server, rfile=None):
+        pywsgi.WSGIHandler.__init__(self, CountingSocket(sock), address,
+                                    server, rfile)
+
+
+def start_counting_server(app, **kwargs):
+    server = pywsgi.WSGIServer(("127.0.0.1", 0), app,
+                               handler_class=CountingHandler, **kwargs)
+    server.start()
+    return server, (server.server_host, server.server_port)
+'''
+
+
+def test_wsgi_pipelined_requests_answered_in_one_send():
+    _check(_COUNTING + '''
+def app(environ, start_response):
+    body = environ["PATH_INFO"].encode("ascii")
+    start_response("200 OK", [("Content-Length", str(len(body)))])
+    return [body]
+
+server, addr = start_counting_server(app)
+raw = (b"GET /a HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n"
+       b"GET /b HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n"
+       b"GET /c HTTP/1.1\\r\\nHost: x\\r\\nConnection: close\\r\\n\\r\\n")
+resp = http_request(addr, raw)
+server.stop()
+assert resp.count(b"200 OK") == 3, resp
+assert resp.index(b"/a") < resp.index(b"/b") < resp.index(b"/c"), resp
+assert len(sends) == 1, sends
+print("OK")
+''')
+
+
+def test_wsgi_pipelined_response_not_held_behind_a_slow_app():
+    _check('''
+import time
+
+def app(environ, start_response):
+    path = environ["PATH_INFO"]
+    if path == "/slow":
+        gevent.sleep(1.0)
+    body = path.encode("ascii")
+    start_response("200 OK", [("Content-Length", str(len(body)))])
+    return [body]
+
+server, addr = start_server(app)
+c = fsocket.create_connection(addr)
+start = time.time()
+c.sendall(b"GET /a HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n"
+          b"GET /slow HTTP/1.1\\r\\nHost: x\\r\\nConnection: close\\r\\n\\r\\n")
+got = b""
+while not got.endswith(b"/a"):
+    got += c.recv(4096)
+first = time.time() - start
+while True:
+    d = c.recv(4096)
+    if not d:
+        break
+    got += d
+c.close()
+server.stop()
+assert first < 0.5, first
+assert got.endswith(b"/slow"), got
+print("OK")
+''')
+
+
+def test_wsgi_pipelined_response_sent_when_the_next_app_raises():
+    _check('''
+def app(environ, start_response):
+    if environ["PATH_INFO"] == "/boom":
+        raise RuntimeError("boom")
+    start_response("200 OK", [("Content-Length", "2")])
+    return [b"/a"]
+
+server, addr = start_server(app)
+resp = http_request(addr, b"GET /a HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n"
+                          b"GET /boom HTTP/1.1\\r\\nHost: x\\r\\n"
+                          b"Connection: close\\r\\n\\r\\n")
+server.stop()
+assert resp.startswith(b"HTTP/1.1 200 OK"), resp
+assert resp.endswith(b"/a"), resp
+print("OK")
+''')
+
+
+def test_wsgi_small_chunks_coalesced():
+    _check(_COUNTING + '''
+def app(environ, start_response):
+    start_response("200 OK", [])
+    for i in range(200):
+        yield b"x"
+
+server, addr = start_counting_server(app)
+resp = http_request(addr, b"GET / HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n")
+assert resp.endswith(b"x" * 200), resp
+assert len(sends) == 1, sends
+
+# Chunked keep-alive: headers, 200 frames and the terminator in one send.
+del sends[:]
+c = fsocket.create_connection(addr)
+c.sendall(b"GET / HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n")
+got = b""
+while not got.endswith(b"0\\r\\n\\r\\n"):
+    got += c.recv(65536)
+c.close()
+assert got.count(b"1\\r\\nx\\r\\n") == 200, got
+assert len(sends) == 1, sends
+server.stop()
+print("OK")
+''')
+
+
+def test_wsgi_streaming_app_not_held_back():
+    # An app that blocks between chunks must have what it already yielded
+    # sent, or a client waiting for it would never let it continue.
+    _check(_COUNTING + '''
+go = filament.Event()
+
+def app(environ, start_response):
+    start_response("200 OK", [])
+    yield b"first"
+    go.wait()
+    yield b"second"
+
+server, addr = start_counting_server(app)
+c = fsocket.create_connection(addr)
+c.sendall(b"GET / HTTP/1.1\\r\\nHost: x\\r\\nConnection: close\\r\\n\\r\\n")
+got = b""
+with filament.Timeout(5):
+    while b"first" not in got:
+        got += c.recv(4096)
+assert b"second" not in got, got
+go.set()
+while True:
+    d = c.recv(4096)
+    if not d:
+        break
+    got += d
+c.close()
+server.stop()
+assert got.endswith(b"second"), got
+print("OK")
+''')
+
+
+def test_wsgi_access_log_only_formatted_with_a_log():
+    _check(_COUNTING + '''
+formatted = []
+
+class Handler(CountingHandler):
+    def format_request(self):
+        formatted.append(1)
+        return CountingHandler.format_request(self)
+
+def app(environ, start_response):
+    start_response("200 OK", [("Content-Length", "2")])
+    return [b"ok"]
+
+class Log(object):
+    def __init__(self):
+        self.lines = []
+
+    def write(self, s):
+        self.lines.append(s)
+
+raw = b"GET / HTTP/1.1\\r\\nHost: x\\r\\n\\r\\n"
+for log, expect in ((None, 0), (Log(), 1)):
+    del formatted[:]
+    server = pywsgi.WSGIServer(("127.0.0.1", 0), app, log=log,
+                               handler_class=Handler)
+    server.start()
+    resp = http_request(addr=(server.server_host, server.server_port),
+                        raw=raw)
+    server.stop()
+    assert resp.endswith(b"ok"), resp
+    assert len(formatted) == expect, (log, formatted)
+    if log is not None:
+        assert len(log.lines) == 1 and '"GET / HTTP/1.1" 200' in \\
+            log.lines[0], log.lines
+print("OK")
+''')